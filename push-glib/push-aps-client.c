@@ -19,6 +19,7 @@
 #include <glib/gi18n.h>
 
 #include "push-aps-client.h"
+#include "push-aps-dedup.h"
 #include "push-debug.h"
 
 /**
@@ -37,6 +38,9 @@
  */
 
 #define PUSH_APS_CLIENT_TIMEOUT_SECONDS 2
+#define PUSH_APS_CLIENT_N_PRIORITIES    3
+#define PUSH_APS_CLIENT_WRITE_BATCH     4096
+#define PUSH_APS_CLIENT_TOKEN_SIZE      32
 
 G_DEFINE_TYPE(PushApsClient, push_aps_client, G_TYPE_OBJECT)
 
@@ -49,6 +53,18 @@ typedef struct
 } FeedbackMessage;
 #pragma pack()
 
+typedef struct
+{
+   GList          link;
+   guint32        request_id;
+   guint          priority;
+   gint64         expires_at;
+   GSequenceIter *expiry_iter;
+   gchar         *collapse_id;
+   GByteArray    *header;
+   GBytes        *payload;
+} PushApsFrame;
+
 struct _PushApsClientPrivate
 {
    PushApsClientMode mode;
@@ -62,22 +78,38 @@ struct _PushApsClientPrivate
    FeedbackMessage fb_msg;
    guint8 gw_read_buf[6];
    guint feedback_interval;
+
+   PushApsDedup *dedup;
+   guint dedup_window;
+   guint dedup_capacity;
+
+   guint max_payload_size;
    guint feedback_handler;
 
    GCancellable *dispose_cancellable;
 
    guint state;
-   GQueue *queue;
+
+   GQueue lanes[PUSH_APS_CLIENT_N_PRIORITIES];
+   guint credits[PUSH_APS_CLIENT_N_PRIORITIES];
+   GSequence *expiry;
+   GHashTable *collapse;
+   GByteArray *write_buf;
+   gsize write_offset;
+   GArray *write_ids;
 };
 
 enum
 {
    PROP_0,
+   PROP_DEDUP_CAPACITY,
+   PROP_DEDUP_WINDOW,
    PROP_MODE,
    PROP_SSL_CERT_FILE,
    PROP_SSL_KEY_FILE,
    PROP_TLS_CERTIFICATE,
    PROP_FEEDBACK_INTERVAL,
+   PROP_MAX_PAYLOAD_SIZE,
    LAST_PROP
 };
 
@@ -98,7 +130,23 @@ enum
 static GParamSpec *gParamSpecs[LAST_PROP];
 static guint       gSignals[LAST_SIGNAL];
 
-static void push_aps_client_try_load_tls (PushApsClient *client);
+/*
+ * Number of frames each lane may write per round before lower priority
+ * lanes get their turn. Lower lanes are never starved entirely.
+ */
+static const guint gLaneWeights[PUSH_APS_CLIENT_N_PRIORITIES] = { 16, 4, 1 };
+
+static void     push_aps_client_try_load_tls        (PushApsClient       *client);
+static void     push_aps_client_pump                (PushApsClient       *client);
+static void     push_aps_client_reset               (PushApsClient       *client);
+static gboolean push_aps_client_complete_result     (GSimpleAsyncResult  *simple);
+static void     push_aps_client_connect_async       (PushApsClient       *client,
+                                                     GCancellable        *cancellable,
+                                                     GAsyncReadyCallback  callback,
+                                                     gpointer             user_data);
+static void     push_aps_client_connect_gateway_cb2 (GObject             *object,
+                                                     GAsyncResult        *result,
+                                                     gpointer             user_data);
 
 static gchar *
 _hex_encode (const guint8 *buffer,
@@ -137,12 +185,40 @@ get_error_message (PushApsClientError error)
       return _("Invalid Payload Size");
    case PUSH_APS_CLIENT_ERROR_INVALID_TOKEN:
       return _("Invalid Token");
+   case PUSH_APS_CLIENT_ERROR_EXPIRED:
+      return _("The notification expired before it could be sent.");
+   case PUSH_APS_CLIENT_ERROR_COLLAPSED:
+      return _("The notification was replaced by a newer one.");
+   case PUSH_APS_CLIENT_ERROR_DUPLICATE:
+      return _("The notification was recently delivered to the device.");
    default:
       return _("An unknown error ocurred during delivery.");
    }
    g_assert_not_reached();
 }
 
+/*
+ * Completes the duplicate tracking started for @simple when it was
+ * submitted. Only a successful delivery is remembered, so that a retry
+ * after a failure is not reported as a duplicate.
+ */
+static void
+push_aps_client_dedup_end (PushApsClient      *client,
+                           GSimpleAsyncResult *simple,
+                           gboolean            delivered)
+{
+   PushApsClientPrivate *priv = client->priv;
+
+   if (priv->dedup && g_object_get_data(G_OBJECT(simple), "dedup")) {
+      push_aps_dedup_end(
+            priv->dedup,
+            g_object_get_data(G_OBJECT(simple), "device-token"),
+            GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(simple),
+                                               "payload-hash")),
+            delivered);
+   }
+}
+
 static void
 push_aps_client_dispatch_error (PushApsClient      *client,
                                 guint32             result_id,
@@ -176,6 +252,7 @@ push_aps_client_dispatch_error (PushApsClient      *client,
                                       code,
                                       "%s",
                                       get_error_message(code));
+      push_aps_client_dedup_end(client, simple, FALSE);
       g_simple_async_result_complete_in_idle(simple);
       g_hash_table_remove(priv->results, &result_id);
    }
@@ -183,28 +260,6 @@ push_aps_client_dispatch_error (PushApsClient      *client,
    EXIT;
 }
 
-static void
-push_aps_client_dispatch (PushApsClient *client)
-{
-   PushApsClientPrivate *priv;
-   GSimpleAsyncResult *simple;
-   GHashTableIter iter;
-
-   ENTRY;
-
-   g_assert(PUSH_IS_APS_CLIENT(client));
-
-   priv = client->priv;
-
-   g_hash_table_iter_init(&iter, priv->results);
-   while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&simple)) {
-      g_simple_async_result_set_op_res_gboolean(simple, TRUE);
-      g_simple_async_result_complete_in_idle(simple);
-   }
-
-   EXIT;
-}
-
 static void
 push_aps_client_read_gateway_cb (GObject      *object,
                                  GAsyncResult *result,
@@ -221,19 +276,44 @@ push_aps_client_read_gateway_cb (GObject      *object,
 
    ENTRY;
 
-   g_assert(PUSH_IS_APS_CLIENT(client));
    g_assert(G_IS_INPUT_STREAM(input));
 
-   buffer = client->priv->gw_read_buf;
    ret = g_input_stream_read_finish(input, result, &error);
 
+   /*
+    * If the client was disposed, the read was cancelled and @client may
+    * no longer be valid. Do not touch it.
+    */
+   if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free(error);
+      EXIT;
+   }
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+
+   /*
+    * Ignore results from a connection that has since been replaced.
+    */
+   if (!client->priv->gateway_stream ||
+       (input != g_io_stream_get_input_stream(client->priv->gateway_stream))) {
+      g_clear_error(&error);
+      EXIT;
+   }
+
+   buffer = client->priv->gw_read_buf;
+
    switch (ret) {
    case -1:
-      /* TODO: push_aps_client_fail(client); */
+      g_warning("Failed to read from APS stream: %s", error->message);
+      g_error_free(error);
+      push_aps_client_reset(client);
       EXIT;
    case 0:
-      /* EOF */
-      push_aps_client_dispatch(client);
+      /*
+       * EOF, the gateway closes the connection after reporting an error.
+       * Reconnect if there are still frames waiting to be written.
+       */
+      push_aps_client_reset(client);
       EXIT;
    default:
       DUMP_BYTES(gateway, ((guint8 *)&client->priv->gw_read_buf), ret);
@@ -248,7 +328,7 @@ push_aps_client_read_gateway_cb (GObject      *object,
                                 client->priv->gw_read_buf,
                                 sizeof client->priv->gw_read_buf,
                                 G_PRIORITY_DEFAULT,
-                                NULL, /* priv->shutdown, */
+                                client->priv->dispose_cancellable,
                                 push_aps_client_read_gateway_cb,
                                 client);
       EXIT;
@@ -294,13 +374,19 @@ push_aps_client_read_feedback_cb (GObject      *object,
 
    g_assert(G_IS_INPUT_STREAM(stream));
 
-   priv = client->priv;
-
    ret = g_input_stream_read_finish(stream, result, &error);
 
+   if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free(error);
+      EXIT;
+   }
+
+   priv = client->priv;
+
    switch (ret) {
    case -1:
    case 0:
+      g_clear_error(&error);
       EXIT;
    default:
       DUMP_BYTES(feedback, ((guint8 *)&priv->fb_msg), ret);
@@ -327,7 +413,7 @@ push_aps_client_read_feedback_cb (GObject      *object,
                                 (guint8 *)&client->priv->fb_msg,
                                 sizeof client->priv->fb_msg,
                                 G_PRIORITY_DEFAULT,
-                                NULL, /* priv->shutdown */
+                                client->priv->dispose_cancellable,
                                 push_aps_client_read_feedback_cb,
                                 client);
       g_object_unref(identity);
@@ -352,21 +438,23 @@ push_aps_client_connect_feedback_cb (GObject      *object,
    ENTRY;
 
    g_assert(G_IS_SOCKET_CLIENT(socket_client));
-   g_assert(PUSH_IS_APS_CLIENT(client));
 
    if (!(conn = g_socket_client_connect_to_host_finish(socket_client,
                                                        result,
                                                        &error))) {
-      g_warning("Failed to connect to APS feedback: %s", error->message);
+      if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+         g_warning("Failed to connect to APS feedback: %s", error->message);
+      }
       g_error_free(error);
       EXIT;
    } else {
+      g_assert(PUSH_IS_APS_CLIENT(client));
       stream = g_io_stream_get_input_stream(G_IO_STREAM(conn));
       g_input_stream_read_async(stream,
                                 (guint *)&client->priv->fb_msg,
                                 sizeof client->priv->fb_msg,
                                 G_PRIORITY_DEFAULT,
-                                NULL, /* priv->shutdown */
+                                client->priv->dispose_cancellable,
                                 push_aps_client_read_feedback_cb,
                                 client);
       g_object_unref(conn);
@@ -408,7 +496,7 @@ push_aps_client_feedback_cb (gpointer data)
    g_socket_client_connect_to_host_async(socket_client,
                                          host,
                                          2196,
-                                         NULL, /* TODO: priv->shutdown */
+                                         priv->dispose_cancellable,
                                          push_aps_client_connect_feedback_cb,
                                          client);
    g_object_unref(socket_client);
@@ -417,65 +505,441 @@ push_aps_client_feedback_cb (gpointer data)
 }
 
 static void
-push_aps_client_write (PushApsClient *client,
-                       GByteArray    *buffer)
+push_aps_client_frame_free (PushApsClient *client,
+                            PushApsFrame  *frame)
+{
+   if (frame->expiry_iter) {
+      g_sequence_remove(frame->expiry_iter);
+   }
+   if (frame->collapse_id) {
+      g_hash_table_remove(client->priv->collapse, frame->collapse_id);
+      g_free(frame->collapse_id);
+   }
+   g_byte_array_unref(frame->header);
+   g_bytes_unref(frame->payload);
+   g_slice_free(PushApsFrame, frame);
+}
+
+static gint
+push_aps_client_frame_compare (gconstpointer a,
+                               gconstpointer b,
+                               gpointer      user_data)
+{
+   const PushApsFrame *fa = a;
+   const PushApsFrame *fb = b;
+
+   if (fa->expires_at < fb->expires_at) {
+      return -1;
+   } else if (fa->expires_at > fb->expires_at) {
+      return 1;
+   }
+
+   return 0;
+}
+
+static void
+push_aps_client_prune (PushApsClient *client)
 {
    PushApsClientPrivate *priv;
-   GOutputStream *stream;
-   GError *error = NULL;
-   gsize bytes_written;
+   GSequenceIter *iter;
+   PushApsFrame *frame;
+   gint64 now;
 
    ENTRY;
 
    g_assert(PUSH_IS_APS_CLIENT(client));
-   g_assert(client->priv->gateway_stream);
-   g_assert(buffer);
 
    priv = client->priv;
 
-   stream = g_io_stream_get_output_stream(priv->gateway_stream);
-   g_assert(stream);
+   /*
+    * Frames with an expiration are indexed by it, so only the frames that
+    * have actually expired need to be visited.
+    */
+   now = g_get_real_time() / G_USEC_PER_SEC;
+   while (!g_sequence_iter_is_end((iter = g_sequence_get_begin_iter(priv->expiry)))) {
+      frame = g_sequence_get(iter);
+      if (frame->expires_at > now) {
+         break;
+      }
+      g_queue_unlink(&priv->lanes[frame->priority], &frame->link);
+      push_aps_client_dispatch_error(client,
+                                     frame->request_id,
+                                     PUSH_APS_CLIENT_ERROR_EXPIRED);
+      push_aps_client_frame_free(client, frame);
+   }
+
+   EXIT;
+}
+
+static PushApsFrame *
+push_aps_client_next_frame (PushApsClient *client)
+{
+   PushApsClientPrivate *priv;
+   GList *link;
+   guint pass;
+   guint i;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+
+   priv = client->priv;
 
    /*
-    * TODO: Probably should do this asynchronously.
+    * Weighted round-robin between the lanes. Each lane may take up to its
+    * weight in frames per round, highest priority first. Once every lane
+    * with pending frames has spent its credits, a new round begins.
     */
+   for (pass = 0; pass < 2; pass++) {
+      for (i = 0; i < PUSH_APS_CLIENT_N_PRIORITIES; i++) {
+         if (priv->lanes[i].length && priv->credits[i]) {
+            priv->credits[i]--;
+            link = g_queue_pop_head_link(&priv->lanes[i]);
+            return link->data;
+         }
+      }
+      for (i = 0; i < PUSH_APS_CLIENT_N_PRIORITIES; i++) {
+         priv->credits[i] = gLaneWeights[i];
+      }
+   }
 
-   DUMP_BYTES(buffer, buffer->data, buffer->len);
+   return NULL;
+}
 
-   if (!g_output_stream_write_all(stream,
-                                  (gconstpointer)buffer->data,
-                                  buffer->len,
-                                  &bytes_written,
-                                  NULL,
-                                  &error)) {
+static gboolean
+push_aps_client_has_frames (PushApsClient *client)
+{
+   guint i;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+
+   for (i = 0; i < PUSH_APS_CLIENT_N_PRIORITIES; i++) {
+      if (client->priv->lanes[i].length) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+static void
+push_aps_client_reset (PushApsClient *client)
+{
+   PushApsClientPrivate *priv;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+
+   priv = client->priv;
+
+   if (priv->state != STATE_CONNECTED) {
+      EXIT;
+   }
+
+   g_clear_object(&priv->gateway_stream);
+   priv->state = STATE_0;
+
+   if (push_aps_client_has_frames(client)) {
+      push_aps_client_connect_async(client,
+                                    priv->dispose_cancellable,
+                                    push_aps_client_connect_gateway_cb2,
+                                    NULL);
+   }
+
+   EXIT;
+}
+
+static void
+push_aps_client_written (PushApsClient *client)
+{
+   PushApsClientPrivate *priv;
+   GSimpleAsyncResult *simple;
+   guint32 request_id;
+   guint i;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+
+   priv = client->priv;
+
+   /*
+    * Add a timeout to complete each request if we don't get notified of
+    * an error (which is what usually happens).
+    */
+   for (i = 0; i < priv->write_ids->len; i++) {
+      request_id = g_array_index(priv->write_ids, guint32, i);
+      if (priv->results &&
+          (simple = g_hash_table_lookup(priv->results, &request_id))) {
+         g_timeout_add_seconds(1,
+                               (GSourceFunc)push_aps_client_complete_result,
+                               g_object_ref(simple));
+      }
+   }
+
+   g_array_set_size(priv->write_ids, 0);
+   g_byte_array_unref(priv->write_buf);
+   priv->write_buf = NULL;
+   priv->write_offset = 0;
+
+   EXIT;
+}
+
+/*
+ * Fails the requests of the batch whose write failed with @error. The
+ * batch may have been partially written, so APNs may or may not have
+ * received them; callers are told rather than the frames being resent.
+ */
+static void
+push_aps_client_write_failed (PushApsClient *client,
+                              const GError  *error)
+{
+   PushApsClientPrivate *priv;
+   GSimpleAsyncResult *simple;
+   guint32 request_id;
+   guint i;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+   g_assert(error);
+
+   priv = client->priv;
+
+   for (i = 0; i < priv->write_ids->len; i++) {
+      request_id = g_array_index(priv->write_ids, guint32, i);
+      if (priv->results &&
+          (simple = g_hash_table_lookup(priv->results, &request_id))) {
+         g_simple_async_result_set_from_error(simple, error);
+         push_aps_client_dedup_end(client, simple, FALSE);
+         g_simple_async_result_complete_in_idle(simple);
+         g_hash_table_remove(priv->results, &request_id);
+      }
+   }
+
+   g_array_set_size(priv->write_ids, 0);
+   g_byte_array_unref(priv->write_buf);
+   priv->write_buf = NULL;
+   priv->write_offset = 0;
+
+   EXIT;
+}
+
+static void
+push_aps_client_write_cb (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+   PushApsClientPrivate *priv;
+   GOutputStream *stream = (GOutputStream *)object;
+   PushApsClient *client = user_data;
+   GError *error = NULL;
+   gssize ret;
+
+   ENTRY;
+
+   g_assert(G_IS_OUTPUT_STREAM(stream));
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+
+   priv = client->priv;
+
+   ret = g_output_stream_write_finish(stream, result, &error);
+
+   if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free(error);
+      g_object_unref(client);
+      EXIT;
+   }
+
+   if (ret < 0) {
       g_warning("Failed to write to APS stream: %s", error->message);
+      push_aps_client_write_failed(client, error);
       g_error_free(error);
+      if (priv->gateway_stream &&
+          (stream == g_io_stream_get_output_stream(priv->gateway_stream))) {
+         push_aps_client_reset(client);
+      } else {
+         push_aps_client_pump(client);
+      }
+      g_object_unref(client);
+      EXIT;
+   }
+
+   priv->write_offset += ret;
+
+   if (priv->write_offset < priv->write_buf->len) {
+      g_output_stream_write_async(stream,
+                                  priv->write_buf->data + priv->write_offset,
+                                  priv->write_buf->len - priv->write_offset,
+                                  G_PRIORITY_DEFAULT,
+                                  priv->dispose_cancellable,
+                                  push_aps_client_write_cb,
+                                  client);
+      EXIT;
+   }
+
+   push_aps_client_written(client);
+   push_aps_client_pump(client);
+   g_object_unref(client);
+
+   EXIT;
+}
+
+static void
+push_aps_client_pump (PushApsClient *client)
+{
+   PushApsClientPrivate *priv;
+   GOutputStream *stream;
+   PushApsFrame *frame;
+   GByteArray *buffer;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+
+   priv = client->priv;
+
+   /*
+    * Only one write may be outstanding at a time and it holds a reference
+    * to @client so that the buffer outlives the operation. Frames stay in
+    * their lanes until the stream is ready so that higher priority frames
+    * submitted in the meantime can still be written first.
+    */
+   if ((priv->state != STATE_CONNECTED) || priv->write_buf) {
       EXIT;
    }
 
-   g_assert_cmpint(bytes_written, ==, buffer->len);
+   g_assert(priv->gateway_stream);
+
+   push_aps_client_prune(client);
+
+   buffer = g_byte_array_sized_new(PUSH_APS_CLIENT_WRITE_BATCH);
+   while ((buffer->len < PUSH_APS_CLIENT_WRITE_BATCH) &&
+          (frame = push_aps_client_next_frame(client))) {
+      g_byte_array_append(buffer, frame->header->data, frame->header->len);
+      g_byte_array_append(buffer,
+                          g_bytes_get_data(frame->payload, NULL),
+                          g_bytes_get_size(frame->payload));
+      g_array_append_val(priv->write_ids, frame->request_id);
+      push_aps_client_frame_free(client, frame);
+   }
+
+   if (!buffer->len) {
+      g_byte_array_unref(buffer);
+      EXIT;
+   }
+
+   DUMP_BYTES(buffer, buffer->data, buffer->len);
+
+   priv->write_buf = buffer;
+   priv->write_offset = 0;
+
+   stream = g_io_stream_get_output_stream(priv->gateway_stream);
+   g_output_stream_write_async(stream,
+                               buffer->data,
+                               buffer->len,
+                               G_PRIORITY_DEFAULT,
+                               priv->dispose_cancellable,
+                               push_aps_client_write_cb,
+                               g_object_ref(client));
 
    EXIT;
 }
 
+static gboolean
+push_aps_client_collapse (PushApsClient *client,
+                          PushApsFrame  *frame)
+{
+   PushApsClientPrivate *priv;
+   PushApsFrame *queued;
+   GByteArray *header;
+   GBytes *payload;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+   g_assert(frame);
+   g_assert(frame->collapse_id);
+
+   priv = client->priv;
+
+   if (!(queued = g_hash_table_lookup(priv->collapse, frame->collapse_id))) {
+      RETURN(FALSE);
+   }
+
+   /*
+    * Replace the contents of the unwritten frame, keeping its place in the
+    * lane, and complete the superseded request. If the new request has a
+    * higher priority, the frame moves to the back of that lane instead.
+    */
+   push_aps_client_dispatch_error(client,
+                                  queued->request_id,
+                                  PUSH_APS_CLIENT_ERROR_COLLAPSED);
+
+   header = queued->header;
+   queued->header = frame->header;
+   frame->header = header;
+
+   payload = queued->payload;
+   queued->payload = frame->payload;
+   frame->payload = payload;
+   queued->request_id = frame->request_id;
+
+   if (frame->priority < queued->priority) {
+      g_queue_unlink(&priv->lanes[queued->priority], &queued->link);
+      queued->priority = frame->priority;
+      g_queue_push_tail_link(&priv->lanes[queued->priority], &queued->link);
+   }
+
+   if (queued->expires_at != frame->expires_at) {
+      if (queued->expiry_iter) {
+         g_sequence_remove(queued->expiry_iter);
+         queued->expiry_iter = NULL;
+      }
+      queued->expires_at = frame->expires_at;
+      if (queued->expires_at) {
+         queued->expiry_iter =
+            g_sequence_insert_sorted(priv->expiry, queued,
+                                     push_aps_client_frame_compare, NULL);
+      }
+   }
+
+   g_free(frame->collapse_id);
+   frame->collapse_id = NULL;
+   push_aps_client_frame_free(client, frame);
+
+   RETURN(TRUE);
+}
+
 static void
 push_aps_client_queue (PushApsClient *client,
-                       GByteArray    *buffer)
+                       PushApsFrame  *frame)
 {
    PushApsClientPrivate *priv;
 
    g_assert(PUSH_IS_APS_CLIENT(client));
-   g_assert(buffer);
+   g_assert(frame);
+   g_assert(frame->priority < PUSH_APS_CLIENT_N_PRIORITIES);
 
    ENTRY;
 
    priv = client->priv;
 
-   if (priv->state == STATE_CONNECTED) {
-      push_aps_client_write(client, buffer);
-   } else {
-      g_queue_push_tail(priv->queue, g_byte_array_ref(buffer));
+   if (frame->collapse_id) {
+      if (push_aps_client_collapse(client, frame)) {
+         EXIT;
+      }
+      g_hash_table_insert(priv->collapse, frame->collapse_id, frame);
+   }
+
+   frame->link.data = frame;
+   g_queue_push_tail_link(&priv->lanes[frame->priority], &frame->link);
+   if (frame->expires_at) {
+      frame->expiry_iter =
+         g_sequence_insert_sorted(priv->expiry, frame,
+                                  push_aps_client_frame_compare, NULL);
    }
+   push_aps_client_pump(client);
 
    EXIT;
 }
@@ -490,7 +954,6 @@ push_aps_client_connect_gateway_cb (GObject      *object,
    GSocketClient *socket_client = (GSocketClient *)object;
    PushApsClient *client;
    GInputStream *input;
-   GByteArray *buffer;
    GError *error = NULL;
 
    ENTRY;
@@ -520,7 +983,7 @@ push_aps_client_connect_gateway_cb (GObject      *object,
                                 client->priv->gw_read_buf,
                                 sizeof client->priv->gw_read_buf,
                                 G_PRIORITY_DEFAULT,
-                                NULL, /* priv->shutdown, */
+                                client->priv->dispose_cancellable,
                                 push_aps_client_read_gateway_cb,
                                 client);
 
@@ -537,10 +1000,7 @@ push_aps_client_connect_gateway_cb (GObject      *object,
       /*
        * Flush any pending requests.
        */
-      while ((buffer = g_queue_pop_head(client->priv->queue))) {
-         push_aps_client_write(client, buffer);
-         g_byte_array_unref(buffer);
-      }
+      push_aps_client_pump(client);
    }
 
    g_simple_async_result_set_op_res_gboolean(simple, !!conn);
@@ -696,15 +1156,81 @@ from_hex (guint8 c)
    case 'd': return 0xd;
    case 'e': return 0xe;
    case 'f': return 0xf;
+   case 'A': return 0xa;
+   case 'B': return 0xb;
+   case 'C': return 0xc;
+   case 'D': return 0xd;
+   case 'E': return 0xe;
+   case 'F': return 0xf;
    default: return 0;
    }
 }
 
+/*
+ * Checks a delivery for everything the gateway would reject with an error
+ * response. Such errors make the gateway close the connection, losing any
+ * frames written after the bad one, so they are caught here instead.
+ */
+static gboolean
+push_aps_client_validate (PushApsClient    *client,
+                          PushApsIdentity  *identity,
+                          PushApsMessage   *message,
+                          GError          **error)
+{
+   PushApsClientError code = 0;
+   const gchar *device_token;
+   GDateTime *expires_at;
+   gint64 expiry;
+   gsize size;
+   guint i;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+   g_assert(PUSH_IS_APS_IDENTITY(identity));
+   g_assert(PUSH_IS_APS_MESSAGE(message));
+
+   device_token = push_aps_identity_get_device_token(identity);
+   size = push_aps_message_get_size(message);
+   expires_at = push_aps_message_get_expires_at(message);
+   expiry = expires_at ? g_date_time_to_unix(expires_at) : 0;
+
+   if (!device_token || !*device_token) {
+      code = PUSH_APS_CLIENT_ERROR_MISSING_DEVICE_TOKEN;
+   } else if (strlen(device_token) != (PUSH_APS_CLIENT_TOKEN_SIZE * 2)) {
+      code = PUSH_APS_CLIENT_ERROR_INVALID_TOKEN_SIZE;
+   } else if (!size) {
+      code = PUSH_APS_CLIENT_ERROR_MISSING_PAYLOAD;
+   } else if (size > client->priv->max_payload_size) {
+      code = PUSH_APS_CLIENT_ERROR_INVALID_PAYLOAD_SIZE;
+   } else if ((expiry < 0) || (expiry > G_MAXUINT32)) {
+      code = PUSH_APS_CLIENT_ERROR_PROCESSING_ERROR;
+   } else {
+      for (i = 0; device_token[i]; i++) {
+         if (!g_ascii_isxdigit(device_token[i])) {
+            code = PUSH_APS_CLIENT_ERROR_INVALID_TOKEN;
+            break;
+         }
+      }
+   }
+
+   if (code) {
+      g_set_error(error, PUSH_APS_CLIENT_ERROR, code,
+                  "%s", get_error_message(code));
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+/*
+ * Encodes the frame header for a notification, everything up to and
+ * including the payload length. The payload itself is appended from its
+ * shared #GBytes when the frame is written.
+ */
 static GByteArray *
 push_aps_client_encode (PushApsClient *client,
                         const gchar   *device_token,
                         GDateTime     *expires_at,
-                        const gchar   *message,
+                        GBytes        *payload,
                         guint32        request_id)
 {
    GByteArray *ret = NULL;
@@ -719,7 +1245,7 @@ push_aps_client_encode (PushApsClient *client,
 
    g_return_val_if_fail(PUSH_IS_APS_CLIENT(client), NULL);
    g_return_val_if_fail(device_token, NULL);
-   g_return_val_if_fail(message, NULL);
+   g_return_val_if_fail(payload, NULL);
 
    ret = g_byte_array_sized_new(64);
 
@@ -752,7 +1278,6 @@ push_aps_client_encode (PushApsClient *client,
     */
    len = strlen(device_token) / 2;
    b16 = GUINT16_TO_BE(len);
-   g_assert_cmpint(len % 2, ==, 0);
 
    /*
     * Encode the token from hex.
@@ -772,12 +1297,11 @@ push_aps_client_encode (PushApsClient *client,
    g_free(data);
 
    /*
-    * Payload length and payload.
+    * Payload length.
     */
-   len = strlen(message);
+   len = g_bytes_get_size(payload);
    b16 = GUINT16_TO_BE(len);
    g_byte_array_append(ret, (guint8 *)&b16, 2);
-   g_byte_array_append(ret, (guint8 *)message, len);
 
    RETURN(ret);
 }
@@ -800,6 +1324,7 @@ push_aps_client_complete_result (GSimpleAsyncResult *simple)
 
    if (client->priv->results) {
       if (g_hash_table_lookup(client->priv->results, &request_id)) {
+         push_aps_client_dedup_end(client, simple, TRUE);
          g_simple_async_result_set_op_res_gboolean(simple, TRUE);
          g_simple_async_result_complete_in_idle(simple);
          g_hash_table_remove(client->priv->results, &request_id);
@@ -855,6 +1380,9 @@ push_aps_client_connect_gateway_cb2 (GObject      *object,
  * The message is serialized and sent via the Apple push notification
  * gateway who performs the actual delivery to the identified device.
  *
+ * This is equivalent to calling push_aps_client_deliver_full_async()
+ * with %PUSH_APS_CLIENT_PRIORITY_NORMAL.
+ *
  * @callback MUST call push_aps_client_deliver_finish() with the
  * provided #GAsyncResult.
  */
@@ -865,11 +1393,56 @@ push_aps_client_deliver_async (PushApsClient       *client,
                                GCancellable        *cancellable,
                                GAsyncReadyCallback  callback,
                                gpointer             user_data)
+{
+   push_aps_client_deliver_full_async(client,
+                                      identity,
+                                      message,
+                                      PUSH_APS_CLIENT_PRIORITY_NORMAL,
+                                      cancellable,
+                                      callback,
+                                      user_data);
+}
+
+/**
+ * push_aps_client_deliver_full_async:
+ * @client: A #PushApsClient.
+ * @identity: A #PushApsIdentity.
+ * @message: A #PushApsMessage.
+ * @priority: A #PushApsClientPriority.
+ * @cancellable: (allow-none: A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback to execute upon completion.
+ * @user_data: User data for @callback.
+ *
+ * Like push_aps_client_deliver_async() but places the frame for @message
+ * in the outbound lane for @priority. Frames are written in FIFO order
+ * within a lane. Higher priority lanes are drained first using a weighted
+ * round-robin so that a backlog of bulk messages does not delay urgent
+ * ones, while lower priority lanes are still guaranteed some progress.
+ *
+ * If #PushApsMessage:expires-at passes while the frame is still queued,
+ * the delivery fails with %PUSH_APS_CLIENT_ERROR_EXPIRED. A message
+ * whose expiry has already passed when it is submitted is sent once, as
+ * APNs does. Only expiries that cannot be encoded are rejected.
+ *
+ * @callback MUST call push_aps_client_deliver_finish() with the
+ * provided #GAsyncResult.
+ */
+void
+push_aps_client_deliver_full_async (PushApsClient         *client,
+                                    PushApsIdentity       *identity,
+                                    PushApsMessage        *message,
+                                    PushApsClientPriority  priority,
+                                    GCancellable          *cancellable,
+                                    GAsyncReadyCallback    callback,
+                                    gpointer               user_data)
 {
    PushApsClientPrivate *priv;
    GSimpleAsyncResult *simple;
    const gchar *device_token;
-   GByteArray *buffer;
+   const gchar *collapse_key;
+   PushApsFrame *frame;
+   GDateTime *expires_at;
+   GError *error = NULL;
    guint32 *request_id;
 
    ENTRY;
@@ -877,6 +1450,7 @@ push_aps_client_deliver_async (PushApsClient       *client,
    g_return_if_fail(PUSH_IS_APS_CLIENT(client));
    g_return_if_fail(PUSH_IS_APS_IDENTITY(identity));
    g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(priority <= PUSH_APS_CLIENT_PRIORITY_LOW);
    g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
    g_return_if_fail(callback);
 
@@ -890,6 +1464,44 @@ push_aps_client_deliver_async (PushApsClient       *client,
       EXIT;
    }
 
+   /*
+    * Fail invalid requests locally rather than letting the gateway drop
+    * the connection over them.
+    */
+   if (!push_aps_client_validate(client, identity, message, &error)) {
+      g_simple_async_report_take_gerror_in_idle(G_OBJECT(client),
+                                                callback,
+                                                user_data,
+                                                error);
+      EXIT;
+   }
+
+   device_token = push_aps_identity_get_device_token(identity);
+
+   /*
+    * Drop the request if the same payload is being delivered to this
+    * device, or was successfully delivered within the dedup window.
+    */
+   if (priv->dedup_window) {
+      if (!priv->dedup) {
+         priv->dedup = push_aps_dedup_new(priv->dedup_window,
+                                          priv->dedup_capacity);
+      }
+      if (push_aps_dedup_check(priv->dedup,
+                               device_token,
+                               push_aps_message_get_payload_hash(message))) {
+         g_simple_async_report_error_in_idle(
+               G_OBJECT(client),
+               callback,
+               user_data,
+               PUSH_APS_CLIENT_ERROR,
+               PUSH_APS_CLIENT_ERROR_DUPLICATE,
+               "%s",
+               get_error_message(PUSH_APS_CLIENT_ERROR_DUPLICATE));
+         EXIT;
+      }
+   }
+
    /*
     * Start connecting if needed.
     */
@@ -904,7 +1516,6 @@ push_aps_client_deliver_async (PushApsClient       *client,
     * Build buffer to deliver to gateway and async result for
     * completion of asynchronous request.
     */
-   device_token = push_aps_identity_get_device_token(identity);
    request_id = g_new0(guint32, 1);
    *request_id = ++priv->last_id;
    simple = g_simple_async_result_new(G_OBJECT(client), callback, user_data,
@@ -914,27 +1525,44 @@ push_aps_client_deliver_async (PushApsClient       *client,
                           g_strdup(device_token), g_free);
    g_object_set_data(G_OBJECT(simple), "request-id",
                      GINT_TO_POINTER(*request_id));
-   buffer = push_aps_client_encode(client,
-                                   device_token,
-                                   push_aps_message_get_expires_at(message),
-                                   push_aps_message_get_json(message),
-                                   *request_id);
-   g_hash_table_insert(priv->results, request_id, simple);
-
+   g_object_set_data(G_OBJECT(simple), "payload-hash",
+                     GUINT_TO_POINTER(
+                           push_aps_message_get_payload_hash(message)));
+   if (priv->dedup_window) {
+      push_aps_dedup_begin(priv->dedup,
+                           device_token,
+                           push_aps_message_get_payload_hash(message));
+      g_object_set_data(G_OBJECT(simple), "dedup", priv->dedup);
+   }
+   expires_at = push_aps_message_get_expires_at(message);
+   frame = g_slice_new0(PushApsFrame);
+   frame->request_id = *request_id;
+   frame->priority = priority;
+   frame->expires_at = expires_at ? g_date_time_to_unix(expires_at) : 0;
    /*
-    * Add a timeout to complete the request if we don't get notified of
-    * success (which is what usually happens).
+    * APNs attempts a notification whose expiry has already passed once,
+    * without storing it. Such frames are not expired locally either.
     */
-   g_timeout_add_seconds(1,
-                         (GSourceFunc)push_aps_client_complete_result,
-                         g_object_ref(simple));
+   if (frame->expires_at <= (g_get_real_time() / G_USEC_PER_SEC)) {
+      frame->expires_at = 0;
+   }
+   if ((collapse_key = push_aps_message_get_collapse_key(message))) {
+      frame->collapse_id = g_strdup_printf("%s:%s", device_token, collapse_key);
+   }
+   frame->payload = push_aps_message_get_bytes(message);
+   frame->header = push_aps_client_encode(client,
+                                          device_token,
+                                          expires_at,
+                                          frame->payload,
+                                          *request_id);
+   g_hash_table_insert(priv->results, request_id, simple);
 
    /*
-    * Write bytes to gateway immediately if we can, otherwise queue them.
+    * Place the frame in its lane. It is written as soon as the gateway
+    * connection is ready and no higher priority frames are ahead of it.
+    * The completion timeout is armed once the frame is actually written.
     */
-   push_aps_client_queue(client, buffer);
-
-   g_byte_array_unref(buffer);
+   push_aps_client_queue(client, frame);
 
    EXIT;
 }
@@ -1120,15 +1748,112 @@ push_aps_client_set_feedback_interval (PushApsClient *client,
    EXIT;
 }
 
+/**
+ * push_aps_client_get_dedup_capacity:
+ * @client: (in): A #PushApsClient.
+ *
+ * Fetches the "dedup-capacity" property, the number of recent deliveries
+ * remembered per dedup generation.
+ *
+ * Returns: A #guint.
+ */
+guint
+push_aps_client_get_dedup_capacity (PushApsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_APS_CLIENT(client), 0);
+   return client->priv->dedup_capacity;
+}
+
+static void
+push_aps_client_set_dedup_capacity (PushApsClient *client,
+                                    guint          dedup_capacity)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_APS_CLIENT(client));
+   g_return_if_fail(dedup_capacity > 0);
+   client->priv->dedup_capacity = dedup_capacity;
+   EXIT;
+}
+
+/**
+ * push_aps_client_get_dedup_window:
+ * @client: (in): A #PushApsClient.
+ *
+ * Fetches the "dedup-window" property, the number of seconds during which
+ * a repeated delivery of the same payload to the same device fails with
+ * %PUSH_APS_CLIENT_ERROR_DUPLICATE instead of being sent. A delivery is
+ * a duplicate while an identical one is still in flight, or once one has
+ * succeeded. A failed delivery is forgotten so that it may be retried
+ * within the window. Zero disables duplicate suppression.
+ *
+ * Returns: A #guint containing the window in seconds.
+ */
+guint
+push_aps_client_get_dedup_window (PushApsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_APS_CLIENT(client), 0);
+   return client->priv->dedup_window;
+}
+
+static void
+push_aps_client_set_dedup_window (PushApsClient *client,
+                                  guint          dedup_window)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_APS_CLIENT(client));
+   client->priv->dedup_window = dedup_window;
+   EXIT;
+}
+
+/**
+ * push_aps_client_get_max_payload_size:
+ * @client: (in): A #PushApsClient.
+ *
+ * Fetches the "max-payload-size" property, the largest JSON payload in
+ * bytes that will be sent to the gateway. Larger messages fail with
+ * %PUSH_APS_CLIENT_ERROR_INVALID_PAYLOAD_SIZE. See
+ * push_aps_message_truncate_alert() to make a message fit.
+ *
+ * Returns: A #guint containing the size in bytes.
+ */
+guint
+push_aps_client_get_max_payload_size (PushApsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_APS_CLIENT(client), 0);
+   return client->priv->max_payload_size;
+}
+
+/**
+ * push_aps_client_set_max_payload_size:
+ * @client: (in): A #PushApsClient.
+ * @max_payload_size: The size in bytes.
+ *
+ * Sets the "max-payload-size" property.
+ */
+void
+push_aps_client_set_max_payload_size (PushApsClient *client,
+                                      guint          max_payload_size)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_APS_CLIENT(client));
+   g_return_if_fail(max_payload_size > 0);
+   g_return_if_fail(max_payload_size <= G_MAXUINT16);
+   client->priv->max_payload_size = max_payload_size;
+   g_object_notify_by_pspec(G_OBJECT(client),
+                            gParamSpecs[PROP_MAX_PAYLOAD_SIZE]);
+   EXIT;
+}
+
 static void
 push_aps_client_dispose (GObject *object)
 {
    PushApsClientPrivate *priv;
    GHashTableIter iter;
    GHashTable *hash;
-   GByteArray *array;
    gpointer key;
    gpointer value;
+   GList *link;
+   guint i;
 
    ENTRY;
 
@@ -1146,13 +1871,12 @@ push_aps_client_dispose (GObject *object)
       g_clear_object(&priv->gateway_stream);
    }
 
-   while ((array = g_queue_pop_head(priv->queue))) {
-      g_byte_array_free(array, TRUE);
+   for (i = 0; i < PUSH_APS_CLIENT_N_PRIORITIES; i++) {
+      while ((link = g_queue_pop_head_link(&priv->lanes[i]))) {
+         push_aps_client_frame_free(PUSH_APS_CLIENT(object), link->data);
+      }
    }
 
-   g_queue_free(priv->queue);
-   priv->queue = NULL;
-
    if ((hash = priv->results)) {
       priv->results = NULL;
       g_hash_table_iter_init(&iter, hash);
@@ -1162,6 +1886,7 @@ push_aps_client_dispose (GObject *object)
                                          PUSH_APS_CLIENT_ERROR_CANCELLED,
                                          _("Request was cancelled due to "
                                            "shutting down."));
+         push_aps_client_dedup_end(PUSH_APS_CLIENT(object), value, FALSE);
          g_simple_async_result_complete_in_idle(value);
       }
       g_hash_table_unref(hash);
@@ -1194,6 +1919,23 @@ push_aps_client_finalize (GObject *object)
 
    g_clear_error(&priv->tls_error);
 
+   if (priv->write_buf) {
+      g_byte_array_unref(priv->write_buf);
+      priv->write_buf = NULL;
+   }
+
+   g_array_unref(priv->write_ids);
+   priv->write_ids = NULL;
+
+   g_sequence_free(priv->expiry);
+   priv->expiry = NULL;
+
+   g_hash_table_unref(priv->collapse);
+   priv->collapse = NULL;
+
+   push_aps_dedup_free(priv->dedup);
+   priv->dedup = NULL;
+
    G_OBJECT_CLASS(push_aps_client_parent_class)->finalize(object);
 
    EXIT;
@@ -1208,9 +1950,18 @@ push_aps_client_get_property (GObject    *object,
    PushApsClient *client = PUSH_APS_CLIENT(object);
 
    switch (prop_id) {
+   case PROP_DEDUP_CAPACITY:
+      g_value_set_uint(value, push_aps_client_get_dedup_capacity(client));
+      break;
+   case PROP_DEDUP_WINDOW:
+      g_value_set_uint(value, push_aps_client_get_dedup_window(client));
+      break;
    case PROP_FEEDBACK_INTERVAL:
       g_value_set_uint(value, push_aps_client_get_feedback_interval(client));
       break;
+   case PROP_MAX_PAYLOAD_SIZE:
+      g_value_set_uint(value, push_aps_client_get_max_payload_size(client));
+      break;
    case PROP_MODE:
       g_value_set_enum(value, push_aps_client_get_mode(client));
       break;
@@ -1237,9 +1988,18 @@ push_aps_client_set_property (GObject      *object,
    PushApsClient *client = PUSH_APS_CLIENT(object);
 
    switch (prop_id) {
+   case PROP_DEDUP_CAPACITY:
+      push_aps_client_set_dedup_capacity(client, g_value_get_uint(value));
+      break;
+   case PROP_DEDUP_WINDOW:
+      push_aps_client_set_dedup_window(client, g_value_get_uint(value));
+      break;
    case PROP_FEEDBACK_INTERVAL:
       push_aps_client_set_feedback_interval(client, g_value_get_uint(value));
       break;
+   case PROP_MAX_PAYLOAD_SIZE:
+      push_aps_client_set_max_payload_size(client, g_value_get_uint(value));
+      break;
    case PROP_MODE:
       push_aps_client_set_mode(client, g_value_get_enum(value));
       break;
@@ -1271,6 +2031,28 @@ push_aps_client_class_init (PushApsClientClass *klass)
    object_class->set_property = push_aps_client_set_property;
    g_type_class_add_private(object_class, sizeof(PushApsClientPrivate));
 
+   gParamSpecs[PROP_DEDUP_CAPACITY] =
+      g_param_spec_uint("dedup-capacity",
+                        _("Dedup Capacity"),
+                        _("The number of recent deliveries to remember."),
+                        1,
+                        G_MAXUINT / 4,
+                        10000,
+                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_DEDUP_CAPACITY,
+                                   gParamSpecs[PROP_DEDUP_CAPACITY]);
+
+   gParamSpecs[PROP_DEDUP_WINDOW] =
+      g_param_spec_uint("dedup-window",
+                        _("Dedup Window"),
+                        _("Seconds to suppress duplicate deliveries, or 0."),
+                        0,
+                        G_MAXUINT,
+                        0,
+                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_DEDUP_WINDOW,
+                                   gParamSpecs[PROP_DEDUP_WINDOW]);
+
    gParamSpecs[PROP_FEEDBACK_INTERVAL] =
       g_param_spec_uint("feedback-interval",
                         _("Feedback Interval"),
@@ -1282,6 +2064,17 @@ push_aps_client_class_init (PushApsClientClass *klass)
    g_object_class_install_property(object_class, PROP_FEEDBACK_INTERVAL,
                                    gParamSpecs[PROP_FEEDBACK_INTERVAL]);
 
+   gParamSpecs[PROP_MAX_PAYLOAD_SIZE] =
+      g_param_spec_uint("max-payload-size",
+                        _("Max Payload Size"),
+                        _("The largest payload in bytes to send."),
+                        1,
+                        G_MAXUINT16,
+                        256,
+                        G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_MAX_PAYLOAD_SIZE,
+                                   gParamSpecs[PROP_MAX_PAYLOAD_SIZE]);
+
    gParamSpecs[PROP_MODE] =
       g_param_spec_enum("mode",
                         _("Mode"),
@@ -1337,6 +2130,8 @@ push_aps_client_class_init (PushApsClientClass *klass)
 static void
 push_aps_client_init (PushApsClient *client)
 {
+   guint i;
+
    ENTRY;
    client->priv = G_TYPE_INSTANCE_GET_PRIVATE(client,
                                               PUSH_TYPE_APS_CLIENT,
@@ -1347,7 +2142,16 @@ push_aps_client_init (PushApsClient *client)
                             g_free, g_object_unref);
    client->priv->last_id = g_random_int();
    client->priv->feedback_interval = 10;
-   client->priv->queue = g_queue_new();
+   client->priv->dedup_capacity = 10000;
+   client->priv->max_payload_size = 256;
+   client->priv->write_ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+   client->priv->expiry = g_sequence_new(NULL);
+   client->priv->collapse = g_hash_table_new(g_str_hash, g_str_equal);
+   for (i = 0; i < PUSH_APS_CLIENT_N_PRIORITIES; i++) {
+      g_queue_init(&client->priv->lanes[i]);
+      client->priv->credits[i] = gLaneWeights[i];
+   }
+   client->priv->dispose_cancellable = g_cancellable_new();
    EXIT;
 }
 
@@ -1370,6 +2174,26 @@ push_aps_client_mode_get_type (void)
    return type_id;
 }
 
+GType
+push_aps_client_priority_get_type (void)
+{
+   static GType type_id;
+   static gsize initialized = FALSE;
+   static GEnumValue values[] = {
+      { PUSH_APS_CLIENT_PRIORITY_HIGH, "PUSH_APS_CLIENT_PRIORITY_HIGH", "HIGH" },
+      { PUSH_APS_CLIENT_PRIORITY_NORMAL, "PUSH_APS_CLIENT_PRIORITY_NORMAL", "NORMAL" },
+      { PUSH_APS_CLIENT_PRIORITY_LOW, "PUSH_APS_CLIENT_PRIORITY_LOW", "LOW" },
+      { 0 }
+   };
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_enum_register_static("PushApsClientPriority", values);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
 GQuark
 push_aps_client_error_quark (void)
 {
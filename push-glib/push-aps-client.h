@@ -28,6 +28,7 @@ G_BEGIN_DECLS
 
 #define PUSH_TYPE_APS_CLIENT            (push_aps_client_get_type())
 #define PUSH_TYPE_APS_CLIENT_MODE       (push_aps_client_mode_get_type())
+#define PUSH_TYPE_APS_CLIENT_PRIORITY   (push_aps_client_priority_get_type())
 #define PUSH_APS_CLIENT_ERROR           (push_aps_client_error_quark())
 #define PUSH_APS_CLIENT(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_APS_CLIENT, PushApsClient))
 #define PUSH_APS_CLIENT_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_APS_CLIENT, PushApsClient const))
@@ -41,6 +42,7 @@ typedef struct _PushApsClientClass   PushApsClientClass;
 typedef struct _PushApsClientPrivate PushApsClientPrivate;
 typedef enum   _PushApsClientError   PushApsClientError;
 typedef enum   _PushApsClientMode    PushApsClientMode;
+typedef enum   _PushApsClientPriority PushApsClientPriority;
 
 enum _PushApsClientError
 {
@@ -57,6 +59,9 @@ enum _PushApsClientError
    PUSH_APS_CLIENT_ERROR_ALREADY_CONNECTED    = 257,
    PUSH_APS_CLIENT_ERROR_TLS_NOT_AVAILABLE    = 258,
    PUSH_APS_CLIENT_ERROR_CANCELLED            = 259,
+   PUSH_APS_CLIENT_ERROR_EXPIRED              = 260,
+   PUSH_APS_CLIENT_ERROR_COLLAPSED            = 261,
+   PUSH_APS_CLIENT_ERROR_DUPLICATE            = 262,
 };
 
 enum _PushApsClientMode
@@ -65,6 +70,13 @@ enum _PushApsClientMode
    PUSH_APS_CLIENT_SANDBOX    = 2,
 };
 
+enum _PushApsClientPriority
+{
+   PUSH_APS_CLIENT_PRIORITY_HIGH   = 0,
+   PUSH_APS_CLIENT_PRIORITY_NORMAL = 1,
+   PUSH_APS_CLIENT_PRIORITY_LOW    = 2,
+};
+
 struct _PushApsClient
 {
    GObject parent;
@@ -78,18 +90,31 @@ struct _PushApsClientClass
    GObjectClass parent_class;
 };
 
-void     push_aps_client_deliver_async  (PushApsClient        *client,
-                                         PushApsIdentity      *identity,
-                                         PushApsMessage       *message,
-                                         GCancellable         *cancellable,
-                                         GAsyncReadyCallback   callback,
-                                         gpointer              user_data);
-gboolean push_aps_client_deliver_finish (PushApsClient        *client,
-                                         GAsyncResult         *result,
-                                         GError              **error);
-GQuark   push_aps_client_error_quark    (void) G_GNUC_CONST;
-GType    push_aps_client_get_type       (void) G_GNUC_CONST;
-GType    push_aps_client_mode_get_type  (void) G_GNUC_CONST;
+void     push_aps_client_deliver_async        (PushApsClient          *client,
+                                               PushApsIdentity        *identity,
+                                               PushApsMessage         *message,
+                                               GCancellable           *cancellable,
+                                               GAsyncReadyCallback     callback,
+                                               gpointer                user_data);
+void     push_aps_client_deliver_full_async   (PushApsClient          *client,
+                                               PushApsIdentity        *identity,
+                                               PushApsMessage         *message,
+                                               PushApsClientPriority   priority,
+                                               GCancellable           *cancellable,
+                                               GAsyncReadyCallback     callback,
+                                               gpointer                user_data);
+gboolean push_aps_client_deliver_finish       (PushApsClient          *client,
+                                               GAsyncResult           *result,
+                                               GError                **error);
+GQuark   push_aps_client_error_quark          (void) G_GNUC_CONST;
+guint    push_aps_client_get_dedup_capacity   (PushApsClient          *client);
+guint    push_aps_client_get_dedup_window     (PushApsClient          *client);
+guint    push_aps_client_get_max_payload_size (PushApsClient          *client);
+GType    push_aps_client_get_type             (void) G_GNUC_CONST;
+GType    push_aps_client_mode_get_type        (void) G_GNUC_CONST;
+GType    push_aps_client_priority_get_type    (void) G_GNUC_CONST;
+void     push_aps_client_set_max_payload_size (PushApsClient          *client,
+                                               guint                   max_payload_size);
 
 G_END_DECLS
 
@@ -0,0 +1,314 @@
+/* push-aps-dedup.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "push-aps-dedup.h"
+#include "push-debug.h"
+
+/*
+ * PushApsDedup remembers fingerprints of recently delivered
+ * (device token, payload) pairs so that repeated submissions within a
+ * short window can be dropped.
+ *
+ * Fingerprints are 64-bit FNV-1a hashes of the token and payload hash,
+ * stored in two fixed size open addressing tables, one per generation.
+ * New fingerprints go into the current generation. When it is older than
+ * the window, or holds capacity entries, the previous generation is
+ * cleared and the two are swapped. Lookups check both. Memory is therefore
+ * bounded by the capacity, and an entry is remembered for at least one
+ * window and at most two.
+ *
+ * Deliveries that have been submitted but not yet completed are tracked
+ * separately in a set of in-flight fingerprints, so that repeated
+ * submissions are caught before the first one succeeds. An in-flight
+ * fingerprint is dropped if its delivery fails and moved to the current
+ * generation if it succeeds.
+ */
+
+#define FNV_OFFSET_BASIS G_GUINT64_CONSTANT(14695981039346656037)
+#define FNV_PRIME        G_GUINT64_CONSTANT(1099511628211)
+
+typedef struct
+{
+   guint64 *slots;
+   guint    count;
+   gint64   started_at;
+} PushApsDedupGeneration;
+
+struct _PushApsDedup
+{
+   gint64                  window;
+   guint                   capacity;
+   guint                   mask;
+   PushApsDedupGeneration  gens[2];
+   guint                   current;
+   GHashTable             *in_flight;
+};
+
+static guint64
+push_aps_dedup_hash (guint64      hash,
+                     const gchar *str)
+{
+   for (; *str; str++) {
+      hash ^= (guint8)*str;
+      hash *= FNV_PRIME;
+   }
+
+   return hash;
+}
+
+static gboolean
+push_aps_dedup_contains (PushApsDedup           *dedup,
+                         PushApsDedupGeneration *gen,
+                         guint64                 fingerprint)
+{
+   guint i;
+
+   for (i = fingerprint & dedup->mask;
+        gen->slots[i];
+        i = (i + 1) & dedup->mask) {
+      if (gen->slots[i] == fingerprint) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+static void
+push_aps_dedup_insert (PushApsDedup           *dedup,
+                       PushApsDedupGeneration *gen,
+                       guint64                 fingerprint)
+{
+   guint i;
+
+   for (i = fingerprint & dedup->mask;
+        gen->slots[i];
+        i = (i + 1) & dedup->mask) {
+      /* Do nothing */
+   }
+
+   gen->slots[i] = fingerprint;
+   gen->count++;
+}
+
+static void
+push_aps_dedup_rotate (PushApsDedup *dedup,
+                       gint64        now)
+{
+   PushApsDedupGeneration *gen;
+
+   dedup->current = !dedup->current;
+   gen = &dedup->gens[dedup->current];
+   memset(gen->slots, 0, sizeof(guint64) * (dedup->mask + 1));
+   gen->count = 0;
+   gen->started_at = now;
+}
+
+static guint64
+push_aps_dedup_fingerprint (const gchar *device_token,
+                            guint        payload_hash)
+{
+   guint64 fingerprint;
+   guint i;
+
+   fingerprint = push_aps_dedup_hash(FNV_OFFSET_BASIS, device_token);
+   for (i = 0; i < 4; i++) {
+      fingerprint ^= (payload_hash >> (i * 8)) & 0xFF;
+      fingerprint *= FNV_PRIME;
+   }
+
+   /*
+    * Zero marks an empty slot.
+    */
+   return fingerprint ? fingerprint : 1;
+}
+
+static void
+push_aps_dedup_expire (PushApsDedup *dedup)
+{
+   PushApsDedupGeneration *gen;
+   gint64 now;
+
+   now = g_get_monotonic_time();
+
+   /*
+    * Once the previous generation is older than two windows, nothing in
+    * either generation is worth keeping.
+    */
+   gen = &dedup->gens[dedup->current];
+   if ((now - gen->started_at) >= (2 * dedup->window)) {
+      push_aps_dedup_rotate(dedup, now);
+      push_aps_dedup_rotate(dedup, now);
+   } else if (((now - gen->started_at) >= dedup->window) ||
+              (gen->count >= dedup->capacity)) {
+      push_aps_dedup_rotate(dedup, now);
+   }
+}
+
+/**
+ * push_aps_dedup_check:
+ * @dedup: A #PushApsDedup.
+ * @device_token: The device token being delivered to.
+ * @payload_hash: The hash of the payload being delivered, as returned by
+ *   push_aps_message_get_payload_hash().
+ *
+ * Checks if the payload is being delivered to @device_token, or was
+ * delivered successfully within the window.
+ *
+ * Returns: %TRUE if the pair is a duplicate.
+ */
+gboolean
+push_aps_dedup_check (PushApsDedup *dedup,
+                      const gchar  *device_token,
+                      guint         payload_hash)
+{
+   guint64 fingerprint;
+
+   g_return_val_if_fail(dedup, FALSE);
+   g_return_val_if_fail(device_token, FALSE);
+
+   fingerprint = push_aps_dedup_fingerprint(device_token, payload_hash);
+   push_aps_dedup_expire(dedup);
+
+   return (g_hash_table_contains(dedup->in_flight, &fingerprint) ||
+           push_aps_dedup_contains(dedup, &dedup->gens[0], fingerprint) ||
+           push_aps_dedup_contains(dedup, &dedup->gens[1], fingerprint));
+}
+
+/**
+ * push_aps_dedup_begin:
+ * @dedup: A #PushApsDedup.
+ * @device_token: The device token being delivered to.
+ * @payload_hash: The hash of the payload being delivered.
+ *
+ * Marks the payload as being delivered to @device_token, so that
+ * push_aps_dedup_check() reports further submissions as duplicates until
+ * push_aps_dedup_end() is called.
+ */
+void
+push_aps_dedup_begin (PushApsDedup *dedup,
+                      const gchar  *device_token,
+                      guint         payload_hash)
+{
+   guint64 *fingerprint;
+
+   g_return_if_fail(dedup);
+   g_return_if_fail(device_token);
+
+   fingerprint = g_new(guint64, 1);
+   *fingerprint = push_aps_dedup_fingerprint(device_token, payload_hash);
+   g_hash_table_add(dedup->in_flight, fingerprint);
+}
+
+/**
+ * push_aps_dedup_end:
+ * @dedup: A #PushApsDedup.
+ * @device_token: The device token that was delivered to.
+ * @payload_hash: The hash of the payload that was delivered.
+ * @delivered: If the delivery succeeded.
+ *
+ * Completes a delivery started with push_aps_dedup_begin(). If
+ * @delivered is %TRUE, the pair keeps being reported as a duplicate for
+ * the rest of the window. Otherwise it is forgotten so that the delivery
+ * may be retried.
+ */
+void
+push_aps_dedup_end (PushApsDedup *dedup,
+                    const gchar  *device_token,
+                    guint         payload_hash,
+                    gboolean      delivered)
+{
+   guint64 fingerprint;
+
+   g_return_if_fail(dedup);
+   g_return_if_fail(device_token);
+
+   fingerprint = push_aps_dedup_fingerprint(device_token, payload_hash);
+   g_hash_table_remove(dedup->in_flight, &fingerprint);
+
+   if (!delivered) {
+      return;
+   }
+
+   push_aps_dedup_expire(dedup);
+
+   if (!push_aps_dedup_contains(dedup, &dedup->gens[0], fingerprint) &&
+       !push_aps_dedup_contains(dedup, &dedup->gens[1], fingerprint)) {
+      push_aps_dedup_insert(dedup,
+                            &dedup->gens[dedup->current],
+                            fingerprint);
+   }
+}
+
+/**
+ * push_aps_dedup_free:
+ * @dedup: A #PushApsDedup.
+ *
+ * Frees @dedup and its tables.
+ */
+void
+push_aps_dedup_free (PushApsDedup *dedup)
+{
+   if (dedup) {
+      g_free(dedup->gens[0].slots);
+      g_free(dedup->gens[1].slots);
+      g_hash_table_unref(dedup->in_flight);
+      g_slice_free(PushApsDedup, dedup);
+   }
+}
+
+/**
+ * push_aps_dedup_new:
+ * @window: The window in seconds.
+ * @capacity: The maximum number of entries per generation.
+ *
+ * Creates a new duplicate filter. Each generation table is sized to stay
+ * at most half full at @capacity entries.
+ *
+ * Returns: A newly allocated #PushApsDedup.
+ */
+PushApsDedup *
+push_aps_dedup_new (guint window,
+                    guint capacity)
+{
+   PushApsDedup *dedup;
+   guint size;
+
+   g_return_val_if_fail(window > 0, NULL);
+   g_return_val_if_fail(capacity > 0, NULL);
+   g_return_val_if_fail(capacity <= (G_MAXUINT / 4), NULL);
+
+   for (size = 16; size < (capacity * 2); size <<= 1) {
+      /* Do nothing */
+   }
+
+   dedup = g_slice_new0(PushApsDedup);
+   dedup->window = (gint64)window * G_USEC_PER_SEC;
+   dedup->capacity = capacity;
+   dedup->mask = size - 1;
+   dedup->gens[0].slots = g_new0(guint64, size);
+   dedup->gens[1].slots = g_new0(guint64, size);
+   dedup->gens[0].started_at = g_get_monotonic_time();
+   dedup->gens[1].started_at = dedup->gens[0].started_at;
+   dedup->in_flight = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                            g_free, NULL);
+
+   return dedup;
+}
@@ -0,0 +1,44 @@
+/* push-aps-dedup.h
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PUSH_APS_DEDUP_H
+#define PUSH_APS_DEDUP_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PushApsDedup PushApsDedup;
+
+void          push_aps_dedup_begin (PushApsDedup *dedup,
+                                    const gchar  *device_token,
+                                    guint         payload_hash);
+gboolean      push_aps_dedup_check (PushApsDedup *dedup,
+                                    const gchar  *device_token,
+                                    guint         payload_hash);
+void          push_aps_dedup_end   (PushApsDedup *dedup,
+                                    const gchar  *device_token,
+                                    guint         payload_hash,
+                                    gboolean      delivered);
+void          push_aps_dedup_free  (PushApsDedup *dedup);
+PushApsDedup *push_aps_dedup_new   (guint         window,
+                                    guint         capacity);
+
+G_END_DECLS
+
+#endif /* PUSH_APS_DEDUP_H */
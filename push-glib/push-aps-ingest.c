@@ -0,0 +1,594 @@
+/* push-aps-ingest.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glib/gi18n.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+
+#include "push-aps-identity.h"
+#include "push-aps-ingest.h"
+#include "push-aps-message.h"
+#include "push-debug.h"
+
+/**
+ * SECTION:push-aps-ingest
+ * @title: PushApsIngest
+ * @short_description: Streams delivery records into a #PushApsClient.
+ *
+ * #PushApsIngest reads newline-delimited JSON delivery records from a
+ * #GInputStream and delivers them using a #PushApsClient. Each line holds
+ * one JSON object with a "device_token" member. The remaining members are
+ * used to build the message, as done by push_aps_message_new_from_json().
+ *
+ * |[
+ * {"device_token":"0123...","alert":"Hello","badge":1}
+ * ]|
+ *
+ * Records are parsed one line at a time and no more than
+ * #PushApsIngest:max-in-flight deliveries are outstanding at once. Reading
+ * from the stream pauses until deliveries complete, so arbitrarily large
+ * inputs are processed in constant memory.
+ *
+ * Lines that cannot be parsed are counted and skipped. Deliveries that
+ * fail are counted and reported with the #PushApsIngest::delivery-failed
+ * signal.
+ */
+
+G_DEFINE_TYPE(PushApsIngest, push_aps_ingest, G_TYPE_OBJECT)
+
+#define DEFAULT_MAX_IN_FLIGHT 1000
+
+struct _PushApsIngestPrivate
+{
+   PushApsClient *client;
+   guint          max_in_flight;
+   guint64        n_delivered;
+   guint64        n_failed;
+   guint64        n_invalid;
+};
+
+typedef struct
+{
+   PushApsIngest      *ingest;
+   GSimpleAsyncResult *simple;
+   GDataInputStream   *stream;
+   GCancellable       *cancellable;
+   JsonParser         *parser;
+   GError             *error;
+   guint               in_flight;
+   gboolean            reading;
+   gboolean            done;
+} PushApsIngestRun;
+
+typedef struct
+{
+   PushApsIngestRun *run;
+   PushApsIdentity  *identity;
+} PushApsIngestDelivery;
+
+enum
+{
+   PROP_0,
+   PROP_CLIENT,
+   PROP_MAX_IN_FLIGHT,
+   LAST_PROP
+};
+
+enum
+{
+   DELIVERY_FAILED,
+   LAST_SIGNAL
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+static guint       gSignals[LAST_SIGNAL];
+
+static void push_aps_ingest_read (PushApsIngestRun *run);
+
+/**
+ * push_aps_ingest_new:
+ * @client: (in): A #PushApsClient.
+ *
+ * Creates a new #PushApsIngest delivering records with @client.
+ *
+ * Returns: (transfer full): A newly allocated #PushApsIngest.
+ */
+PushApsIngest *
+push_aps_ingest_new (PushApsClient *client)
+{
+   return g_object_new(PUSH_TYPE_APS_INGEST,
+                       "client", client,
+                       NULL);
+}
+
+/**
+ * push_aps_ingest_get_client:
+ * @ingest: (in): A #PushApsIngest.
+ *
+ * Fetches the client used to deliver records.
+ *
+ * Returns: (transfer none): A #PushApsClient.
+ */
+PushApsClient *
+push_aps_ingest_get_client (PushApsIngest *ingest)
+{
+   g_return_val_if_fail(PUSH_IS_APS_INGEST(ingest), NULL);
+   return ingest->priv->client;
+}
+
+guint
+push_aps_ingest_get_max_in_flight (PushApsIngest *ingest)
+{
+   g_return_val_if_fail(PUSH_IS_APS_INGEST(ingest), 0);
+   return ingest->priv->max_in_flight;
+}
+
+/**
+ * push_aps_ingest_set_max_in_flight:
+ * @ingest: (in): A #PushApsIngest.
+ * @max_in_flight: (in): The maximum number of outstanding deliveries.
+ *
+ * Sets the number of deliveries that may be outstanding before reading
+ * from the input stream pauses. The new limit applies to runs that are
+ * already in progress.
+ */
+void
+push_aps_ingest_set_max_in_flight (PushApsIngest *ingest,
+                                   guint          max_in_flight)
+{
+   g_return_if_fail(PUSH_IS_APS_INGEST(ingest));
+   g_return_if_fail(max_in_flight > 0);
+
+   ingest->priv->max_in_flight = max_in_flight;
+   g_object_notify_by_pspec(G_OBJECT(ingest), gParamSpecs[PROP_MAX_IN_FLIGHT]);
+}
+
+/**
+ * push_aps_ingest_get_n_delivered:
+ * @ingest: (in): A #PushApsIngest.
+ *
+ * Fetches the number of records that were delivered successfully.
+ *
+ * Returns: A #guint64.
+ */
+guint64
+push_aps_ingest_get_n_delivered (PushApsIngest *ingest)
+{
+   g_return_val_if_fail(PUSH_IS_APS_INGEST(ingest), 0);
+   return ingest->priv->n_delivered;
+}
+
+/**
+ * push_aps_ingest_get_n_failed:
+ * @ingest: (in): A #PushApsIngest.
+ *
+ * Fetches the number of records whose delivery failed.
+ *
+ * Returns: A #guint64.
+ */
+guint64
+push_aps_ingest_get_n_failed (PushApsIngest *ingest)
+{
+   g_return_val_if_fail(PUSH_IS_APS_INGEST(ingest), 0);
+   return ingest->priv->n_failed;
+}
+
+/**
+ * push_aps_ingest_get_n_invalid:
+ * @ingest: (in): A #PushApsIngest.
+ *
+ * Fetches the number of lines that were skipped because they did not
+ * contain a valid delivery record.
+ *
+ * Returns: A #guint64.
+ */
+guint64
+push_aps_ingest_get_n_invalid (PushApsIngest *ingest)
+{
+   g_return_val_if_fail(PUSH_IS_APS_INGEST(ingest), 0);
+   return ingest->priv->n_invalid;
+}
+
+static void
+push_aps_ingest_run_free (PushApsIngestRun *run)
+{
+   g_object_unref(run->ingest);
+   g_object_unref(run->simple);
+   g_object_unref(run->stream);
+   g_object_unref(run->parser);
+   if (run->cancellable) {
+      g_object_unref(run->cancellable);
+   }
+   g_clear_error(&run->error);
+   g_slice_free(PushApsIngestRun, run);
+}
+
+/*
+ * Completes @run once the input is exhausted and every outstanding
+ * delivery has finished.
+ */
+static void
+push_aps_ingest_run_complete (PushApsIngestRun *run)
+{
+   ENTRY;
+
+   if (!run->done || run->reading || run->in_flight) {
+      EXIT;
+   }
+
+   if (run->error) {
+      g_simple_async_result_take_error(run->simple, run->error);
+      run->error = NULL;
+   } else {
+      g_simple_async_result_set_op_res_gboolean(run->simple, TRUE);
+   }
+
+   g_simple_async_result_complete(run->simple);
+   push_aps_ingest_run_free(run);
+
+   EXIT;
+}
+
+static void
+push_aps_ingest_deliver_cb (GObject      *object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+   PushApsIngestDelivery *delivery = user_data;
+   PushApsIngestPrivate *priv;
+   PushApsIngestRun *run = delivery->run;
+   GError *error = NULL;
+
+   ENTRY;
+
+   priv = run->ingest->priv;
+
+   if (push_aps_client_deliver_finish(PUSH_APS_CLIENT(object),
+                                      result,
+                                      &error)) {
+      priv->n_delivered++;
+   } else {
+      priv->n_failed++;
+      g_signal_emit(run->ingest, gSignals[DELIVERY_FAILED], 0,
+                    delivery->identity, error);
+      g_error_free(error);
+   }
+
+   g_object_unref(delivery->identity);
+   g_slice_free(PushApsIngestDelivery, delivery);
+
+   run->in_flight--;
+
+   if (!run->done && !run->reading && (run->in_flight < priv->max_in_flight)) {
+      push_aps_ingest_read(run);
+   } else {
+      push_aps_ingest_run_complete(run);
+   }
+
+   EXIT;
+}
+
+/*
+ * Parses a single record and hands it to the client. Returns FALSE if
+ * the line did not contain a valid record.
+ */
+static gboolean
+push_aps_ingest_dispatch (PushApsIngestRun *run,
+                          const gchar      *line,
+                          gsize             length)
+{
+   PushApsIngestDelivery *delivery;
+   PushApsMessage *message;
+   const gchar *device_token;
+   JsonObject *object;
+   JsonNode *root;
+   JsonNode *node;
+
+   if (!json_parser_load_from_data(run->parser, line, length, NULL) ||
+       !(root = json_parser_get_root(run->parser)) ||
+       !JSON_NODE_HOLDS_OBJECT(root)) {
+      return FALSE;
+   }
+
+   object = json_node_get_object(root);
+
+   if (!(node = json_object_get_member(object, "device_token")) ||
+       (json_node_get_value_type(node) != G_TYPE_STRING) ||
+       !(device_token = json_node_get_string(node)) ||
+       !*device_token) {
+      return FALSE;
+   }
+
+   delivery = g_slice_new0(PushApsIngestDelivery);
+   delivery->run = run;
+   delivery->identity = push_aps_identity_new(device_token);
+
+   json_object_remove_member(object, "device_token");
+   message = push_aps_message_new_from_json(object);
+
+   run->in_flight++;
+
+   push_aps_client_deliver_async(run->ingest->priv->client,
+                                 delivery->identity,
+                                 message,
+                                 run->cancellable,
+                                 push_aps_ingest_deliver_cb,
+                                 delivery);
+
+   g_object_unref(message);
+
+   return TRUE;
+}
+
+static void
+push_aps_ingest_read_cb (GObject      *object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+   PushApsIngestRun *run = user_data;
+   GError *error = NULL;
+   gchar *line;
+   gsize length;
+
+   ENTRY;
+
+   run->reading = FALSE;
+
+   if (!(line = g_data_input_stream_read_line_finish(run->stream,
+                                                     result,
+                                                     &length,
+                                                     &error))) {
+      run->error = error;
+      run->done = TRUE;
+      push_aps_ingest_run_complete(run);
+      EXIT;
+   }
+
+   g_strchug(line);
+
+   if (*line && !push_aps_ingest_dispatch(run, line, strlen(line))) {
+      run->ingest->priv->n_invalid++;
+   }
+
+   g_free(line);
+
+   /*
+    * Keep reading until the in-flight limit is reached. Otherwise the
+    * next completed delivery resumes reading.
+    */
+   if (run->in_flight < run->ingest->priv->max_in_flight) {
+      push_aps_ingest_read(run);
+   }
+
+   EXIT;
+}
+
+static void
+push_aps_ingest_read (PushApsIngestRun *run)
+{
+   run->reading = TRUE;
+   g_data_input_stream_read_line_async(run->stream,
+                                       G_PRIORITY_DEFAULT,
+                                       run->cancellable,
+                                       push_aps_ingest_read_cb,
+                                       run);
+}
+
+/**
+ * push_aps_ingest_run_async:
+ * @ingest: (in): A #PushApsIngest.
+ * @stream: (in): A #GInputStream of newline-delimited JSON records.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: User data for @callback.
+ *
+ * Asynchronously reads delivery records from @stream and delivers them.
+ * @callback is executed once @stream has been read to the end and every
+ * delivery has completed.
+ */
+void
+push_aps_ingest_run_async (PushApsIngest       *ingest,
+                           GInputStream        *stream,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+   PushApsIngestRun *run;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_APS_INGEST(ingest));
+   g_return_if_fail(G_IS_INPUT_STREAM(stream));
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+   g_return_if_fail(callback);
+
+   run = g_slice_new0(PushApsIngestRun);
+   run->ingest = g_object_ref(ingest);
+   run->simple = g_simple_async_result_new(G_OBJECT(ingest), callback,
+                                           user_data,
+                                           push_aps_ingest_run_async);
+   run->stream = g_data_input_stream_new(stream);
+   run->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+   run->parser = json_parser_new();
+
+   g_data_input_stream_set_newline_type(run->stream,
+                                        G_DATA_STREAM_NEWLINE_TYPE_ANY);
+
+   push_aps_ingest_read(run);
+
+   EXIT;
+}
+
+/**
+ * push_aps_ingest_run_finish:
+ * @ingest: (in): A #PushApsIngest.
+ * @result: A #GAsyncResult.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to push_aps_ingest_run_async().
+ * Failed deliveries and invalid records do not cause the run to fail;
+ * see push_aps_ingest_get_n_failed() and push_aps_ingest_get_n_invalid().
+ *
+ * Returns: %TRUE if the stream was read to the end; otherwise %FALSE and
+ *   @error is set.
+ */
+gboolean
+push_aps_ingest_run_finish (PushApsIngest  *ingest,
+                            GAsyncResult   *result,
+                            GError        **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+   gboolean ret;
+
+   ENTRY;
+
+   g_return_val_if_fail(PUSH_IS_APS_INGEST(ingest), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
+
+   if (!(ret = g_simple_async_result_get_op_res_gboolean(simple))) {
+      g_simple_async_result_propagate_error(simple, error);
+   }
+
+   RETURN(ret);
+}
+
+static void
+push_aps_ingest_finalize (GObject *object)
+{
+   PushApsIngestPrivate *priv;
+
+   ENTRY;
+
+   priv = PUSH_APS_INGEST(object)->priv;
+   g_clear_object(&priv->client);
+
+   G_OBJECT_CLASS(push_aps_ingest_parent_class)->finalize(object);
+
+   EXIT;
+}
+
+static void
+push_aps_ingest_get_property (GObject    *object,
+                              guint       prop_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+   PushApsIngest *ingest = PUSH_APS_INGEST(object);
+
+   switch (prop_id) {
+   case PROP_CLIENT:
+      g_value_set_object(value, push_aps_ingest_get_client(ingest));
+      break;
+   case PROP_MAX_IN_FLIGHT:
+      g_value_set_uint(value, push_aps_ingest_get_max_in_flight(ingest));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_aps_ingest_set_property (GObject      *object,
+                              guint         prop_id,
+                              const GValue *value,
+                              GParamSpec   *pspec)
+{
+   PushApsIngest *ingest = PUSH_APS_INGEST(object);
+
+   switch (prop_id) {
+   case PROP_CLIENT:
+      ingest->priv->client = g_value_dup_object(value);
+      break;
+   case PROP_MAX_IN_FLIGHT:
+      push_aps_ingest_set_max_in_flight(ingest, g_value_get_uint(value));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_aps_ingest_class_init (PushApsIngestClass *klass)
+{
+   GObjectClass *object_class;
+
+   ENTRY;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->finalize = push_aps_ingest_finalize;
+   object_class->get_property = push_aps_ingest_get_property;
+   object_class->set_property = push_aps_ingest_set_property;
+   g_type_class_add_private(object_class, sizeof(PushApsIngestPrivate));
+
+   gParamSpecs[PROP_CLIENT] =
+      g_param_spec_object("client",
+                          _("Client"),
+                          _("The client used to deliver records."),
+                          PUSH_TYPE_APS_CLIENT,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_CLIENT,
+                                   gParamSpecs[PROP_CLIENT]);
+
+   gParamSpecs[PROP_MAX_IN_FLIGHT] =
+      g_param_spec_uint("max-in-flight",
+                        _("Max In Flight"),
+                        _("The maximum number of outstanding deliveries."),
+                        1,
+                        G_MAXUINT,
+                        DEFAULT_MAX_IN_FLIGHT,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_MAX_IN_FLIGHT,
+                                   gParamSpecs[PROP_MAX_IN_FLIGHT]);
+
+   /**
+    * PushApsIngest::delivery-failed:
+    * @ingest: A #PushApsIngest.
+    * @identity: The #PushApsIdentity of the record.
+    * @error: A #GError describing the failure.
+    *
+    * Emitted when the delivery of a record fails.
+    */
+   gSignals[DELIVERY_FAILED] = g_signal_new("delivery-failed",
+                                            PUSH_TYPE_APS_INGEST,
+                                            G_SIGNAL_RUN_LAST,
+                                            0,
+                                            NULL,
+                                            NULL,
+                                            g_cclosure_marshal_generic,
+                                            G_TYPE_NONE,
+                                            2,
+                                            PUSH_TYPE_APS_IDENTITY,
+                                            G_TYPE_ERROR);
+
+   EXIT;
+}
+
+static void
+push_aps_ingest_init (PushApsIngest *ingest)
+{
+   ENTRY;
+   ingest->priv =
+      G_TYPE_INSTANCE_GET_PRIVATE(ingest,
+                                  PUSH_TYPE_APS_INGEST,
+                                  PushApsIngestPrivate);
+   ingest->priv->max_in_flight = DEFAULT_MAX_IN_FLIGHT;
+   EXIT;
+}
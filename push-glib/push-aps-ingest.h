@@ -0,0 +1,74 @@
+/* push-aps-ingest.h
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PUSH_APS_INGEST_H
+#define PUSH_APS_INGEST_H
+
+#include <gio/gio.h>
+
+#include "push-aps-client.h"
+
+G_BEGIN_DECLS
+
+#define PUSH_TYPE_APS_INGEST            (push_aps_ingest_get_type())
+#define PUSH_APS_INGEST(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_APS_INGEST, PushApsIngest))
+#define PUSH_APS_INGEST_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_APS_INGEST, PushApsIngest const))
+#define PUSH_APS_INGEST_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  PUSH_TYPE_APS_INGEST, PushApsIngestClass))
+#define PUSH_IS_APS_INGEST(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PUSH_TYPE_APS_INGEST))
+#define PUSH_IS_APS_INGEST_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  PUSH_TYPE_APS_INGEST))
+#define PUSH_APS_INGEST_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  PUSH_TYPE_APS_INGEST, PushApsIngestClass))
+
+typedef struct _PushApsIngest        PushApsIngest;
+typedef struct _PushApsIngestClass   PushApsIngestClass;
+typedef struct _PushApsIngestPrivate PushApsIngestPrivate;
+
+struct _PushApsIngest
+{
+   GObject parent;
+
+   /*< private >*/
+   PushApsIngestPrivate *priv;
+};
+
+struct _PushApsIngestClass
+{
+   GObjectClass parent_class;
+};
+
+PushApsClient *push_aps_ingest_get_client        (PushApsIngest        *ingest);
+guint          push_aps_ingest_get_max_in_flight (PushApsIngest        *ingest);
+guint64        push_aps_ingest_get_n_delivered   (PushApsIngest        *ingest);
+guint64        push_aps_ingest_get_n_failed      (PushApsIngest        *ingest);
+guint64        push_aps_ingest_get_n_invalid     (PushApsIngest        *ingest);
+GType          push_aps_ingest_get_type          (void) G_GNUC_CONST;
+PushApsIngest *push_aps_ingest_new               (PushApsClient        *client);
+void           push_aps_ingest_run_async         (PushApsIngest        *ingest,
+                                                  GInputStream         *stream,
+                                                  GCancellable         *cancellable,
+                                                  GAsyncReadyCallback   callback,
+                                                  gpointer              user_data);
+gboolean       push_aps_ingest_run_finish        (PushApsIngest        *ingest,
+                                                  GAsyncResult         *result,
+                                                  GError              **error);
+void           push_aps_ingest_set_max_in_flight (PushApsIngest        *ingest,
+                                                  guint                 max_in_flight);
+
+G_END_DECLS
+
+#endif /* PUSH_APS_INGEST_H */
@@ -0,0 +1,555 @@
+/* push-aps-message-template.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "push-aps-message-private.h"
+#include "push-aps-message-template.h"
+#include "push-debug.h"
+#include "push-json.h"
+
+/**
+ * SECTION:push-aps-message-template
+ * @title: PushApsMessageTemplate
+ * @short_description: Pre-serialized #PushApsMessage with per-recipient slots.
+ *
+ * #PushApsMessageTemplate is used to deliver personalised copies of a
+ * message to many identities. The template is created from a prototype
+ * #PushApsMessage whose payload is serialized once. Slots in the payload
+ * are then filled in for each recipient, which only requires joining the
+ * constant fragments with the slot values.
+ *
+ * Slots are written into string values of the prototype:
+ *
+ * <itemizedlist>
+ *   <listitem>"{name}" anywhere inside a string is a string slot. The value
+ *   is escaped and placed inside the string.</listitem>
+ *   <listitem>A string consisting only of "{#name}" is an integer slot. The
+ *   string, including its quotes, is replaced by the number.</listitem>
+ * </itemizedlist>
+ *
+ * The "badge" of the prototype may also be used as an integer slot by
+ * passing its name to push_aps_message_template_new().
+ *
+ * When rendering, the type of each value is given by its name rather than
+ * by the template: "name" is followed by a const gchar* and "#name" by a
+ * #gint, mirroring the slot syntax.
+ *
+ * |[
+ * push_aps_message_set_alert(prototype, "Hi {name}, you have {n} new items");
+ * push_aps_message_set_badge(prototype, 0);
+ * tmpl = push_aps_message_template_new(prototype, "n");
+ * message = push_aps_message_template_render_message(tmpl,
+ *                                                    "name", "Bob",
+ *                                                    "#n", 5,
+ *                                                    NULL);
+ * ]|
+ *
+ * Note that a string slot and an integer slot may share a name, as "n"
+ * does above. An integer value fills both, and is formatted as decimal
+ * text for the string slot.
+ */
+
+G_DEFINE_BOXED_TYPE(PushApsMessageTemplate,
+                    push_aps_message_template,
+                    push_aps_message_template_ref,
+                    push_aps_message_template_unref)
+
+enum
+{
+   SLOT_STRING,
+   SLOT_INTEGER,
+};
+
+typedef struct
+{
+   gchar *name;
+   guint  type;
+} PushApsTemplateSlot;
+
+typedef struct
+{
+   guint offset;
+   guint length;
+   gint  slot;
+} PushApsTemplatePart;
+
+struct _PushApsMessageTemplate
+{
+   volatile gint   ref_count;
+   GDateTime      *expires_at;
+   gchar          *collapse_key;
+   gchar          *text;
+   gsize           text_len;
+   GArray         *slots;
+   GArray         *parts;
+};
+
+static gint
+push_aps_message_template_add_slot (PushApsMessageTemplate *tmpl,
+                                    const gchar            *name,
+                                    gsize                   name_len,
+                                    guint                   type)
+{
+   PushApsTemplateSlot slot;
+   PushApsTemplateSlot *iter;
+   guint i;
+
+   for (i = 0; i < tmpl->slots->len; i++) {
+      iter = &g_array_index(tmpl->slots, PushApsTemplateSlot, i);
+      if ((iter->type == type) &&
+          !strncmp(iter->name, name, name_len) &&
+          !iter->name[name_len]) {
+         return i;
+      }
+   }
+
+   slot.name = g_strndup(name, name_len);
+   slot.type = type;
+   g_array_append_val(tmpl->slots, slot);
+
+   return tmpl->slots->len - 1;
+}
+
+static void
+push_aps_message_template_add_part (PushApsMessageTemplate *tmpl,
+                                    const gchar            *begin,
+                                    const gchar            *end,
+                                    gint                    slot)
+{
+   PushApsTemplatePart part;
+
+   if ((slot < 0) && (end <= begin)) {
+      return;
+   }
+
+   part.offset = begin - tmpl->text;
+   part.length = end - begin;
+   part.slot = slot;
+   g_array_append_val(tmpl->parts, part);
+}
+
+static gboolean
+push_aps_message_template_is_name (const gchar *begin,
+                                   const gchar *end)
+{
+   if (begin == end) {
+      return FALSE;
+   }
+
+   for (; begin < end; begin++) {
+      if (!g_ascii_isalnum(*begin) && (*begin != '_') && (*begin != '-')) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+/*
+ * Splits the string value between @begin and @end (exclusive of quotes)
+ * at any "{name}" slots. @lit points to the start of the pending constant
+ * fragment and is advanced past each slot.
+ */
+static void
+push_aps_message_template_scan_string (PushApsMessageTemplate  *tmpl,
+                                       const gchar             *begin,
+                                       const gchar             *end,
+                                       const gchar            **lit)
+{
+   const gchar *open;
+   const gchar *close;
+   gint slot;
+
+   if (((end - begin) > 3) &&
+       (begin[0] == '{') &&
+       (begin[1] == '#') &&
+       (end[-1] == '}') &&
+       push_aps_message_template_is_name(begin + 2, end - 1)) {
+      slot = push_aps_message_template_add_slot(tmpl, begin + 2,
+                                                end - begin - 3,
+                                                SLOT_INTEGER);
+      push_aps_message_template_add_part(tmpl, *lit, begin - 1, -1);
+      push_aps_message_template_add_part(tmpl, begin, begin, slot);
+      *lit = end + 1;
+      return;
+   }
+
+   for (open = begin; open < end; open++) {
+      if (*open != '{') {
+         continue;
+      }
+      for (close = open + 1; (close < end) && (*close != '}'); close++) {
+         /* Do nothing */
+      }
+      if ((close == end) ||
+          !push_aps_message_template_is_name(open + 1, close)) {
+         continue;
+      }
+      slot = push_aps_message_template_add_slot(tmpl, open + 1,
+                                                close - open - 1,
+                                                SLOT_STRING);
+      push_aps_message_template_add_part(tmpl, *lit, open, -1);
+      push_aps_message_template_add_part(tmpl, open, open, slot);
+      *lit = open = close + 1;
+      open--;
+   }
+}
+
+static void
+push_aps_message_template_compile (PushApsMessageTemplate *tmpl,
+                                   const gchar            *badge_slot)
+{
+   const gchar *key = NULL;
+   const gchar *lit;
+   const gchar *end;
+   const gchar *iter;
+   const gchar *str;
+   gboolean found_badge = FALSE;
+   gboolean in_aps = FALSE;
+   gsize key_len = 0;
+   guint depth = 0;
+   gint slot;
+
+   lit = iter = tmpl->text;
+   end = tmpl->text + tmpl->text_len;
+
+   while (iter < end) {
+      switch (*iter) {
+      case '"':
+         for (str = ++iter; *iter != '"'; iter++) {
+            if (*iter == '\\') {
+               iter++;
+            }
+         }
+         if (iter[1] == ':') {
+            key = str;
+            key_len = iter - str;
+         } else {
+            push_aps_message_template_scan_string(tmpl, str, iter, &lit);
+         }
+         iter++;
+         break;
+      case '{':
+      case '[':
+         depth++;
+         if ((depth == 2) && (*iter == '{') &&
+             key && (key_len == 3) && !strncmp(key, "aps", 3)) {
+            in_aps = TRUE;
+         }
+         iter++;
+         break;
+      case '}':
+      case ']':
+         if (depth == 2) {
+            in_aps = FALSE;
+         }
+         depth--;
+         iter++;
+         break;
+      case '-':
+      case '0': case '1': case '2': case '3': case '4':
+      case '5': case '6': case '7': case '8': case '9':
+         for (str = iter; (iter < end) && strchr("+-.0123456789eE", *iter); iter++) {
+            /* Do nothing */
+         }
+         if (badge_slot && in_aps && (depth == 2) &&
+             key && (key_len == 5) && !strncmp(key, "badge", 5)) {
+            slot = push_aps_message_template_add_slot(tmpl, badge_slot,
+                                                      strlen(badge_slot),
+                                                      SLOT_INTEGER);
+            push_aps_message_template_add_part(tmpl, lit, str, -1);
+            push_aps_message_template_add_part(tmpl, str, str, slot);
+            lit = iter;
+            found_badge = TRUE;
+         }
+         break;
+      default:
+         iter++;
+         break;
+      }
+   }
+
+   push_aps_message_template_add_part(tmpl, lit, end, -1);
+
+   if (badge_slot && !found_badge) {
+      g_warning("The prototype message has no badge to use as slot \"%s\".",
+                badge_slot);
+   }
+}
+
+/**
+ * push_aps_message_template_new:
+ * @prototype: (in): A #PushApsMessage.
+ * @badge_slot: (allow-none): Slot name for the badge, or %NULL.
+ *
+ * Creates a new template from the current payload, "expires-at" and
+ * "collapse-key" of @prototype. Later changes to @prototype do not affect
+ * the template. If @badge_slot is not %NULL, the badge number becomes an
+ * integer slot with that name.
+ *
+ * Returns: (transfer full): A newly allocated #PushApsMessageTemplate.
+ */
+PushApsMessageTemplate *
+push_aps_message_template_new (PushApsMessage *prototype,
+                               const gchar    *badge_slot)
+{
+   PushApsMessageTemplate *tmpl;
+   GDateTime *expires_at;
+
+   ENTRY;
+
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(prototype), NULL);
+
+   tmpl = g_slice_new0(PushApsMessageTemplate);
+   tmpl->ref_count = 1;
+   if ((expires_at = push_aps_message_get_expires_at(prototype))) {
+      tmpl->expires_at = g_date_time_ref(expires_at);
+   }
+   tmpl->collapse_key =
+      g_strdup(push_aps_message_get_collapse_key(prototype));
+   tmpl->text = g_strdup(push_aps_message_get_json(prototype));
+   tmpl->text_len = strlen(tmpl->text);
+   tmpl->slots = g_array_new(FALSE, FALSE, sizeof(PushApsTemplateSlot));
+   tmpl->parts = g_array_new(FALSE, FALSE, sizeof(PushApsTemplatePart));
+
+   push_aps_message_template_compile(tmpl, badge_slot);
+
+   RETURN(tmpl);
+}
+
+/**
+ * push_aps_message_template_render_valist:
+ * @tmpl: (in): A #PushApsMessageTemplate.
+ * @first_slot: The name of the first slot, or %NULL.
+ * @args: The value of the first slot followed by further name and value
+ *   pairs, terminated by %NULL.
+ *
+ * Renders the JSON payload of @tmpl. A name is followed by a const gchar*
+ * value, which fills the string slots of that name. A name prefixed with
+ * "#" is followed by a #gint, which fills the integer slots of that name
+ * and is formatted as decimal text for its string slots. Slots without a
+ * value render as an empty string or zero.
+ *
+ * Returns: (transfer full): A newly allocated string.
+ */
+gchar *
+push_aps_message_template_render_valist (PushApsMessageTemplate *tmpl,
+                                         const gchar            *first_slot,
+                                         va_list                 args)
+{
+   PushApsTemplateSlot *slot;
+   PushApsTemplatePart *part;
+   const gchar *string = NULL;
+   const gchar *name;
+   const gchar **strs;
+   gboolean matched;
+   gboolean is_int;
+   GString *str;
+   gchar *numbers;
+   gint *ints;
+   gint value = 0;
+   guint n_slots;
+   guint i;
+
+   g_return_val_if_fail(tmpl, NULL);
+
+   n_slots = tmpl->slots->len;
+   strs = g_newa(const gchar *, n_slots + 1);
+   ints = g_newa(gint, n_slots + 1);
+   numbers = g_newa(gchar, (n_slots + 1) * 12);
+   memset(strs, 0, sizeof(gchar *) * (n_slots + 1));
+   memset(ints, 0, sizeof(gint) * (n_slots + 1));
+
+   for (name = first_slot; name; name = va_arg(args, const gchar *)) {
+      /*
+       * The type of the value is given by the caller, never by the
+       * template, so that a template without a slot cannot make us read
+       * a vararg as the wrong type.
+       */
+      if ((is_int = (name[0] == '#'))) {
+         value = va_arg(args, gint);
+         name++;
+      } else {
+         string = va_arg(args, const gchar *);
+      }
+
+      matched = FALSE;
+      for (i = 0; i < n_slots; i++) {
+         slot = &g_array_index(tmpl->slots, PushApsTemplateSlot, i);
+         if (strcmp(slot->name, name)) {
+            continue;
+         }
+         if (slot->type == SLOT_INTEGER) {
+            if (!is_int) {
+               continue;
+            }
+            ints[i] = value;
+         } else if (is_int) {
+            g_snprintf(&numbers[i * 12], 12, "%d", value);
+            strs[i] = &numbers[i * 12];
+         } else {
+            strs[i] = string;
+         }
+         matched = TRUE;
+      }
+
+      if (!matched) {
+         g_warning("No %s slot named \"%s\" in template.",
+                   is_int ? "integer or string" : "string", name);
+      }
+   }
+
+   str = g_string_sized_new(tmpl->text_len + (n_slots * 32));
+
+   for (i = 0; i < tmpl->parts->len; i++) {
+      part = &g_array_index(tmpl->parts, PushApsTemplatePart, i);
+      if (part->slot < 0) {
+         g_string_append_len(str, tmpl->text + part->offset, part->length);
+      } else if (g_array_index(tmpl->slots, PushApsTemplateSlot,
+                               part->slot).type == SLOT_INTEGER) {
+         g_string_append_printf(str, "%d", ints[part->slot]);
+      } else {
+         push_json_append_escaped(str, strs[part->slot]);
+      }
+   }
+
+   return g_string_free(str, FALSE);
+}
+
+/**
+ * push_aps_message_template_render:
+ * @tmpl: (in): A #PushApsMessageTemplate.
+ * @first_slot: The name of the first slot, or %NULL.
+ * @...: The value of the first slot followed by further name and value
+ *   pairs, terminated by %NULL.
+ *
+ * Renders the JSON payload of @tmpl. See
+ * push_aps_message_template_render_valist() for how values are passed.
+ *
+ * Returns: (transfer full): A newly allocated string.
+ */
+gchar *
+push_aps_message_template_render (PushApsMessageTemplate *tmpl,
+                                  const gchar            *first_slot,
+                                  ...)
+{
+   va_list args;
+   gchar *ret;
+
+   g_return_val_if_fail(tmpl, NULL);
+
+   va_start(args, first_slot);
+   ret = push_aps_message_template_render_valist(tmpl, first_slot, args);
+   va_end(args);
+
+   return ret;
+}
+
+/**
+ * push_aps_message_template_render_message:
+ * @tmpl: (in): A #PushApsMessageTemplate.
+ * @first_slot: The name of the first slot, or %NULL.
+ * @...: The value of the first slot followed by further name and value
+ *   pairs, terminated by %NULL.
+ *
+ * Renders @tmpl into a new #PushApsMessage suitable for
+ * push_aps_client_deliver_async(). The message carries the rendered
+ * payload as its JSON along with the "expires-at" and "collapse-key" the
+ * prototype had when @tmpl was created. Its "alert", "badge" and "sound"
+ * properties are not set. The message is sealed, see
+ * push_aps_message_seal().
+ *
+ * Returns: (transfer full): A newly created #PushApsMessage.
+ */
+PushApsMessage *
+push_aps_message_template_render_message (PushApsMessageTemplate *tmpl,
+                                          const gchar            *first_slot,
+                                          ...)
+{
+   PushApsMessage *message;
+   va_list args;
+   gchar *json;
+
+   ENTRY;
+
+   g_return_val_if_fail(tmpl, NULL);
+
+   va_start(args, first_slot);
+   json = push_aps_message_template_render_valist(tmpl, first_slot, args);
+   va_end(args);
+
+   message = push_aps_message_new();
+   push_aps_message_set_expires_at(message, tmpl->expires_at);
+   push_aps_message_set_collapse_key(message, tmpl->collapse_key);
+   _push_aps_message_take_json(message, json);
+   push_aps_message_seal(message);
+
+   RETURN(message);
+}
+
+/**
+ * push_aps_message_template_ref:
+ * @tmpl: (in): A #PushApsMessageTemplate.
+ *
+ * Increments the reference count of @tmpl by one.
+ *
+ * Returns: (transfer full): @tmpl.
+ */
+PushApsMessageTemplate *
+push_aps_message_template_ref (PushApsMessageTemplate *tmpl)
+{
+   g_return_val_if_fail(tmpl, NULL);
+   g_return_val_if_fail(tmpl->ref_count > 0, NULL);
+
+   g_atomic_int_inc(&tmpl->ref_count);
+
+   return tmpl;
+}
+
+/**
+ * push_aps_message_template_unref:
+ * @tmpl: (in): A #PushApsMessageTemplate.
+ *
+ * Decrements the reference count of @tmpl by one. When it reaches zero,
+ * the template is freed.
+ */
+void
+push_aps_message_template_unref (PushApsMessageTemplate *tmpl)
+{
+   PushApsTemplateSlot *slot;
+   guint i;
+
+   g_return_if_fail(tmpl);
+   g_return_if_fail(tmpl->ref_count > 0);
+
+   if (g_atomic_int_dec_and_test(&tmpl->ref_count)) {
+      for (i = 0; i < tmpl->slots->len; i++) {
+         slot = &g_array_index(tmpl->slots, PushApsTemplateSlot, i);
+         g_free(slot->name);
+      }
+      g_array_unref(tmpl->slots);
+      g_array_unref(tmpl->parts);
+      g_free(tmpl->text);
+      g_free(tmpl->collapse_key);
+      if (tmpl->expires_at) {
+         g_date_time_unref(tmpl->expires_at);
+      }
+      g_slice_free(PushApsMessageTemplate, tmpl);
+   }
+}
@@ -0,0 +1,49 @@
+/* push-aps-message-template.h
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PUSH_APS_MESSAGE_TEMPLATE_H
+#define PUSH_APS_MESSAGE_TEMPLATE_H
+
+#include <glib-object.h>
+
+#include "push-aps-message.h"
+
+G_BEGIN_DECLS
+
+#define PUSH_TYPE_APS_MESSAGE_TEMPLATE (push_aps_message_template_get_type())
+
+typedef struct _PushApsMessageTemplate PushApsMessageTemplate;
+
+GType                   push_aps_message_template_get_type       (void) G_GNUC_CONST;
+PushApsMessageTemplate *push_aps_message_template_new            (PushApsMessage         *prototype,
+                                                                  const gchar            *badge_slot);
+PushApsMessageTemplate *push_aps_message_template_ref            (PushApsMessageTemplate *tmpl);
+gchar                  *push_aps_message_template_render         (PushApsMessageTemplate *tmpl,
+                                                                  const gchar            *first_slot,
+                                                                  ...) G_GNUC_NULL_TERMINATED;
+PushApsMessage         *push_aps_message_template_render_message (PushApsMessageTemplate *tmpl,
+                                                                  const gchar            *first_slot,
+                                                                  ...) G_GNUC_NULL_TERMINATED;
+gchar                  *push_aps_message_template_render_valist  (PushApsMessageTemplate *tmpl,
+                                                                  const gchar            *first_slot,
+                                                                  va_list                 args);
+void                    push_aps_message_template_unref          (PushApsMessageTemplate *tmpl);
+
+G_END_DECLS
+
+#endif /* PUSH_APS_MESSAGE_TEMPLATE_H */
@@ -17,9 +17,12 @@
  */
 
 #include <glib/gi18n.h>
+#include <string.h>
 
 #include "push-aps-message.h"
+#include "push-aps-message-private.h"
 #include "push-debug.h"
+#include "push-json.h"
 
 /**
  * SECTION:push-aps-message
@@ -51,7 +54,10 @@ struct _PushApsMessagePrivate
    gchar *alert;
    guint badge;
    gchar *sound;
-   gchar *json;
+   gchar *collapse_key;
+   GBytes *bytes;
+   guint payload_hash;
+   gboolean sealed;
 };
 
 enum
@@ -59,6 +65,7 @@ enum
    PROP_0,
    PROP_ALERT,
    PROP_BADGE,
+   PROP_COLLAPSE_KEY,
    PROP_EXPIRES_AT,
    PROP_JSON,
    PROP_SOUND,
@@ -67,6 +74,15 @@ enum
 
 static GParamSpec *gParamSpecs[LAST_PROP];
 
+/*
+ * Process-wide table of serialized payloads, shared by messages with
+ * identical content. Disabled while gInternLimit is zero.
+ */
+static GMutex      gInternMutex;
+static GHashTable *gIntern;
+static GQueue      gInternFifo = G_QUEUE_INIT;
+static guint       gInternLimit;
+
 PushApsMessage *
 push_aps_message_new (void)
 {
@@ -119,6 +135,146 @@ push_aps_message_new_from_json (JsonObject *object)
    RETURN(message);
 }
 
+static void
+push_aps_message_invalidate (PushApsMessage *message)
+{
+   if (message->priv->bytes) {
+      g_bytes_unref(message->priv->bytes);
+      message->priv->bytes = NULL;
+   }
+   message->priv->payload_hash = 0;
+}
+
+static void
+push_aps_message_intern_trim (guint limit)
+{
+   GBytes *bytes;
+
+   while (gInternFifo.length > limit) {
+      bytes = g_queue_pop_head(&gInternFifo);
+      g_hash_table_remove(gIntern, bytes);
+   }
+}
+
+/*
+ * Returns the interned copy of @bytes, taking ownership of @bytes. If
+ * interning is disabled, @bytes is returned unchanged.
+ */
+static GBytes *
+push_aps_message_intern (GBytes *bytes)
+{
+   GBytes *ret;
+
+   g_mutex_lock(&gInternMutex);
+
+   if (!gInternLimit) {
+      ret = bytes;
+   } else if ((ret = g_hash_table_lookup(gIntern, bytes))) {
+      g_bytes_ref(ret);
+      g_bytes_unref(bytes);
+   } else {
+      ret = bytes;
+      g_hash_table_insert(gIntern, g_bytes_ref(bytes), bytes);
+      g_queue_push_tail(&gInternFifo, bytes);
+      push_aps_message_intern_trim(gInternLimit);
+   }
+
+   g_mutex_unlock(&gInternMutex);
+
+   return ret;
+}
+
+/**
+ * push_aps_message_set_intern_limit:
+ * @limit: The maximum number of interned payloads, or zero.
+ *
+ * Enables a process-wide table of serialized payloads holding up to @limit
+ * entries. Messages serializing to identical content then share a single
+ * #GBytes, which makes them cheap to compare with
+ * push_aps_message_payload_equal(). The oldest entries are dropped first
+ * once the table is full. Setting @limit to zero, the default, disables
+ * and empties the table.
+ *
+ * Messages keep their payload when it is dropped from the table.
+ */
+void
+push_aps_message_set_intern_limit (guint limit)
+{
+   g_mutex_lock(&gInternMutex);
+
+   if (!gIntern) {
+      gIntern = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+                                      (GDestroyNotify)g_bytes_unref, NULL);
+   }
+
+   gInternLimit = limit;
+   push_aps_message_intern_trim(limit);
+
+   g_mutex_unlock(&gInternMutex);
+}
+
+/**
+ * push_aps_message_get_intern_limit:
+ *
+ * Retrieves the limit set with push_aps_message_set_intern_limit().
+ *
+ * Returns: The maximum number of interned payloads, or zero if disabled.
+ */
+guint
+push_aps_message_get_intern_limit (void)
+{
+   guint ret;
+
+   g_mutex_lock(&gInternMutex);
+   ret = gInternLimit;
+   g_mutex_unlock(&gInternMutex);
+
+   return ret;
+}
+
+/*
+ * Appends the "aps" dictionary and closes the payload object started in
+ * @str, then stores the result as the payload of @message.
+ */
+static void
+push_aps_message_finish_json (PushApsMessage *message,
+                              GString        *str)
+{
+   PushApsMessagePrivate *priv = message->priv;
+   gboolean first = TRUE;
+   gsize len;
+
+   g_string_append(str, "\"aps\":{");
+   if (priv->alert) {
+      g_string_append(str, "\"alert\":");
+      push_json_append_string(str, priv->alert);
+      first = FALSE;
+   }
+   if (priv->badge_set || (!priv->alert && !priv->sound)) {
+      if (!first) {
+         g_string_append_c(str, ',');
+      }
+      g_string_append_printf(str, "\"badge\":%u", priv->badge);
+      first = FALSE;
+   }
+   if (priv->sound) {
+      if (!first) {
+         g_string_append_c(str, ',');
+      }
+      g_string_append(str, "\"sound\":");
+      push_json_append_string(str, priv->sound);
+   }
+   g_string_append(str, "}}");
+
+   /*
+    * The string stays nul-terminated past the end of the bytes so it can
+    * be returned directly from push_aps_message_get_json().
+    */
+   len = str->len;
+   priv->bytes = g_bytes_new_take(g_string_free(str, FALSE), len);
+   priv->bytes = push_aps_message_intern(priv->bytes);
+}
+
 /**
  * push_aps_message_get_json:
  * @message: (in): A #PushApsMessage.
@@ -135,13 +291,9 @@ push_aps_message_get_json (PushApsMessage *message)
 {
    PushApsMessagePrivate *priv;
    GHashTableIter iter;
-   JsonGenerator *json;
-   JsonObject *obj;
-   JsonObject *aps;
-   JsonNode *root;
+   GString *str;
    gpointer key;
    gpointer value;
-   gchar *ret = NULL;
 
    ENTRY;
 
@@ -149,44 +301,301 @@ push_aps_message_get_json (PushApsMessage *message)
 
    priv = message->priv;
 
-   if (priv->json) {
-      RETURN(priv->json);
+   if (priv->bytes) {
+      RETURN(g_bytes_get_data(priv->bytes, NULL));
+   }
+
+   /*
+    * Write the payload directly rather than building a JsonNode tree and
+    * running it through JsonGenerator. Extras come first, followed by the
+    * "aps" dictionary, which is the order the generator used.
+    */
+   str = g_string_sized_new(256);
+   g_string_append_c(str, '{');
+
+   if (priv->extra) {
+      g_hash_table_iter_init(&iter, priv->extra);
+      while (g_hash_table_iter_next(&iter, &key, &value)) {
+         push_json_append_member(str, key);
+         push_json_append_node(str, value);
+         g_string_append_c(str, ',');
+      }
+   }
+
+   push_aps_message_finish_json(message, str);
+
+   RETURN(g_bytes_get_data(priv->bytes, NULL));
+}
+
+/*
+ * _push_aps_message_take_json:
+ * @message: A #PushApsMessage.
+ * @json: (transfer full): A JSON encoded payload.
+ *
+ * Replaces the cached payload of @message with @json, which was produced
+ * elsewhere (such as by #PushApsMessageTemplate). The payload is kept until
+ * a property affecting it is changed.
+ */
+void
+_push_aps_message_take_json (PushApsMessage *message,
+                             gchar          *json)
+{
+   g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
+   g_return_if_fail(json);
+
+   push_aps_message_invalidate(message);
+   message->priv->bytes = g_bytes_new_take(json, strlen(json));
+   message->priv->bytes = push_aps_message_intern(message->priv->bytes);
+}
+
+/**
+ * push_aps_message_get_payload_hash:
+ * @message: (in): A #PushApsMessage.
+ *
+ * Retrieves a hash of the serialized payload of @message, suitable for
+ * use with #GHashTable. The hash is cached until @message changes. A
+ * sealed message has its hash computed when it is sealed, so this never
+ * writes to a sealed message.
+ *
+ * Returns: The payload hash.
+ */
+guint
+push_aps_message_get_payload_hash (PushApsMessage *message)
+{
+   PushApsMessagePrivate *priv;
+
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(message), 0);
+
+   priv = message->priv;
+
+   if (!priv->payload_hash) {
+      g_assert(!priv->sealed);
+      push_aps_message_get_json(message);
+      priv->payload_hash = g_bytes_hash(priv->bytes) | 1;
+   }
+
+   return priv->payload_hash;
+}
+
+/**
+ * push_aps_message_payload_equal:
+ * @message: (in): A #PushApsMessage.
+ * @other: (in): A #PushApsMessage.
+ *
+ * Checks if @message and @other serialize to the same payload. When
+ * payload interning is enabled this is usually a pointer comparison.
+ *
+ * Returns: %TRUE if the payloads are identical.
+ */
+gboolean
+push_aps_message_payload_equal (PushApsMessage *message,
+                                PushApsMessage *other)
+{
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(message), FALSE);
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(other), FALSE);
+
+   push_aps_message_get_json(message);
+   push_aps_message_get_json(other);
+
+   if (message->priv->bytes == other->priv->bytes) {
+      return TRUE;
+   }
+
+   if (push_aps_message_get_payload_hash(message) !=
+       push_aps_message_get_payload_hash(other)) {
+      return FALSE;
+   }
+
+   return g_bytes_equal(message->priv->bytes, other->priv->bytes);
+}
+
+/**
+ * push_aps_message_get_bytes:
+ * @message: (in): A #PushApsMessage.
+ *
+ * Retrieves the JSON encoded payload as a #GBytes. Unlike
+ * push_aps_message_get_json(), the result stays valid after @message is
+ * modified or finalized, so it can be shared by every frame or record
+ * referencing the payload without copying it.
+ *
+ * Returns: (transfer full): A #GBytes which should be released with
+ *   g_bytes_unref().
+ */
+GBytes *
+push_aps_message_get_bytes (PushApsMessage *message)
+{
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(message), NULL);
+
+   push_aps_message_get_json(message);
+
+   return g_bytes_ref(message->priv->bytes);
+}
+
+/**
+ * push_aps_message_seal:
+ * @message: (in): A #PushApsMessage.
+ *
+ * Serializes @message and makes it immutable. Setting any property of a
+ * sealed message is a programming error.
+ *
+ * Since a sealed message is never modified again, it may be read and
+ * delivered from multiple threads at once.
+ */
+void
+push_aps_message_seal (PushApsMessage *message)
+{
+   g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+
+   if (!message->priv->sealed) {
+      push_aps_message_get_payload_hash(message);
+      message->priv->sealed = TRUE;
+   }
+}
+
+/**
+ * push_aps_message_is_sealed:
+ * @message: (in): A #PushApsMessage.
+ *
+ * Checks if push_aps_message_seal() has been called on @message.
+ *
+ * Returns: %TRUE if @message is immutable.
+ */
+gboolean
+push_aps_message_is_sealed (PushApsMessage *message)
+{
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(message), FALSE);
+   return message->priv->sealed;
+}
+
+/**
+ * push_aps_message_get_size:
+ * @message: (in): A #PushApsMessage.
+ *
+ * Computes the size in bytes of the JSON encoded payload, as returned by
+ * push_aps_message_get_json(), without serializing the message.
+ *
+ * Returns: The payload size in bytes.
+ */
+gsize
+push_aps_message_get_size (PushApsMessage *message)
+{
+   PushApsMessagePrivate *priv;
+   GHashTableIter iter;
+   gboolean first = TRUE;
+   gpointer key;
+   gpointer value;
+   gchar buf[16];
+   gsize ret;
+
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(message), 0);
+
+   priv = message->priv;
+
+   if (priv->bytes) {
+      return g_bytes_get_size(priv->bytes);
    }
 
-   obj = json_object_new();
-   root = json_node_new(JSON_NODE_OBJECT);
-   json_node_take_object(root, obj);
+   /*
+    * Mirror the layout written by push_aps_message_get_json().
+    */
+   ret = 1;
 
    if (priv->extra) {
       g_hash_table_iter_init(&iter, priv->extra);
       while (g_hash_table_iter_next(&iter, &key, &value)) {
-         json_object_set_member(obj, key, json_node_copy(value));
+         ret += push_json_escaped_size(key, -1) + 3;
+         ret += push_json_node_size(value) + 1;
       }
    }
 
-   aps = json_object_new();
+   ret += 7;
    if (priv->alert) {
-      json_object_set_string_member(aps, "alert", priv->alert);
+      ret += 10 + push_json_escaped_size(priv->alert, -1);
+      first = FALSE;
    }
    if (priv->badge_set || (!priv->alert && !priv->sound)) {
-      json_object_set_int_member(aps, "badge", priv->badge);
+      ret += (first ? 0 : 1) + 8;
+      ret += g_snprintf(buf, sizeof buf, "%u", priv->badge);
+      first = FALSE;
    }
    if (priv->sound) {
-      json_object_set_string_member(aps, "sound", priv->sound);
+      ret += (first ? 0 : 1) + 10;
+      ret += push_json_escaped_size(priv->sound, -1);
+   }
+   ret += 2;
+
+   return ret;
+}
+
+/**
+ * push_aps_message_truncate_alert:
+ * @message: (in): A #PushApsMessage.
+ * @max_size: The maximum payload size in bytes.
+ *
+ * Shortens the "alert" property so that the encoded payload is no larger
+ * than @max_size bytes. The alert is cut at a UTF-8 character boundary and
+ * an ellipsis is appended.
+ *
+ * If the payload already fits, @message is not modified. If it cannot fit
+ * even after dropping all but the ellipsis, @message is not modified and
+ * %FALSE is returned.
+ *
+ * Returns: %TRUE if the payload fits within @max_size.
+ */
+gboolean
+push_aps_message_truncate_alert (PushApsMessage *message,
+                                 gsize           max_size)
+{
+   static const gchar ellipsis[] = "\342\200\246";
+   PushApsMessagePrivate *priv;
+   const gchar *begin;
+   const gchar *cut;
+   const gchar *end;
+   gsize removed = 0;
+   gsize needed;
+   gsize size;
+   gchar *alert;
+
+   ENTRY;
+
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(message), FALSE);
+   g_return_val_if_fail(!message->priv->sealed, FALSE);
+
+   priv = message->priv;
+
+   if ((size = push_aps_message_get_size(message)) <= max_size) {
+      RETURN(TRUE);
    }
-   json_object_set_object_member(obj, "aps", aps);
 
-   json = json_generator_new();
-   json_generator_set_root(json, root);
-   ret = json_generator_to_data(json, NULL);
+   if (!priv->alert || !*priv->alert) {
+      RETURN(FALSE);
+   }
 
-   json_node_free(root);
-   g_object_unref(json);
+   /*
+    * Walk back from the end of the alert one character at a time until
+    * enough escaped bytes are gone to make room for the ellipsis.
+    */
+   needed = (size - max_size) + (sizeof ellipsis - 1);
+   begin = priv->alert;
+   end = cut = begin + strlen(begin);
+   while (removed < needed) {
+      if (cut == begin) {
+         RETURN(FALSE);
+      }
+      end = cut;
+      cut = g_utf8_find_prev_char(begin, cut);
+      if (!cut) {
+         RETURN(FALSE);
+      }
+      removed += push_json_escaped_size(cut, end - cut);
+   }
 
-   g_free(priv->json);
-   priv->json = ret;
+   alert = g_strdup_printf("%.*s%s", (gint)(cut - begin), begin, ellipsis);
+   push_aps_message_set_alert(message, alert);
+   g_free(alert);
 
-   RETURN(ret);
+   RETURN(TRUE);
 }
 
 /**
@@ -211,6 +620,7 @@ push_aps_message_add_extra (PushApsMessage *message,
    ENTRY;
 
    g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
    g_return_if_fail(key);
    g_return_if_fail(!g_str_equal(key, "aps"));
    g_return_if_fail(value);
@@ -225,8 +635,7 @@ push_aps_message_add_extra (PushApsMessage *message,
 
    g_hash_table_insert(priv->extra, g_strdup(key), json_node_copy(value));
 
-   g_free(priv->json);
-   priv->json = NULL;
+   push_aps_message_invalidate(message);
 
    EXIT;
 }
@@ -295,6 +704,22 @@ push_aps_message_get_badge (PushApsMessage *message)
    return message->priv->badge;
 }
 
+/**
+ * push_aps_message_get_collapse_key:
+ * @message: A #PushApsMessage.
+ *
+ * Retrieves the "collapse-key" property. See
+ * push_aps_message_set_collapse_key().
+ *
+ * Returns: A string or %NULL if not set.
+ */
+const gchar *
+push_aps_message_get_collapse_key (PushApsMessage *message)
+{
+   g_return_val_if_fail(PUSH_IS_APS_MESSAGE(message), NULL);
+   return message->priv->collapse_key;
+}
+
 /**
  * push_aps_message_get_expires_at:
  * @message: A #PushApsMessage.
@@ -340,11 +765,11 @@ push_aps_message_set_alert (PushApsMessage *message,
                             const gchar    *alert)
 {
    g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
 
    g_free(message->priv->alert);
    message->priv->alert = g_strdup(alert);
-   g_free(message->priv->json);
-   message->priv->json = NULL;
+   push_aps_message_invalidate(message);
    g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_ALERT]);
 }
 
@@ -362,14 +787,36 @@ push_aps_message_set_badge (PushApsMessage *message,
                             guint           badge)
 {
    g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
 
    message->priv->badge = badge;
    message->priv->badge_set = TRUE;
-   g_free(message->priv->json);
-   message->priv->json = NULL;
+   push_aps_message_invalidate(message);
    g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_BADGE]);
 }
 
+/**
+ * push_aps_message_set_collapse_key:
+ * @message: A #PushApsMessage.
+ * @collapse_key: (allow-none): A string or %NULL.
+ *
+ * Sets the "collapse-key" property. If a message for the same device with
+ * the same collapse key is still waiting to be written by #PushApsClient,
+ * it is replaced by this one and its delivery completes with
+ * %PUSH_APS_CLIENT_ERROR_COLLAPSED. The key is not sent to the gateway.
+ */
+void
+push_aps_message_set_collapse_key (PushApsMessage *message,
+                                   const gchar    *collapse_key)
+{
+   g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
+
+   g_free(message->priv->collapse_key);
+   message->priv->collapse_key = g_strdup(collapse_key);
+   g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_COLLAPSE_KEY]);
+}
+
 /**
  * push_aps_message_set_expires_at:
  * @message: A #PushApsMessage.
@@ -377,12 +824,17 @@ push_aps_message_set_badge (PushApsMessage *message,
  *
  * Sets the "expires-at" property, containing the time at which the message
  * should expire and further attempts to deliver should be aborted.
+ *
+ * A time in the past does not make the delivery fail. Like APNs, which
+ * attempts such a notification once without storing it, #PushApsClient
+ * still sends it.
  */
 void
 push_aps_message_set_expires_at (PushApsMessage *message,
                                  GDateTime      *expires_at)
 {
    g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
 
    if (message->priv->expires_at) {
       g_date_time_unref(message->priv->expires_at);
@@ -407,14 +859,375 @@ push_aps_message_set_sound (PushApsMessage *message,
                             const gchar    *sound)
 {
    g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
 
    g_free(message->priv->sound);
    message->priv->sound = g_strdup(sound);
-   g_free(message->priv->json);
-   message->priv->json = NULL;
+   push_aps_message_invalidate(message);
    g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_SOUND]);
 }
 
+/**
+ * push_aps_message_reset:
+ * @message: A #PushApsMessage.
+ *
+ * Clears every property of @message, including extras, so that the
+ * object can be reused for another notification.
+ *
+ * Only messages that have not been sealed may be reset, since a sealed
+ * message may be shared, for example by a pending delivery. This must
+ * also only be called once no other code still refers to @message. To
+ * reuse a message with #PushApsMessageBuilder, see
+ * push_aps_message_builder_end_into().
+ */
+void
+push_aps_message_reset (PushApsMessage *message)
+{
+   PushApsMessagePrivate *priv;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
+
+   priv = message->priv;
+
+   g_object_freeze_notify(G_OBJECT(message));
+
+   push_aps_message_invalidate(message);
+
+   if (priv->extra) {
+      g_hash_table_remove_all(priv->extra);
+   }
+
+   if (priv->alert) {
+      g_free(priv->alert);
+      priv->alert = NULL;
+      g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_ALERT]);
+   }
+
+   if (priv->badge_set) {
+      priv->badge = 0;
+      priv->badge_set = FALSE;
+      g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_BADGE]);
+   }
+
+   if (priv->sound) {
+      g_free(priv->sound);
+      priv->sound = NULL;
+      g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_SOUND]);
+   }
+
+   if (priv->collapse_key) {
+      g_free(priv->collapse_key);
+      priv->collapse_key = NULL;
+      g_object_notify_by_pspec(G_OBJECT(message),
+                               gParamSpecs[PROP_COLLAPSE_KEY]);
+   }
+
+   if (priv->expires_at) {
+      g_date_time_unref(priv->expires_at);
+      priv->expires_at = NULL;
+   }
+
+   g_object_thaw_notify(G_OBJECT(message));
+
+   EXIT;
+}
+
+/**
+ * push_aps_message_builder_init:
+ * @builder: (out caller-allocates): A #PushApsMessageBuilder.
+ *
+ * Initializes @builder, typically allocated on the stack, to build a new
+ * #PushApsMessage. Strings and #GDateTime instances passed to the builder
+ * are not copied and must remain valid until
+ * push_aps_message_builder_end() or push_aps_message_builder_clear() is
+ * called. Extras are serialized as they are added.
+ *
+ * |[
+ * PushApsMessageBuilder builder;
+ *
+ * push_aps_message_builder_init(&builder);
+ * push_aps_message_builder_set_alert(&builder, "Hello");
+ * push_aps_message_builder_set_badge(&builder, 1);
+ * message = push_aps_message_builder_end(&builder);
+ * ]|
+ */
+void
+push_aps_message_builder_init (PushApsMessageBuilder *builder)
+{
+   g_return_if_fail(builder);
+
+   memset(builder, 0, sizeof *builder);
+}
+
+/**
+ * push_aps_message_builder_clear:
+ * @builder: A #PushApsMessageBuilder.
+ *
+ * Releases any resources held by @builder and initializes it again.
+ */
+void
+push_aps_message_builder_clear (PushApsMessageBuilder *builder)
+{
+   g_return_if_fail(builder);
+
+   if (builder->extras) {
+      g_string_free(builder->extras, TRUE);
+   }
+
+   memset(builder, 0, sizeof *builder);
+}
+
+/**
+ * push_aps_message_builder_set_alert:
+ * @builder: A #PushApsMessageBuilder.
+ * @alert: (allow-none): The alert text to display.
+ *
+ * Sets the "alert" property of the message being built.
+ */
+void
+push_aps_message_builder_set_alert (PushApsMessageBuilder *builder,
+                                    const gchar           *alert)
+{
+   g_return_if_fail(builder);
+   builder->alert = alert;
+}
+
+/**
+ * push_aps_message_builder_set_badge:
+ * @builder: A #PushApsMessageBuilder.
+ * @badge: The badge number to display.
+ *
+ * Sets the "badge" property of the message being built.
+ */
+void
+push_aps_message_builder_set_badge (PushApsMessageBuilder *builder,
+                                    guint                  badge)
+{
+   g_return_if_fail(builder);
+   builder->badge = badge;
+   builder->badge_set = TRUE;
+}
+
+/**
+ * push_aps_message_builder_set_collapse_key:
+ * @builder: A #PushApsMessageBuilder.
+ * @collapse_key: (allow-none): A string or %NULL.
+ *
+ * Sets the "collapse-key" property of the message being built.
+ */
+void
+push_aps_message_builder_set_collapse_key (PushApsMessageBuilder *builder,
+                                           const gchar           *collapse_key)
+{
+   g_return_if_fail(builder);
+   builder->collapse_key = collapse_key;
+}
+
+/**
+ * push_aps_message_builder_set_expires_at:
+ * @builder: A #PushApsMessageBuilder.
+ * @expires_at: (allow-none): A #GDateTime, or %NULL.
+ *
+ * Sets the "expires-at" property of the message being built.
+ */
+void
+push_aps_message_builder_set_expires_at (PushApsMessageBuilder *builder,
+                                         GDateTime             *expires_at)
+{
+   g_return_if_fail(builder);
+   builder->expires_at = expires_at;
+}
+
+/**
+ * push_aps_message_builder_set_sound:
+ * @builder: A #PushApsMessageBuilder.
+ * @sound: (allow-none): The sound to play.
+ *
+ * Sets the "sound" property of the message being built.
+ */
+void
+push_aps_message_builder_set_sound (PushApsMessageBuilder *builder,
+                                    const gchar           *sound)
+{
+   g_return_if_fail(builder);
+   builder->sound = sound;
+}
+
+static GString *
+push_aps_message_builder_get_extras (PushApsMessageBuilder *builder)
+{
+   if (!builder->extras) {
+      builder->extras = g_string_sized_new(256);
+      g_string_append_c(builder->extras, '{');
+   }
+
+   return builder->extras;
+}
+
+/**
+ * push_aps_message_builder_add_extra:
+ * @builder: A #PushApsMessageBuilder.
+ * @key: The key to associate with @value. It MUST NOT be "aps".
+ * @value: (transfer none): A #JsonNode to send with the message.
+ *
+ * Adds an extra field to the message being built. Unlike
+ * push_aps_message_add_extra(), @value is serialized immediately and
+ * extras are written in the order they are added. Adding the same @key
+ * twice is not detected.
+ */
+void
+push_aps_message_builder_add_extra (PushApsMessageBuilder *builder,
+                                    const gchar           *key,
+                                    JsonNode              *value)
+{
+   GString *str;
+
+   g_return_if_fail(builder);
+   g_return_if_fail(key);
+   g_return_if_fail(!g_str_equal(key, "aps"));
+   g_return_if_fail(value);
+
+   str = push_aps_message_builder_get_extras(builder);
+   push_json_append_member(str, key);
+   push_json_append_node(str, value);
+   g_string_append_c(str, ',');
+}
+
+/**
+ * push_aps_message_builder_add_extra_string:
+ * @builder: A #PushApsMessageBuilder.
+ * @key: The key for @value. It MUST NOT be "aps".
+ * @value: The value for @key.
+ *
+ * Adds an extra string field to the message being built.
+ */
+void
+push_aps_message_builder_add_extra_string (PushApsMessageBuilder *builder,
+                                           const gchar           *key,
+                                           const gchar           *value)
+{
+   GString *str;
+
+   g_return_if_fail(builder);
+   g_return_if_fail(key);
+   g_return_if_fail(!g_str_equal(key, "aps"));
+
+   str = push_aps_message_builder_get_extras(builder);
+   push_json_append_member(str, key);
+   if (value) {
+      push_json_append_string(str, value);
+   } else {
+      g_string_append_len(str, "null", 4);
+   }
+   g_string_append_c(str, ',');
+}
+
+/*
+ * Replaces the contents of @message with those of @builder and clears
+ * @builder. No property notifications are emitted.
+ */
+static void
+push_aps_message_builder_fill (PushApsMessageBuilder *builder,
+                               PushApsMessage        *message)
+{
+   PushApsMessagePrivate *priv = message->priv;
+   GString *str;
+
+   push_aps_message_invalidate(message);
+
+   if (priv->extra) {
+      g_hash_table_remove_all(priv->extra);
+   }
+
+   g_free(priv->alert);
+   priv->alert = g_strdup(builder->alert);
+   priv->badge = builder->badge;
+   priv->badge_set = builder->badge_set;
+   g_free(priv->sound);
+   priv->sound = g_strdup(builder->sound);
+   g_free(priv->collapse_key);
+   priv->collapse_key = g_strdup(builder->collapse_key);
+   if (priv->expires_at) {
+      g_date_time_unref(priv->expires_at);
+      priv->expires_at = NULL;
+   }
+   if (builder->expires_at) {
+      priv->expires_at = g_date_time_ref(builder->expires_at);
+   }
+
+   str = push_aps_message_builder_get_extras(builder);
+   builder->extras = NULL;
+   push_aps_message_finish_json(message, str);
+   push_aps_message_get_payload_hash(message);
+
+   push_aps_message_builder_clear(builder);
+}
+
+/**
+ * push_aps_message_builder_end:
+ * @builder: A #PushApsMessageBuilder.
+ *
+ * Creates a sealed #PushApsMessage from the contents of @builder, then
+ * clears @builder so it can be used for another message. No property
+ * notifications are emitted and the payload is serialized only once.
+ *
+ * Extras added with the builder are part of the payload but are not
+ * available through the #PushApsMessage API.
+ *
+ * Since the message is sealed it cannot be passed to
+ * push_aps_message_reset(). Use push_aps_message_builder_end_into() to
+ * reuse a message instead.
+ *
+ * Returns: (transfer full): A newly created, sealed #PushApsMessage.
+ */
+PushApsMessage *
+push_aps_message_builder_end (PushApsMessageBuilder *builder)
+{
+   PushApsMessage *message;
+
+   ENTRY;
+
+   g_return_val_if_fail(builder, NULL);
+
+   message = g_object_new(PUSH_TYPE_APS_MESSAGE, NULL);
+   push_aps_message_builder_fill(builder, message);
+   message->priv->sealed = TRUE;
+
+   RETURN(message);
+}
+
+/**
+ * push_aps_message_builder_end_into:
+ * @builder: A #PushApsMessageBuilder.
+ * @message: (in): A #PushApsMessage that has not been sealed.
+ *
+ * Like push_aps_message_builder_end(), but replaces the contents of
+ * @message, which the caller owns, instead of creating a new message.
+ * @message is not sealed, so once no other code refers to it, for
+ * example after its delivery has completed, it may be filled again.
+ *
+ * The payload including the builder extras is kept until a property of
+ * @message is changed. Since those extras are not available through the
+ * #PushApsMessage API, they are dropped from the payload at that point.
+ */
+void
+push_aps_message_builder_end_into (PushApsMessageBuilder *builder,
+                                   PushApsMessage        *message)
+{
+   ENTRY;
+
+   g_return_if_fail(builder);
+   g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(!message->priv->sealed);
+
+   push_aps_message_builder_fill(builder, message);
+
+   EXIT;
+}
+
 static void
 push_aps_message_finalize (GObject *object)
 {
@@ -430,8 +1243,13 @@ push_aps_message_finalize (GObject *object)
    g_free(priv->sound);
    priv->sound = NULL;
 
-   g_free(priv->json);
-   priv->json = NULL;
+   g_free(priv->collapse_key);
+   priv->collapse_key = NULL;
+
+   if (priv->bytes) {
+      g_bytes_unref(priv->bytes);
+      priv->bytes = NULL;
+   }
 
    if (priv->expires_at) {
       g_date_time_unref(priv->expires_at);
@@ -463,6 +1281,9 @@ push_aps_message_get_property (GObject    *object,
    case PROP_BADGE:
       g_value_set_uint(value, push_aps_message_get_badge(message));
       break;
+   case PROP_COLLAPSE_KEY:
+      g_value_set_string(value, push_aps_message_get_collapse_key(message));
+      break;
    case PROP_JSON:
       g_value_set_string(value, push_aps_message_get_json(message));
       break;
@@ -489,6 +1310,9 @@ push_aps_message_set_property (GObject      *object,
    case PROP_BADGE:
       push_aps_message_set_badge(message, g_value_get_uint(value));
       break;
+   case PROP_COLLAPSE_KEY:
+      push_aps_message_set_collapse_key(message, g_value_get_string(value));
+      break;
    case PROP_SOUND:
       push_aps_message_set_sound(message, g_value_get_string(value));
       break;
@@ -530,6 +1354,15 @@ push_aps_message_class_init (PushApsMessageClass *klass)
    g_object_class_install_property(object_class, PROP_BADGE,
                                    gParamSpecs[PROP_BADGE]);
 
+   gParamSpecs[PROP_COLLAPSE_KEY] =
+      g_param_spec_string("collapse-key",
+                          _("Collapse Key"),
+                          _("Key used to replace queued messages to a device."),
+                          NULL,
+                          G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_COLLAPSE_KEY,
+                                   gParamSpecs[PROP_COLLAPSE_KEY]);
+
    gParamSpecs[PROP_EXPIRES_AT] =
       g_param_spec_boxed("expires-at",
                          _("Expires At"),
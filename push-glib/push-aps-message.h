@@ -35,6 +35,7 @@ G_BEGIN_DECLS
 typedef struct _PushApsMessage        PushApsMessage;
 typedef struct _PushApsMessageClass   PushApsMessageClass;
 typedef struct _PushApsMessagePrivate PushApsMessagePrivate;
+typedef struct _PushApsMessageBuilder PushApsMessageBuilder;
 
 struct _PushApsMessage
 {
@@ -49,28 +50,83 @@ struct _PushApsMessageClass
    GObjectClass parent_class;
 };
 
-void            push_aps_message_add_extra        (PushApsMessage *message,
-                                                   const gchar    *key,
-                                                   JsonNode       *value);
-void            push_aps_message_add_extra_string (PushApsMessage *message,
-                                                   const gchar    *key,
-                                                   const gchar    *value);
-GType           push_aps_message_get_type         (void) G_GNUC_CONST;
-const gchar    *push_aps_message_get_alert        (PushApsMessage *message);
-guint           push_aps_message_get_badge        (PushApsMessage *message);
-GDateTime      *push_aps_message_get_expires_at   (PushApsMessage *message);
-const gchar    *push_aps_message_get_json         (PushApsMessage *message);
-const gchar    *push_aps_message_get_sound        (PushApsMessage *message);
-PushApsMessage *push_aps_message_new              (void);
-PushApsMessage *push_aps_message_new_from_json    (JsonObject     *object);
-void            push_aps_message_set_alert        (PushApsMessage *message,
-                                                   const gchar    *alert);
-void            push_aps_message_set_badge        (PushApsMessage *message,
-                                                   guint           badge);
-void            push_aps_message_set_expires_at   (PushApsMessage *message,
-                                                   GDateTime      *expires_at);
-void            push_aps_message_set_sound        (PushApsMessage *message,
-                                                   const gchar    *sound);
+/**
+ * PushApsMessageBuilder:
+ *
+ * A stack-allocatable structure used to create #PushApsMessage instances
+ * without per-property overhead. See push_aps_message_builder_init().
+ */
+struct _PushApsMessageBuilder
+{
+   /*< private >*/
+   const gchar *alert;
+   const gchar *sound;
+   const gchar *collapse_key;
+   GDateTime   *expires_at;
+   guint        badge;
+   gboolean     badge_set;
+   GString     *extras;
+   gpointer     padding[4];
+};
+
+void            push_aps_message_add_extra                (PushApsMessage        *message,
+                                                           const gchar           *key,
+                                                           JsonNode              *value);
+void            push_aps_message_add_extra_string         (PushApsMessage        *message,
+                                                           const gchar           *key,
+                                                           const gchar           *value);
+void            push_aps_message_builder_add_extra        (PushApsMessageBuilder *builder,
+                                                           const gchar           *key,
+                                                           JsonNode              *value);
+void            push_aps_message_builder_add_extra_string (PushApsMessageBuilder *builder,
+                                                           const gchar           *key,
+                                                           const gchar           *value);
+void            push_aps_message_builder_clear            (PushApsMessageBuilder *builder);
+PushApsMessage *push_aps_message_builder_end              (PushApsMessageBuilder *builder);
+void            push_aps_message_builder_end_into         (PushApsMessageBuilder *builder,
+                                                           PushApsMessage        *message);
+void            push_aps_message_builder_init             (PushApsMessageBuilder *builder);
+void            push_aps_message_builder_set_alert        (PushApsMessageBuilder *builder,
+                                                           const gchar           *alert);
+void            push_aps_message_builder_set_badge        (PushApsMessageBuilder *builder,
+                                                           guint                  badge);
+void            push_aps_message_builder_set_collapse_key (PushApsMessageBuilder *builder,
+                                                           const gchar           *collapse_key);
+void            push_aps_message_builder_set_expires_at   (PushApsMessageBuilder *builder,
+                                                           GDateTime             *expires_at);
+void            push_aps_message_builder_set_sound        (PushApsMessageBuilder *builder,
+                                                           const gchar           *sound);
+GBytes         *push_aps_message_get_bytes                (PushApsMessage        *message);
+GType           push_aps_message_get_type                 (void) G_GNUC_CONST;
+const gchar    *push_aps_message_get_alert                (PushApsMessage        *message);
+guint           push_aps_message_get_badge                (PushApsMessage        *message);
+const gchar    *push_aps_message_get_collapse_key         (PushApsMessage        *message);
+GDateTime      *push_aps_message_get_expires_at           (PushApsMessage        *message);
+guint           push_aps_message_get_intern_limit         (void);
+const gchar    *push_aps_message_get_json                 (PushApsMessage        *message);
+guint           push_aps_message_get_payload_hash         (PushApsMessage        *message);
+gsize           push_aps_message_get_size                 (PushApsMessage        *message);
+const gchar    *push_aps_message_get_sound                (PushApsMessage        *message);
+gboolean        push_aps_message_is_sealed                (PushApsMessage        *message);
+PushApsMessage *push_aps_message_new                      (void);
+PushApsMessage *push_aps_message_new_from_json            (JsonObject            *object);
+gboolean        push_aps_message_payload_equal            (PushApsMessage        *message,
+                                                           PushApsMessage        *other);
+void            push_aps_message_reset                    (PushApsMessage        *message);
+void            push_aps_message_seal                     (PushApsMessage        *message);
+void            push_aps_message_set_alert                (PushApsMessage        *message,
+                                                           const gchar           *alert);
+void            push_aps_message_set_badge                (PushApsMessage        *message,
+                                                           guint                  badge);
+void            push_aps_message_set_collapse_key         (PushApsMessage        *message,
+                                                           const gchar           *collapse_key);
+void            push_aps_message_set_expires_at           (PushApsMessage        *message,
+                                                           GDateTime             *expires_at);
+void            push_aps_message_set_intern_limit         (guint                  limit);
+void            push_aps_message_set_sound                (PushApsMessage        *message,
+                                                           const gchar           *sound);
+gboolean        push_aps_message_truncate_alert           (PushApsMessage        *message,
+                                                           gsize                  max_size);
 
 G_END_DECLS
 
@@ -0,0 +1,1091 @@
+/* push-aps-router.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+
+#include "push-aps-router.h"
+#include "push-debug.h"
+
+/**
+ * SECTION:push-aps-router
+ * @title: PushApsRouter
+ * @short_description: Route APS notifications to per-certificate clients.
+ *
+ * #PushApsRouter manages a set of #PushApsClient instances, one per
+ * application certificate. Each certificate is registered under a route
+ * key (such as the application bundle identifier) using
+ * push_aps_router_add_route(). Notifications are then delivered with
+ * push_aps_router_deliver_async() by specifying the route key.
+ *
+ * Clients are created lazily upon the first delivery for a route and are
+ * closed after they have been idle for "idle-timeout" seconds. No more than
+ * "max-clients" clients will be open at any time. If the limit is reached,
+ * the least recently used idle client is closed to make room. If all
+ * clients are busy, the delivery waits until one becomes idle.
+ *
+ * The "identity-removed" signal of every client is forwarded along with the
+ * route key it was received on.
+ */
+
+G_DEFINE_TYPE(PushApsRouter, push_aps_router, G_TYPE_OBJECT)
+
+typedef struct
+{
+   PushApsRouter   *router;
+   gchar           *key;
+   gchar           *ssl_cert_file;
+   gchar           *ssl_key_file;
+   GTlsCertificate *tls_certificate;
+   PushApsClient   *client;
+   gulong           removed_handler;
+   guint            in_flight;
+   gint64           last_used;
+   GList            lru_link;
+} PushApsRoute;
+
+typedef struct
+{
+   PushApsRouter         *router;
+   gchar                 *key;
+   PushApsClient         *client;
+   PushApsIdentity       *identity;
+   PushApsMessage        *message;
+   PushApsClientPriority  priority;
+   GCancellable          *cancellable;
+   gulong                 cancelled_id;
+   GSimpleAsyncResult    *simple;
+} PushApsDelivery;
+
+struct _PushApsRouterPrivate
+{
+   PushApsClientMode  mode;
+   GHashTable        *routes;
+   GQueue             lru;
+   GQueue             waiting;
+   guint              idle_timeout;
+   guint              idle_handler;
+   guint              max_clients;
+};
+
+enum
+{
+   PROP_0,
+   PROP_IDLE_TIMEOUT,
+   PROP_MAX_CLIENTS,
+   PROP_MODE,
+   PROP_N_CLIENTS,
+   LAST_PROP
+};
+
+enum
+{
+   IDENTITY_REMOVED,
+   LAST_SIGNAL
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+static guint       gSignals[LAST_SIGNAL];
+
+static void push_aps_router_dispatch (PushApsRouter   *router,
+                                      PushApsDelivery *delivery);
+
+/**
+ * push_aps_router_new:
+ * @mode: The #PushApsClientMode for clients created by the router.
+ *
+ * Creates a new #PushApsRouter. Clients created by the router will connect
+ * to the production or sandbox gateway depending on @mode.
+ *
+ * Returns: (transfer full): A newly allocated #PushApsRouter.
+ */
+PushApsRouter *
+push_aps_router_new (PushApsClientMode mode)
+{
+   return g_object_new(PUSH_TYPE_APS_ROUTER,
+                       "mode", mode,
+                       NULL);
+}
+
+static void
+push_aps_route_free (gpointer data)
+{
+   PushApsRoute *route = data;
+
+   g_assert(!route->client);
+
+   g_free(route->key);
+   g_free(route->ssl_cert_file);
+   g_free(route->ssl_key_file);
+   g_clear_object(&route->tls_certificate);
+   g_slice_free(PushApsRoute, route);
+}
+
+static void
+push_aps_delivery_free (PushApsDelivery *delivery)
+{
+   g_free(delivery->key);
+   g_clear_object(&delivery->client);
+   g_object_unref(delivery->identity);
+   g_object_unref(delivery->message);
+   if (delivery->cancellable) {
+      g_cancellable_disconnect(delivery->cancellable,
+                               delivery->cancelled_id);
+      g_object_unref(delivery->cancellable);
+   }
+   g_clear_object(&delivery->simple);
+   g_object_unref(delivery->router);
+   g_slice_free(PushApsDelivery, delivery);
+}
+
+/*
+ * Completes a delivery as soon as it is cancelled while waiting for a
+ * client. It stays in the waiting queue until the router drains it.
+ */
+static void
+push_aps_delivery_cancelled_cb (GCancellable *cancellable,
+                                gpointer      user_data)
+{
+   PushApsDelivery *delivery = user_data;
+   GSimpleAsyncResult *simple;
+
+   ENTRY;
+
+   if ((simple = delivery->simple)) {
+      delivery->simple = NULL;
+      g_simple_async_result_set_error(simple,
+                                      G_IO_ERROR,
+                                      G_IO_ERROR_CANCELLED,
+                                      _("The delivery was cancelled."));
+      g_simple_async_result_complete_in_idle(simple);
+      g_object_unref(simple);
+   }
+
+   EXIT;
+}
+
+/*
+ * Stops watching the cancellable of @delivery once it leaves the waiting
+ * queue. Returns FALSE and frees @delivery if it was already cancelled.
+ */
+static gboolean
+push_aps_delivery_stop_waiting (PushApsDelivery *delivery)
+{
+   if (delivery->cancelled_id) {
+      g_cancellable_disconnect(delivery->cancellable,
+                               delivery->cancelled_id);
+      delivery->cancelled_id = 0;
+   }
+
+   if (!delivery->simple) {
+      push_aps_delivery_free(delivery);
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+static void
+push_aps_router_identity_removed_cb (PushApsClient   *client,
+                                     PushApsIdentity *identity,
+                                     PushApsRoute    *route)
+{
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+   g_assert(PUSH_IS_APS_IDENTITY(identity));
+   g_assert(route);
+   g_assert(route->client == client);
+
+   g_signal_emit(route->router, gSignals[IDENTITY_REMOVED], 0,
+                 route->key, identity);
+
+   EXIT;
+}
+
+static void
+push_aps_router_close_client (PushApsRouter *router,
+                              PushApsRoute  *route)
+{
+   PushApsRouterPrivate *priv;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_ROUTER(router));
+   g_assert(route);
+   g_assert(route->client);
+
+   priv = router->priv;
+
+   g_signal_handler_disconnect(route->client, route->removed_handler);
+   route->removed_handler = 0;
+
+   /*
+    * Deliveries still in flight hold their own reference to the client,
+    * so it will be disposed (and the connection closed) once they finish.
+    */
+   g_clear_object(&route->client);
+   g_queue_unlink(&priv->lru, &route->lru_link);
+
+   g_object_notify_by_pspec(G_OBJECT(router), gParamSpecs[PROP_N_CLIENTS]);
+
+   EXIT;
+}
+
+static gboolean
+push_aps_router_evict_one (PushApsRouter *router)
+{
+   PushApsRoute *route;
+   GList *iter;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_ROUTER(router));
+
+   /*
+    * Walk from the least recently used end looking for an idle client.
+    */
+   for (iter = router->priv->lru.tail; iter; iter = iter->prev) {
+      route = iter->data;
+      if (!route->in_flight) {
+         push_aps_router_close_client(router, route);
+         RETURN(TRUE);
+      }
+   }
+
+   RETURN(FALSE);
+}
+
+static gboolean
+push_aps_router_idle_cb (gpointer data)
+{
+   PushApsRouterPrivate *priv;
+   PushApsRouter *router = data;
+   PushApsRoute *route;
+   GList *iter;
+   GList *prev;
+   gint64 expire_before;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_ROUTER(router));
+
+   priv = router->priv;
+
+   expire_before = g_get_monotonic_time() -
+                   ((gint64)priv->idle_timeout * G_USEC_PER_SEC);
+
+   /*
+    * The LRU is ordered by last use, so we can stop at the first route
+    * that has been used recently.
+    */
+   for (iter = priv->lru.tail; iter; iter = prev) {
+      prev = iter->prev;
+      route = iter->data;
+      if (route->last_used > expire_before) {
+         break;
+      }
+      if (!route->in_flight) {
+         push_aps_router_close_client(router, route);
+      }
+   }
+
+   RETURN(TRUE);
+}
+
+static gboolean
+push_aps_router_open_client (PushApsRouter *router,
+                             PushApsRoute  *route)
+{
+   PushApsRouterPrivate *priv;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_ROUTER(router));
+   g_assert(route);
+   g_assert(!route->client);
+
+   priv = router->priv;
+
+   if ((priv->lru.length >= priv->max_clients) &&
+       !push_aps_router_evict_one(router)) {
+      RETURN(FALSE);
+   }
+
+   route->client = g_object_new(PUSH_TYPE_APS_CLIENT,
+                                "mode", priv->mode,
+                                "ssl-cert-file", route->ssl_cert_file,
+                                "ssl-key-file", route->ssl_key_file,
+                                "tls-certificate", route->tls_certificate,
+                                NULL);
+   route->removed_handler =
+      g_signal_connect(route->client,
+                       "identity-removed",
+                       G_CALLBACK(push_aps_router_identity_removed_cb),
+                       route);
+   route->last_used = g_get_monotonic_time();
+   g_queue_push_head_link(&priv->lru, &route->lru_link);
+
+   g_object_notify_by_pspec(G_OBJECT(router), gParamSpecs[PROP_N_CLIENTS]);
+
+   RETURN(TRUE);
+}
+
+static void
+push_aps_router_drain (PushApsRouter *router)
+{
+   PushApsRouterPrivate *priv;
+   PushApsDelivery *delivery;
+   PushApsRoute *route;
+   GList *iter;
+   GList *next;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_ROUTER(router));
+
+   priv = router->priv;
+
+   /*
+    * Deliveries cancelled while waiting for a client have already been
+    * completed, so they no longer hold up the ones behind them.
+    */
+   for (iter = priv->waiting.head; iter; iter = next) {
+      next = iter->next;
+      delivery = iter->data;
+      if (!delivery->simple) {
+         g_queue_delete_link(&priv->waiting, iter);
+         push_aps_delivery_free(delivery);
+      }
+   }
+
+   while ((delivery = g_queue_peek_head(&priv->waiting))) {
+      route = g_hash_table_lookup(priv->routes, delivery->key);
+      if (route && !route->client &&
+          !push_aps_router_open_client(router, route)) {
+         break;
+      }
+      g_queue_pop_head(&priv->waiting);
+      if (push_aps_delivery_stop_waiting(delivery)) {
+         push_aps_router_dispatch(router, delivery);
+      }
+   }
+
+   EXIT;
+}
+
+static void
+push_aps_router_deliver_cb (GObject      *object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+   PushApsDelivery *delivery = user_data;
+   PushApsRouter *router;
+   PushApsClient *client = (PushApsClient *)object;
+   PushApsRoute *route;
+   GError *error = NULL;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_CLIENT(client));
+   g_assert(delivery);
+
+   router = delivery->router;
+
+   if (!push_aps_client_deliver_finish(client, result, &error)) {
+      g_simple_async_result_take_error(delivery->simple, error);
+   } else {
+      g_simple_async_result_set_op_res_gboolean(delivery->simple, TRUE);
+   }
+   g_simple_async_result_complete(delivery->simple);
+
+   if (router->priv->routes &&
+       (route = g_hash_table_lookup(router->priv->routes, delivery->key)) &&
+       (route->client == client)) {
+      g_assert_cmpint(route->in_flight, >, 0);
+      route->in_flight--;
+      route->last_used = g_get_monotonic_time();
+      g_queue_unlink(&router->priv->lru, &route->lru_link);
+      g_queue_push_head_link(&router->priv->lru, &route->lru_link);
+   }
+
+   if (router->priv->routes) {
+      push_aps_router_drain(router);
+   }
+
+   push_aps_delivery_free(delivery);
+
+   EXIT;
+}
+
+static void
+push_aps_router_dispatch (PushApsRouter   *router,
+                          PushApsDelivery *delivery)
+{
+   PushApsRouterPrivate *priv;
+   PushApsRoute *route;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_APS_ROUTER(router));
+   g_assert(delivery);
+
+   priv = router->priv;
+
+   if (!(route = g_hash_table_lookup(priv->routes, delivery->key))) {
+      g_simple_async_result_set_error(delivery->simple,
+                                      PUSH_APS_ROUTER_ERROR,
+                                      PUSH_APS_ROUTER_ERROR_UNKNOWN_ROUTE,
+                                      _("No route named \"%s\"."),
+                                      delivery->key);
+      g_simple_async_result_complete_in_idle(delivery->simple);
+      push_aps_delivery_free(delivery);
+      EXIT;
+   }
+
+   if (!route->client && !push_aps_router_open_client(router, route)) {
+      g_queue_push_tail(&priv->waiting, delivery);
+      if (delivery->cancellable) {
+         delivery->cancelled_id =
+            g_cancellable_connect(delivery->cancellable,
+                                  G_CALLBACK(push_aps_delivery_cancelled_cb),
+                                  delivery,
+                                  NULL);
+      }
+      EXIT;
+   }
+
+   route->in_flight++;
+   route->last_used = g_get_monotonic_time();
+   g_queue_unlink(&priv->lru, &route->lru_link);
+   g_queue_push_head_link(&priv->lru, &route->lru_link);
+
+   delivery->client = g_object_ref(route->client);
+   push_aps_client_deliver_full_async(route->client,
+                                      delivery->identity,
+                                      delivery->message,
+                                      delivery->priority,
+                                      delivery->cancellable,
+                                      push_aps_router_deliver_cb,
+                                      delivery);
+
+   EXIT;
+}
+
+/**
+ * push_aps_router_deliver_async:
+ * @router: (in): A #PushApsRouter.
+ * @key: (in): The route key to deliver with.
+ * @identity: (in): A #PushApsIdentity.
+ * @message: (in): A #PushApsMessage.
+ * @cancellable: (allow-none): A #GCancellable, or %NULL.
+ * @callback: A #GAsyncReadyCallback to execute upon completion.
+ * @user_data: User data for @callback.
+ *
+ * Asynchronously delivers @message to @identity using the client for the
+ * route named @key. The client is created if necessary. If @cancellable
+ * is cancelled while the delivery waits for a client, it completes with
+ * %G_IO_ERROR_CANCELLED right away.
+ *
+ * @callback MUST call push_aps_router_deliver_finish() with the provided
+ * #GAsyncResult.
+ */
+void
+push_aps_router_deliver_async (PushApsRouter       *router,
+                               const gchar         *key,
+                               PushApsIdentity     *identity,
+                               PushApsMessage      *message,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+   push_aps_router_deliver_full_async(router,
+                                      key,
+                                      identity,
+                                      message,
+                                      PUSH_APS_CLIENT_PRIORITY_NORMAL,
+                                      cancellable,
+                                      callback,
+                                      user_data);
+}
+
+/**
+ * push_aps_router_deliver_full_async:
+ * @router: (in): A #PushApsRouter.
+ * @key: (in): The route key to deliver with.
+ * @identity: (in): A #PushApsIdentity.
+ * @message: (in): A #PushApsMessage.
+ * @priority: (in): A #PushApsClientPriority.
+ * @cancellable: (allow-none): A #GCancellable, or %NULL.
+ * @callback: A #GAsyncReadyCallback to execute upon completion.
+ * @user_data: User data for @callback.
+ *
+ * Like push_aps_router_deliver_async() but delivers @message in the
+ * outbound lane for @priority. See push_aps_client_deliver_full_async().
+ *
+ * @callback MUST call push_aps_router_deliver_finish() with the provided
+ * #GAsyncResult.
+ */
+void
+push_aps_router_deliver_full_async (PushApsRouter         *router,
+                                    const gchar           *key,
+                                    PushApsIdentity       *identity,
+                                    PushApsMessage        *message,
+                                    PushApsClientPriority  priority,
+                                    GCancellable          *cancellable,
+                                    GAsyncReadyCallback    callback,
+                                    gpointer               user_data)
+{
+   PushApsDelivery *delivery;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_APS_ROUTER(router));
+   g_return_if_fail(key);
+   g_return_if_fail(PUSH_IS_APS_IDENTITY(identity));
+   g_return_if_fail(PUSH_IS_APS_MESSAGE(message));
+   g_return_if_fail(priority <= PUSH_APS_CLIENT_PRIORITY_LOW);
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+   g_return_if_fail(callback);
+
+   delivery = g_slice_new0(PushApsDelivery);
+   delivery->router = g_object_ref(router);
+   delivery->key = g_strdup(key);
+   delivery->identity = g_object_ref(identity);
+   delivery->message = g_object_ref(message);
+   delivery->priority = priority;
+   delivery->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+   delivery->simple = g_simple_async_result_new(G_OBJECT(router),
+                                                callback,
+                                                user_data,
+                                                push_aps_router_deliver_async);
+
+   push_aps_router_dispatch(router, delivery);
+
+   EXIT;
+}
+
+/**
+ * push_aps_router_deliver_finish:
+ * @router: (in): A #PushApsRouter.
+ * @result: A #GAsyncResult.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to push_aps_router_deliver_async().
+ * Errors from the underlying #PushApsClient are propagated unchanged.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+push_aps_router_deliver_finish (PushApsRouter  *router,
+                                GAsyncResult   *result,
+                                GError        **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+   gboolean ret;
+
+   ENTRY;
+
+   g_return_val_if_fail(PUSH_IS_APS_ROUTER(router), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
+
+   if (!(ret = g_simple_async_result_get_op_res_gboolean(simple))) {
+      g_simple_async_result_propagate_error(simple, error);
+   }
+
+   RETURN(ret);
+}
+
+/*
+ * Removes the route named @key without failing the deliveries waiting
+ * for it, so that a replacement route can pick them up.
+ */
+static gboolean
+push_aps_router_remove_route_internal (PushApsRouter *router,
+                                       const gchar   *key)
+{
+   PushApsRoute *route;
+
+   g_assert(PUSH_IS_APS_ROUTER(router));
+   g_assert(key);
+
+   if (!(route = g_hash_table_lookup(router->priv->routes, key))) {
+      return FALSE;
+   }
+
+   if (route->client) {
+      push_aps_router_close_client(router, route);
+   }
+   g_hash_table_remove(router->priv->routes, key);
+
+   return TRUE;
+}
+
+static PushApsRoute *
+push_aps_router_add_route_internal (PushApsRouter *router,
+                                    const gchar   *key)
+{
+   PushApsRoute *route;
+
+   g_assert(PUSH_IS_APS_ROUTER(router));
+   g_assert(key);
+
+   push_aps_router_remove_route_internal(router, key);
+
+   route = g_slice_new0(PushApsRoute);
+   route->router = router;
+   route->key = g_strdup(key);
+   route->lru_link.data = route;
+   g_hash_table_insert(router->priv->routes, route->key, route);
+
+   return route;
+}
+
+/**
+ * push_aps_router_add_route:
+ * @router: (in): A #PushApsRouter.
+ * @key: (in): The route key.
+ * @ssl_cert_file: (in): Path to the TLS certificate for the route.
+ * @ssl_key_file: (in): Path to the TLS private key for the route.
+ *
+ * Registers a route named @key using the certificate found in
+ * @ssl_cert_file and @ssl_key_file. The files are not loaded until a
+ * client is needed for the route.
+ *
+ * If a route named @key already exists, it is replaced. Deliveries waiting
+ * for a client of the old route use the new one.
+ */
+void
+push_aps_router_add_route (PushApsRouter *router,
+                           const gchar   *key,
+                           const gchar   *ssl_cert_file,
+                           const gchar   *ssl_key_file)
+{
+   PushApsRoute *route;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_APS_ROUTER(router));
+   g_return_if_fail(key);
+   g_return_if_fail(ssl_cert_file);
+   g_return_if_fail(ssl_key_file);
+
+   route = push_aps_router_add_route_internal(router, key);
+   route->ssl_cert_file = g_strdup(ssl_cert_file);
+   route->ssl_key_file = g_strdup(ssl_key_file);
+   push_aps_router_drain(router);
+
+   EXIT;
+}
+
+/**
+ * push_aps_router_add_route_certificate:
+ * @router: (in): A #PushApsRouter.
+ * @key: (in): The route key.
+ * @tls_certificate: (in): A #GTlsCertificate.
+ *
+ * Registers a route named @key using the already loaded @tls_certificate.
+ *
+ * If a route named @key already exists, it is replaced.
+ */
+void
+push_aps_router_add_route_certificate (PushApsRouter   *router,
+                                       const gchar     *key,
+                                       GTlsCertificate *tls_certificate)
+{
+   PushApsRoute *route;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_APS_ROUTER(router));
+   g_return_if_fail(key);
+   g_return_if_fail(G_IS_TLS_CERTIFICATE(tls_certificate));
+
+   route = push_aps_router_add_route_internal(router, key);
+   route->tls_certificate = g_object_ref(tls_certificate);
+   push_aps_router_drain(router);
+
+   EXIT;
+}
+
+/**
+ * push_aps_router_remove_route:
+ * @router: (in): A #PushApsRouter.
+ * @key: (in): The route key.
+ *
+ * Removes the route named @key and closes its client, if any. Deliveries
+ * already submitted to the client will still complete. Deliveries waiting
+ * for a client will fail with %PUSH_APS_ROUTER_ERROR_UNKNOWN_ROUTE.
+ */
+void
+push_aps_router_remove_route (PushApsRouter *router,
+                              const gchar   *key)
+{
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_APS_ROUTER(router));
+   g_return_if_fail(key);
+
+   if (push_aps_router_remove_route_internal(router, key)) {
+      push_aps_router_drain(router);
+   }
+
+   EXIT;
+}
+
+/**
+ * push_aps_router_get_idle_timeout:
+ * @router: (in): A #PushApsRouter.
+ *
+ * Fetches the "idle-timeout" property, the number of seconds a client may
+ * be unused before it is closed.
+ *
+ * Returns: A #guint containing the timeout in seconds.
+ */
+guint
+push_aps_router_get_idle_timeout (PushApsRouter *router)
+{
+   g_return_val_if_fail(PUSH_IS_APS_ROUTER(router), 0);
+   return router->priv->idle_timeout;
+}
+
+/**
+ * push_aps_router_set_idle_timeout:
+ * @router: (in): A #PushApsRouter.
+ * @idle_timeout: The timeout in seconds.
+ *
+ * Sets the "idle-timeout" property. Clients that have not been used for
+ * @idle_timeout seconds are closed.
+ */
+void
+push_aps_router_set_idle_timeout (PushApsRouter *router,
+                                  guint          idle_timeout)
+{
+   PushApsRouterPrivate *priv;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_APS_ROUTER(router));
+   g_return_if_fail(idle_timeout > 0);
+
+   priv = router->priv;
+
+   priv->idle_timeout = idle_timeout;
+
+   /*
+    * Check for idle clients a few times per timeout period so that a
+    * client is closed reasonably close to its deadline.
+    */
+   if (priv->idle_handler) {
+      g_source_remove(priv->idle_handler);
+   }
+   priv->idle_handler =
+      g_timeout_add_seconds(CLAMP(idle_timeout / 4, 1, 60),
+                            push_aps_router_idle_cb,
+                            router);
+
+   g_object_notify_by_pspec(G_OBJECT(router), gParamSpecs[PROP_IDLE_TIMEOUT]);
+
+   EXIT;
+}
+
+/**
+ * push_aps_router_get_max_clients:
+ * @router: (in): A #PushApsRouter.
+ *
+ * Fetches the "max-clients" property, the maximum number of clients that
+ * may be connected at once.
+ *
+ * Returns: A #guint.
+ */
+guint
+push_aps_router_get_max_clients (PushApsRouter *router)
+{
+   g_return_val_if_fail(PUSH_IS_APS_ROUTER(router), 0);
+   return router->priv->max_clients;
+}
+
+/**
+ * push_aps_router_set_max_clients:
+ * @router: (in): A #PushApsRouter.
+ * @max_clients: The maximum number of open clients.
+ *
+ * Sets the "max-clients" property. If more clients are currently open,
+ * idle clients are closed until the limit is satisfied.
+ */
+void
+push_aps_router_set_max_clients (PushApsRouter *router,
+                                 guint          max_clients)
+{
+   PushApsRouterPrivate *priv;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_APS_ROUTER(router));
+   g_return_if_fail(max_clients > 0);
+
+   priv = router->priv;
+
+   priv->max_clients = max_clients;
+
+   while ((priv->lru.length > max_clients) &&
+          push_aps_router_evict_one(router)) {
+      /* Do nothing */
+   }
+
+   push_aps_router_drain(router);
+
+   g_object_notify_by_pspec(G_OBJECT(router), gParamSpecs[PROP_MAX_CLIENTS]);
+
+   EXIT;
+}
+
+/**
+ * push_aps_router_get_mode:
+ * @router: (in): A #PushApsRouter.
+ *
+ * Fetches the "mode" property used for clients created by the router.
+ *
+ * Returns: A #PushApsClientMode.
+ */
+PushApsClientMode
+push_aps_router_get_mode (PushApsRouter *router)
+{
+   g_return_val_if_fail(PUSH_IS_APS_ROUTER(router), 0);
+   return router->priv->mode;
+}
+
+static void
+push_aps_router_set_mode (PushApsRouter     *router,
+                          PushApsClientMode  mode)
+{
+   g_return_if_fail(PUSH_IS_APS_ROUTER(router));
+   g_return_if_fail((mode == PUSH_APS_CLIENT_PRODUCTION) ||
+                    (mode == PUSH_APS_CLIENT_SANDBOX));
+   router->priv->mode = mode;
+}
+
+/**
+ * push_aps_router_get_n_clients:
+ * @router: (in): A #PushApsRouter.
+ *
+ * Fetches the "n-clients" property, the number of clients currently open.
+ *
+ * Returns: A #guint.
+ */
+guint
+push_aps_router_get_n_clients (PushApsRouter *router)
+{
+   g_return_val_if_fail(PUSH_IS_APS_ROUTER(router), 0);
+   return router->priv->lru.length;
+}
+
+static void
+push_aps_router_dispose (GObject *object)
+{
+   PushApsRouterPrivate *priv;
+   PushApsDelivery *delivery;
+   PushApsRoute *route;
+   GHashTable *routes;
+
+   ENTRY;
+
+   priv = PUSH_APS_ROUTER(object)->priv;
+
+   if (priv->idle_handler) {
+      g_source_remove(priv->idle_handler);
+      priv->idle_handler = 0;
+   }
+
+   while ((route = g_queue_peek_head(&priv->lru))) {
+      push_aps_router_close_client(PUSH_APS_ROUTER(object), route);
+   }
+
+   while ((delivery = g_queue_pop_head(&priv->waiting))) {
+      if (!push_aps_delivery_stop_waiting(delivery)) {
+         continue;
+      }
+      g_simple_async_result_set_error(delivery->simple,
+                                      PUSH_APS_ROUTER_ERROR,
+                                      PUSH_APS_ROUTER_ERROR_CANCELLED,
+                                      _("Request was cancelled due to "
+                                        "shutting down."));
+      g_simple_async_result_complete_in_idle(delivery->simple);
+      push_aps_delivery_free(delivery);
+   }
+
+   if ((routes = priv->routes)) {
+      priv->routes = NULL;
+      g_hash_table_unref(routes);
+   }
+
+   G_OBJECT_CLASS(push_aps_router_parent_class)->dispose(object);
+
+   EXIT;
+}
+
+static void
+push_aps_router_get_property (GObject    *object,
+                              guint       prop_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+   PushApsRouter *router = PUSH_APS_ROUTER(object);
+
+   switch (prop_id) {
+   case PROP_IDLE_TIMEOUT:
+      g_value_set_uint(value, push_aps_router_get_idle_timeout(router));
+      break;
+   case PROP_MAX_CLIENTS:
+      g_value_set_uint(value, push_aps_router_get_max_clients(router));
+      break;
+   case PROP_MODE:
+      g_value_set_enum(value, push_aps_router_get_mode(router));
+      break;
+   case PROP_N_CLIENTS:
+      g_value_set_uint(value, push_aps_router_get_n_clients(router));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_aps_router_set_property (GObject      *object,
+                              guint         prop_id,
+                              const GValue *value,
+                              GParamSpec   *pspec)
+{
+   PushApsRouter *router = PUSH_APS_ROUTER(object);
+
+   switch (prop_id) {
+   case PROP_IDLE_TIMEOUT:
+      push_aps_router_set_idle_timeout(router, g_value_get_uint(value));
+      break;
+   case PROP_MAX_CLIENTS:
+      push_aps_router_set_max_clients(router, g_value_get_uint(value));
+      break;
+   case PROP_MODE:
+      push_aps_router_set_mode(router, g_value_get_enum(value));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_aps_router_class_init (PushApsRouterClass *klass)
+{
+   GObjectClass *object_class;
+
+   ENTRY;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->dispose = push_aps_router_dispose;
+   object_class->get_property = push_aps_router_get_property;
+   object_class->set_property = push_aps_router_set_property;
+   g_type_class_add_private(object_class, sizeof(PushApsRouterPrivate));
+
+   gParamSpecs[PROP_IDLE_TIMEOUT] =
+      g_param_spec_uint("idle-timeout",
+                        _("Idle Timeout"),
+                        _("Seconds before an unused client is closed."),
+                        1,
+                        G_MAXUINT,
+                        300,
+                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+   g_object_class_install_property(object_class, PROP_IDLE_TIMEOUT,
+                                   gParamSpecs[PROP_IDLE_TIMEOUT]);
+
+   gParamSpecs[PROP_MAX_CLIENTS] =
+      g_param_spec_uint("max-clients",
+                        _("Max Clients"),
+                        _("The maximum number of open clients."),
+                        1,
+                        G_MAXUINT,
+                        64,
+                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+   g_object_class_install_property(object_class, PROP_MAX_CLIENTS,
+                                   gParamSpecs[PROP_MAX_CLIENTS]);
+
+   gParamSpecs[PROP_MODE] =
+      g_param_spec_enum("mode",
+                        _("Mode"),
+                        _("The mode of clients created by the router."),
+                        PUSH_TYPE_APS_CLIENT_MODE,
+                        PUSH_APS_CLIENT_PRODUCTION,
+                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_MODE,
+                                   gParamSpecs[PROP_MODE]);
+
+   gParamSpecs[PROP_N_CLIENTS] =
+      g_param_spec_uint("n-clients",
+                        _("N Clients"),
+                        _("The number of currently open clients."),
+                        0,
+                        G_MAXUINT,
+                        0,
+                        G_PARAM_READABLE);
+   g_object_class_install_property(object_class, PROP_N_CLIENTS,
+                                   gParamSpecs[PROP_N_CLIENTS]);
+
+   /**
+    * PushApsRouter::identity-removed:
+    * @router: A #PushApsRouter.
+    * @key: The route key the identity was removed from.
+    * @identity: A #PushApsIdentity.
+    *
+    * Forwarded from #PushApsClient::identity-removed for the client
+    * servicing the route named @key.
+    */
+   gSignals[IDENTITY_REMOVED] =
+      g_signal_new("identity-removed",
+                   PUSH_TYPE_APS_ROUTER,
+                   G_SIGNAL_RUN_FIRST,
+                   0,
+                   NULL,
+                   NULL,
+                   g_cclosure_marshal_generic,
+                   G_TYPE_NONE,
+                   2,
+                   G_TYPE_STRING,
+                   PUSH_TYPE_APS_IDENTITY);
+
+   EXIT;
+}
+
+static void
+push_aps_router_init (PushApsRouter *router)
+{
+   ENTRY;
+   router->priv = G_TYPE_INSTANCE_GET_PRIVATE(router,
+                                              PUSH_TYPE_APS_ROUTER,
+                                              PushApsRouterPrivate);
+   router->priv->mode = PUSH_APS_CLIENT_PRODUCTION;
+   router->priv->routes = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                NULL, push_aps_route_free);
+   router->priv->max_clients = 64;
+   g_queue_init(&router->priv->lru);
+   g_queue_init(&router->priv->waiting);
+   EXIT;
+}
+
+GQuark
+push_aps_router_error_quark (void)
+{
+   return g_quark_from_static_string("push-aps-router-error-quark");
+}
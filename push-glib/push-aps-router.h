@@ -0,0 +1,104 @@
+/* push-aps-router.h
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PUSH_APS_ROUTER_H
+#define PUSH_APS_ROUTER_H
+
+#include <gio/gio.h>
+
+#include "push-aps-client.h"
+#include "push-aps-identity.h"
+#include "push-aps-message.h"
+
+G_BEGIN_DECLS
+
+#define PUSH_TYPE_APS_ROUTER            (push_aps_router_get_type())
+#define PUSH_APS_ROUTER_ERROR           (push_aps_router_error_quark())
+#define PUSH_APS_ROUTER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_APS_ROUTER, PushApsRouter))
+#define PUSH_APS_ROUTER_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_APS_ROUTER, PushApsRouter const))
+#define PUSH_APS_ROUTER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  PUSH_TYPE_APS_ROUTER, PushApsRouterClass))
+#define PUSH_IS_APS_ROUTER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PUSH_TYPE_APS_ROUTER))
+#define PUSH_IS_APS_ROUTER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  PUSH_TYPE_APS_ROUTER))
+#define PUSH_APS_ROUTER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  PUSH_TYPE_APS_ROUTER, PushApsRouterClass))
+
+typedef struct _PushApsRouter        PushApsRouter;
+typedef struct _PushApsRouterClass   PushApsRouterClass;
+typedef struct _PushApsRouterPrivate PushApsRouterPrivate;
+typedef enum   _PushApsRouterError   PushApsRouterError;
+
+enum _PushApsRouterError
+{
+   PUSH_APS_ROUTER_ERROR_UNKNOWN_ROUTE = 1,
+   PUSH_APS_ROUTER_ERROR_CANCELLED     = 2,
+};
+
+struct _PushApsRouter
+{
+   GObject parent;
+
+   /*< private >*/
+   PushApsRouterPrivate *priv;
+};
+
+struct _PushApsRouterClass
+{
+   GObjectClass parent_class;
+};
+
+void              push_aps_router_add_route             (PushApsRouter          *router,
+                                                         const gchar            *key,
+                                                         const gchar            *ssl_cert_file,
+                                                         const gchar            *ssl_key_file);
+void              push_aps_router_add_route_certificate (PushApsRouter          *router,
+                                                         const gchar            *key,
+                                                         GTlsCertificate        *tls_certificate);
+void              push_aps_router_deliver_async         (PushApsRouter          *router,
+                                                         const gchar            *key,
+                                                         PushApsIdentity        *identity,
+                                                         PushApsMessage         *message,
+                                                         GCancellable           *cancellable,
+                                                         GAsyncReadyCallback     callback,
+                                                         gpointer                user_data);
+void              push_aps_router_deliver_full_async    (PushApsRouter          *router,
+                                                         const gchar            *key,
+                                                         PushApsIdentity        *identity,
+                                                         PushApsMessage         *message,
+                                                         PushApsClientPriority   priority,
+                                                         GCancellable           *cancellable,
+                                                         GAsyncReadyCallback     callback,
+                                                         gpointer                user_data);
+gboolean          push_aps_router_deliver_finish        (PushApsRouter          *router,
+                                                         GAsyncResult           *result,
+                                                         GError                **error);
+GQuark            push_aps_router_error_quark           (void) G_GNUC_CONST;
+guint             push_aps_router_get_idle_timeout      (PushApsRouter          *router);
+guint             push_aps_router_get_max_clients       (PushApsRouter          *router);
+PushApsClientMode push_aps_router_get_mode              (PushApsRouter          *router);
+guint             push_aps_router_get_n_clients         (PushApsRouter          *router);
+GType             push_aps_router_get_type              (void) G_GNUC_CONST;
+PushApsRouter    *push_aps_router_new                   (PushApsClientMode       mode);
+void              push_aps_router_remove_route          (PushApsRouter          *router,
+                                                         const gchar            *key);
+void              push_aps_router_set_idle_timeout      (PushApsRouter          *router,
+                                                         guint                   idle_timeout);
+void              push_aps_router_set_max_clients       (PushApsRouter          *router,
+                                                         guint                   max_clients);
+
+G_END_DECLS
+
+#endif /* PUSH_APS_ROUTER_H */
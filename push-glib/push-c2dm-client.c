@@ -20,6 +20,7 @@
 
 #include "push-c2dm-client.h"
 #include "push-debug.h"
+#include "push-session.h"
 
 #define PUSH_C2DM_CLIENT_URL "https://android.apis.google.com/c2dm/send"
 
@@ -43,6 +44,11 @@
  * Authentication is currently only provided via "Google Client Login".
  * As of April 2012, this has been deprecated. OAuth2 support will be
  * added sometime in the near future.
+ *
+ * The client allows up to 32 connections to C2DM, which are closed after
+ * being idle for 60 seconds. These may be changed with the "max-conns",
+ * "max-conns-per-host" and "idle-timeout" properties of #SoupSession. Use
+ * push_c2dm_client_warm_up_async() to open connections ahead of time.
  */
 
 G_DEFINE_TYPE(PushC2dmClient, push_c2dm_client, SOUP_TYPE_SESSION_ASYNC)
@@ -295,6 +301,64 @@ push_c2dm_client_deliver_finish (PushC2dmClient  *client,
    RETURN(ret);
 }
 
+/**
+ * push_c2dm_client_warm_up_async:
+ * @client: (in): A #PushC2dmClient.
+ * @n_connections: (in): The number of connections to open.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: User data for @callback.
+ *
+ * Asynchronously opens up to @n_connections connections to C2DM so that
+ * the first deliveries after startup or a quiet period do not have to
+ * wait for TCP and TLS handshakes. The connections are kept in the pool
+ * of @client until they have been idle for the "idle-timeout" of the
+ * session. The number of connections is limited by "max-conns-per-host".
+ * Cancelling @cancellable cancels the requests that are still
+ * outstanding.
+ */
+void
+push_c2dm_client_warm_up_async (PushC2dmClient      *client,
+                                guint                n_connections,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_C2DM_CLIENT(client));
+   push_session_warm_up_async(SOUP_SESSION(client),
+                              PUSH_C2DM_CLIENT_URL,
+                              n_connections,
+                              cancellable,
+                              callback,
+                              user_data,
+                              push_c2dm_client_warm_up_async);
+   EXIT;
+}
+
+/**
+ * push_c2dm_client_warm_up_finish:
+ * @client: (in): A #PushC2dmClient.
+ * @result: A #GAsyncResult.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes a request to push_c2dm_client_warm_up_async().
+ *
+ * Returns: %TRUE if at least one connection was opened.
+ */
+gboolean
+push_c2dm_client_warm_up_finish (PushC2dmClient  *client,
+                                 GAsyncResult    *result,
+                                 GError         **error)
+{
+   gboolean ret;
+
+   ENTRY;
+   g_return_val_if_fail(PUSH_IS_C2DM_CLIENT(client), FALSE);
+   ret = push_session_warm_up_finish(SOUP_SESSION(client), result, error);
+   RETURN(ret);
+}
+
 static void
 push_c2dm_client_finalize (GObject *object)
 {
@@ -388,6 +452,7 @@ push_c2dm_client_init (PushC2dmClient *client)
    client->priv = G_TYPE_INSTANCE_GET_PRIVATE(client,
                                               PUSH_TYPE_C2DM_CLIENT,
                                               PushC2dmClientPrivate);
+   push_session_configure(SOUP_SESSION(client));
    EXIT;
 }
 
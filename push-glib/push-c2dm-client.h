@@ -78,6 +78,14 @@ gboolean push_c2dm_client_deliver_finish (PushC2dmClient       *client,
                                           GError              **error);
 GQuark   push_c2dm_client_error_quark    (void) G_GNUC_CONST;
 GType    push_c2dm_client_get_type       (void) G_GNUC_CONST;
+void     push_c2dm_client_warm_up_async  (PushC2dmClient       *client,
+                                          guint                 n_connections,
+                                          GCancellable         *cancellable,
+                                          GAsyncReadyCallback   callback,
+                                          gpointer              user_data);
+gboolean push_c2dm_client_warm_up_finish (PushC2dmClient       *client,
+                                          GAsyncResult         *result,
+                                          GError              **error);
 
 G_END_DECLS
 
@@ -0,0 +1,642 @@
+/* push-gcm-batcher.c
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glib/gi18n.h>
+
+#include "push-debug.h"
+#include "push-gcm-batcher.h"
+#include "push-gcm-message-private.h"
+
+/**
+ * SECTION:push-gcm-batcher
+ * @title: PushGcmBatcher
+ * @short_description: Merges single-recipient GCM deliveries.
+ *
+ * #PushGcmBatcher sits in front of a #PushGcmClient and accepts
+ * deliveries to a single #PushGcmIdentity. Deliveries of identical
+ * messages that are requested within #PushGcmBatcher:window milliseconds
+ * of each other are sent as a single multicast request of up to 1000
+ * registration ids. Messages are considered identical when they
+ * serialize to the same request body, even if they are different
+ * #PushGcmMessage instances.
+ *
+ * Each call to push_gcm_batcher_deliver_async() still completes on its
+ * own, with the outcome GCM reported for that identity.
+ */
+
+G_DEFINE_TYPE(PushGcmBatcher, push_gcm_batcher, G_TYPE_OBJECT)
+
+#define PUSH_GCM_BATCHER_MAX_IDS 1000
+#define DEFAULT_WINDOW           10
+
+struct _PushGcmBatcherPrivate
+{
+   PushGcmClient *client;
+   GHashTable    *batches;
+   guint          n_pending;
+   guint          window;
+};
+
+/*
+ * A call to push_gcm_batcher_deliver_async(). @simple is cleared once the
+ * caller has been completed, which happens early if @cancellable is
+ * cancelled.
+ */
+typedef struct
+{
+   GSimpleAsyncResult *simple;
+   GCancellable       *cancellable;
+   gulong              cancelled_id;
+} PushGcmBatchCaller;
+
+typedef struct
+{
+   PushGcmBatcher *batcher;
+   PushGcmMessage *message;
+   GBytes         *key;
+   GList          *identities;
+   GPtrArray      *callers;
+   guint           timeout_id;
+} PushGcmBatch;
+
+enum
+{
+   PROP_0,
+   PROP_CLIENT,
+   PROP_N_PENDING,
+   PROP_WINDOW,
+   LAST_PROP
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+
+/**
+ * push_gcm_batcher_new:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Creates a new #PushGcmBatcher delivering messages with @client.
+ *
+ * Returns: (transfer full): A newly allocated #PushGcmBatcher.
+ */
+PushGcmBatcher *
+push_gcm_batcher_new (PushGcmClient *client)
+{
+   return g_object_new(PUSH_TYPE_GCM_BATCHER,
+                       "client", client,
+                       NULL);
+}
+
+/**
+ * push_gcm_batcher_get_client:
+ * @batcher: (in): A #PushGcmBatcher.
+ *
+ * Fetches the client used to deliver batches.
+ *
+ * Returns: (transfer none): A #PushGcmClient.
+ */
+PushGcmClient *
+push_gcm_batcher_get_client (PushGcmBatcher *batcher)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_BATCHER(batcher), NULL);
+   return batcher->priv->client;
+}
+
+/**
+ * push_gcm_batcher_get_n_pending:
+ * @batcher: (in): A #PushGcmBatcher.
+ *
+ * Fetches the number of deliveries waiting for their batch to be sent.
+ *
+ * Returns: A #guint.
+ */
+guint
+push_gcm_batcher_get_n_pending (PushGcmBatcher *batcher)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_BATCHER(batcher), 0);
+   return batcher->priv->n_pending;
+}
+
+guint
+push_gcm_batcher_get_window (PushGcmBatcher *batcher)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_BATCHER(batcher), 0);
+   return batcher->priv->window;
+}
+
+/**
+ * push_gcm_batcher_set_window:
+ * @batcher: (in): A #PushGcmBatcher.
+ * @window: (in): The batching window in milliseconds.
+ *
+ * Sets how long the first delivery of a batch waits for more deliveries
+ * of the same message. A window of zero still merges deliveries that are
+ * requested during the same main loop iteration. Batches that are
+ * already waiting keep their original window.
+ */
+void
+push_gcm_batcher_set_window (PushGcmBatcher *batcher,
+                             guint           window)
+{
+   g_return_if_fail(PUSH_IS_GCM_BATCHER(batcher));
+   batcher->priv->window = window;
+   g_object_notify_by_pspec(G_OBJECT(batcher), gParamSpecs[PROP_WINDOW]);
+}
+
+static void
+push_gcm_batch_caller_free (PushGcmBatchCaller *caller)
+{
+   if (caller->cancellable) {
+      g_cancellable_disconnect(caller->cancellable, caller->cancelled_id);
+      g_object_unref(caller->cancellable);
+   }
+   if (caller->simple) {
+      g_object_unref(caller->simple);
+   }
+   g_slice_free(PushGcmBatchCaller, caller);
+}
+
+static void
+push_gcm_batch_caller_cancelled_cb (GCancellable *cancellable,
+                                    gpointer      user_data)
+{
+   PushGcmBatchCaller *caller = user_data;
+   GSimpleAsyncResult *simple;
+
+   ENTRY;
+
+   if ((simple = caller->simple)) {
+      caller->simple = NULL;
+      g_simple_async_result_set_error(simple,
+                                      G_IO_ERROR,
+                                      G_IO_ERROR_CANCELLED,
+                                      _("The delivery was cancelled."));
+      g_simple_async_result_complete_in_idle(simple);
+      g_object_unref(simple);
+   }
+
+   EXIT;
+}
+
+static PushGcmBatch *
+push_gcm_batch_new (PushGcmBatcher *batcher,
+                    PushGcmMessage *message,
+                    GBytes         *key)
+{
+   PushGcmBatch *batch;
+
+   batch = g_slice_new0(PushGcmBatch);
+   batch->batcher = g_object_ref(batcher);
+   batch->message = g_object_ref(message);
+   batch->key = g_bytes_ref(key);
+   batch->callers = g_ptr_array_new_with_free_func(
+         (GDestroyNotify)push_gcm_batch_caller_free);
+
+   return batch;
+}
+
+static void
+push_gcm_batch_free (PushGcmBatch *batch)
+{
+   g_object_unref(batch->batcher);
+   g_object_unref(batch->message);
+   g_bytes_unref(batch->key);
+   g_list_foreach(batch->identities, (GFunc)g_object_unref, NULL);
+   g_list_free(batch->identities);
+   g_ptr_array_unref(batch->callers);
+   g_slice_free(PushGcmBatch, batch);
+}
+
+/*
+ * Completes the delivery of each caller in @batch with the result GCM
+ * reported for its identity. A caller whose identity has no result of
+ * its own, because the request failed as a whole, receives @error.
+ * Callers that were cancelled have been completed already.
+ */
+static void
+push_gcm_batcher_deliver_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+   PushGcmBatchCaller *caller;
+   GSimpleAsyncResult *simple;
+   PushGcmClientError code;
+   PushGcmResult *gcm_result;
+   PushGcmBatch *batch = user_data;
+   GPtrArray *results = NULL;
+   GError *error = NULL;
+   guint i;
+
+   ENTRY;
+
+   g_assert(PUSH_IS_GCM_CLIENT(object));
+   g_assert(batch);
+
+   push_gcm_client_deliver_finish_with_results(PUSH_GCM_CLIENT(object),
+                                               result,
+                                               &results,
+                                               &error);
+
+   for (i = 0; i < batch->callers->len; i++) {
+      caller = g_ptr_array_index(batch->callers, i);
+      if (!(simple = caller->simple)) {
+         continue;
+      }
+      caller->simple = NULL;
+
+      gcm_result = (i < results->len) ? g_ptr_array_index(results, i) : NULL;
+
+      if (gcm_result) {
+         g_simple_async_result_set_op_res_gpointer(
+               simple,
+               push_gcm_result_ref(gcm_result),
+               (GDestroyNotify)push_gcm_result_unref);
+      }
+
+      code = gcm_result ? push_gcm_result_get_error(gcm_result)
+                        : PUSH_GCM_CLIENT_ERROR_REQUEST_FAILED;
+
+      if (code == PUSH_GCM_CLIENT_ERROR_REQUEST_FAILED && error) {
+         g_simple_async_result_set_from_error(simple, error);
+      } else if (code) {
+         g_simple_async_result_set_error(simple,
+                                         PUSH_GCM_CLIENT_ERROR,
+                                         code,
+                                         _("GCM failed to deliver the "
+                                           "message (error %d)."),
+                                         code);
+      }
+
+      g_simple_async_result_complete(simple);
+      g_object_unref(simple);
+   }
+
+   g_ptr_array_unref(results);
+   g_clear_error(&error);
+   push_gcm_batch_free(batch);
+
+   EXIT;
+}
+
+/*
+ * Removes @batch from the pending batches and hands its identities to
+ * the client as a single multicast delivery.
+ */
+static void
+push_gcm_batcher_send (PushGcmBatcher *batcher,
+                       PushGcmBatch   *batch)
+{
+   PushGcmBatcherPrivate *priv;
+
+   ENTRY;
+
+   priv = batcher->priv;
+
+   g_hash_table_remove(priv->batches, batch->key);
+   if (batch->timeout_id) {
+      g_source_remove(batch->timeout_id);
+      batch->timeout_id = 0;
+   }
+
+   priv->n_pending -= batch->callers->len;
+   g_object_notify_by_pspec(G_OBJECT(batcher), gParamSpecs[PROP_N_PENDING]);
+
+   batch->identities = g_list_reverse(batch->identities);
+   push_gcm_client_deliver_async(priv->client,
+                                 batch->identities,
+                                 batch->message,
+                                 NULL,
+                                 push_gcm_batcher_deliver_cb,
+                                 batch);
+
+   EXIT;
+}
+
+static gboolean
+push_gcm_batcher_timeout_cb (gpointer user_data)
+{
+   PushGcmBatch *batch = user_data;
+
+   ENTRY;
+   batch->timeout_id = 0;
+   push_gcm_batcher_send(batch->batcher, batch);
+   RETURN(FALSE);
+}
+
+/**
+ * push_gcm_batcher_deliver_async:
+ * @batcher: (in): A #PushGcmBatcher.
+ * @identity: (in): A #PushGcmIdentity.
+ * @message: (in): A #PushGcmMessage.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: User data for @callback.
+ *
+ * Asynchronously delivers @message to @identity. The delivery is held
+ * for up to #PushGcmBatcher:window milliseconds so that it may be sent
+ * together with other deliveries of the same message. Once 1000
+ * identities are waiting for a message, they are sent right away.
+ *
+ * @message must not be modified until @callback is executed. Cancelling
+ * @cancellable completes this delivery right away with
+ * %G_IO_ERROR_CANCELLED, but does not withdraw it from the multicast
+ * request.
+ */
+void
+push_gcm_batcher_deliver_async (PushGcmBatcher      *batcher,
+                                PushGcmIdentity     *identity,
+                                PushGcmMessage      *message,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+   PushGcmBatcherPrivate *priv;
+   PushGcmBatchCaller *caller;
+   GSimpleAsyncResult *simple;
+   PushGcmBatch *batch;
+   GBytes *key;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_GCM_BATCHER(batcher));
+   g_return_if_fail(PUSH_IS_GCM_IDENTITY(identity));
+   g_return_if_fail(PUSH_IS_GCM_MESSAGE(message));
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+   g_return_if_fail(callback);
+
+   priv = batcher->priv;
+
+   simple = g_simple_async_result_new(G_OBJECT(batcher), callback, user_data,
+                                      push_gcm_batcher_deliver_async);
+   g_simple_async_result_set_check_cancellable(simple, cancellable);
+
+   key = _push_gcm_message_get_bytes(message);
+   if (!(batch = g_hash_table_lookup(priv->batches, key))) {
+      batch = push_gcm_batch_new(batcher, message, key);
+      g_hash_table_insert(priv->batches, batch->key, batch);
+      batch->timeout_id = g_timeout_add(priv->window,
+                                        push_gcm_batcher_timeout_cb,
+                                        batch);
+   }
+
+   /*
+    * Identities are prepended and reversed when the batch is sent, so
+    * that they line up with batch->callers.
+    */
+   batch->identities = g_list_prepend(batch->identities,
+                                      g_object_ref(identity));
+   caller = g_slice_new0(PushGcmBatchCaller);
+   caller->simple = simple;
+   g_ptr_array_add(batch->callers, caller);
+   if (cancellable) {
+      caller->cancellable = g_object_ref(cancellable);
+      caller->cancelled_id =
+         g_cancellable_connect(cancellable,
+                               G_CALLBACK(push_gcm_batch_caller_cancelled_cb),
+                               caller,
+                               NULL);
+   }
+
+   priv->n_pending++;
+   g_object_notify_by_pspec(G_OBJECT(batcher), gParamSpecs[PROP_N_PENDING]);
+
+   if (batch->callers->len >= PUSH_GCM_BATCHER_MAX_IDS) {
+      push_gcm_batcher_send(batcher, batch);
+   }
+
+   EXIT;
+}
+
+/**
+ * push_gcm_batcher_deliver_finish:
+ * @batcher: (in): A #PushGcmBatcher.
+ * @result: A #GAsyncResult.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to push_gcm_batcher_deliver_async().
+ *
+ * Returns: %TRUE if GCM accepted the message for the identity; otherwise
+ *   %FALSE and @error is set.
+ */
+gboolean
+push_gcm_batcher_deliver_finish (PushGcmBatcher  *batcher,
+                                 GAsyncResult    *result,
+                                 GError         **error)
+{
+   gboolean ret;
+
+   ENTRY;
+   ret = push_gcm_batcher_deliver_finish_with_result(batcher, result,
+                                                     NULL, error);
+   RETURN(ret);
+}
+
+/**
+ * push_gcm_batcher_deliver_finish_with_result:
+ * @batcher: (in): A #PushGcmBatcher.
+ * @result: A #GAsyncResult.
+ * @gcm_result: (out) (allow-none): A location for a #PushGcmResult, or
+ *   %NULL.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes a request to push_gcm_batcher_deliver_async() like
+ * push_gcm_batcher_deliver_finish(), additionally providing the
+ * #PushGcmResult GCM reported for the identity. @gcm_result is set to
+ * %NULL if the delivery was cancelled before a result was known.
+ * Otherwise it should be freed with push_gcm_result_unref().
+ *
+ * Returns: %TRUE if GCM accepted the message for the identity; otherwise
+ *   %FALSE and @error is set.
+ */
+gboolean
+push_gcm_batcher_deliver_finish_with_result (PushGcmBatcher  *batcher,
+                                             GAsyncResult    *result,
+                                             PushGcmResult  **gcm_result,
+                                             GError         **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+   PushGcmResult *r;
+   gboolean ret;
+
+   ENTRY;
+
+   g_return_val_if_fail(PUSH_IS_GCM_BATCHER(batcher), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
+
+   ret = !g_simple_async_result_propagate_error(simple, error);
+
+   if (gcm_result) {
+      r = g_simple_async_result_get_op_res_gpointer(simple);
+      *gcm_result = r ? push_gcm_result_ref(r) : NULL;
+   }
+
+   RETURN(ret);
+}
+
+/**
+ * push_gcm_batcher_flush:
+ * @batcher: (in): A #PushGcmBatcher.
+ *
+ * Sends every pending batch right away instead of waiting for the end of
+ * its window.
+ */
+void
+push_gcm_batcher_flush (PushGcmBatcher *batcher)
+{
+   GHashTableIter iter;
+   PushGcmBatch *batch;
+   GList *batches = NULL;
+   GList *list;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_GCM_BATCHER(batcher));
+
+   g_hash_table_iter_init(&iter, batcher->priv->batches);
+   while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&batch)) {
+      batches = g_list_prepend(batches, batch);
+   }
+
+   for (list = batches; list; list = list->next) {
+      push_gcm_batcher_send(batcher, list->data);
+   }
+
+   g_list_free(batches);
+
+   EXIT;
+}
+
+static void
+push_gcm_batcher_finalize (GObject *object)
+{
+   PushGcmBatcherPrivate *priv;
+
+   ENTRY;
+
+   priv = PUSH_GCM_BATCHER(object)->priv;
+   g_clear_object(&priv->client);
+   g_hash_table_unref(priv->batches);
+
+   G_OBJECT_CLASS(push_gcm_batcher_parent_class)->finalize(object);
+
+   EXIT;
+}
+
+static void
+push_gcm_batcher_get_property (GObject    *object,
+                               guint       prop_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+   PushGcmBatcher *batcher = PUSH_GCM_BATCHER(object);
+
+   switch (prop_id) {
+   case PROP_CLIENT:
+      g_value_set_object(value, push_gcm_batcher_get_client(batcher));
+      break;
+   case PROP_N_PENDING:
+      g_value_set_uint(value, push_gcm_batcher_get_n_pending(batcher));
+      break;
+   case PROP_WINDOW:
+      g_value_set_uint(value, push_gcm_batcher_get_window(batcher));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_gcm_batcher_set_property (GObject      *object,
+                               guint         prop_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+   PushGcmBatcher *batcher = PUSH_GCM_BATCHER(object);
+
+   switch (prop_id) {
+   case PROP_CLIENT:
+      batcher->priv->client = g_value_dup_object(value);
+      break;
+   case PROP_WINDOW:
+      push_gcm_batcher_set_window(batcher, g_value_get_uint(value));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_gcm_batcher_class_init (PushGcmBatcherClass *klass)
+{
+   GObjectClass *object_class;
+
+   ENTRY;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->finalize = push_gcm_batcher_finalize;
+   object_class->get_property = push_gcm_batcher_get_property;
+   object_class->set_property = push_gcm_batcher_set_property;
+   g_type_class_add_private(object_class, sizeof(PushGcmBatcherPrivate));
+
+   gParamSpecs[PROP_CLIENT] =
+      g_param_spec_object("client",
+                          _("Client"),
+                          _("The client used to deliver batches."),
+                          PUSH_TYPE_GCM_CLIENT,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_CLIENT,
+                                   gParamSpecs[PROP_CLIENT]);
+
+   gParamSpecs[PROP_N_PENDING] =
+      g_param_spec_uint("n-pending",
+                        _("N Pending"),
+                        _("The number of deliveries waiting to be sent."),
+                        0,
+                        G_MAXUINT,
+                        0,
+                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_N_PENDING,
+                                   gParamSpecs[PROP_N_PENDING]);
+
+   gParamSpecs[PROP_WINDOW] =
+      g_param_spec_uint("window",
+                        _("Window"),
+                        _("The batching window in milliseconds."),
+                        0,
+                        G_MAXUINT,
+                        DEFAULT_WINDOW,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_WINDOW,
+                                   gParamSpecs[PROP_WINDOW]);
+
+   EXIT;
+}
+
+static void
+push_gcm_batcher_init (PushGcmBatcher *batcher)
+{
+   ENTRY;
+   batcher->priv = G_TYPE_INSTANCE_GET_PRIVATE(batcher,
+                                               PUSH_TYPE_GCM_BATCHER,
+                                               PushGcmBatcherPrivate);
+   batcher->priv->window = DEFAULT_WINDOW;
+   batcher->priv->batches = g_hash_table_new(g_bytes_hash, g_bytes_equal);
+   EXIT;
+}
@@ -0,0 +1,81 @@
+/* push-gcm-batcher.h
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PUSH_GCM_BATCHER_H
+#define PUSH_GCM_BATCHER_H
+
+#include <gio/gio.h>
+
+#include "push-gcm-client.h"
+#include "push-gcm-identity.h"
+#include "push-gcm-message.h"
+#include "push-gcm-result.h"
+
+G_BEGIN_DECLS
+
+#define PUSH_TYPE_GCM_BATCHER            (push_gcm_batcher_get_type())
+#define PUSH_GCM_BATCHER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_GCM_BATCHER, PushGcmBatcher))
+#define PUSH_GCM_BATCHER_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_GCM_BATCHER, PushGcmBatcher const))
+#define PUSH_GCM_BATCHER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  PUSH_TYPE_GCM_BATCHER, PushGcmBatcherClass))
+#define PUSH_IS_GCM_BATCHER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PUSH_TYPE_GCM_BATCHER))
+#define PUSH_IS_GCM_BATCHER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  PUSH_TYPE_GCM_BATCHER))
+#define PUSH_GCM_BATCHER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  PUSH_TYPE_GCM_BATCHER, PushGcmBatcherClass))
+
+typedef struct _PushGcmBatcher        PushGcmBatcher;
+typedef struct _PushGcmBatcherClass   PushGcmBatcherClass;
+typedef struct _PushGcmBatcherPrivate PushGcmBatcherPrivate;
+
+struct _PushGcmBatcher
+{
+   GObject parent;
+
+   /*< private >*/
+   PushGcmBatcherPrivate *priv;
+};
+
+struct _PushGcmBatcherClass
+{
+   GObjectClass parent_class;
+};
+
+void            push_gcm_batcher_deliver_async              (PushGcmBatcher       *batcher,
+                                                             PushGcmIdentity      *identity,
+                                                             PushGcmMessage       *message,
+                                                             GCancellable         *cancellable,
+                                                             GAsyncReadyCallback   callback,
+                                                             gpointer              user_data);
+gboolean        push_gcm_batcher_deliver_finish             (PushGcmBatcher       *batcher,
+                                                             GAsyncResult         *result,
+                                                             GError              **error);
+gboolean        push_gcm_batcher_deliver_finish_with_result (PushGcmBatcher       *batcher,
+                                                             GAsyncResult         *result,
+                                                             PushGcmResult       **gcm_result,
+                                                             GError              **error);
+void            push_gcm_batcher_flush                      (PushGcmBatcher       *batcher);
+PushGcmClient  *push_gcm_batcher_get_client                 (PushGcmBatcher       *batcher);
+guint           push_gcm_batcher_get_n_pending              (PushGcmBatcher       *batcher);
+GType           push_gcm_batcher_get_type                   (void) G_GNUC_CONST;
+guint           push_gcm_batcher_get_window                 (PushGcmBatcher       *batcher);
+PushGcmBatcher *push_gcm_batcher_new                        (PushGcmClient        *client);
+void            push_gcm_batcher_set_window                 (PushGcmBatcher       *batcher,
+                                                             guint                 window);
+
+G_END_DECLS
+
+#endif /* PUSH_GCM_BATCHER_H */
@@ -0,0 +1,1844 @@
+/* push-gcm-ccs-client.c
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glib/gi18n.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+
+#include "push-debug.h"
+#include "push-gcm-ccs-client.h"
+#include "push-gcm-message-private.h"
+#include "push-gcm-result-private.h"
+#include "push-json.h"
+
+#define PUSH_GCM_CCS_CLIENT_DOMAIN          "gcm.googleapis.com"
+#define PUSH_GCM_CCS_CLIENT_HOST            "gcm.googleapis.com"
+#define PUSH_GCM_CCS_CLIENT_PORT            5235
+#define PUSH_GCM_CCS_CLIENT_MAX_CONNECTIONS 2
+#define PUSH_GCM_CCS_CLIENT_MAX_UNACKED     100
+#define PUSH_GCM_CCS_CLIENT_MAX_RETRIES     3
+#define PUSH_GCM_CCS_CLIENT_BACKOFF_MIN     1000
+#define PUSH_GCM_CCS_CLIENT_BACKOFF_MAX     60000
+#define PUSH_GCM_CCS_CLIENT_CONNECT_TIMEOUT 60
+#define PUSH_GCM_CCS_CLIENT_READ_SIZE       4096
+
+/**
+ * SECTION:push-gcm-ccs-client
+ * @title: PushGcmCcsClient
+ * @short_description: Client to send notifications to GCM over XMPP.
+ *
+ * #PushGcmCcsClient delivers messages to Android devices using the GCM
+ * Cloud Connection Server (CCS). Instead of one HTTP request per message,
+ * the client keeps persistent XMPP connections to GCM and sends messages
+ * over them as they are requested.
+ *
+ * Each connection may have up to 100 messages that GCM has not yet
+ * acknowledged. Further messages wait in a queue until an ack or nack
+ * arrives, or until another connection is opened. Up to
+ * #PushGcmCcsClient:max-connections connections are opened as needed.
+ *
+ * The callback of push_gcm_ccs_client_deliver_async() is executed once GCM
+ * acknowledges the message. Messages that GCM reports as temporarily
+ * unavailable, or that were unacknowledged when a connection was lost,
+ * are sent again up to three times.
+ *
+ * Every message requests a delivery receipt. When GCM reports that the
+ * message reached the device, the #PushGcmCcsClient::delivery-receipt
+ * signal is emitted. Messages sent by devices are reported with the
+ * #PushGcmCcsClient::message-received signal.
+ */
+
+G_DEFINE_TYPE(PushGcmCcsClient, push_gcm_ccs_client, G_TYPE_OBJECT)
+
+struct _PushGcmCcsClientPrivate
+{
+   gchar     *api_key;
+   gchar     *host;
+   gchar     *sender_id;
+   guint      port;
+   gboolean   tls;
+   guint      max_connections;
+   GPtrArray *connections;
+   GQueue    *queue;
+   guint32    id_prefix;
+   guint64    id_sequence;
+};
+
+typedef enum
+{
+   PUSH_GCM_CCS_STATE_CONNECTING,
+   PUSH_GCM_CCS_STATE_AUTHENTICATING,
+   PUSH_GCM_CCS_STATE_BINDING,
+   PUSH_GCM_CCS_STATE_READY,
+   PUSH_GCM_CCS_STATE_DRAINING,
+   PUSH_GCM_CCS_STATE_CLOSED,
+} PushGcmCcsState;
+
+/*
+ * A single XMPP connection to CCS. Pending reads, writes, the connection
+ * attempt and the connect timeout each hold a reference. @client is
+ * cleared when the connection is closed, after which callbacks only drop
+ * their reference.
+ */
+typedef struct
+{
+   volatile gint         ref_count;
+   PushGcmCcsClient     *client;
+   PushGcmCcsState       state;
+   GIOStream            *stream;
+   GCancellable         *cancellable;
+   guint                 timeout_id;
+   GMarkupParseContext  *context;
+   JsonParser           *parser;
+   GHashTable           *unacked;
+   GString              *out;
+   GString              *flushing;
+   GString              *text;
+   guint                 depth;
+   gchar                *stanza;
+   gchar                *stanza_type;
+   gchar                *stanza_id;
+   gchar                *stanza_from;
+   gboolean              in_gcm;
+   gboolean              in_mechanism;
+   gboolean              has_plain;
+   gboolean              has_bind;
+   gboolean              has_ping;
+   gboolean              restart;
+   guint8                buffer[PUSH_GCM_CCS_CLIENT_READ_SIZE];
+} PushGcmCcsConnection;
+
+/*
+ * A message waiting to be sent or acknowledged. @bytes holds the
+ * serialized message at the time of the call to
+ * push_gcm_ccs_client_deliver_async().
+ */
+typedef struct
+{
+   PushGcmCcsClient   *client;
+   GSimpleAsyncResult *simple;
+   PushGcmIdentity    *identity;
+   GBytes             *bytes;
+   GCancellable       *cancellable;
+   gchar              *message_id;
+   guint               attempt;
+} PushGcmCcsPending;
+
+enum
+{
+   PROP_0,
+   PROP_API_KEY,
+   PROP_HOST,
+   PROP_MAX_CONNECTIONS,
+   PROP_N_CONNECTIONS,
+   PROP_PORT,
+   PROP_QUEUE_DEPTH,
+   PROP_SENDER_ID,
+   PROP_TLS,
+   LAST_PROP
+};
+
+enum
+{
+   DELIVERY_RECEIPT,
+   IDENTITY_CHANGED,
+   IDENTITY_REMOVED,
+   MESSAGE_RECEIVED,
+   LAST_SIGNAL
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+static guint       gSignals[LAST_SIGNAL];
+
+static void push_gcm_ccs_client_dispatch (PushGcmCcsClient *client);
+
+/**
+ * push_gcm_ccs_client_new:
+ * @sender_id: (in): The GCM sender id (project number).
+ * @api_key: (in): The API key of the sender.
+ *
+ * Creates a new #PushGcmCcsClient authenticating as @sender_id.
+ *
+ * Returns: (transfer full): A newly allocated #PushGcmCcsClient.
+ */
+PushGcmCcsClient *
+push_gcm_ccs_client_new (const gchar *sender_id,
+                         const gchar *api_key)
+{
+   return g_object_new(PUSH_TYPE_GCM_CCS_CLIENT,
+                       "api-key", api_key,
+                       "sender-id", sender_id,
+                       NULL);
+}
+
+const gchar *
+push_gcm_ccs_client_get_api_key (PushGcmCcsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), NULL);
+   return client->priv->api_key;
+}
+
+const gchar *
+push_gcm_ccs_client_get_host (PushGcmCcsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), NULL);
+   return client->priv->host;
+}
+
+guint
+push_gcm_ccs_client_get_port (PushGcmCcsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), 0);
+   return client->priv->port;
+}
+
+const gchar *
+push_gcm_ccs_client_get_sender_id (PushGcmCcsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), NULL);
+   return client->priv->sender_id;
+}
+
+/**
+ * push_gcm_ccs_client_get_tls:
+ * @client: (in): A #PushGcmCcsClient.
+ *
+ * Fetches the "tls" property, whether connections to the server are
+ * encrypted and its certificate verified. It is only meant to be disabled
+ * to connect to a local stand-in for CCS, such as the push-ccs-server
+ * tool.
+ *
+ * Returns: %TRUE if TLS is used.
+ */
+gboolean
+push_gcm_ccs_client_get_tls (PushGcmCcsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), FALSE);
+   return client->priv->tls;
+}
+
+/**
+ * push_gcm_ccs_client_get_max_connections:
+ * @client: (in): A #PushGcmCcsClient.
+ *
+ * Fetches the "max-connections" property.
+ *
+ * Returns: The maximum number of connections to CCS.
+ */
+guint
+push_gcm_ccs_client_get_max_connections (PushGcmCcsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), 0);
+   return client->priv->max_connections;
+}
+
+/**
+ * push_gcm_ccs_client_set_max_connections:
+ * @client: (in): A #PushGcmCcsClient.
+ * @max_connections: (in): The maximum number of connections.
+ *
+ * Sets the number of connections the client may open to CCS. Lowering
+ * the limit does not close connections that are already open.
+ */
+void
+push_gcm_ccs_client_set_max_connections (PushGcmCcsClient *client,
+                                         guint             max_connections)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_GCM_CCS_CLIENT(client));
+   g_return_if_fail(max_connections > 0);
+   client->priv->max_connections = max_connections;
+   g_object_notify_by_pspec(G_OBJECT(client),
+                            gParamSpecs[PROP_MAX_CONNECTIONS]);
+   push_gcm_ccs_client_dispatch(client);
+   EXIT;
+}
+
+/**
+ * push_gcm_ccs_client_get_n_connections:
+ * @client: (in): A #PushGcmCcsClient.
+ *
+ * Fetches the number of connections that are open or being opened.
+ *
+ * Returns: A #guint.
+ */
+guint
+push_gcm_ccs_client_get_n_connections (PushGcmCcsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), 0);
+   return client->priv->connections->len;
+}
+
+/**
+ * push_gcm_ccs_client_get_queue_depth:
+ * @client: (in): A #PushGcmCcsClient.
+ *
+ * Fetches the number of messages waiting for a connection to send them
+ * on. Messages that were sent but not yet acknowledged are not counted.
+ *
+ * Returns: A #guint.
+ */
+guint
+push_gcm_ccs_client_get_queue_depth (PushGcmCcsClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), 0);
+   return g_queue_get_length(client->priv->queue);
+}
+
+static void
+push_gcm_ccs_pending_free (PushGcmCcsPending *pending)
+{
+   g_object_unref(pending->client);
+   g_object_unref(pending->simple);
+   g_object_unref(pending->identity);
+   g_bytes_unref(pending->bytes);
+   if (pending->cancellable) {
+      g_object_unref(pending->cancellable);
+   }
+   g_free(pending->message_id);
+   g_slice_free(PushGcmCcsPending, pending);
+}
+
+/*
+ * Completes the delivery of @pending with @result, which is consumed, and
+ * @error if the delivery failed.
+ */
+static void
+push_gcm_ccs_pending_complete (PushGcmCcsPending *pending,
+                               PushGcmResult     *result,
+                               const GError      *error)
+{
+   ENTRY;
+
+   if (result) {
+      g_simple_async_result_set_op_res_gpointer(
+            pending->simple,
+            result,
+            (GDestroyNotify)push_gcm_result_unref);
+   }
+
+   if (error) {
+      g_simple_async_result_set_from_error(pending->simple, error);
+   }
+
+   g_simple_async_result_complete_in_idle(pending->simple);
+   push_gcm_ccs_pending_free(pending);
+
+   EXIT;
+}
+
+static guint
+push_gcm_ccs_client_get_backoff (guint attempt)
+{
+   guint delay;
+
+   delay = PUSH_GCM_CCS_CLIENT_BACKOFF_MIN << MIN(attempt, 16);
+   delay = MIN(delay, PUSH_GCM_CCS_CLIENT_BACKOFF_MAX);
+
+   return g_random_int_range(delay / 2, delay + 1);
+}
+
+static gboolean
+push_gcm_ccs_client_retry_cb (gpointer user_data)
+{
+   PushGcmCcsPending *pending = user_data;
+   PushGcmCcsClient *client = pending->client;
+
+   ENTRY;
+
+   g_queue_push_head(client->priv->queue, pending);
+   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_QUEUE_DEPTH]);
+   push_gcm_ccs_client_dispatch(client);
+
+   RETURN(FALSE);
+}
+
+static PushGcmCcsConnection *
+push_gcm_ccs_connection_ref (PushGcmCcsConnection *conn)
+{
+   g_atomic_int_inc(&conn->ref_count);
+   return conn;
+}
+
+static void
+push_gcm_ccs_connection_unref (PushGcmCcsConnection *conn)
+{
+   if (g_atomic_int_dec_and_test(&conn->ref_count)) {
+      g_clear_object(&conn->stream);
+      g_object_unref(conn->cancellable);
+      if (conn->context) {
+         g_markup_parse_context_free(conn->context);
+      }
+      g_object_unref(conn->parser);
+      g_hash_table_unref(conn->unacked);
+      g_string_free(conn->out, TRUE);
+      g_string_free(conn->flushing, TRUE);
+      g_string_free(conn->text, TRUE);
+      g_free(conn->stanza);
+      g_free(conn->stanza_type);
+      g_free(conn->stanza_id);
+      g_free(conn->stanza_from);
+      g_slice_free(PushGcmCcsConnection, conn);
+   }
+}
+
+static PushGcmCcsConnection *
+push_gcm_ccs_connection_new (PushGcmCcsClient *client)
+{
+   PushGcmCcsConnection *conn;
+
+   conn = g_slice_new0(PushGcmCcsConnection);
+   conn->ref_count = 1;
+   conn->client = client;
+   conn->state = PUSH_GCM_CCS_STATE_CONNECTING;
+   conn->cancellable = g_cancellable_new();
+   conn->parser = json_parser_new();
+   conn->unacked = g_hash_table_new(g_str_hash, g_str_equal);
+   conn->out = g_string_new(NULL);
+   conn->flushing = g_string_new(NULL);
+   conn->text = g_string_new(NULL);
+
+   return conn;
+}
+
+/*
+ * Removes @conn from its client and cancels its pending operations.
+ * Messages that were not acknowledged are queued again, unless @error is
+ * set and they have been sent too often already. If the connection could
+ * not be established and no other connection is ready, the queued
+ * messages fail with @error instead of reconnecting over and over.
+ */
+static void
+push_gcm_ccs_connection_close (PushGcmCcsConnection *conn,
+                               const GError         *error)
+{
+   PushGcmCcsClientPrivate *priv;
+   PushGcmCcsConnection *other;
+   PushGcmCcsPending *pending;
+   PushGcmCcsClient *client;
+   GHashTableIter iter;
+   gboolean was_ready;
+   gboolean any_ready = FALSE;
+   guint i;
+
+   ENTRY;
+
+   if (!(client = conn->client)) {
+      EXIT;
+   }
+
+   g_object_ref(client);
+   priv = client->priv;
+
+   was_ready = (conn->state >= PUSH_GCM_CCS_STATE_READY);
+   conn->client = NULL;
+   conn->state = PUSH_GCM_CCS_STATE_CLOSED;
+   g_cancellable_cancel(conn->cancellable);
+
+   if (conn->timeout_id) {
+      g_source_remove(conn->timeout_id);
+      conn->timeout_id = 0;
+   }
+
+   g_hash_table_iter_init(&iter, conn->unacked);
+   while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&pending)) {
+      if (error && (pending->attempt >= PUSH_GCM_CCS_CLIENT_MAX_RETRIES)) {
+         push_gcm_ccs_pending_complete(pending, NULL, error);
+      } else {
+         pending->attempt += !!error;
+         g_queue_push_head(priv->queue, pending);
+      }
+   }
+   g_hash_table_remove_all(conn->unacked);
+
+   g_ptr_array_remove(priv->connections, conn);
+   g_object_notify_by_pspec(G_OBJECT(client),
+                            gParamSpecs[PROP_N_CONNECTIONS]);
+
+   if (!was_ready && error) {
+      for (i = 0; i < priv->connections->len; i++) {
+         other = g_ptr_array_index(priv->connections, i);
+         any_ready |= (other->state == PUSH_GCM_CCS_STATE_READY);
+      }
+      if (!any_ready) {
+         while ((pending = g_queue_pop_head(priv->queue))) {
+            push_gcm_ccs_pending_complete(pending, NULL, error);
+         }
+      }
+   }
+
+   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_QUEUE_DEPTH]);
+
+   if (was_ready) {
+      push_gcm_ccs_client_dispatch(client);
+   }
+
+   g_object_unref(client);
+
+   EXIT;
+}
+
+static void push_gcm_ccs_connection_write (PushGcmCcsConnection *conn);
+
+static void
+push_gcm_ccs_connection_write_cb (GObject      *object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
+{
+   PushGcmCcsConnection *conn = user_data;
+   GError *error = NULL;
+   GString *tmp;
+   gssize n;
+
+   ENTRY;
+
+   n = g_output_stream_write_finish(G_OUTPUT_STREAM(object), result, &error);
+
+   if (!conn->client) {
+      GOTO(cleanup);
+   }
+
+   if (n < 0) {
+      push_gcm_ccs_connection_close(conn, error);
+      GOTO(cleanup);
+   }
+
+   g_string_erase(conn->flushing, 0, n);
+
+   /*
+    * Stanzas added while writing were appended to conn->out, so swap the
+    * buffers once the current one has been written.
+    */
+   if (!conn->flushing->len) {
+      tmp = conn->flushing;
+      conn->flushing = conn->out;
+      conn->out = tmp;
+   }
+
+   if (conn->flushing->len) {
+      push_gcm_ccs_connection_write(conn);
+   }
+
+cleanup:
+   g_clear_error(&error);
+   push_gcm_ccs_connection_unref(conn);
+
+   EXIT;
+}
+
+static void
+push_gcm_ccs_connection_write (PushGcmCcsConnection *conn)
+{
+   GOutputStream *output;
+
+   output = g_io_stream_get_output_stream(conn->stream);
+   g_output_stream_write_async(output,
+                               conn->flushing->str,
+                               conn->flushing->len,
+                               G_PRIORITY_DEFAULT,
+                               conn->cancellable,
+                               push_gcm_ccs_connection_write_cb,
+                               push_gcm_ccs_connection_ref(conn));
+}
+
+/*
+ * Starts writing the contents of conn->out unless a write is already in
+ * progress, in which case they are written once it completes.
+ */
+static void
+push_gcm_ccs_connection_flush (PushGcmCcsConnection *conn)
+{
+   GString *tmp;
+
+   if (!conn->flushing->len && conn->out->len) {
+      tmp = conn->flushing;
+      conn->flushing = conn->out;
+      conn->out = tmp;
+      push_gcm_ccs_connection_write(conn);
+   }
+}
+
+/*
+ * Authenticates with SASL PLAIN using the sender id and API key.
+ */
+static void
+push_gcm_ccs_connection_authenticate (PushGcmCcsConnection *conn)
+{
+   PushGcmCcsClientPrivate *priv;
+   GString *plain;
+   gchar *encoded;
+
+   priv = conn->client->priv;
+
+   plain = g_string_new(NULL);
+   g_string_append_c(plain, '\0');
+   g_string_append_printf(plain, "%s@%s",
+                          priv->sender_id,
+                          PUSH_GCM_CCS_CLIENT_DOMAIN);
+   g_string_append_c(plain, '\0');
+   g_string_append(plain, priv->api_key);
+   encoded = g_base64_encode((guchar *)plain->str, plain->len);
+
+   g_string_append_printf(conn->out,
+                          "<auth mechanism=\"PLAIN\" "
+                          "xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\">"
+                          "%s</auth>",
+                          encoded);
+   push_gcm_ccs_connection_flush(conn);
+
+   g_free(encoded);
+   g_string_free(plain, TRUE);
+}
+
+/*
+ * Sends the JSON document @json wrapped in a GCM message stanza.
+ */
+static void
+push_gcm_ccs_connection_write_gcm (PushGcmCcsConnection *conn,
+                                   GString              *json)
+{
+   gchar *escaped;
+
+   escaped = g_markup_escape_text(json->str, json->len);
+   g_string_append(conn->out,
+                   "<message id=\"\">"
+                   "<gcm xmlns=\"google:mobile:data\">");
+   g_string_append(conn->out, escaped);
+   g_string_append(conn->out, "</gcm></message>");
+   push_gcm_ccs_connection_flush(conn);
+   g_free(escaped);
+}
+
+/*
+ * Acknowledges a message sent to us by @to. CCS expects an ack for every
+ * upstream message and delivery receipt.
+ */
+static void
+push_gcm_ccs_connection_send_ack (PushGcmCcsConnection *conn,
+                                  const gchar          *to,
+                                  const gchar          *message_id)
+{
+   GString *json;
+
+   json = g_string_new("{");
+   push_json_append_member(json, "to");
+   push_json_append_string(json, to);
+   g_string_append_c(json, ',');
+   push_json_append_member(json, "message_id");
+   push_json_append_string(json, message_id);
+   g_string_append(json, ",\"message_type\":\"ack\"}");
+   push_gcm_ccs_connection_write_gcm(conn, json);
+   g_string_free(json, TRUE);
+}
+
+static void
+push_gcm_ccs_connection_send (PushGcmCcsConnection *conn,
+                              PushGcmCcsPending    *pending)
+{
+   GString *json;
+
+   ENTRY;
+
+   json = g_string_sized_new(g_bytes_get_size(pending->bytes) + 256);
+   g_string_append_c(json, '{');
+   push_json_append_member(json, "to");
+   push_json_append_string(
+         json,
+         push_gcm_identity_get_registration_id(pending->identity));
+   g_string_append_c(json, ',');
+   push_json_append_member(json, "message_id");
+   push_json_append_string(json, pending->message_id);
+   g_string_append(json, ",\"delivery_receipt_requested\":true,");
+   g_string_append_len(json,
+                       g_bytes_get_data(pending->bytes, NULL),
+                       g_bytes_get_size(pending->bytes));
+   g_string_append_c(json, '}');
+
+   g_hash_table_insert(conn->unacked, pending->message_id, pending);
+   push_gcm_ccs_connection_write_gcm(conn, json);
+
+   g_string_free(json, TRUE);
+
+   EXIT;
+}
+
+static const gchar *
+push_gcm_ccs_client_get_string (JsonObject  *object,
+                                const gchar *name)
+{
+   JsonNode *node;
+
+   if ((node = json_object_get_member(object, name)) &&
+       JSON_NODE_HOLDS_VALUE(node) &&
+       (json_node_get_value_type(node) == G_TYPE_STRING)) {
+      return json_node_get_string(node);
+   }
+
+   return NULL;
+}
+
+static PushGcmClientError
+push_gcm_ccs_client_lookup_error (const gchar *name)
+{
+   static const struct {
+      const gchar        *name;
+      PushGcmClientError  code;
+   } errors[] = {
+      { "BAD_REGISTRATION", PUSH_GCM_CLIENT_ERROR_INVALID_REGISTRATION },
+      { "DEVICE_MESSAGE_RATE_EXCEEDED", PUSH_GCM_CLIENT_ERROR_UNAVAILABLE },
+      { "DEVICE_UNREGISTERED", PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED },
+      { "INTERNAL_SERVER_ERROR",
+        PUSH_GCM_CLIENT_ERROR_INTERNAL_SERVER_ERROR },
+      { "SERVICE_UNAVAILABLE", PUSH_GCM_CLIENT_ERROR_UNAVAILABLE },
+   };
+   guint i;
+
+   for (i = 0; name && (i < G_N_ELEMENTS(errors)); i++) {
+      if (!g_strcmp0(name, errors[i].name)) {
+         return errors[i].code;
+      }
+   }
+
+   return PUSH_GCM_CLIENT_ERROR_UNKNOWN;
+}
+
+/*
+ * Handles the ack or nack of a message we sent. Temporary failures are
+ * retried with exponential backoff, and messages refused because the
+ * connection is draining are queued again right away.
+ */
+static void
+push_gcm_ccs_connection_handle_ack (PushGcmCcsConnection *conn,
+                                    JsonObject           *object,
+                                    gboolean              nack)
+{
+   PushGcmCcsPending *pending;
+   PushGcmClientError code;
+   PushGcmCcsClient *client = conn->client;
+   PushGcmIdentity *canonical;
+   const gchar *registration_id;
+   const gchar *message_id;
+   const gchar *name;
+   GError *error = NULL;
+
+   ENTRY;
+
+   if (!(message_id = push_gcm_ccs_client_get_string(object, "message_id")) ||
+       !(pending = g_hash_table_lookup(conn->unacked, message_id))) {
+      EXIT;
+   }
+
+   g_hash_table_remove(conn->unacked, message_id);
+
+   if (!nack) {
+      registration_id =
+         push_gcm_ccs_client_get_string(object, "registration_id");
+      if (registration_id && *registration_id) {
+         canonical = push_gcm_identity_new(registration_id);
+         g_signal_emit(client, gSignals[IDENTITY_CHANGED], 0,
+                       pending->identity, canonical);
+         g_object_unref(canonical);
+      }
+      push_gcm_ccs_pending_complete(pending,
+                                    _push_gcm_result_new(pending->identity,
+                                                         pending->message_id,
+                                                         registration_id,
+                                                         0),
+                                    NULL);
+      EXIT;
+   }
+
+   name = push_gcm_ccs_client_get_string(object, "error");
+   code = push_gcm_ccs_client_lookup_error(name);
+
+   if (!g_strcmp0(name, "CONNECTION_DRAINING")) {
+      conn->state = PUSH_GCM_CCS_STATE_DRAINING;
+      g_queue_push_head(client->priv->queue, pending);
+      g_object_notify_by_pspec(G_OBJECT(client),
+                               gParamSpecs[PROP_QUEUE_DEPTH]);
+   } else if (((code == PUSH_GCM_CLIENT_ERROR_UNAVAILABLE) ||
+               (code == PUSH_GCM_CLIENT_ERROR_INTERNAL_SERVER_ERROR)) &&
+              (pending->attempt < PUSH_GCM_CCS_CLIENT_MAX_RETRIES)) {
+      g_timeout_add(push_gcm_ccs_client_get_backoff(pending->attempt),
+                    push_gcm_ccs_client_retry_cb,
+                    pending);
+      pending->attempt++;
+   } else {
+      if ((code == PUSH_GCM_CLIENT_ERROR_INVALID_REGISTRATION) ||
+          (code == PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED)) {
+         g_signal_emit(client, gSignals[IDENTITY_REMOVED], 0,
+                       pending->identity);
+      }
+      g_set_error(&error,
+                  PUSH_GCM_CLIENT_ERROR,
+                  code,
+                  _("GCM rejected the message: %s."),
+                  name ? name : "UNKNOWN");
+      push_gcm_ccs_pending_complete(pending,
+                                    _push_gcm_result_new(pending->identity,
+                                                         pending->message_id,
+                                                         NULL,
+                                                         code),
+                                    error);
+      g_error_free(error);
+   }
+
+   EXIT;
+}
+
+/*
+ * Handles a delivery receipt for a message we sent, or a message sent
+ * upstream by a device. Both must be acknowledged.
+ */
+static void
+push_gcm_ccs_connection_handle_message (PushGcmCcsConnection *conn,
+                                        JsonObject           *object,
+                                        gboolean              receipt)
+{
+   PushGcmIdentity *identity;
+   const gchar *registration_id;
+   const gchar *message_id;
+   const gchar *from;
+   JsonObject *data = NULL;
+   JsonNode *node;
+
+   ENTRY;
+
+   if (!(from = push_gcm_ccs_client_get_string(object, "from")) ||
+       !(message_id = push_gcm_ccs_client_get_string(object, "message_id"))) {
+      EXIT;
+   }
+
+   if ((node = json_object_get_member(object, "data")) &&
+       JSON_NODE_HOLDS_OBJECT(node)) {
+      data = json_node_get_object(node);
+   }
+
+   if (!receipt) {
+      identity = push_gcm_identity_new(from);
+      g_signal_emit(conn->client, gSignals[MESSAGE_RECEIVED], 0,
+                    identity, data);
+      g_object_unref(identity);
+   } else if (data &&
+              (registration_id =
+                  push_gcm_ccs_client_get_string(data,
+                                                 "device_registration_id"))) {
+      identity = push_gcm_identity_new(registration_id);
+      g_signal_emit(conn->client, gSignals[DELIVERY_RECEIPT], 0,
+                    identity,
+                    push_gcm_ccs_client_get_string(data,
+                                                   "original_message_id"));
+      g_object_unref(identity);
+   }
+
+   push_gcm_ccs_connection_send_ack(conn, from, message_id);
+
+   EXIT;
+}
+
+static gboolean
+push_gcm_ccs_connection_handle_gcm (PushGcmCcsConnection  *conn,
+                                    GError               **error)
+{
+   const gchar *message_type;
+   const gchar *control_type;
+   JsonObject *object;
+   JsonNode *root;
+
+   ENTRY;
+
+   if (!json_parser_load_from_data(conn->parser,
+                                   conn->text->str,
+                                   conn->text->len,
+                                   error)) {
+      RETURN(FALSE);
+   }
+
+   if (!(root = json_parser_get_root(conn->parser)) ||
+       !JSON_NODE_HOLDS_OBJECT(root)) {
+      RETURN(TRUE);
+   }
+
+   object = json_node_get_object(root);
+   message_type = push_gcm_ccs_client_get_string(object, "message_type");
+
+   if (!message_type) {
+      push_gcm_ccs_connection_handle_message(conn, object, FALSE);
+   } else if (!g_strcmp0(message_type, "ack")) {
+      push_gcm_ccs_connection_handle_ack(conn, object, FALSE);
+   } else if (!g_strcmp0(message_type, "nack")) {
+      push_gcm_ccs_connection_handle_ack(conn, object, TRUE);
+   } else if (!g_strcmp0(message_type, "receipt")) {
+      push_gcm_ccs_connection_handle_message(conn, object, TRUE);
+   } else if (!g_strcmp0(message_type, "control")) {
+      control_type = push_gcm_ccs_client_get_string(object, "control_type");
+      if (!g_strcmp0(control_type, "CONNECTION_DRAINING")) {
+         conn->state = PUSH_GCM_CCS_STATE_DRAINING;
+      }
+   }
+
+   /*
+    * Acks free up room on this connection, while draining requires
+    * another one.
+    */
+   push_gcm_ccs_client_dispatch(conn->client);
+
+   RETURN(TRUE);
+}
+
+/*
+ * Answers an <iq type="get"/> from CCS. Pings are answered with a result
+ * so that CCS keeps the connection open, anything else is rejected as
+ * XMPP requires.
+ */
+static void
+push_gcm_ccs_connection_answer_iq (PushGcmCcsConnection *conn)
+{
+   const gchar *from;
+   const gchar *id;
+   gchar *reply;
+
+   id = conn->stanza_id ? conn->stanza_id : "";
+   from = conn->stanza_from ? conn->stanza_from : "";
+
+   if (conn->has_ping) {
+      reply = g_markup_printf_escaped("<iq type=\"result\" id=\"%s\" "
+                                      "to=\"%s\"/>",
+                                      id, from);
+   } else {
+      reply = g_markup_printf_escaped(
+            "<iq type=\"error\" id=\"%s\" to=\"%s\">"
+            "<error type=\"cancel\">"
+            "<service-unavailable "
+            "xmlns=\"urn:ietf:params:xml:ns:xmpp-stanzas\"/>"
+            "</error></iq>",
+            id, from);
+   }
+
+   g_string_append(conn->out, reply);
+   push_gcm_ccs_connection_flush(conn);
+   g_free(reply);
+}
+
+/*
+ * Handles a complete top-level stanza. SASL and resource binding are
+ * driven from here until the connection is ready.
+ */
+static gboolean
+push_gcm_ccs_connection_handle_stanza (PushGcmCcsConnection  *conn,
+                                       const gchar           *name,
+                                       GError               **error)
+{
+   ENTRY;
+
+   if (!g_strcmp0(name, "stream:features")) {
+      if (conn->state == PUSH_GCM_CCS_STATE_AUTHENTICATING) {
+         if (!conn->has_plain) {
+            g_set_error(error,
+                        PUSH_GCM_CCS_CLIENT_ERROR,
+                        PUSH_GCM_CCS_CLIENT_ERROR_AUTHENTICATION_FAILED,
+                        _("CCS does not offer PLAIN authentication."));
+            RETURN(FALSE);
+         }
+         push_gcm_ccs_connection_authenticate(conn);
+      } else if ((conn->state == PUSH_GCM_CCS_STATE_BINDING) &&
+                 conn->has_bind) {
+         g_string_append(conn->out,
+                         "<iq type=\"set\" id=\"bind\">"
+                         "<bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\"/>"
+                         "</iq>");
+         push_gcm_ccs_connection_flush(conn);
+      }
+      conn->has_plain = FALSE;
+      conn->has_bind = FALSE;
+   } else if (!g_strcmp0(name, "success")) {
+      conn->state = PUSH_GCM_CCS_STATE_BINDING;
+      conn->restart = TRUE;
+   } else if (!g_strcmp0(name, "failure")) {
+      g_set_error(error,
+                  PUSH_GCM_CCS_CLIENT_ERROR,
+                  PUSH_GCM_CCS_CLIENT_ERROR_AUTHENTICATION_FAILED,
+                  _("CCS rejected the sender id or API key."));
+      RETURN(FALSE);
+   } else if (!g_strcmp0(name, "iq")) {
+      if (!g_strcmp0(conn->stanza_type, "error")) {
+         g_set_error(error,
+                     PUSH_GCM_CCS_CLIENT_ERROR,
+                     PUSH_GCM_CCS_CLIENT_ERROR_STREAM_ERROR,
+                     _("CCS rejected the resource binding."));
+         RETURN(FALSE);
+      } else if (!g_strcmp0(conn->stanza_type, "get")) {
+         push_gcm_ccs_connection_answer_iq(conn);
+      } else if (conn->state == PUSH_GCM_CCS_STATE_BINDING) {
+         conn->state = PUSH_GCM_CCS_STATE_READY;
+         if (conn->timeout_id) {
+            g_source_remove(conn->timeout_id);
+            conn->timeout_id = 0;
+         }
+         push_gcm_ccs_client_dispatch(conn->client);
+      }
+   } else if (!g_strcmp0(name, "message")) {
+      if (conn->text->len && !push_gcm_ccs_connection_handle_gcm(conn, error)) {
+         RETURN(FALSE);
+      }
+      g_string_truncate(conn->text, 0);
+   } else if (!g_strcmp0(name, "stream:error")) {
+      g_set_error(error,
+                  PUSH_GCM_CCS_CLIENT_ERROR,
+                  PUSH_GCM_CCS_CLIENT_ERROR_STREAM_ERROR,
+                  _("CCS reported a stream error."));
+      RETURN(FALSE);
+   }
+
+   RETURN(TRUE);
+}
+
+static void
+push_gcm_ccs_connection_start_element (GMarkupParseContext  *context,
+                                       const gchar          *element_name,
+                                       const gchar         **attribute_names,
+                                       const gchar         **attribute_values,
+                                       gpointer              user_data,
+                                       GError              **error)
+{
+   PushGcmCcsConnection *conn = user_data;
+   guint i;
+
+   if (conn->depth == 1) {
+      g_free(conn->stanza);
+      g_free(conn->stanza_type);
+      g_free(conn->stanza_id);
+      g_free(conn->stanza_from);
+      conn->stanza = g_strdup(element_name);
+      conn->stanza_type = NULL;
+      conn->stanza_id = NULL;
+      conn->stanza_from = NULL;
+      conn->has_ping = FALSE;
+      for (i = 0; attribute_names[i]; i++) {
+         if (!g_strcmp0(attribute_names[i], "type")) {
+            conn->stanza_type = g_strdup(attribute_values[i]);
+         } else if (!g_strcmp0(attribute_names[i], "id")) {
+            conn->stanza_id = g_strdup(attribute_values[i]);
+         } else if (!g_strcmp0(attribute_names[i], "from")) {
+            conn->stanza_from = g_strdup(attribute_values[i]);
+         }
+      }
+   } else if (conn->depth > 1) {
+      if (!g_strcmp0(element_name, "gcm")) {
+         conn->in_gcm = TRUE;
+         g_string_truncate(conn->text, 0);
+      } else if (!g_strcmp0(element_name, "mechanism")) {
+         conn->in_mechanism = TRUE;
+         g_string_truncate(conn->text, 0);
+      } else if (!g_strcmp0(element_name, "bind")) {
+         conn->has_bind = TRUE;
+      } else if (!g_strcmp0(element_name, "ping")) {
+         conn->has_ping = TRUE;
+      }
+   }
+
+   conn->depth++;
+}
+
+static void
+push_gcm_ccs_connection_end_element (GMarkupParseContext  *context,
+                                     const gchar          *element_name,
+                                     gpointer              user_data,
+                                     GError              **error)
+{
+   PushGcmCcsConnection *conn = user_data;
+
+   conn->depth--;
+
+   if (conn->in_gcm && !g_strcmp0(element_name, "gcm")) {
+      conn->in_gcm = FALSE;
+   } else if (conn->in_mechanism && !g_strcmp0(element_name, "mechanism")) {
+      conn->has_plain |= !g_strcmp0(conn->text->str, "PLAIN");
+      conn->in_mechanism = FALSE;
+      g_string_truncate(conn->text, 0);
+   }
+
+   if (conn->depth == 1) {
+      push_gcm_ccs_connection_handle_stanza(conn, element_name, error);
+   } else if (conn->depth == 0) {
+      g_set_error(error,
+                  PUSH_GCM_CCS_CLIENT_ERROR,
+                  PUSH_GCM_CCS_CLIENT_ERROR_CONNECTION_CLOSED,
+                  _("CCS closed the stream."));
+   }
+}
+
+static void
+push_gcm_ccs_connection_text (GMarkupParseContext  *context,
+                              const gchar          *text,
+                              gsize                 text_len,
+                              gpointer              user_data,
+                              GError              **error)
+{
+   PushGcmCcsConnection *conn = user_data;
+
+   if (conn->in_gcm || conn->in_mechanism) {
+      g_string_append_len(conn->text, text, text_len);
+   }
+}
+
+static const GMarkupParser gParser = {
+   push_gcm_ccs_connection_start_element,
+   push_gcm_ccs_connection_end_element,
+   push_gcm_ccs_connection_text,
+   NULL,
+   NULL,
+};
+
+/*
+ * Opens a new XML stream. This happens once the connection is established
+ * and again after authentication, each time with a new parser since the
+ * server starts a new document.
+ */
+static void
+push_gcm_ccs_connection_start_stream (PushGcmCcsConnection *conn)
+{
+   if (conn->context) {
+      g_markup_parse_context_free(conn->context);
+   }
+
+   conn->context = g_markup_parse_context_new(&gParser, 0, conn, NULL);
+   conn->depth = 0;
+   conn->in_gcm = FALSE;
+   conn->in_mechanism = FALSE;
+   conn->restart = FALSE;
+
+   g_string_append(conn->out,
+                   "<stream:stream to=\"" PUSH_GCM_CCS_CLIENT_DOMAIN "\" "
+                   "version=\"1.0\" xmlns=\"jabber:client\" "
+                   "xmlns:stream=\"http://etherx.jabber.org/streams\">");
+   push_gcm_ccs_connection_flush(conn);
+}
+
+static void push_gcm_ccs_connection_read (PushGcmCcsConnection *conn);
+
+static void
+push_gcm_ccs_connection_read_cb (GObject      *object,
+                                 GAsyncResult *result,
+                                 gpointer      user_data)
+{
+   PushGcmCcsConnection *conn = user_data;
+   GError *error = NULL;
+   gssize n;
+
+   ENTRY;
+
+   n = g_input_stream_read_finish(G_INPUT_STREAM(object), result, &error);
+
+   if (!conn->client) {
+      GOTO(cleanup);
+   }
+
+   if (n <= 0) {
+      if (!n) {
+         g_set_error(&error,
+                     PUSH_GCM_CCS_CLIENT_ERROR,
+                     PUSH_GCM_CCS_CLIENT_ERROR_CONNECTION_CLOSED,
+                     _("CCS closed the connection."));
+      }
+      push_gcm_ccs_connection_close(conn, error);
+      GOTO(cleanup);
+   }
+
+   if (!g_markup_parse_context_parse(conn->context,
+                                     (const gchar *)conn->buffer,
+                                     n,
+                                     &error)) {
+      push_gcm_ccs_connection_close(conn, error);
+      GOTO(cleanup);
+   }
+
+   /*
+    * A draining connection is closed once its last message has been
+    * acknowledged. Any queued messages go to a new connection.
+    */
+   if ((conn->state == PUSH_GCM_CCS_STATE_DRAINING) &&
+       !g_hash_table_size(conn->unacked)) {
+      push_gcm_ccs_connection_close(conn, NULL);
+      GOTO(cleanup);
+   }
+
+   if (conn->restart) {
+      push_gcm_ccs_connection_start_stream(conn);
+   }
+
+   push_gcm_ccs_connection_read(conn);
+
+cleanup:
+   g_clear_error(&error);
+   push_gcm_ccs_connection_unref(conn);
+
+   EXIT;
+}
+
+static void
+push_gcm_ccs_connection_read (PushGcmCcsConnection *conn)
+{
+   GInputStream *input;
+
+   input = g_io_stream_get_input_stream(conn->stream);
+   g_input_stream_read_async(input,
+                             conn->buffer,
+                             sizeof(conn->buffer),
+                             G_PRIORITY_DEFAULT,
+                             conn->cancellable,
+                             push_gcm_ccs_connection_read_cb,
+                             push_gcm_ccs_connection_ref(conn));
+}
+
+static void
+push_gcm_ccs_connection_connect_cb (GObject      *object,
+                                    GAsyncResult *result,
+                                    gpointer      user_data)
+{
+   PushGcmCcsConnection *conn = user_data;
+   GSocketConnection *connection;
+   GError *error = NULL;
+
+   ENTRY;
+
+   connection = g_socket_client_connect_to_host_finish(G_SOCKET_CLIENT(object),
+                                                       result,
+                                                       &error);
+
+   if (!conn->client) {
+      g_clear_object(&connection);
+      GOTO(cleanup);
+   }
+
+   if (!connection) {
+      push_gcm_ccs_connection_close(conn, error);
+      GOTO(cleanup);
+   }
+
+   conn->stream = G_IO_STREAM(connection);
+   conn->state = PUSH_GCM_CCS_STATE_AUTHENTICATING;
+   push_gcm_ccs_connection_start_stream(conn);
+   push_gcm_ccs_connection_read(conn);
+
+cleanup:
+   g_clear_error(&error);
+   push_gcm_ccs_connection_unref(conn);
+
+   EXIT;
+}
+
+/*
+ * Gives up on a connection that did not become ready in time. Only the
+ * handshake is bounded, an established connection may stay idle for as
+ * long as CCS allows.
+ */
+static gboolean
+push_gcm_ccs_connection_timeout_cb (gpointer user_data)
+{
+   PushGcmCcsConnection *conn = user_data;
+   GError *error;
+
+   ENTRY;
+
+   conn->timeout_id = 0;
+   error = g_error_new(G_IO_ERROR,
+                       G_IO_ERROR_TIMED_OUT,
+                       _("Timed out connecting to CCS."));
+   push_gcm_ccs_connection_close(conn, error);
+   g_error_free(error);
+
+   RETURN(FALSE);
+}
+
+static void
+push_gcm_ccs_client_connect (PushGcmCcsClient *client)
+{
+   PushGcmCcsClientPrivate *priv;
+   PushGcmCcsConnection *conn;
+   GSocketClient *socket_client;
+
+   ENTRY;
+
+   priv = client->priv;
+
+   conn = push_gcm_ccs_connection_new(client);
+   g_ptr_array_add(priv->connections, conn);
+   g_object_notify_by_pspec(G_OBJECT(client),
+                            gParamSpecs[PROP_N_CONNECTIONS]);
+
+   socket_client = g_object_new(G_TYPE_SOCKET_CLIENT,
+                                "protocol", G_SOCKET_PROTOCOL_TCP,
+                                "tls", priv->tls,
+                                "type", G_SOCKET_TYPE_STREAM,
+                                NULL);
+   g_socket_client_connect_to_host_async(socket_client,
+                                         priv->host,
+                                         priv->port,
+                                         conn->cancellable,
+                                         push_gcm_ccs_connection_connect_cb,
+                                         push_gcm_ccs_connection_ref(conn));
+   g_object_unref(socket_client);
+
+   conn->timeout_id =
+      g_timeout_add_seconds_full(G_PRIORITY_DEFAULT,
+                                 PUSH_GCM_CCS_CLIENT_CONNECT_TIMEOUT,
+                                 push_gcm_ccs_connection_timeout_cb,
+                                 push_gcm_ccs_connection_ref(conn),
+                                 (GDestroyNotify)push_gcm_ccs_connection_unref);
+
+   EXIT;
+}
+
+/*
+ * Sends queued messages on the ready connection with the fewest
+ * unacknowledged messages, until every connection has reached the flow
+ * control window. If messages remain, another connection is opened,
+ * one at a time, up to max-connections.
+ */
+static void
+push_gcm_ccs_client_dispatch (PushGcmCcsClient *client)
+{
+   PushGcmCcsClientPrivate *priv;
+   PushGcmCcsConnection *conn;
+   PushGcmCcsConnection *best;
+   PushGcmCcsPending *pending;
+   gboolean connecting = FALSE;
+   guint depth;
+   guint i;
+
+   ENTRY;
+
+   g_object_ref(client);
+
+   priv = client->priv;
+   depth = g_queue_get_length(priv->queue);
+
+   while ((pending = g_queue_peek_head(priv->queue))) {
+      if (pending->cancellable &&
+          g_cancellable_is_cancelled(pending->cancellable)) {
+         g_queue_pop_head(priv->queue);
+         push_gcm_ccs_pending_complete(pending, NULL, NULL);
+         continue;
+      }
+
+      best = NULL;
+      for (i = 0; i < priv->connections->len; i++) {
+         conn = g_ptr_array_index(priv->connections, i);
+         if ((conn->state == PUSH_GCM_CCS_STATE_READY) &&
+             (g_hash_table_size(conn->unacked) <
+              PUSH_GCM_CCS_CLIENT_MAX_UNACKED) &&
+             (!best ||
+              (g_hash_table_size(conn->unacked) <
+               g_hash_table_size(best->unacked)))) {
+            best = conn;
+         }
+      }
+
+      if (!best) {
+         break;
+      }
+
+      g_queue_pop_head(priv->queue);
+      push_gcm_ccs_connection_send(best, pending);
+   }
+
+   if (!g_queue_is_empty(priv->queue) &&
+       (priv->connections->len < priv->max_connections)) {
+      for (i = 0; i < priv->connections->len; i++) {
+         conn = g_ptr_array_index(priv->connections, i);
+         connecting |= (conn->state < PUSH_GCM_CCS_STATE_READY);
+      }
+      if (!connecting) {
+         push_gcm_ccs_client_connect(client);
+      }
+   }
+
+   if (depth != g_queue_get_length(priv->queue)) {
+      g_object_notify_by_pspec(G_OBJECT(client),
+                               gParamSpecs[PROP_QUEUE_DEPTH]);
+   }
+
+   g_object_unref(client);
+
+   EXIT;
+}
+
+/**
+ * push_gcm_ccs_client_deliver_async:
+ * @client: (in): A #PushGcmCcsClient.
+ * @identity: (in): A #PushGcmIdentity.
+ * @message: (in): A #PushGcmMessage.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: User data for @callback.
+ *
+ * Asynchronously delivers @message to @identity over CCS. A connection is
+ * opened if none is available. @callback is executed once GCM has
+ * acknowledged or rejected the message.
+ *
+ * Cancelling @cancellable only prevents the message from being sent if it
+ * is still queued.
+ */
+void
+push_gcm_ccs_client_deliver_async (PushGcmCcsClient    *client,
+                                   PushGcmIdentity     *identity,
+                                   PushGcmMessage      *message,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+   PushGcmCcsClientPrivate *priv;
+   PushGcmCcsPending *pending;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_GCM_CCS_CLIENT(client));
+   g_return_if_fail(PUSH_IS_GCM_IDENTITY(identity));
+   g_return_if_fail(PUSH_IS_GCM_MESSAGE(message));
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+   g_return_if_fail(callback);
+
+   priv = client->priv;
+
+   pending = g_slice_new0(PushGcmCcsPending);
+   pending->client = g_object_ref(client);
+   pending->simple =
+      g_simple_async_result_new(G_OBJECT(client), callback, user_data,
+                                push_gcm_ccs_client_deliver_async);
+   g_simple_async_result_set_check_cancellable(pending->simple, cancellable);
+   pending->identity = g_object_ref(identity);
+   pending->bytes = g_bytes_ref(_push_gcm_message_get_bytes(message));
+   pending->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+   pending->message_id = g_strdup_printf("%08x-%" G_GUINT64_FORMAT,
+                                         priv->id_prefix,
+                                         ++priv->id_sequence);
+
+   g_queue_push_tail(priv->queue, pending);
+   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_QUEUE_DEPTH]);
+   push_gcm_ccs_client_dispatch(client);
+
+   EXIT;
+}
+
+/**
+ * push_gcm_ccs_client_deliver_finish:
+ * @client: (in): A #PushGcmCcsClient.
+ * @result: A #GAsyncResult.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to
+ * push_gcm_ccs_client_deliver_async().
+ *
+ * Returns: %TRUE if GCM acknowledged the message; otherwise %FALSE and
+ *   @error is set.
+ */
+gboolean
+push_gcm_ccs_client_deliver_finish (PushGcmCcsClient  *client,
+                                    GAsyncResult      *result,
+                                    GError           **error)
+{
+   gboolean ret;
+
+   ENTRY;
+   ret = push_gcm_ccs_client_deliver_finish_with_result(client, result,
+                                                        NULL, error);
+   RETURN(ret);
+}
+
+/**
+ * push_gcm_ccs_client_deliver_finish_with_result:
+ * @client: (in): A #PushGcmCcsClient.
+ * @result: A #GAsyncResult.
+ * @gcm_result: (out) (allow-none): A location for a #PushGcmResult, or
+ *   %NULL.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes a request to push_gcm_ccs_client_deliver_async() like
+ * push_gcm_ccs_client_deliver_finish(), additionally providing the
+ * #PushGcmResult for the ack or nack. Its message id matches the one
+ * reported by #PushGcmCcsClient::delivery-receipt. @gcm_result is set to
+ * %NULL if GCM did not answer, for example because the connection failed.
+ * Otherwise it should be freed with push_gcm_result_unref().
+ *
+ * Returns: %TRUE if GCM acknowledged the message; otherwise %FALSE and
+ *   @error is set.
+ */
+gboolean
+push_gcm_ccs_client_deliver_finish_with_result (PushGcmCcsClient  *client,
+                                                GAsyncResult      *result,
+                                                PushGcmResult    **gcm_result,
+                                                GError           **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+   PushGcmResult *r;
+   gboolean ret;
+
+   ENTRY;
+
+   g_return_val_if_fail(PUSH_IS_GCM_CCS_CLIENT(client), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
+
+   ret = !g_simple_async_result_propagate_error(simple, error);
+
+   if (gcm_result) {
+      r = g_simple_async_result_get_op_res_gpointer(simple);
+      *gcm_result = r ? push_gcm_result_ref(r) : NULL;
+   }
+
+   RETURN(ret);
+}
+
+GQuark
+push_gcm_ccs_client_error_quark (void)
+{
+   return g_quark_from_static_string("push-gcm-ccs-client-error-quark");
+}
+
+static void
+push_gcm_ccs_client_dispose (GObject *object)
+{
+   PushGcmCcsClientPrivate *priv;
+   PushGcmCcsConnection *conn;
+   guint i;
+
+   ENTRY;
+
+   priv = PUSH_GCM_CCS_CLIENT(object)->priv;
+
+   /*
+    * Every pending message holds a reference to the client, so only idle
+    * connections remain. Their outstanding reads and timeouts are
+    * cancelled.
+    */
+   for (i = 0; i < priv->connections->len; i++) {
+      conn = g_ptr_array_index(priv->connections, i);
+      conn->client = NULL;
+      conn->state = PUSH_GCM_CCS_STATE_CLOSED;
+      g_cancellable_cancel(conn->cancellable);
+      if (conn->timeout_id) {
+         g_source_remove(conn->timeout_id);
+         conn->timeout_id = 0;
+      }
+   }
+   g_ptr_array_set_size(priv->connections, 0);
+
+   G_OBJECT_CLASS(push_gcm_ccs_client_parent_class)->dispose(object);
+
+   EXIT;
+}
+
+static void
+push_gcm_ccs_client_finalize (GObject *object)
+{
+   PushGcmCcsClientPrivate *priv;
+
+   ENTRY;
+
+   priv = PUSH_GCM_CCS_CLIENT(object)->priv;
+   g_free(priv->api_key);
+   g_free(priv->host);
+   g_free(priv->sender_id);
+   g_ptr_array_unref(priv->connections);
+   g_queue_free(priv->queue);
+
+   G_OBJECT_CLASS(push_gcm_ccs_client_parent_class)->finalize(object);
+
+   EXIT;
+}
+
+static void
+push_gcm_ccs_client_get_property (GObject    *object,
+                                  guint       prop_id,
+                                  GValue     *value,
+                                  GParamSpec *pspec)
+{
+   PushGcmCcsClient *client = PUSH_GCM_CCS_CLIENT(object);
+
+   switch (prop_id) {
+   case PROP_API_KEY:
+      g_value_set_string(value, push_gcm_ccs_client_get_api_key(client));
+      break;
+   case PROP_HOST:
+      g_value_set_string(value, push_gcm_ccs_client_get_host(client));
+      break;
+   case PROP_MAX_CONNECTIONS:
+      g_value_set_uint(value,
+                       push_gcm_ccs_client_get_max_connections(client));
+      break;
+   case PROP_N_CONNECTIONS:
+      g_value_set_uint(value, push_gcm_ccs_client_get_n_connections(client));
+      break;
+   case PROP_PORT:
+      g_value_set_uint(value, push_gcm_ccs_client_get_port(client));
+      break;
+   case PROP_QUEUE_DEPTH:
+      g_value_set_uint(value, push_gcm_ccs_client_get_queue_depth(client));
+      break;
+   case PROP_SENDER_ID:
+      g_value_set_string(value, push_gcm_ccs_client_get_sender_id(client));
+      break;
+   case PROP_TLS:
+      g_value_set_boolean(value, push_gcm_ccs_client_get_tls(client));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_gcm_ccs_client_set_property (GObject      *object,
+                                  guint         prop_id,
+                                  const GValue *value,
+                                  GParamSpec   *pspec)
+{
+   PushGcmCcsClient *client = PUSH_GCM_CCS_CLIENT(object);
+
+   switch (prop_id) {
+   case PROP_API_KEY:
+      client->priv->api_key = g_value_dup_string(value);
+      break;
+   case PROP_HOST:
+      client->priv->host = g_value_dup_string(value);
+      break;
+   case PROP_MAX_CONNECTIONS:
+      push_gcm_ccs_client_set_max_connections(client,
+                                              g_value_get_uint(value));
+      break;
+   case PROP_PORT:
+      client->priv->port = g_value_get_uint(value);
+      break;
+   case PROP_SENDER_ID:
+      client->priv->sender_id = g_value_dup_string(value);
+      break;
+   case PROP_TLS:
+      client->priv->tls = g_value_get_boolean(value);
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_gcm_ccs_client_class_init (PushGcmCcsClientClass *klass)
+{
+   GObjectClass *object_class;
+
+   ENTRY;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->dispose = push_gcm_ccs_client_dispose;
+   object_class->finalize = push_gcm_ccs_client_finalize;
+   object_class->get_property = push_gcm_ccs_client_get_property;
+   object_class->set_property = push_gcm_ccs_client_set_property;
+   g_type_class_add_private(object_class, sizeof(PushGcmCcsClientPrivate));
+
+   gParamSpecs[PROP_API_KEY] =
+      g_param_spec_string("api-key",
+                          _("API Key"),
+                          _("The API key used to authenticate with CCS."),
+                          NULL,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_API_KEY,
+                                   gParamSpecs[PROP_API_KEY]);
+
+   gParamSpecs[PROP_HOST] =
+      g_param_spec_string("host",
+                          _("Host"),
+                          _("The host name of the CCS server."),
+                          PUSH_GCM_CCS_CLIENT_HOST,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_HOST,
+                                   gParamSpecs[PROP_HOST]);
+
+   gParamSpecs[PROP_MAX_CONNECTIONS] =
+      g_param_spec_uint("max-connections",
+                        _("Max Connections"),
+                        _("The maximum number of connections to CCS."),
+                        1,
+                        G_MAXUINT,
+                        PUSH_GCM_CCS_CLIENT_MAX_CONNECTIONS,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_MAX_CONNECTIONS,
+                                   gParamSpecs[PROP_MAX_CONNECTIONS]);
+
+   gParamSpecs[PROP_N_CONNECTIONS] =
+      g_param_spec_uint("n-connections",
+                        _("N Connections"),
+                        _("The number of connections to CCS."),
+                        0,
+                        G_MAXUINT,
+                        0,
+                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_N_CONNECTIONS,
+                                   gParamSpecs[PROP_N_CONNECTIONS]);
+
+   gParamSpecs[PROP_PORT] =
+      g_param_spec_uint("port",
+                        _("Port"),
+                        _("The port of the CCS server."),
+                        1,
+                        G_MAXUINT16,
+                        PUSH_GCM_CCS_CLIENT_PORT,
+                        G_PARAM_READWRITE |
+                        G_PARAM_CONSTRUCT_ONLY |
+                        G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_PORT,
+                                   gParamSpecs[PROP_PORT]);
+
+   gParamSpecs[PROP_QUEUE_DEPTH] =
+      g_param_spec_uint("queue-depth",
+                        _("Queue Depth"),
+                        _("The number of messages waiting to be sent."),
+                        0,
+                        G_MAXUINT,
+                        0,
+                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_QUEUE_DEPTH,
+                                   gParamSpecs[PROP_QUEUE_DEPTH]);
+
+   gParamSpecs[PROP_SENDER_ID] =
+      g_param_spec_string("sender-id",
+                          _("Sender Id"),
+                          _("The GCM sender id used to authenticate "
+                            "with CCS."),
+                          NULL,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_SENDER_ID,
+                                   gParamSpecs[PROP_SENDER_ID]);
+
+   gParamSpecs[PROP_TLS] =
+      g_param_spec_boolean("tls",
+                           _("TLS"),
+                           _("If connections should use TLS."),
+                           TRUE,
+                           G_PARAM_READWRITE |
+                           G_PARAM_CONSTRUCT_ONLY |
+                           G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_TLS,
+                                   gParamSpecs[PROP_TLS]);
+
+   /**
+    * PushGcmCcsClient::delivery-receipt:
+    * @client: A #PushGcmCcsClient.
+    * @identity: The #PushGcmIdentity the message was delivered to.
+    * @message_id: The message id of the delivered message.
+    *
+    * Emitted when GCM reports that a message reached the device.
+    * @message_id matches push_gcm_result_get_message_id() of the result
+    * of the delivery.
+    */
+   gSignals[DELIVERY_RECEIPT] = g_signal_new("delivery-receipt",
+                                             PUSH_TYPE_GCM_CCS_CLIENT,
+                                             G_SIGNAL_RUN_FIRST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             g_cclosure_marshal_generic,
+                                             G_TYPE_NONE,
+                                             2,
+                                             PUSH_TYPE_GCM_IDENTITY,
+                                             G_TYPE_STRING);
+
+   /**
+    * PushGcmCcsClient::identity-changed:
+    * @client: A #PushGcmCcsClient.
+    * @identity: The #PushGcmIdentity that was delivered to.
+    * @canonical: A #PushGcmIdentity with the canonical registration id.
+    *
+    * Emitted when GCM reports that the device of @identity has a new
+    * canonical registration id. @identity should be replaced with
+    * @canonical in any persistent storage.
+    */
+   gSignals[IDENTITY_CHANGED] = g_signal_new("identity-changed",
+                                             PUSH_TYPE_GCM_CCS_CLIENT,
+                                             G_SIGNAL_RUN_FIRST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             g_cclosure_marshal_generic,
+                                             G_TYPE_NONE,
+                                             2,
+                                             PUSH_TYPE_GCM_IDENTITY,
+                                             PUSH_TYPE_GCM_IDENTITY);
+
+   /**
+    * PushGcmCcsClient::identity-removed:
+    * @client: A #PushGcmCcsClient.
+    * @identity: The #PushGcmIdentity that is no longer registered.
+    *
+    * Emitted when GCM reports that @identity is invalid or no longer
+    * registered. It should be removed from any persistent storage.
+    */
+   gSignals[IDENTITY_REMOVED] = g_signal_new("identity-removed",
+                                             PUSH_TYPE_GCM_CCS_CLIENT,
+                                             G_SIGNAL_RUN_FIRST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             g_cclosure_marshal_VOID__OBJECT,
+                                             G_TYPE_NONE,
+                                             1,
+                                             PUSH_TYPE_GCM_IDENTITY);
+
+   /**
+    * PushGcmCcsClient::message-received:
+    * @client: A #PushGcmCcsClient.
+    * @identity: The #PushGcmIdentity of the sending device.
+    * @data: (allow-none): A #JsonObject with the data of the message.
+    *
+    * Emitted when a device sends a message upstream. The message has
+    * already been acknowledged to GCM.
+    */
+   gSignals[MESSAGE_RECEIVED] = g_signal_new("message-received",
+                                             PUSH_TYPE_GCM_CCS_CLIENT,
+                                             G_SIGNAL_RUN_FIRST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             g_cclosure_marshal_generic,
+                                             G_TYPE_NONE,
+                                             2,
+                                             PUSH_TYPE_GCM_IDENTITY,
+                                             JSON_TYPE_OBJECT);
+
+   EXIT;
+}
+
+static void
+push_gcm_ccs_client_init (PushGcmCcsClient *client)
+{
+   ENTRY;
+   client->priv =
+      G_TYPE_INSTANCE_GET_PRIVATE(client,
+                                  PUSH_TYPE_GCM_CCS_CLIENT,
+                                  PushGcmCcsClientPrivate);
+   client->priv->max_connections = PUSH_GCM_CCS_CLIENT_MAX_CONNECTIONS;
+   client->priv->connections = g_ptr_array_new_with_free_func(
+         (GDestroyNotify)push_gcm_ccs_connection_unref);
+   client->priv->queue = g_queue_new();
+   client->priv->id_prefix = g_random_int();
+   EXIT;
+}
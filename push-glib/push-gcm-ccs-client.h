@@ -0,0 +1,95 @@
+/* push-gcm-ccs-client.h
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PUSH_GCM_CCS_CLIENT_H
+#define PUSH_GCM_CCS_CLIENT_H
+
+#include <gio/gio.h>
+
+#include "push-gcm-identity.h"
+#include "push-gcm-message.h"
+#include "push-gcm-result.h"
+
+G_BEGIN_DECLS
+
+#define PUSH_TYPE_GCM_CCS_CLIENT            (push_gcm_ccs_client_get_type())
+#define PUSH_GCM_CCS_CLIENT_ERROR           (push_gcm_ccs_client_error_quark())
+#define PUSH_GCM_CCS_CLIENT(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_GCM_CCS_CLIENT, PushGcmCcsClient))
+#define PUSH_GCM_CCS_CLIENT_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_GCM_CCS_CLIENT, PushGcmCcsClient const))
+#define PUSH_GCM_CCS_CLIENT_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  PUSH_TYPE_GCM_CCS_CLIENT, PushGcmCcsClientClass))
+#define PUSH_IS_GCM_CCS_CLIENT(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PUSH_TYPE_GCM_CCS_CLIENT))
+#define PUSH_IS_GCM_CCS_CLIENT_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  PUSH_TYPE_GCM_CCS_CLIENT))
+#define PUSH_GCM_CCS_CLIENT_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  PUSH_TYPE_GCM_CCS_CLIENT, PushGcmCcsClientClass))
+
+typedef struct _PushGcmCcsClient        PushGcmCcsClient;
+typedef struct _PushGcmCcsClientClass   PushGcmCcsClientClass;
+typedef struct _PushGcmCcsClientPrivate PushGcmCcsClientPrivate;
+typedef enum   _PushGcmCcsClientError   PushGcmCcsClientError;
+
+enum _PushGcmCcsClientError
+{
+   PUSH_GCM_CCS_CLIENT_ERROR_AUTHENTICATION_FAILED = 1,
+   PUSH_GCM_CCS_CLIENT_ERROR_STREAM_ERROR          = 2,
+   PUSH_GCM_CCS_CLIENT_ERROR_CONNECTION_CLOSED     = 3,
+};
+
+struct _PushGcmCcsClient
+{
+   GObject parent;
+
+   /*< private >*/
+   PushGcmCcsClientPrivate *priv;
+};
+
+struct _PushGcmCcsClientClass
+{
+   GObjectClass parent_class;
+};
+
+void              push_gcm_ccs_client_deliver_async              (PushGcmCcsClient     *client,
+                                                                  PushGcmIdentity      *identity,
+                                                                  PushGcmMessage       *message,
+                                                                  GCancellable         *cancellable,
+                                                                  GAsyncReadyCallback   callback,
+                                                                  gpointer              user_data);
+gboolean          push_gcm_ccs_client_deliver_finish             (PushGcmCcsClient     *client,
+                                                                  GAsyncResult         *result,
+                                                                  GError              **error);
+gboolean          push_gcm_ccs_client_deliver_finish_with_result (PushGcmCcsClient     *client,
+                                                                  GAsyncResult         *result,
+                                                                  PushGcmResult       **gcm_result,
+                                                                  GError              **error);
+GQuark            push_gcm_ccs_client_error_quark                (void) G_GNUC_CONST;
+const gchar      *push_gcm_ccs_client_get_api_key                (PushGcmCcsClient     *client);
+const gchar      *push_gcm_ccs_client_get_host                   (PushGcmCcsClient     *client);
+guint             push_gcm_ccs_client_get_max_connections        (PushGcmCcsClient     *client);
+guint             push_gcm_ccs_client_get_n_connections          (PushGcmCcsClient     *client);
+guint             push_gcm_ccs_client_get_port                   (PushGcmCcsClient     *client);
+guint             push_gcm_ccs_client_get_queue_depth            (PushGcmCcsClient     *client);
+const gchar      *push_gcm_ccs_client_get_sender_id              (PushGcmCcsClient     *client);
+gboolean          push_gcm_ccs_client_get_tls                    (PushGcmCcsClient     *client);
+GType             push_gcm_ccs_client_get_type                   (void) G_GNUC_CONST;
+PushGcmCcsClient *push_gcm_ccs_client_new                        (const gchar          *sender_id,
+                                                                  const gchar          *api_key);
+void              push_gcm_ccs_client_set_max_connections        (PushGcmCcsClient     *client,
+                                                                  guint                 max_connections);
+
+G_END_DECLS
+
+#endif /* PUSH_GCM_CCS_CLIENT_H */
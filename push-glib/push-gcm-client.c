@@ -20,8 +20,22 @@
 
 #include "push-debug.h"
 #include "push-gcm-client.h"
-
-#define PUSH_GCM_CLIENT_URL "https://android.googleapis.com/gcm/send"
+#include "push-gcm-message-private.h"
+#include "push-gcm-response.h"
+#include "push-gcm-result-private.h"
+#include "push-json.h"
+#include "push-session.h"
+
+#define PUSH_GCM_CLIENT_URL          "https://android.googleapis.com/gcm/send"
+#define PUSH_GCM_CLIENT_MAX_IDS      1000
+#define PUSH_GCM_CLIENT_MAX_PARALLEL 4
+#define PUSH_GCM_CLIENT_MAX_RETRIES  3
+#define PUSH_GCM_CLIENT_BACKOFF_MIN  1000
+#define PUSH_GCM_CLIENT_BACKOFF_MAX  60000
+#define PUSH_GCM_CLIENT_LIMIT_START  4
+#define PUSH_GCM_CLIENT_LATENCY_MULT 3
+#define PUSH_GCM_CLIENT_STATUS_429   429
+#define PUSH_GCM_CLIENT_REMAP_MAX    10000
 
 /**
  * SECTION:push-gcm-client
@@ -39,24 +53,68 @@
  * :identity-removed single will be emitted. It is important that consumers
  * connect to this signal and remove the device from their database to
  * prevent further communication with the service.
+ *
+ * If GCM reports that a device has a new canonical registration id, the
+ * :identity-changed signal is emitted with the old and the new identity.
+ * Consumers should update their database so that messages are not sent
+ * to both. If #PushGcmClient:remap-identities is %TRUE, the client also
+ * remembers the canonical registration id and uses it for later
+ * deliveries to the old one. Only the #PushGcmClient:remap-capacity most
+ * recently used registration ids are remembered.
+ *
+ * The client allows up to 32 connections to GCM, which are closed after
+ * being idle for 60 seconds. These may be changed with the "max-conns",
+ * "max-conns-per-host" and "idle-timeout" properties of #SoupSession. Use
+ * push_gcm_client_warm_up_async() to open connections ahead of time.
+ *
+ * Requests are not handed to the session all at once. The number of
+ * requests in flight is limited by #PushGcmClient:in-flight-limit, and
+ * the remaining requests wait in a queue. The limit grows by about one
+ * request per round trip while GCM responds promptly, and is halved when
+ * GCM answers with a server error or 429, or when a response takes more
+ * than three times the average latency. It never exceeds
+ * #PushGcmClient:max-in-flight.
  */
 
 G_DEFINE_TYPE(PushGcmClient, push_gcm_client, SOUP_TYPE_SESSION_ASYNC)
 
 struct _PushGcmClientPrivate
 {
-   gchar *auth_token;
+   gchar      *auth_token;
+   guint       max_parallel;
+   guint       max_retries;
+   gboolean    remap_identities;
+   guint       remap_capacity;
+   GHashTable *remap;
+   GQueue      remap_lru;
+   gchar      *url;
+
+   GQueue     *queue;
+   guint       n_in_flight;
+   guint       max_in_flight;
+   gdouble     limit;
+   gdouble     latency;
+   gint64      last_decrease;
 };
 
 enum
 {
    PROP_0,
    PROP_AUTH_TOKEN,
+   PROP_IN_FLIGHT_LIMIT,
+   PROP_MAX_IN_FLIGHT,
+   PROP_MAX_PARALLEL,
+   PROP_MAX_RETRIES,
+   PROP_QUEUE_DEPTH,
+   PROP_REMAP_CAPACITY,
+   PROP_REMAP_IDENTITIES,
+   PROP_URL,
    LAST_PROP
 };
 
 enum
 {
+   IDENTITY_CHANGED,
    IDENTITY_REMOVED,
    LAST_SIGNAL
 };
@@ -69,39 +127,792 @@ push_gcm_client_new (const gchar *auth_token)
 {
    PushGcmClient *client;
 
-   ENTRY;
-   client = g_object_new(PUSH_TYPE_GCM_CLIENT,
-                         "auth-token", auth_token,
-                         NULL);
-   RETURN(client);
+   ENTRY;
+   client = g_object_new(PUSH_TYPE_GCM_CLIENT,
+                         "auth-token", auth_token,
+                         NULL);
+   RETURN(client);
+}
+
+const gchar *
+push_gcm_client_get_auth_token (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), NULL);
+   return client->priv->auth_token;
+}
+
+void
+push_gcm_client_set_auth_token (PushGcmClient *client,
+                                const gchar   *auth_token)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
+   g_free(client->priv->auth_token);
+   client->priv->auth_token = g_strdup(auth_token);
+   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_AUTH_TOKEN]);
+   EXIT;
+}
+
+/**
+ * push_gcm_client_get_in_flight_limit:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Fetches the "in-flight-limit" property.
+ *
+ * Returns: The number of requests that may currently be in flight.
+ */
+guint
+push_gcm_client_get_in_flight_limit (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), 0);
+   return (guint)client->priv->limit;
+}
+
+/**
+ * push_gcm_client_get_max_in_flight:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Fetches the "max-in-flight" property.
+ *
+ * Returns: The upper bound of the in-flight limit.
+ */
+guint
+push_gcm_client_get_max_in_flight (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), 0);
+   return client->priv->max_in_flight;
+}
+
+/**
+ * push_gcm_client_set_max_in_flight:
+ * @client: (in): A #PushGcmClient.
+ * @max_in_flight: (in): The maximum number of requests in flight.
+ *
+ * Sets the upper bound of #PushGcmClient:in-flight-limit. The current
+ * limit is lowered right away if it exceeds @max_in_flight.
+ */
+void
+push_gcm_client_set_max_in_flight (PushGcmClient *client,
+                                   guint          max_in_flight)
+{
+   PushGcmClientPrivate *priv;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
+   g_return_if_fail(max_in_flight > 0);
+
+   priv = client->priv;
+   priv->max_in_flight = max_in_flight;
+   g_object_notify_by_pspec(G_OBJECT(client),
+                            gParamSpecs[PROP_MAX_IN_FLIGHT]);
+
+   if (priv->limit > max_in_flight) {
+      priv->limit = max_in_flight;
+      g_object_notify_by_pspec(G_OBJECT(client),
+                               gParamSpecs[PROP_IN_FLIGHT_LIMIT]);
+   }
+
+   EXIT;
+}
+
+/**
+ * push_gcm_client_get_max_parallel:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Fetches the "max-parallel" property.
+ *
+ * Returns: The maximum number of concurrent requests per delivery.
+ */
+guint
+push_gcm_client_get_max_parallel (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), 0);
+   return client->priv->max_parallel;
+}
+
+/**
+ * push_gcm_client_set_max_parallel:
+ * @client: (in): A #PushGcmClient.
+ * @max_parallel: (in): The maximum number of concurrent requests.
+ *
+ * Sets the number of requests a single call to
+ * push_gcm_client_deliver_async() may have in flight at once when the
+ * identities do not fit in a single request.
+ */
+void
+push_gcm_client_set_max_parallel (PushGcmClient *client,
+                                  guint          max_parallel)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
+   g_return_if_fail(max_parallel > 0);
+   client->priv->max_parallel = max_parallel;
+   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_MAX_PARALLEL]);
+   EXIT;
+}
+
+/**
+ * push_gcm_client_get_max_retries:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Fetches the "max-retries" property.
+ *
+ * Returns: The number of times a registration id is retried.
+ */
+guint
+push_gcm_client_get_max_retries (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), 0);
+   return client->priv->max_retries;
+}
+
+/**
+ * push_gcm_client_set_max_retries:
+ * @client: (in): A #PushGcmClient.
+ * @max_retries: (in): The number of retries.
+ *
+ * Sets the number of times delivery to a registration id is retried after
+ * a transient failure. Set to zero to disable retries.
+ */
+void
+push_gcm_client_set_max_retries (PushGcmClient *client,
+                                 guint          max_retries)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
+   client->priv->max_retries = max_retries;
+   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_MAX_RETRIES]);
+   EXIT;
+}
+
+/**
+ * push_gcm_client_get_queue_depth:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Fetches the number of requests waiting for the in-flight limit to
+ * allow them to be sent. Requests waiting to be retried are not counted.
+ *
+ * Returns: A #guint.
+ */
+guint
+push_gcm_client_get_queue_depth (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), 0);
+   return g_queue_get_length(client->priv->queue);
+}
+
+/*
+ * A canonical registration id remembered for an old one. Entries are
+ * kept in least recently used order in remap_lru so that the oldest can
+ * be dropped once remap-capacity is reached.
+ */
+typedef struct
+{
+   gchar *registration_id;
+   gchar *canonical;
+   GList  link;
+} PushGcmRemap;
+
+static void
+push_gcm_remap_free (PushGcmRemap *remap)
+{
+   g_free(remap->registration_id);
+   g_free(remap->canonical);
+   g_slice_free(PushGcmRemap, remap);
+}
+
+/*
+ * Drops the least recently used canonical registration ids until at most
+ * @capacity are remembered.
+ */
+static void
+push_gcm_client_trim_remap (PushGcmClient *client,
+                            guint          capacity)
+{
+   PushGcmClientPrivate *priv = client->priv;
+   PushGcmRemap *remap;
+   GList *link;
+
+   while (priv->remap_lru.length > capacity) {
+      link = g_queue_pop_tail_link(&priv->remap_lru);
+      remap = link->data;
+      g_hash_table_remove(priv->remap, remap->registration_id);
+   }
+}
+
+static void
+push_gcm_client_add_remap (PushGcmClient *client,
+                           const gchar   *registration_id,
+                           const gchar   *canonical)
+{
+   PushGcmClientPrivate *priv = client->priv;
+   PushGcmRemap *remap;
+
+   if ((remap = g_hash_table_lookup(priv->remap, registration_id))) {
+      g_free(remap->canonical);
+      remap->canonical = g_strdup(canonical);
+      g_queue_unlink(&priv->remap_lru, &remap->link);
+   } else {
+      remap = g_slice_new0(PushGcmRemap);
+      remap->registration_id = g_strdup(registration_id);
+      remap->canonical = g_strdup(canonical);
+      remap->link.data = remap;
+      g_hash_table_insert(priv->remap, remap->registration_id, remap);
+   }
+
+   g_queue_push_head_link(&priv->remap_lru, &remap->link);
+   push_gcm_client_trim_remap(client, priv->remap_capacity);
+}
+
+/**
+ * push_gcm_client_get_remap_capacity:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Fetches the "remap-capacity" property, the maximum number of canonical
+ * registration ids remembered when #PushGcmClient:remap-identities is
+ * enabled.
+ *
+ * Returns: A #guint.
+ */
+guint
+push_gcm_client_get_remap_capacity (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), 0);
+   return client->priv->remap_capacity;
+}
+
+/**
+ * push_gcm_client_set_remap_capacity:
+ * @client: (in): A #PushGcmClient.
+ * @remap_capacity: (in): The maximum number of remembered ids.
+ *
+ * Sets the maximum number of canonical registration ids remembered. Once
+ * reached, the least recently used one is forgotten. Lowering the
+ * capacity forgets the excess immediately.
+ */
+void
+push_gcm_client_set_remap_capacity (PushGcmClient *client,
+                                    guint          remap_capacity)
+{
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
+   g_return_if_fail(remap_capacity > 0);
+
+   client->priv->remap_capacity = remap_capacity;
+   push_gcm_client_trim_remap(client, remap_capacity);
+   g_object_notify_by_pspec(G_OBJECT(client),
+                            gParamSpecs[PROP_REMAP_CAPACITY]);
+
+   EXIT;
+}
+
+/**
+ * push_gcm_client_get_remap_identities:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Fetches the "remap-identities" property.
+ *
+ * Returns: %TRUE if canonical registration ids are remembered.
+ */
+gboolean
+push_gcm_client_get_remap_identities (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), FALSE);
+   return client->priv->remap_identities;
+}
+
+/**
+ * push_gcm_client_set_remap_identities:
+ * @client: (in): A #PushGcmClient.
+ * @remap_identities: (in): If canonical registration ids are remembered.
+ *
+ * Sets if the client should remember the canonical registration ids
+ * returned by GCM. Later deliveries to an old registration id are then
+ * sent to the canonical one instead. Disabling it forgets the
+ * registration ids remembered so far.
+ */
+void
+push_gcm_client_set_remap_identities (PushGcmClient *client,
+                                      gboolean       remap_identities)
+{
+   PushGcmClientPrivate *priv;
+
+   ENTRY;
+
+   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
+
+   priv = client->priv;
+   priv->remap_identities = !!remap_identities;
+
+   if (!priv->remap_identities) {
+      push_gcm_client_trim_remap(client, 0);
+   }
+
+   g_object_notify_by_pspec(G_OBJECT(client),
+                            gParamSpecs[PROP_REMAP_IDENTITIES]);
+
+   EXIT;
+}
+
+/**
+ * push_gcm_client_get_url:
+ * @client: (in): A #PushGcmClient.
+ *
+ * Fetches the "url" property, the URL that GCM requests are posted to.
+ *
+ * Returns: A string which should not be modified or freed.
+ */
+const gchar *
+push_gcm_client_get_url (PushGcmClient *client)
+{
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), NULL);
+   return client->priv->url;
+}
+
+/**
+ * push_gcm_client_set_url:
+ * @client: (in): A #PushGcmClient.
+ * @url: (in) (allow-none): A URL or %NULL for the default.
+ *
+ * Sets the "url" property. It defaults to Google's GCM endpoint and only
+ * needs to be changed to go through a proxy or to test against a local
+ * server. Requests that were already sent are not affected.
+ */
+void
+push_gcm_client_set_url (PushGcmClient *client,
+                         const gchar   *url)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
+   g_free(client->priv->url);
+   client->priv->url = g_strdup(url ? url : PUSH_GCM_CLIENT_URL);
+   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_URL]);
+   EXIT;
+}
+
+/*
+ * Returns the registration id to send to for @identity, taking
+ * canonical registration ids remembered by the client into account.
+ */
+static const gchar *
+push_gcm_client_get_registration_id (PushGcmClient   *client,
+                                     PushGcmIdentity *identity)
+{
+   PushGcmClientPrivate *priv = client->priv;
+   const gchar *registration_id;
+   PushGcmRemap *remap;
+
+   registration_id = push_gcm_identity_get_registration_id(identity);
+
+   if (registration_id &&
+       priv->remap_identities &&
+       (remap = g_hash_table_lookup(priv->remap, registration_id))) {
+      g_queue_unlink(&priv->remap_lru, &remap->link);
+      g_queue_push_head_link(&priv->remap_lru, &remap->link);
+      return remap->canonical;
+   }
+
+   return registration_id;
+}
+
+/*
+ * State shared by the requests of a single call to
+ * push_gcm_client_deliver_async(). The identities are split into chunks
+ * of at most PUSH_GCM_CLIENT_MAX_IDS which are submitted in parallel.
+ * Chunks that are retried stay active until their last attempt is done.
+ */
+typedef struct
+{
+   PushGcmClient      *client;
+   GSimpleAsyncResult *simple;
+   PushGcmMessage     *message;
+   GCancellable       *cancellable;
+   GList              *identities;
+   GList              *next;
+   guint               next_index;
+   guint               n_active;
+   GPtrArray          *results;
+   GError             *error;
+} PushGcmDelivery;
+
+/*
+ * An identity left out of a request because its canonical registration id
+ * is already part of it. It receives a copy of the result at @target.
+ */
+typedef struct
+{
+   PushGcmIdentity *identity;
+   guint            index;
+   guint            target;
+} PushGcmAlias;
+
+/*
+ * A request for part of a delivery. @indices holds the position of each
+ * identity within the delivery, where its result is stored. @aliases is
+ * filled in when the request is built.
+ */
+typedef struct
+{
+   PushGcmDelivery *delivery;
+   GPtrArray       *identities;
+   GArray          *indices;
+   GArray          *aliases;
+   guint            attempt;
+   gint64           sent_at;
+} PushGcmChunk;
+
+static void push_gcm_client_submit (PushGcmDelivery *delivery);
+
+static void
+push_gcm_delivery_free (PushGcmDelivery *delivery)
+{
+   ENTRY;
+
+   g_object_unref(delivery->client);
+   g_object_unref(delivery->simple);
+   g_object_unref(delivery->message);
+   if (delivery->cancellable) {
+      g_object_unref(delivery->cancellable);
+   }
+   g_list_foreach(delivery->identities, (GFunc)g_object_unref, NULL);
+   g_list_free(delivery->identities);
+   g_ptr_array_unref(delivery->results);
+   g_clear_error(&delivery->error);
+   g_slice_free(PushGcmDelivery, delivery);
+
+   EXIT;
+}
+
+static PushGcmChunk *
+push_gcm_chunk_new (PushGcmDelivery *delivery,
+                    guint            attempt)
+{
+   PushGcmChunk *chunk;
+
+   chunk = g_slice_new0(PushGcmChunk);
+   chunk->delivery = delivery;
+   chunk->identities = g_ptr_array_new();
+   chunk->indices = g_array_new(FALSE, FALSE, sizeof(guint));
+   chunk->aliases = g_array_new(FALSE, FALSE, sizeof(PushGcmAlias));
+   chunk->attempt = attempt;
+
+   return chunk;
+}
+
+static void
+push_gcm_chunk_free (PushGcmChunk *chunk)
+{
+   g_ptr_array_unref(chunk->identities);
+   g_array_unref(chunk->indices);
+   g_array_unref(chunk->aliases);
+   g_slice_free(PushGcmChunk, chunk);
+}
+
+static void
+push_gcm_chunk_add (PushGcmChunk    *chunk,
+                    PushGcmIdentity *identity,
+                    guint            index)
+{
+   g_ptr_array_add(chunk->identities, identity);
+   g_array_append_val(chunk->indices, index);
+}
+
+/*
+ * Stores the result for the identity at @index, replacing the result of
+ * an earlier attempt.
+ */
+static void
+push_gcm_delivery_set_result (PushGcmDelivery *delivery,
+                              guint            index,
+                              PushGcmResult   *result)
+{
+   if (delivery->results->pdata[index]) {
+      push_gcm_result_unref(delivery->results->pdata[index]);
+   }
+   delivery->results->pdata[index] = result;
+}
+
+/*
+ * Records @error as the result of @delivery unless an earlier chunk has
+ * already failed. Only the first failure is reported, but the remaining
+ * chunks are still delivered.
+ */
+static void
+push_gcm_delivery_take_error (PushGcmDelivery *delivery,
+                              GError          *error)
+{
+   if (!delivery->error) {
+      delivery->error = error;
+   } else {
+      g_error_free(error);
+   }
+}
+
+typedef struct
+{
+   PushGcmClient *client;
+   PushGcmChunk  *chunk;
+   PushGcmChunk  *retry;
+} PushGcmParseState;
+
+static void
+push_gcm_client_apply_result (PushGcmParseState  *state,
+                              PushGcmIdentity    *identity,
+                              guint               index,
+                              const gchar        *message_id,
+                              const gchar        *registration_id,
+                              PushGcmClientError  code)
+{
+   PushGcmClientPrivate *priv;
+   PushGcmIdentity *canonical;
+   PushGcmChunk *chunk = state->chunk;
+
+   g_assert(PUSH_IS_GCM_IDENTITY(identity));
+
+   /*
+    * An alias may already be using the canonical id it shares.
+    */
+   if (registration_id && *registration_id &&
+       g_strcmp0(push_gcm_identity_get_registration_id(identity),
+                 registration_id)) {
+      priv = state->client->priv;
+      if (priv->remap_identities &&
+          push_gcm_identity_get_registration_id(identity)) {
+         push_gcm_client_add_remap(
+               state->client,
+               push_gcm_identity_get_registration_id(identity),
+               registration_id);
+      }
+      canonical = push_gcm_identity_new(registration_id);
+      g_signal_emit(state->client, gSignals[IDENTITY_CHANGED], 0,
+                    identity, canonical);
+      g_object_unref(canonical);
+   }
+
+   push_gcm_delivery_set_result(chunk->delivery, index,
+                                _push_gcm_result_new(identity,
+                                                     message_id,
+                                                     registration_id,
+                                                     code));
+
+   switch (code) {
+   case PUSH_GCM_CLIENT_ERROR_MISSING_REGISTRATION:
+   case PUSH_GCM_CLIENT_ERROR_INVALID_REGISTRATION:
+   case PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED:
+      g_signal_emit(state->client, gSignals[IDENTITY_REMOVED], 0, identity);
+      break;
+   case PUSH_GCM_CLIENT_ERROR_UNAVAILABLE:
+   case PUSH_GCM_CLIENT_ERROR_INTERNAL_SERVER_ERROR:
+      push_gcm_chunk_add(state->retry, identity, index);
+      break;
+   default:
+      break;
+   }
+}
+
+static void
+push_gcm_client_parse_result (guint               i,
+                              const gchar        *message_id,
+                              const gchar        *registration_id,
+                              PushGcmClientError  code,
+                              gpointer            user_data)
+{
+   PushGcmParseState *state = user_data;
+   PushGcmChunk *chunk = state->chunk;
+   PushGcmAlias *alias;
+   guint j;
+
+   if (i >= chunk->identities->len) {
+      return;
+   }
+
+   push_gcm_client_apply_result(state,
+                                g_ptr_array_index(chunk->identities, i),
+                                g_array_index(chunk->indices, guint, i),
+                                message_id,
+                                registration_id,
+                                code);
+
+   for (j = 0; j < chunk->aliases->len; j++) {
+      alias = &g_array_index(chunk->aliases, PushGcmAlias, j);
+      if (alias->target == i) {
+         push_gcm_client_apply_result(state,
+                                      alias->identity,
+                                      alias->index,
+                                      message_id,
+                                      registration_id,
+                                      code);
+      }
+   }
+}
+
+/*
+ * Matches the "results" array of a GCM response with the identities of
+ * the chunk it was sent for and stores a #PushGcmResult for each of them.
+ * Identities that GCM could not deliver to because of a transient failure
+ * are added to @retry. The body is scanned in place rather than loaded
+ * into a JsonParser.
+ */
+static gboolean
+push_gcm_client_parse_results (PushGcmClient  *client,
+                               SoupMessage    *message,
+                               PushGcmChunk   *chunk,
+                               PushGcmChunk   *retry,
+                               GError        **error)
+{
+   PushGcmParseState state;
+   gboolean ret;
+
+   ENTRY;
+
+   if (!message->response_body->data || !message->response_body->length) {
+      g_set_error(error,
+                  SOUP_HTTP_ERROR,
+                  SOUP_STATUS_IO_ERROR,
+                  _("No data was received from GCM."));
+      RETURN(FALSE);
+   }
+
+   state.client = client;
+   state.chunk = chunk;
+   state.retry = retry;
+
+   ret = push_gcm_response_parse(message->response_body->data,
+                                 message->response_body->length,
+                                 push_gcm_client_parse_result,
+                                 &state,
+                                 error);
+
+   RETURN(ret);
+}
+
+/*
+ * Parses the Retry-After header of @message, which holds either a number
+ * of seconds or an HTTP date. Returns the delay in milliseconds, or 0 if
+ * the header is missing or invalid.
+ */
+static guint
+push_gcm_client_get_retry_after (SoupMessage *message)
+{
+   const gchar *str;
+   SoupDate *date;
+   gchar *end = NULL;
+   gint64 seconds;
+
+   if (!(str = soup_message_headers_get_one(message->response_headers,
+                                            "Retry-After"))) {
+      return 0;
+   }
+
+   seconds = g_ascii_strtoll(str, &end, 10);
+
+   if (end == str) {
+      if (!(date = soup_date_new_from_string(str))) {
+         return 0;
+      }
+      seconds = soup_date_to_time_t(date) -
+                (g_get_real_time() / G_USEC_PER_SEC);
+      soup_date_free(date);
+   }
+
+   /*
+    * Only guard against overflowing the delay in milliseconds, GCM may ask
+    * for a longer wait than our own backoff would use.
+    */
+   return CLAMP(seconds, 0, G_MAXUINT / 1000) * 1000;
 }
 
-const gchar *
-push_gcm_client_get_auth_token (PushGcmClient *client)
+/*
+ * Computes the delay before retry @attempt using exponential backoff with
+ * jitter, so that clients retrying at the same time spread out.
+ */
+static guint
+push_gcm_client_get_backoff (guint attempt)
 {
-   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), NULL);
-   return client->priv->auth_token;
+   guint delay;
+
+   delay = PUSH_GCM_CLIENT_BACKOFF_MIN << MIN(attempt, 16);
+   delay = MIN(delay, PUSH_GCM_CLIENT_BACKOFF_MAX);
+
+   return g_random_int_range(delay / 2, delay + 1);
 }
 
-void
-push_gcm_client_set_auth_token (PushGcmClient *client,
-                                const gchar   *auth_token)
+static void push_gcm_client_dispatch   (PushGcmClient *client);
+static void push_gcm_client_send_chunk (PushGcmClient *client,
+                                        PushGcmChunk  *chunk);
+
+static gboolean
+push_gcm_client_retry_cb (gpointer user_data)
 {
+   PushGcmDelivery *delivery;
+   PushGcmChunk *chunk = user_data;
+
    ENTRY;
-   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
-   g_free(client->priv->auth_token);
-   client->priv->auth_token = g_strdup(auth_token);
-   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_AUTH_TOKEN]);
-   EXIT;
+
+   delivery = chunk->delivery;
+
+   if (delivery->cancellable &&
+       g_cancellable_is_cancelled(delivery->cancellable)) {
+      push_gcm_chunk_free(chunk);
+      delivery->n_active--;
+      push_gcm_client_submit(delivery);
+   } else {
+      push_gcm_client_send_chunk(delivery->client, chunk);
+   }
+
+   RETURN(FALSE);
 }
 
+/*
+ * Adjusts the in-flight limit after the request for @chunk completed with
+ * @status_code. The limit grows by 1/limit for each successful request,
+ * which is about one request per round trip, and is halved on a server
+ * error, a 429 or a latency spike. Requests that were sent before the
+ * last decrease do not decrease the limit again, so a burst of failures
+ * only halves it once.
+ */
 static void
-_push_gcm_identities_free (gpointer data)
+push_gcm_client_update_limit (PushGcmClient *client,
+                              PushGcmChunk  *chunk,
+                              guint          status_code)
 {
-   ENTRY;
-   g_list_foreach(data, (GFunc)g_object_unref, NULL);
-   g_list_free(data);
-   EXIT;
+   PushGcmClientPrivate *priv;
+   gboolean congested;
+   gdouble latency;
+   guint old_limit;
+
+   priv = client->priv;
+   old_limit = priv->limit;
+   latency = g_get_monotonic_time() - chunk->sent_at;
+   congested = (SOUP_STATUS_IS_SERVER_ERROR(status_code) ||
+                (status_code == PUSH_GCM_CLIENT_STATUS_429));
+
+   if (status_code == SOUP_STATUS_OK) {
+      if ((priv->latency > 0) &&
+          (latency > (priv->latency * PUSH_GCM_CLIENT_LATENCY_MULT))) {
+         congested = TRUE;
+      }
+      priv->latency = (priv->latency > 0) ?
+                      (priv->latency + ((latency - priv->latency) / 8.0)) :
+                      latency;
+   }
+
+   if (congested) {
+      if (chunk->sent_at > priv->last_decrease) {
+         priv->limit = MAX(1.0, priv->limit / 2.0);
+         priv->last_decrease = g_get_monotonic_time();
+      }
+   } else if (status_code == SOUP_STATUS_OK) {
+      priv->limit = MIN(priv->max_in_flight,
+                        priv->limit + (1.0 / priv->limit));
+   }
+
+   if ((guint)priv->limit != old_limit) {
+      g_object_notify_by_pspec(G_OBJECT(client),
+                               gParamSpecs[PROP_IN_FLIGHT_LIMIT]);
+   }
 }
 
 static void
@@ -109,119 +920,350 @@ push_gcm_client_deliver_cb (SoupSession *session,
                             SoupMessage *message,
                             gpointer     user_data)
 {
-   GSimpleAsyncResult *simple = user_data;
-   const gchar *str;
-   JsonObject *obj;
-   JsonParser *p = NULL;
-   JsonArray *ar;
-   JsonNode *root;
-   JsonNode *node;
-   gboolean removed;
+   PushGcmClientPrivate *priv;
+   PushGcmDelivery *delivery;
+   PushGcmChunk *chunk = user_data;
+   PushGcmChunk *retry;
+   PushGcmAlias *alias;
    GError *error = NULL;
-   GList *list;
-   gsize length;
+   guint delay;
    guint i;
 
    ENTRY;
 
    g_assert(SOUP_IS_SESSION(session));
    g_assert(SOUP_IS_MESSAGE(message));
-   g_assert(G_IS_SIMPLE_ASYNC_RESULT(simple));
+   g_assert(chunk);
+
+   priv = PUSH_GCM_CLIENT(session)->priv;
+   delivery = chunk->delivery;
+   retry = push_gcm_chunk_new(delivery, chunk->attempt + 1);
+
+   /*
+    * Let queued requests take the place of this one.
+    */
+   priv->n_in_flight--;
+   push_gcm_client_update_limit(PUSH_GCM_CLIENT(session),
+                                chunk,
+                                message->status_code);
+   push_gcm_client_dispatch(PUSH_GCM_CLIENT(session));
 
    switch (message->status_code) {
    case SOUP_STATUS_OK:
+      push_gcm_client_parse_results(PUSH_GCM_CLIENT(session),
+                                    message,
+                                    chunk,
+                                    retry,
+                                    &error);
       break;
    case SOUP_STATUS_BAD_REQUEST:
       /*
        * TODO: Log that there was a JSON encoding error likely.
        */
+      push_gcm_client_parse_results(PUSH_GCM_CLIENT(session),
+                                    message,
+                                    chunk,
+                                    retry,
+                                    &error);
       break;
    case SOUP_STATUS_UNAUTHORIZED:
-      g_simple_async_result_set_error(simple,
-                                      SOUP_HTTP_ERROR,
-                                      message->status_code,
-                                      _("GCM request unauthorized."));
-      GOTO(failure);
+      g_set_error(&error,
+                  SOUP_HTTP_ERROR,
+                  message->status_code,
+                  _("GCM request unauthorized."));
+      break;
    default:
-      if (SOUP_STATUS_IS_SERVER_ERROR(message->status_code) &&
-          (str = soup_message_headers_get_one(message->response_headers,
-                                              "Retry-After"))) {
+      if ((SOUP_STATUS_IS_SERVER_ERROR(message->status_code) ||
+           SOUP_STATUS_IS_TRANSPORT_ERROR(message->status_code) ||
+           (message->status_code == PUSH_GCM_CLIENT_STATUS_429)) &&
+          (message->status_code != SOUP_STATUS_CANCELLED)) {
          /*
-          * TODO: Implement exponential back-off.
+          * The whole request failed, resend it with every identity.
           */
+         for (i = 0; i < chunk->identities->len; i++) {
+            push_gcm_chunk_add(retry,
+                               chunk->identities->pdata[i],
+                               g_array_index(chunk->indices, guint, i));
+         }
+         for (i = 0; i < chunk->aliases->len; i++) {
+            alias = &g_array_index(chunk->aliases, PushGcmAlias, i);
+            push_gcm_chunk_add(retry, alias->identity, alias->index);
+         }
+      } else {
+         g_set_error(&error,
+                     SOUP_HTTP_ERROR,
+                     message->status_code,
+                     _("Unknown failure occurred."));
       }
-      g_simple_async_result_set_error(simple,
-                                      SOUP_HTTP_ERROR,
-                                      message->status_code,
-                                      _("Unknown failure occurred."));
       break;
    }
 
-   if (!message->response_body->data || !message->response_body->length) {
-      g_simple_async_result_set_error(simple,
-                                      SOUP_HTTP_ERROR,
-                                      SOUP_STATUS_IO_ERROR,
-                                      _("No data was received from GCM."));
-      GOTO(failure);
-   }
-
-   p = json_parser_new();
-
-   if (!json_parser_load_from_data(p,
-                                   message->response_body->data,
-                                   message->response_body->length,
-                                   &error)) {
-      g_simple_async_result_take_error(simple, error);
-      GOTO(failure);
-   }
-
-   list = g_object_get_data(G_OBJECT(simple), "identities");
-
-   if ((root = json_parser_get_root(p)) &&
-       JSON_NODE_HOLDS_OBJECT(root) &&
-       (obj = json_node_get_object(root)) &&
-       json_object_has_member(obj, "results") &&
-       (node = json_object_get_member(obj, "results")) &&
-       JSON_NODE_HOLDS_ARRAY(node) &&
-       (ar = json_node_get_array(node))) {
-      length = json_array_get_length(ar);
-      for (i = 0; i < length && list; i++, list = list->next) {
-         /*
-          * TODO: Handle the case that the device_token has been renamed.
-          */
-         removed = FALSE;
-         if ((obj = json_array_get_object_element(ar, i)) &&
-             json_object_has_member(obj, "error") &&
-             (node = json_object_get_member(obj, "error")) &&
-             JSON_NODE_HOLDS_VALUE(node) &&
-             (str = json_node_get_string(node))) {
-            if (!g_strcmp0(str, "MissingRegistration")) {
-               removed = TRUE;
-            } else if (!g_strcmp0(str, "InvalidRegistration")) {
-               removed = TRUE;
-            } else if (!g_strcmp0(str, "MismatchSenderId")) {
-            } else if (!g_strcmp0(str, "NotRegistered")) {
-               removed = TRUE;
-            } else if (!g_strcmp0(str, "MessageTooBig")) {
-            } else if (!g_strcmp0(str, "InvalidDataKey")) {
-            } else if (!g_strcmp0(str, "InvalidTtl")) {
-            }
-
-            if (removed) {
-               g_assert(PUSH_IS_GCM_IDENTITY(list->data));
-               g_signal_emit(session, gSignals[IDENTITY_REMOVED], 0, list->data);
-            }
-         }
+   if (error) {
+      push_gcm_delivery_take_error(delivery, error);
+   }
+
+   if (retry->identities->len && (chunk->attempt < priv->max_retries)) {
+      /*
+       * Honour Retry-After if GCM provided one, otherwise back off
+       * exponentially. The retry keeps the delivery active.
+       */
+      if (!(delay = push_gcm_client_get_retry_after(message))) {
+         delay = push_gcm_client_get_backoff(chunk->attempt);
+      }
+      delivery->n_active++;
+      g_timeout_add(delay, push_gcm_client_retry_cb, retry);
+   } else {
+      if (retry->identities->len) {
+         push_gcm_delivery_take_error(
+               delivery,
+               g_error_new(SOUP_HTTP_ERROR,
+                           SOUP_STATUS_SERVICE_UNAVAILABLE,
+                           _("GCM was unavailable for %u registration ids "
+                             "after %u retries."),
+                           retry->identities->len,
+                           priv->max_retries));
+      }
+      push_gcm_chunk_free(retry);
+   }
+
+   push_gcm_chunk_free(chunk);
+
+   delivery->n_active--;
+   push_gcm_client_submit(delivery);
+
+   EXIT;
+}
+
+/*
+ * Builds the request body for @chunk. The registration ids are escaped
+ * straight into a buffer sized for the whole body, followed by the
+ * serialized options and data cached by @message.
+ *
+ * When canonical registration ids are remembered, several identities of
+ * the chunk may map to the same id. Only the first of them is sent, the
+ * others are moved to the aliases of @chunk and share its result.
+ */
+static SoupMessage *
+push_gcm_client_build_request (PushGcmClient  *client,
+                               PushGcmChunk   *chunk,
+                               PushGcmMessage *message)
+{
+   PushGcmIdentity *identity;
+   const gchar *registration_id;
+   PushGcmAlias alias;
+   SoupMessage *request;
+   GHashTable *seen = NULL;
+   GPtrArray *ids;
+   gpointer target;
+   GString *body;
+   GBytes *bytes;
+   gchar *str;
+   gsize length;
+   gsize size;
+   guint n_ids = 0;
+   guint i;
+
+   request = soup_message_new("POST", client->priv->url);
+
+   str = g_strdup_printf("key=%s", client->priv->auth_token);
+   soup_message_headers_append(request->request_headers, "Authorization", str);
+   g_free(str);
+
+   soup_message_headers_append(request->request_headers,
+                               "Accept",
+                               "application/json");
+
+   bytes = _push_gcm_message_get_bytes(message);
+
+   if (client->priv->remap_identities) {
+      seen = g_hash_table_new(g_str_hash, g_str_equal);
+   }
+
+   /*
+    * {"registration_ids":[ ... ], ... }
+    */
+   size = 25 + g_bytes_get_size(bytes);
+   ids = g_ptr_array_sized_new(chunk->identities->len);
+   for (i = 0; i < chunk->identities->len; i++) {
+      identity = chunk->identities->pdata[i];
+      g_assert(PUSH_IS_GCM_IDENTITY(identity));
+      registration_id = push_gcm_client_get_registration_id(client, identity);
+      if (!registration_id) {
+         registration_id = "";
+      }
+      if (seen && g_hash_table_lookup_extended(seen, registration_id,
+                                               NULL, &target)) {
+         alias.identity = identity;
+         alias.index = g_array_index(chunk->indices, guint, i);
+         alias.target = GPOINTER_TO_UINT(target);
+         g_array_append_val(chunk->aliases, alias);
+         continue;
+      }
+      if (seen) {
+         g_hash_table_insert(seen, (gchar *)registration_id,
+                             GUINT_TO_POINTER(n_ids));
+      }
+      chunk->identities->pdata[n_ids] = identity;
+      g_array_index(chunk->indices, guint, n_ids) =
+         g_array_index(chunk->indices, guint, i);
+      g_ptr_array_add(ids, (gchar *)registration_id);
+      size += push_json_escaped_size(registration_id, -1) + 3;
+      n_ids++;
+   }
+   g_ptr_array_set_size(chunk->identities, n_ids);
+   g_array_set_size(chunk->indices, n_ids);
+
+   body = g_string_sized_new(size);
+   g_string_append(body, "{\"registration_ids\":[");
+   for (i = 0; i < ids->len; i++) {
+      if (i) {
+         g_string_append_c(body, ',');
+      }
+      push_json_append_string(body, ids->pdata[i]);
+   }
+   g_string_append(body, "],");
+   g_string_append_len(body,
+                       g_bytes_get_data(bytes, NULL),
+                       g_bytes_get_size(bytes));
+   g_string_append_c(body, '}');
+
+   g_ptr_array_unref(ids);
+   if (seen) {
+      g_hash_table_unref(seen);
+   }
+
+   length = body->len;
+   soup_message_set_request(request,
+                            "application/json",
+                            SOUP_MEMORY_TAKE,
+                            g_string_free(body, FALSE),
+                            length);
+
+   return request;
+}
+
+/*
+ * Hands queued chunks to the session until the in-flight limit is
+ * reached. Chunks of cancelled deliveries are dropped without being
+ * sent.
+ */
+static void
+push_gcm_client_dispatch (PushGcmClient *client)
+{
+   PushGcmClientPrivate *priv;
+   PushGcmDelivery *delivery;
+   PushGcmChunk *chunk;
+   SoupMessage *request;
+
+   ENTRY;
+
+   priv = client->priv;
+
+   /*
+    * Completing a cancelled delivery may drop the last reference to
+    * the client.
+    */
+   g_object_ref(client);
+
+   while ((priv->n_in_flight < (guint)priv->limit) &&
+          (chunk = g_queue_pop_head(priv->queue))) {
+      g_object_notify_by_pspec(G_OBJECT(client),
+                               gParamSpecs[PROP_QUEUE_DEPTH]);
+      delivery = chunk->delivery;
+      if (delivery->cancellable &&
+          g_cancellable_is_cancelled(delivery->cancellable)) {
+         push_gcm_chunk_free(chunk);
+         delivery->n_active--;
+         push_gcm_client_submit(delivery);
+         continue;
       }
+      request = push_gcm_client_build_request(client,
+                                              chunk,
+                                              delivery->message);
+      chunk->sent_at = g_get_monotonic_time();
+      priv->n_in_flight++;
+      soup_session_queue_message(SOUP_SESSION(client),
+                                 request,
+                                 push_gcm_client_deliver_cb,
+                                 chunk);
+   }
+
+   g_object_unref(client);
+
+   EXIT;
+}
+
+/*
+ * Queues the request for @chunk, to be sent once the in-flight limit
+ * allows it.
+ */
+static void
+push_gcm_client_send_chunk (PushGcmClient *client,
+                            PushGcmChunk  *chunk)
+{
+   g_queue_push_tail(client->priv->queue, chunk);
+   g_object_notify_by_pspec(G_OBJECT(client), gParamSpecs[PROP_QUEUE_DEPTH]);
+   push_gcm_client_dispatch(client);
+}
+
+/*
+ * Submits chunks until max-parallel requests are active, and completes
+ * the delivery once every chunk has finished.
+ */
+static void
+push_gcm_client_submit (PushGcmDelivery *delivery)
+{
+   PushGcmClientPrivate *priv;
+   PushGcmChunk *chunk;
+   GList *iter;
+   guint i;
+
+   ENTRY;
+
+   priv = delivery->client->priv;
+
+   if (delivery->cancellable &&
+       g_cancellable_is_cancelled(delivery->cancellable)) {
+      delivery->next = NULL;
    }
 
-   g_simple_async_result_set_op_res_gboolean(simple, TRUE);
+   while (delivery->next && (delivery->n_active < priv->max_parallel)) {
+      chunk = push_gcm_chunk_new(delivery, 0);
+
+      while (delivery->next &&
+             (chunk->identities->len < PUSH_GCM_CLIENT_MAX_IDS)) {
+         push_gcm_chunk_add(chunk,
+                            delivery->next->data,
+                            delivery->next_index++);
+         delivery->next = delivery->next->next;
+      }
+
+      delivery->n_active++;
+      push_gcm_client_send_chunk(delivery->client, chunk);
+   }
 
-failure:
-   g_simple_async_result_complete_in_idle(simple);
-   g_object_unref(simple);
-   if (p) {
-      g_object_unref(p);
+   if (!delivery->n_active) {
+      /*
+       * Identities without a result were part of a request that failed
+       * as a whole, or were never sent because of cancellation.
+       */
+      for (iter = delivery->identities, i = 0; iter; iter = iter->next, i++) {
+         if (!delivery->results->pdata[i]) {
+            delivery->results->pdata[i] =
+               _push_gcm_result_new(iter->data, NULL, NULL,
+                                    PUSH_GCM_CLIENT_ERROR_REQUEST_FAILED);
+         }
+      }
+      g_simple_async_result_set_op_res_gpointer(
+            delivery->simple,
+            g_ptr_array_ref(delivery->results),
+            (GDestroyNotify)g_ptr_array_unref);
+      if (delivery->error) {
+         g_simple_async_result_take_error(delivery->simple, delivery->error);
+         delivery->error = NULL;
+      }
+      g_simple_async_result_complete_in_idle(delivery->simple);
+      push_gcm_delivery_free(delivery);
    }
 
    EXIT;
@@ -238,6 +1280,17 @@ failure:
  *
  * Asynchronously deliver a #PushGcmMessage to one or more GCM enabled
  * devices.
+ *
+ * GCM accepts at most 1000 registration ids per request, so larger lists
+ * of identities are split into multiple requests. Up to
+ * #PushGcmClient:max-parallel of them are in flight at once. @callback is
+ * executed once every request has completed.
+ *
+ * Requests failing with a server error are retried, as are the
+ * registration ids GCM reports as "Unavailable" or "InternalServerError".
+ * Only the affected registration ids are sent again. A Retry-After header
+ * is honoured, otherwise retries back off exponentially with jitter, up to
+ * #PushGcmClient:max-retries times.
  */
 void
 push_gcm_client_deliver_async (PushGcmClient       *client,
@@ -247,22 +1300,7 @@ push_gcm_client_deliver_async (PushGcmClient       *client,
                                GAsyncReadyCallback  callback,
                                gpointer             user_data)
 {
-   PushGcmClientPrivate *priv;
-   GSimpleAsyncResult *simple;
-   SoupMessage *request;
-   const gchar *registration_id;
-   const gchar *collapse_key;
-   JsonGenerator *g;
-   JsonObject *obj;
-   JsonObject *data;
-   JsonObject *mdata;
-   JsonArray *ar;
-   JsonNode *node;
-   GList *iter;
-   GList *list;
-   gchar *str;
-   gsize length;
-   guint time_to_live;
+   PushGcmDelivery *delivery;
 
    ENTRY;
 
@@ -272,110 +1310,152 @@ push_gcm_client_deliver_async (PushGcmClient       *client,
    g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
    g_return_if_fail(callback);
 
-   priv = client->priv;
+   delivery = g_slice_new0(PushGcmDelivery);
+   delivery->client = g_object_ref(client);
+   delivery->simple =
+      g_simple_async_result_new(G_OBJECT(client), callback, user_data,
+                                push_gcm_client_deliver_async);
+   g_simple_async_result_set_check_cancellable(delivery->simple, cancellable);
+   delivery->message = g_object_ref(message);
+   delivery->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
 
-   request = soup_message_new("POST", PUSH_GCM_CLIENT_URL);
-   ar = json_array_new();
+   /*
+    * Keep the list of identities around until we receive our results.
+    * We need them to key with the resulting arrays.
+    */
+   delivery->identities = g_list_copy(identities);
+   g_list_foreach(delivery->identities, (GFunc)g_object_ref, NULL);
+   delivery->next = delivery->identities;
+   delivery->results =
+      g_ptr_array_new_with_free_func((GDestroyNotify)push_gcm_result_unref);
+   g_ptr_array_set_size(delivery->results,
+                        g_list_length(delivery->identities));
 
-   for (iter = identities; iter; iter = iter->next) {
-      g_assert(PUSH_IS_GCM_IDENTITY(iter->data));
-      registration_id = push_gcm_identity_get_registration_id(iter->data);
-      json_array_add_string_element(ar, registration_id);
-   }
+   push_gcm_client_submit(delivery);
 
-   str = g_strdup_printf("key=%s", priv->auth_token);
-   soup_message_headers_append(request->request_headers, "Authorization", str);
-   g_free(str);
+   EXIT;
+}
 
-   soup_message_headers_append(request->request_headers,
-                               "Accept",
-                               "application/json");
+gboolean
+push_gcm_client_deliver_finish (PushGcmClient  *client,
+                                GAsyncResult   *result,
+                                GError        **error)
+{
+   gboolean ret;
 
-   data = json_object_new();
+   ENTRY;
+   ret = push_gcm_client_deliver_finish_with_results(client, result,
+                                                     NULL, error);
+   RETURN(ret);
+}
 
-   if ((collapse_key = push_gcm_message_get_collapse_key(message))) {
-      json_object_set_string_member(data, "collapse_key", collapse_key);
-   }
+/**
+ * push_gcm_client_deliver_finish_with_results:
+ * @client: (in): A #PushGcmClient.
+ * @result: A #GAsyncResult.
+ * @results: (out) (allow-none) (element-type PushGcmResult): A location
+ *   for the results, or %NULL.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes a request to push_gcm_client_deliver_async() like
+ * push_gcm_client_deliver_finish(), additionally providing a
+ * #PushGcmResult for each identity. The results are in the same order as
+ * the identities passed to push_gcm_client_deliver_async() and are
+ * provided even if the delivery failed. The array should be freed with
+ * g_ptr_array_unref().
+ *
+ * Returns: %TRUE if every request was handled by GCM; otherwise %FALSE
+ *   and @error is set.
+ */
+gboolean
+push_gcm_client_deliver_finish_with_results (PushGcmClient  *client,
+                                             GAsyncResult   *result,
+                                             GPtrArray     **results,
+                                             GError        **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+   GPtrArray *ar;
+   gboolean ret;
 
-   json_object_set_boolean_member(data,
-                                  "delay_while_idle",
-                                  push_gcm_message_get_delay_while_idle(message));
+   ENTRY;
 
-   json_object_set_boolean_member(data,
-                                  "dry_run",
-                                  push_gcm_message_get_dry_run(message));
+   g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
 
-   if ((time_to_live = push_gcm_message_get_time_to_live(message))) {
-      json_object_set_int_member(data, "time_to_live", time_to_live);
-   }
+   ret = !g_simple_async_result_propagate_error(simple, error);
 
-   if ((mdata = push_gcm_message_get_data(message))) {
-      json_object_set_object_member(data, "data", mdata);
+   if (results) {
+      ar = g_simple_async_result_get_op_res_gpointer(simple);
+      *results = ar ? g_ptr_array_ref(ar) : g_ptr_array_new();
    }
 
-   obj = json_object_new();
-   json_object_set_array_member(obj, "registration_ids", ar);
-   json_object_set_object_member(obj, "data", data);
-
-   node = json_node_new(JSON_NODE_OBJECT);
-   json_node_set_object(node, obj);
-   json_object_unref(obj);
-
-   g = json_generator_new();
-   json_generator_set_pretty(g, TRUE);
-   json_generator_set_indent(g, 2);
-   json_generator_set_root(g, node);
-   str = json_generator_to_data(g, &length);
-   json_node_free(node);
-   g_object_unref(g);
-
-   g_print("REQUEST: \"%s\"\n", str);
-
-   soup_message_set_request(request,
-                            "application/json",
-                            SOUP_MEMORY_TAKE,
-                            str,
-                            length);
-
-   simple = g_simple_async_result_new(G_OBJECT(client), callback, user_data,
-                                      push_gcm_client_deliver_async);
+   RETURN(ret);
+}
 
-   /*
-    * Keep the list of identities around until we receive our result.
-    * We need them to key with the resulting array.
-    */
-   list = g_list_copy(identities);
-   g_list_foreach(list, (GFunc)g_object_ref, NULL);
-   g_object_set_data_full(G_OBJECT(simple),
-                          "identities",
-                          list,
-                          _push_gcm_identities_free);
-
-   soup_session_queue_message(SOUP_SESSION(client),
-                              request,
-                              push_gcm_client_deliver_cb,
-                              simple);
+GQuark
+push_gcm_client_error_quark (void)
+{
+   return g_quark_from_static_string("push-gcm-client-error-quark");
+}
 
+/**
+ * push_gcm_client_warm_up_async:
+ * @client: (in): A #PushGcmClient.
+ * @n_connections: (in): The number of connections to open.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: User data for @callback.
+ *
+ * Asynchronously opens up to @n_connections connections to GCM so that
+ * the first deliveries after startup or a quiet period do not have to
+ * wait for TCP and TLS handshakes. The connections are kept in the pool
+ * of @client until they have been idle for the "idle-timeout" of the
+ * session. The number of connections is limited by "max-conns-per-host".
+ *
+ * The requests used to open the connections are sent directly and do not
+ * count against #PushGcmClient:in-flight-limit, so a warm up while
+ * deliveries are in flight may briefly exceed it. Cancelling
+ * @cancellable cancels the requests that are still outstanding.
+ */
+void
+push_gcm_client_warm_up_async (PushGcmClient       *client,
+                               guint                n_connections,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+   ENTRY;
+   g_return_if_fail(PUSH_IS_GCM_CLIENT(client));
+   push_session_warm_up_async(SOUP_SESSION(client),
+                              client->priv->url,
+                              n_connections,
+                              cancellable,
+                              callback,
+                              user_data,
+                              push_gcm_client_warm_up_async);
    EXIT;
 }
 
+/**
+ * push_gcm_client_warm_up_finish:
+ * @client: (in): A #PushGcmClient.
+ * @result: A #GAsyncResult.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes a request to push_gcm_client_warm_up_async().
+ *
+ * Returns: %TRUE if at least one connection was opened.
+ */
 gboolean
-push_gcm_client_deliver_finish (PushGcmClient  *client,
+push_gcm_client_warm_up_finish (PushGcmClient  *client,
                                 GAsyncResult   *result,
                                 GError        **error)
 {
-   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
    gboolean ret;
 
    ENTRY;
-
    g_return_val_if_fail(PUSH_IS_GCM_CLIENT(client), FALSE);
-   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
-
-   if (!(ret = g_simple_async_result_get_op_res_gboolean(simple))) {
-      g_simple_async_result_propagate_error(simple, error);
-   }
-
+   ret = push_session_warm_up_finish(SOUP_SESSION(client), result, error);
    RETURN(ret);
 }
 
@@ -387,6 +1467,9 @@ push_gcm_client_finalize (GObject *object)
    ENTRY;
    priv = PUSH_GCM_CLIENT(object)->priv;
    g_free(priv->auth_token);
+   g_free(priv->url);
+   g_hash_table_unref(priv->remap);
+   g_queue_free(priv->queue);
    G_OBJECT_CLASS(push_gcm_client_parent_class)->finalize(object);
    EXIT;
 }
@@ -403,6 +1486,30 @@ push_gcm_client_get_property (GObject    *object,
    case PROP_AUTH_TOKEN:
       g_value_set_string(value, push_gcm_client_get_auth_token(client));
       break;
+   case PROP_IN_FLIGHT_LIMIT:
+      g_value_set_uint(value, push_gcm_client_get_in_flight_limit(client));
+      break;
+   case PROP_MAX_IN_FLIGHT:
+      g_value_set_uint(value, push_gcm_client_get_max_in_flight(client));
+      break;
+   case PROP_MAX_PARALLEL:
+      g_value_set_uint(value, push_gcm_client_get_max_parallel(client));
+      break;
+   case PROP_MAX_RETRIES:
+      g_value_set_uint(value, push_gcm_client_get_max_retries(client));
+      break;
+   case PROP_QUEUE_DEPTH:
+      g_value_set_uint(value, push_gcm_client_get_queue_depth(client));
+      break;
+   case PROP_REMAP_CAPACITY:
+      g_value_set_uint(value, push_gcm_client_get_remap_capacity(client));
+      break;
+   case PROP_REMAP_IDENTITIES:
+      g_value_set_boolean(value, push_gcm_client_get_remap_identities(client));
+      break;
+   case PROP_URL:
+      g_value_set_string(value, push_gcm_client_get_url(client));
+      break;
    default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
    }
@@ -420,6 +1527,25 @@ push_gcm_client_set_property (GObject      *object,
    case PROP_AUTH_TOKEN:
       push_gcm_client_set_auth_token(client, g_value_get_string(value));
       break;
+   case PROP_MAX_IN_FLIGHT:
+      push_gcm_client_set_max_in_flight(client, g_value_get_uint(value));
+      break;
+   case PROP_MAX_PARALLEL:
+      push_gcm_client_set_max_parallel(client, g_value_get_uint(value));
+      break;
+   case PROP_MAX_RETRIES:
+      push_gcm_client_set_max_retries(client, g_value_get_uint(value));
+      break;
+   case PROP_REMAP_CAPACITY:
+      push_gcm_client_set_remap_capacity(client, g_value_get_uint(value));
+      break;
+   case PROP_REMAP_IDENTITIES:
+      push_gcm_client_set_remap_identities(client,
+                                           g_value_get_boolean(value));
+      break;
+   case PROP_URL:
+      push_gcm_client_set_url(client, g_value_get_string(value));
+      break;
    default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
    }
@@ -448,6 +1574,117 @@ push_gcm_client_class_init (PushGcmClientClass *klass)
    g_object_class_install_property(object_class, PROP_AUTH_TOKEN,
                                    gParamSpecs[PROP_AUTH_TOKEN]);
 
+   gParamSpecs[PROP_IN_FLIGHT_LIMIT] =
+      g_param_spec_uint("in-flight-limit",
+                        _("In Flight Limit"),
+                        _("The number of requests that may currently be "
+                          "in flight."),
+                        1,
+                        G_MAXUINT,
+                        PUSH_GCM_CLIENT_LIMIT_START,
+                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_IN_FLIGHT_LIMIT,
+                                   gParamSpecs[PROP_IN_FLIGHT_LIMIT]);
+
+   gParamSpecs[PROP_MAX_IN_FLIGHT] =
+      g_param_spec_uint("max-in-flight",
+                        _("Max In Flight"),
+                        _("The upper bound of the in-flight limit."),
+                        1,
+                        G_MAXUINT,
+                        PUSH_SESSION_MAX_CONNS,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_MAX_IN_FLIGHT,
+                                   gParamSpecs[PROP_MAX_IN_FLIGHT]);
+
+   gParamSpecs[PROP_MAX_PARALLEL] =
+      g_param_spec_uint("max-parallel",
+                        _("Max Parallel"),
+                        _("The maximum number of concurrent requests "
+                          "for a single delivery."),
+                        1,
+                        G_MAXUINT,
+                        PUSH_GCM_CLIENT_MAX_PARALLEL,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_MAX_PARALLEL,
+                                   gParamSpecs[PROP_MAX_PARALLEL]);
+
+   gParamSpecs[PROP_MAX_RETRIES] =
+      g_param_spec_uint("max-retries",
+                        _("Max Retries"),
+                        _("The number of times a registration id is "
+                          "retried after a transient failure."),
+                        0,
+                        G_MAXUINT,
+                        PUSH_GCM_CLIENT_MAX_RETRIES,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_MAX_RETRIES,
+                                   gParamSpecs[PROP_MAX_RETRIES]);
+
+   gParamSpecs[PROP_QUEUE_DEPTH] =
+      g_param_spec_uint("queue-depth",
+                        _("Queue Depth"),
+                        _("The number of requests waiting to be sent."),
+                        0,
+                        G_MAXUINT,
+                        0,
+                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_QUEUE_DEPTH,
+                                   gParamSpecs[PROP_QUEUE_DEPTH]);
+
+   gParamSpecs[PROP_REMAP_CAPACITY] =
+      g_param_spec_uint("remap-capacity",
+                        _("Remap Capacity"),
+                        _("The maximum number of canonical registration "
+                          "ids to remember."),
+                        1,
+                        G_MAXUINT,
+                        PUSH_GCM_CLIENT_REMAP_MAX,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_REMAP_CAPACITY,
+                                   gParamSpecs[PROP_REMAP_CAPACITY]);
+
+   gParamSpecs[PROP_REMAP_IDENTITIES] =
+      g_param_spec_boolean("remap-identities",
+                           _("Remap Identities"),
+                           _("If deliveries to old registration ids should "
+                             "use the canonical registration id."),
+                           FALSE,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_REMAP_IDENTITIES,
+                                   gParamSpecs[PROP_REMAP_IDENTITIES]);
+
+   gParamSpecs[PROP_URL] =
+      g_param_spec_string("url",
+                          _("Url"),
+                          _("The URL GCM requests are posted to."),
+                          PUSH_GCM_CLIENT_URL,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_URL,
+                                   gParamSpecs[PROP_URL]);
+
+   /**
+    * PushGcmClient::identity-changed:
+    * @client: A #PushGcmClient.
+    * @identity: The #PushGcmIdentity that was delivered to.
+    * @canonical: A #PushGcmIdentity with the canonical registration id.
+    *
+    * Emitted when GCM reports that the device of @identity has a new
+    * canonical registration id. @identity should be replaced with
+    * @canonical in any persistent storage.
+    */
+   gSignals[IDENTITY_CHANGED] = g_signal_new("identity-changed",
+                                             PUSH_TYPE_GCM_CLIENT,
+                                             G_SIGNAL_RUN_FIRST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             g_cclosure_marshal_generic,
+                                             G_TYPE_NONE,
+                                             2,
+                                             PUSH_TYPE_GCM_IDENTITY,
+                                             PUSH_TYPE_GCM_IDENTITY);
+
    gSignals[IDENTITY_REMOVED] = g_signal_new("identity-removed",
                                              PUSH_TYPE_GCM_CLIENT,
                                              G_SIGNAL_RUN_FIRST,
@@ -470,5 +1707,16 @@ push_gcm_client_init (PushGcmClient *client)
       G_TYPE_INSTANCE_GET_PRIVATE(client,
                                   PUSH_TYPE_GCM_CLIENT,
                                   PushGcmClientPrivate);
+   client->priv->max_parallel = PUSH_GCM_CLIENT_MAX_PARALLEL;
+   client->priv->max_retries = PUSH_GCM_CLIENT_MAX_RETRIES;
+   client->priv->remap_capacity = PUSH_GCM_CLIENT_REMAP_MAX;
+   client->priv->remap = g_hash_table_new_full(
+         g_str_hash, g_str_equal, NULL,
+         (GDestroyNotify)push_gcm_remap_free);
+   client->priv->url = g_strdup(PUSH_GCM_CLIENT_URL);
+   client->priv->queue = g_queue_new();
+   client->priv->max_in_flight = PUSH_SESSION_MAX_CONNS;
+   client->priv->limit = PUSH_GCM_CLIENT_LIMIT_START;
+   push_session_configure(SOUP_SESSION(client));
    EXIT;
 }
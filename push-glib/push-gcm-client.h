@@ -27,6 +27,7 @@
 G_BEGIN_DECLS
 
 #define PUSH_TYPE_GCM_CLIENT            (push_gcm_client_get_type())
+#define PUSH_GCM_CLIENT_ERROR           (push_gcm_client_error_quark())
 #define PUSH_GCM_CLIENT(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_GCM_CLIENT, PushGcmClient))
 #define PUSH_GCM_CLIENT_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_GCM_CLIENT, PushGcmClient const))
 #define PUSH_GCM_CLIENT_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  PUSH_TYPE_GCM_CLIENT, PushGcmClientClass))
@@ -37,6 +38,22 @@ G_BEGIN_DECLS
 typedef struct _PushGcmClient        PushGcmClient;
 typedef struct _PushGcmClientClass   PushGcmClientClass;
 typedef struct _PushGcmClientPrivate PushGcmClientPrivate;
+typedef enum   _PushGcmClientError   PushGcmClientError;
+
+enum _PushGcmClientError
+{
+   PUSH_GCM_CLIENT_ERROR_MISSING_REGISTRATION  = 1,
+   PUSH_GCM_CLIENT_ERROR_INVALID_REGISTRATION  = 2,
+   PUSH_GCM_CLIENT_ERROR_MISMATCH_SENDER_ID    = 3,
+   PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED        = 4,
+   PUSH_GCM_CLIENT_ERROR_MESSAGE_TOO_BIG       = 5,
+   PUSH_GCM_CLIENT_ERROR_INVALID_DATA_KEY      = 6,
+   PUSH_GCM_CLIENT_ERROR_INVALID_TTL           = 7,
+   PUSH_GCM_CLIENT_ERROR_UNAVAILABLE           = 8,
+   PUSH_GCM_CLIENT_ERROR_INTERNAL_SERVER_ERROR = 9,
+   PUSH_GCM_CLIENT_ERROR_UNKNOWN               = 255,
+   PUSH_GCM_CLIENT_ERROR_REQUEST_FAILED        = 256,
+};
 
 struct _PushGcmClient
 {
@@ -51,17 +68,50 @@ struct _PushGcmClientClass
    SoupSessionAsyncClass parent_class;
 };
 
-GType          push_gcm_client_get_type      (void) G_GNUC_CONST;
-PushGcmClient *push_gcm_client_new           (const gchar          *auth_token);
-void           push_gcm_client_deliver_async (PushGcmClient        *client,
-                                              GList                *identities,
-                                              PushGcmMessage       *message,
-                                              GCancellable         *cancellable,
-                                              GAsyncReadyCallback   callback,
-                                              gpointer              user_data);
-gboolean       push_gcm_client_deliver_finish (PushGcmClient       *client,
-                                               GAsyncResult        *result,
-                                               GError             **error);
+GQuark         push_gcm_client_error_quark                 (void) G_GNUC_CONST;
+guint          push_gcm_client_get_in_flight_limit         (PushGcmClient        *client);
+guint          push_gcm_client_get_max_in_flight           (PushGcmClient        *client);
+guint          push_gcm_client_get_max_parallel            (PushGcmClient        *client);
+guint          push_gcm_client_get_max_retries             (PushGcmClient        *client);
+guint          push_gcm_client_get_queue_depth             (PushGcmClient        *client);
+guint          push_gcm_client_get_remap_capacity          (PushGcmClient        *client);
+gboolean       push_gcm_client_get_remap_identities        (PushGcmClient        *client);
+const gchar   *push_gcm_client_get_url                     (PushGcmClient        *client);
+GType          push_gcm_client_get_type                    (void) G_GNUC_CONST;
+PushGcmClient *push_gcm_client_new                         (const gchar          *auth_token);
+void           push_gcm_client_deliver_async               (PushGcmClient        *client,
+                                                            GList                *identities,
+                                                            PushGcmMessage       *message,
+                                                            GCancellable         *cancellable,
+                                                            GAsyncReadyCallback   callback,
+                                                            gpointer              user_data);
+gboolean       push_gcm_client_deliver_finish              (PushGcmClient        *client,
+                                                            GAsyncResult         *result,
+                                                            GError              **error);
+gboolean       push_gcm_client_deliver_finish_with_results (PushGcmClient        *client,
+                                                            GAsyncResult         *result,
+                                                            GPtrArray           **results,
+                                                            GError              **error);
+void           push_gcm_client_set_max_in_flight           (PushGcmClient        *client,
+                                                            guint                 max_in_flight);
+void           push_gcm_client_set_max_parallel            (PushGcmClient        *client,
+                                                            guint                 max_parallel);
+void           push_gcm_client_set_max_retries             (PushGcmClient        *client,
+                                                            guint                 max_retries);
+void           push_gcm_client_set_remap_capacity          (PushGcmClient        *client,
+                                                            guint                 remap_capacity);
+void           push_gcm_client_set_remap_identities        (PushGcmClient        *client,
+                                                            gboolean              remap_identities);
+void           push_gcm_client_set_url                     (PushGcmClient        *client,
+                                                            const gchar          *url);
+void           push_gcm_client_warm_up_async               (PushGcmClient        *client,
+                                                            guint                 n_connections,
+                                                            GCancellable         *cancellable,
+                                                            GAsyncReadyCallback   callback,
+                                                            gpointer              user_data);
+gboolean       push_gcm_client_warm_up_finish              (PushGcmClient        *client,
+                                                            GAsyncResult         *result,
+                                                            GError              **error);
 
 G_END_DECLS
 
@@ -19,6 +19,8 @@
 #include <glib/gi18n.h>
 
 #include "push-gcm-message.h"
+#include "push-gcm-message-private.h"
+#include "push-json.h"
 
 G_DEFINE_TYPE(PushGcmMessage, push_gcm_message, G_TYPE_OBJECT)
 
@@ -29,6 +31,7 @@ struct _PushGcmMessagePrivate
    gboolean    delay_while_idle;
    gboolean    dry_run;
    guint       time_to_live;
+   GBytes     *bytes;
 };
 
 enum
@@ -44,6 +47,85 @@ enum
 
 static GParamSpec *gParamSpecs[LAST_PROP];
 
+static void
+push_gcm_message_invalidate (PushGcmMessage *message)
+{
+   if (message->priv->bytes) {
+      g_bytes_unref(message->priv->bytes);
+      message->priv->bytes = NULL;
+   }
+}
+
+/**
+ * push_gcm_message_new:
+ *
+ * Creates a new #PushGcmMessage.
+ *
+ * Returns: (transfer full): A newly allocated #PushGcmMessage.
+ */
+PushGcmMessage *
+push_gcm_message_new (void)
+{
+   return g_object_new(PUSH_TYPE_GCM_MESSAGE, NULL);
+}
+
+/*
+ * Returns the message options and data serialized as the JSON object
+ * members following "registration_ids" in a GCM request, without the
+ * enclosing braces. The result is cached until a property of @message
+ * changes, so sending the same message repeatedly only has to splice in
+ * the registration ids.
+ */
+GBytes *
+_push_gcm_message_get_bytes (PushGcmMessage *message)
+{
+   PushGcmMessagePrivate *priv;
+   JsonNode *node;
+   GString *str;
+   gsize len;
+
+   g_return_val_if_fail(PUSH_IS_GCM_MESSAGE(message), NULL);
+
+   priv = message->priv;
+
+   if (!priv->bytes) {
+      str = g_string_sized_new(128);
+
+      if (priv->collapse_key) {
+         push_json_append_member(str, "collapse_key");
+         push_json_append_string(str, priv->collapse_key);
+         g_string_append_c(str, ',');
+      }
+
+      push_json_append_member(str, "delay_while_idle");
+      g_string_append(str, priv->delay_while_idle ? "true" : "false");
+      g_string_append_c(str, ',');
+
+      push_json_append_member(str, "dry_run");
+      g_string_append(str, priv->dry_run ? "true" : "false");
+
+      if (priv->time_to_live) {
+         g_string_append_c(str, ',');
+         push_json_append_member(str, "time_to_live");
+         g_string_append_printf(str, "%u", priv->time_to_live);
+      }
+
+      if (priv->data) {
+         g_string_append_c(str, ',');
+         push_json_append_member(str, "data");
+         node = json_node_new(JSON_NODE_OBJECT);
+         json_node_set_object(node, priv->data);
+         push_json_append_node(str, node);
+         json_node_free(node);
+      }
+
+      len = str->len;
+      priv->bytes = g_bytes_new_take(g_string_free(str, FALSE), len);
+   }
+
+   return priv->bytes;
+}
+
 const gchar *
 push_gcm_message_get_collapse_key (PushGcmMessage *message)
 {
@@ -58,6 +140,7 @@ push_gcm_message_set_collapse_key (PushGcmMessage *message,
    g_return_if_fail(PUSH_IS_GCM_MESSAGE(message));
    g_free(message->priv->collapse_key);
    message->priv->collapse_key = g_strdup(collapse_key);
+   push_gcm_message_invalidate(message);
    g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_COLLAPSE_KEY]);
 }
 
@@ -68,6 +151,10 @@ push_gcm_message_set_collapse_key (PushGcmMessage *message,
  * Fetches the :data property. This corresponds to the "data" field
  * in a GCM notification.
  *
+ * The serialized form of @message is cached, so modifications made to the
+ * returned object are not picked up until push_gcm_message_set_data() is
+ * called again.
+ *
  * Returns: (transfer none): A #JsonObject or %NULL.
  */
 JsonObject *
@@ -96,6 +183,7 @@ push_gcm_message_set_data (PushGcmMessage *message,
       priv->data = json_object_ref(data);
    }
 
+   push_gcm_message_invalidate(message);
    g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_DATA]);
 }
 
@@ -112,6 +200,7 @@ push_gcm_message_set_delay_while_idle (PushGcmMessage *message,
 {
    g_return_if_fail(PUSH_IS_GCM_MESSAGE(message));
    message->priv->delay_while_idle = delay_while_idle;
+   push_gcm_message_invalidate(message);
    g_object_notify_by_pspec(G_OBJECT(message),
                             gParamSpecs[PROP_DELAY_WHILE_IDLE]);
 }
@@ -129,6 +218,7 @@ push_gcm_message_set_dry_run (PushGcmMessage *message,
 {
    g_return_if_fail(PUSH_IS_GCM_MESSAGE(message));
    message->priv->dry_run = dry_run;
+   push_gcm_message_invalidate(message);
    g_object_notify_by_pspec(G_OBJECT(message), gParamSpecs[PROP_DRY_RUN]);
 }
 
@@ -145,6 +235,7 @@ push_gcm_message_set_time_to_live (PushGcmMessage *message,
 {
    g_return_if_fail(PUSH_IS_GCM_MESSAGE(message));
    message->priv->time_to_live = time_to_live;
+   push_gcm_message_invalidate(message);
    g_object_notify_by_pspec(G_OBJECT(message),
                             gParamSpecs[PROP_TIME_TO_LIVE]);
 }
@@ -162,6 +253,10 @@ push_gcm_message_finalize (GObject *object)
       json_object_unref(priv->data);
    }
 
+   if (priv->bytes) {
+      g_bytes_unref(priv->bytes);
+   }
+
    G_OBJECT_CLASS(push_gcm_message_parent_class)->finalize(object);
 }
 
@@ -0,0 +1,479 @@
+/* push-gcm-response.c
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glib/gi18n.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+
+#include "push-debug.h"
+#include "push-gcm-response.h"
+
+/*
+ * Streaming parser for the body of a GCM multicast response:
+ *
+ *   {"multicast_id":1,"success":1,"failure":1,"canonical_ids":0,
+ *    "results":[{"message_id":"0:1"},{"error":"NotRegistered"}]}
+ *
+ * The body is scanned once and each element of "results" is reported as
+ * soon as it has been read, without building a JsonNode tree. Members
+ * other than "results" are skipped.
+ */
+
+#define MAX_DEPTH 32
+
+typedef struct
+{
+   const gchar *begin;
+   const gchar *p;
+   const gchar *end;
+} PushGcmScanner;
+
+/*
+ * Perfect hash of the error strings documented by GCM. The slot of a
+ * string is (len * 6 + str[0] + str[5]) & 15, which is unique for each
+ * of them. A lookup costs one hash and one memcmp().
+ */
+static const struct
+{
+   const gchar        *name;
+   gsize               len;
+   PushGcmClientError  code;
+} gErrorTable[16] = {
+   [0]  = { "Unavailable", 11, PUSH_GCM_CLIENT_ERROR_UNAVAILABLE },
+   [1]  = { "MismatchSenderId", 16, PUSH_GCM_CLIENT_ERROR_MISMATCH_SENDER_ID },
+   [2]  = { "MessageTooBig", 13, PUSH_GCM_CLIENT_ERROR_MESSAGE_TOO_BIG },
+   [3]  = { "NotRegistered", 13, PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED },
+   [4]  = { "InvalidRegistration", 19,
+            PUSH_GCM_CLIENT_ERROR_INVALID_REGISTRATION },
+   [6]  = { "InvalidDataKey", 14, PUSH_GCM_CLIENT_ERROR_INVALID_DATA_KEY },
+   [9]  = { "InternalServerError", 19,
+            PUSH_GCM_CLIENT_ERROR_INTERNAL_SERVER_ERROR },
+   [13] = { "MissingRegistration", 19,
+            PUSH_GCM_CLIENT_ERROR_MISSING_REGISTRATION },
+   [14] = { "InvalidTtl", 10, PUSH_GCM_CLIENT_ERROR_INVALID_TTL },
+};
+
+/**
+ * push_gcm_response_lookup_error:
+ * @str: An error string from a GCM response.
+ * @len: The length of @str in bytes.
+ *
+ * Maps an error string returned by GCM to a #PushGcmClientError.
+ *
+ * Returns: A #PushGcmClientError, which is
+ *   %PUSH_GCM_CLIENT_ERROR_UNKNOWN for unknown strings.
+ */
+PushGcmClientError
+push_gcm_response_lookup_error (const gchar *str,
+                                gsize        len)
+{
+   guint slot;
+
+   if (!str || (len < 6)) {
+      return PUSH_GCM_CLIENT_ERROR_UNKNOWN;
+   }
+
+   slot = (len * 6 + (guchar)str[0] + (guchar)str[5]) & 15;
+
+   if ((gErrorTable[slot].len == len) &&
+       !memcmp(gErrorTable[slot].name, str, len)) {
+      return gErrorTable[slot].code;
+   }
+
+   return PUSH_GCM_CLIENT_ERROR_UNKNOWN;
+}
+
+static gboolean
+push_gcm_scanner_fail (PushGcmScanner  *scanner,
+                       GError         **error)
+{
+   g_set_error(error,
+               JSON_PARSER_ERROR,
+               JSON_PARSER_ERROR_PARSE,
+               _("Invalid GCM response at offset %u."),
+               (guint)(scanner->p - scanner->begin));
+   return FALSE;
+}
+
+static void
+push_gcm_scanner_skip_ws (PushGcmScanner *scanner)
+{
+   while ((scanner->p < scanner->end) &&
+          ((*scanner->p == ' ') || (*scanner->p == '\t') ||
+           (*scanner->p == '\n') || (*scanner->p == '\r'))) {
+      scanner->p++;
+   }
+}
+
+/*
+ * Skips whitespace and consumes @c if it is the next character.
+ */
+static gboolean
+push_gcm_scanner_accept (PushGcmScanner *scanner,
+                         gchar           c)
+{
+   push_gcm_scanner_skip_ws(scanner);
+
+   if ((scanner->p < scanner->end) && (*scanner->p == c)) {
+      scanner->p++;
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
+static gboolean
+push_gcm_scanner_read_hex (PushGcmScanner *scanner,
+                           gunichar       *value)
+{
+   gint digit;
+   guint i;
+
+   if ((scanner->end - scanner->p) < 4) {
+      return FALSE;
+   }
+
+   *value = 0;
+
+   for (i = 0; i < 4; i++) {
+      if ((digit = g_ascii_xdigit_value(*scanner->p++)) < 0) {
+         return FALSE;
+      }
+      *value = (*value << 4) | digit;
+   }
+
+   return TRUE;
+}
+
+/*
+ * Reads a string and unescapes it into @str. If @str is %NULL, the string
+ * is only skipped.
+ */
+static gboolean
+push_gcm_scanner_read_string (PushGcmScanner *scanner,
+                              GString        *str)
+{
+   const gchar *run;
+   gunichar low;
+   gunichar c;
+   gchar utf8[6];
+
+   if (!push_gcm_scanner_accept(scanner, '"')) {
+      return FALSE;
+   }
+
+   if (str) {
+      g_string_truncate(str, 0);
+   }
+
+   for (run = scanner->p; scanner->p < scanner->end; ) {
+      if (*scanner->p == '"') {
+         if (str) {
+            g_string_append_len(str, run, scanner->p - run);
+         }
+         scanner->p++;
+         return TRUE;
+      }
+
+      if (*scanner->p != '\\') {
+         scanner->p++;
+         continue;
+      }
+
+      if (str) {
+         g_string_append_len(str, run, scanner->p - run);
+      }
+
+      if (++scanner->p >= scanner->end) {
+         return FALSE;
+      }
+
+      switch (*scanner->p++) {
+      case '"': c = '"'; break;
+      case '\\': c = '\\'; break;
+      case '/': c = '/'; break;
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case 'u':
+         if (!push_gcm_scanner_read_hex(scanner, &c)) {
+            return FALSE;
+         }
+         if ((c >= 0xD800) && (c < 0xDC00) &&
+             ((scanner->end - scanner->p) >= 6) &&
+             (scanner->p[0] == '\\') && (scanner->p[1] == 'u')) {
+            scanner->p += 2;
+            if (!push_gcm_scanner_read_hex(scanner, &low)) {
+               return FALSE;
+            }
+            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+         }
+         break;
+      default:
+         return FALSE;
+      }
+
+      if (str) {
+         g_string_append_len(str, utf8, g_unichar_to_utf8(c, utf8));
+      }
+
+      run = scanner->p;
+   }
+
+   return FALSE;
+}
+
+static gboolean
+push_gcm_scanner_skip_value (PushGcmScanner *scanner,
+                             guint           depth)
+{
+   if (depth > MAX_DEPTH) {
+      return FALSE;
+   }
+
+   push_gcm_scanner_skip_ws(scanner);
+
+   if (scanner->p >= scanner->end) {
+      return FALSE;
+   }
+
+   switch (*scanner->p) {
+   case '"':
+      return push_gcm_scanner_read_string(scanner, NULL);
+   case '{':
+      scanner->p++;
+      if (push_gcm_scanner_accept(scanner, '}')) {
+         return TRUE;
+      }
+      do {
+         if (!push_gcm_scanner_read_string(scanner, NULL) ||
+             !push_gcm_scanner_accept(scanner, ':') ||
+             !push_gcm_scanner_skip_value(scanner, depth + 1)) {
+            return FALSE;
+         }
+      } while (push_gcm_scanner_accept(scanner, ','));
+      return push_gcm_scanner_accept(scanner, '}');
+   case '[':
+      scanner->p++;
+      if (push_gcm_scanner_accept(scanner, ']')) {
+         return TRUE;
+      }
+      do {
+         if (!push_gcm_scanner_skip_value(scanner, depth + 1)) {
+            return FALSE;
+         }
+      } while (push_gcm_scanner_accept(scanner, ','));
+      return push_gcm_scanner_accept(scanner, ']');
+   default:
+      /*
+       * Numbers and the literals true, false and null.
+       */
+      if (!strchr("-0123456789tfn", *scanner->p)) {
+         return FALSE;
+      }
+      while ((scanner->p < scanner->end) &&
+             (g_ascii_isalnum(*scanner->p) ||
+              (*scanner->p == '-') || (*scanner->p == '+') ||
+              (*scanner->p == '.'))) {
+         scanner->p++;
+      }
+      return TRUE;
+   }
+}
+
+/*
+ * Reads the value of a result member into @str if it is a string. Any
+ * other value is skipped and @str is left unset.
+ */
+static gboolean
+push_gcm_scanner_read_member (PushGcmScanner *scanner,
+                              GString        *str,
+                              gboolean       *is_set)
+{
+   push_gcm_scanner_skip_ws(scanner);
+
+   if ((scanner->p < scanner->end) && (*scanner->p == '"')) {
+      *is_set = TRUE;
+      return push_gcm_scanner_read_string(scanner, str);
+   }
+
+   return push_gcm_scanner_skip_value(scanner, 1);
+}
+
+static gboolean
+push_gcm_scanner_read_results (PushGcmScanner      *scanner,
+                               GString             *key,
+                               PushGcmResponseFunc  func,
+                               gpointer             user_data)
+{
+   PushGcmClientError code;
+   gboolean has_message_id;
+   gboolean has_registration_id;
+   gboolean has_error;
+   GString *message_id;
+   GString *registration_id;
+   GString *error;
+   gboolean ret = FALSE;
+   guint index = 0;
+
+   if (!push_gcm_scanner_accept(scanner, '[')) {
+      return push_gcm_scanner_skip_value(scanner, 0);
+   }
+
+   if (push_gcm_scanner_accept(scanner, ']')) {
+      return TRUE;
+   }
+
+   message_id = g_string_new(NULL);
+   registration_id = g_string_new(NULL);
+   error = g_string_new(NULL);
+
+   do {
+      has_message_id = FALSE;
+      has_registration_id = FALSE;
+      has_error = FALSE;
+
+      if (!push_gcm_scanner_accept(scanner, '{')) {
+         GOTO(failure);
+      }
+
+      if (!push_gcm_scanner_accept(scanner, '}')) {
+         do {
+            if (!push_gcm_scanner_read_string(scanner, key) ||
+                !push_gcm_scanner_accept(scanner, ':')) {
+               GOTO(failure);
+            }
+            if (!strcmp(key->str, "message_id")) {
+               if (!push_gcm_scanner_read_member(scanner, message_id,
+                                                 &has_message_id)) {
+                  GOTO(failure);
+               }
+            } else if (!strcmp(key->str, "registration_id")) {
+               if (!push_gcm_scanner_read_member(scanner, registration_id,
+                                                 &has_registration_id)) {
+                  GOTO(failure);
+               }
+            } else if (!strcmp(key->str, "error")) {
+               if (!push_gcm_scanner_read_member(scanner, error,
+                                                 &has_error)) {
+                  GOTO(failure);
+               }
+            } else if (!push_gcm_scanner_skip_value(scanner, 2)) {
+               GOTO(failure);
+            }
+         } while (push_gcm_scanner_accept(scanner, ','));
+
+         if (!push_gcm_scanner_accept(scanner, '}')) {
+            GOTO(failure);
+         }
+      }
+
+      code = has_error ? push_gcm_response_lookup_error(error->str,
+                                                        error->len) : 0;
+
+      func(index++,
+           has_message_id ? message_id->str : NULL,
+           has_registration_id ? registration_id->str : NULL,
+           code,
+           user_data);
+   } while (push_gcm_scanner_accept(scanner, ','));
+
+   ret = push_gcm_scanner_accept(scanner, ']');
+
+failure:
+   g_string_free(message_id, TRUE);
+   g_string_free(registration_id, TRUE);
+   g_string_free(error, TRUE);
+
+   return ret;
+}
+
+/**
+ * push_gcm_response_parse:
+ * @data: The body of a GCM response.
+ * @length: The length of @data in bytes.
+ * @func: A function to call for each element of "results".
+ * @user_data: User data for @func.
+ * @error: A location for a #GError, or %NULL.
+ *
+ * Scans the body of a GCM response, calling @func for each element of
+ * its "results" array in order. Results reported before a syntax error
+ * was found are not retracted.
+ *
+ * Returns: %TRUE if @data is a valid response; otherwise %FALSE and
+ *   @error is set.
+ */
+gboolean
+push_gcm_response_parse (const gchar          *data,
+                         gsize                 length,
+                         PushGcmResponseFunc   func,
+                         gpointer              user_data,
+                         GError              **error)
+{
+   PushGcmScanner scanner;
+   gboolean ret = FALSE;
+   GString *key;
+
+   g_return_val_if_fail(data, FALSE);
+   g_return_val_if_fail(func, FALSE);
+
+   scanner.begin = data;
+   scanner.p = data;
+   scanner.end = data + length;
+
+   key = g_string_new(NULL);
+
+   if (!push_gcm_scanner_accept(&scanner, '{')) {
+      GOTO(failure);
+   }
+
+   if (!push_gcm_scanner_accept(&scanner, '}')) {
+      do {
+         if (!push_gcm_scanner_read_string(&scanner, key) ||
+             !push_gcm_scanner_accept(&scanner, ':')) {
+            GOTO(failure);
+         }
+         if (!strcmp(key->str, "results")) {
+            if (!push_gcm_scanner_read_results(&scanner, key,
+                                               func, user_data)) {
+               GOTO(failure);
+            }
+         } else if (!push_gcm_scanner_skip_value(&scanner, 1)) {
+            GOTO(failure);
+         }
+      } while (push_gcm_scanner_accept(&scanner, ','));
+
+      if (!push_gcm_scanner_accept(&scanner, '}')) {
+         GOTO(failure);
+      }
+   }
+
+   push_gcm_scanner_skip_ws(&scanner);
+   ret = (scanner.p == scanner.end);
+
+failure:
+   if (!ret) {
+      push_gcm_scanner_fail(&scanner, error);
+   }
+   g_string_free(key, TRUE);
+
+   return ret;
+}
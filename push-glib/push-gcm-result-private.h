@@ -0,0 +1,34 @@
+/* push-gcm-result-private.h
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PUSH_GCM_RESULT_PRIVATE_H
+#define PUSH_GCM_RESULT_PRIVATE_H
+
+#include "push-gcm-result.h"
+
+G_BEGIN_DECLS
+
+PushGcmResult *_push_gcm_result_new (PushGcmIdentity    *identity,
+                                     const gchar        *message_id,
+                                     const gchar        *registration_id,
+                                     PushGcmClientError  error);
+
+G_END_DECLS
+
+#endif /* PUSH_GCM_RESULT_PRIVATE_H */
@@ -0,0 +1,172 @@
+/* push-gcm-result.c
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "push-gcm-result.h"
+#include "push-gcm-result-private.h"
+
+/**
+ * SECTION:push-gcm-result
+ * @title: PushGcmResult
+ * @short_description: The outcome of a GCM delivery to one device.
+ *
+ * #PushGcmResult describes what GCM reported for a single
+ * #PushGcmIdentity of a multicast delivery. The results of a delivery are
+ * retrieved with push_gcm_client_deliver_finish_with_results().
+ *
+ * If the delivery succeeded, push_gcm_result_get_message_id() returns the
+ * id GCM assigned to the message. If GCM returned a canonical
+ * registration id for the device, it is available from
+ * push_gcm_result_get_registration_id() and should replace the one stored
+ * for the device. Otherwise push_gcm_result_get_error() describes why the
+ * message was not delivered.
+ */
+
+G_DEFINE_BOXED_TYPE(PushGcmResult,
+                    push_gcm_result,
+                    push_gcm_result_ref,
+                    push_gcm_result_unref)
+
+struct _PushGcmResult
+{
+   volatile gint       ref_count;
+   PushGcmIdentity    *identity;
+   gchar              *message_id;
+   gchar              *registration_id;
+   PushGcmClientError  error;
+};
+
+PushGcmResult *
+_push_gcm_result_new (PushGcmIdentity    *identity,
+                      const gchar        *message_id,
+                      const gchar        *registration_id,
+                      PushGcmClientError  error)
+{
+   PushGcmResult *result;
+
+   g_return_val_if_fail(PUSH_IS_GCM_IDENTITY(identity), NULL);
+
+   result = g_slice_new0(PushGcmResult);
+   result->ref_count = 1;
+   result->identity = g_object_ref(identity);
+   result->message_id = g_strdup(message_id);
+   result->registration_id = g_strdup(registration_id);
+   result->error = error;
+
+   return result;
+}
+
+/**
+ * push_gcm_result_get_error:
+ * @result: (in): A #PushGcmResult.
+ *
+ * Fetches the error GCM reported for the device.
+ *
+ * Returns: A #PushGcmClientError, or 0 if the message was delivered.
+ */
+PushGcmClientError
+push_gcm_result_get_error (PushGcmResult *result)
+{
+   g_return_val_if_fail(result, 0);
+   return result->error;
+}
+
+/**
+ * push_gcm_result_get_identity:
+ * @result: (in): A #PushGcmResult.
+ *
+ * Fetches the identity the result is for.
+ *
+ * Returns: (transfer none): A #PushGcmIdentity.
+ */
+PushGcmIdentity *
+push_gcm_result_get_identity (PushGcmResult *result)
+{
+   g_return_val_if_fail(result, NULL);
+   return result->identity;
+}
+
+/**
+ * push_gcm_result_get_message_id:
+ * @result: (in): A #PushGcmResult.
+ *
+ * Fetches the id GCM assigned to the delivered message.
+ *
+ * Returns: A string, or %NULL if the message was not delivered.
+ */
+const gchar *
+push_gcm_result_get_message_id (PushGcmResult *result)
+{
+   g_return_val_if_fail(result, NULL);
+   return result->message_id;
+}
+
+/**
+ * push_gcm_result_get_registration_id:
+ * @result: (in): A #PushGcmResult.
+ *
+ * Fetches the canonical registration id GCM returned for the device.
+ *
+ * Returns: A string, or %NULL if the registration id is already canonical.
+ */
+const gchar *
+push_gcm_result_get_registration_id (PushGcmResult *result)
+{
+   g_return_val_if_fail(result, NULL);
+   return result->registration_id;
+}
+
+/**
+ * push_gcm_result_ref:
+ * @result: (in): A #PushGcmResult.
+ *
+ * Increments the reference count of @result by one.
+ *
+ * Returns: (transfer full): @result.
+ */
+PushGcmResult *
+push_gcm_result_ref (PushGcmResult *result)
+{
+   g_return_val_if_fail(result, NULL);
+   g_return_val_if_fail(result->ref_count > 0, NULL);
+
+   g_atomic_int_inc(&result->ref_count);
+
+   return result;
+}
+
+/**
+ * push_gcm_result_unref:
+ * @result: (in): A #PushGcmResult.
+ *
+ * Decrements the reference count of @result by one. When it reaches zero,
+ * the result is freed.
+ */
+void
+push_gcm_result_unref (PushGcmResult *result)
+{
+   g_return_if_fail(result);
+   g_return_if_fail(result->ref_count > 0);
+
+   if (g_atomic_int_dec_and_test(&result->ref_count)) {
+      g_object_unref(result->identity);
+      g_free(result->message_id);
+      g_free(result->registration_id);
+      g_slice_free(PushGcmResult, result);
+   }
+}
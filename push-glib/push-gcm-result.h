@@ -0,0 +1,44 @@
+/* push-gcm-result.h
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PUSH_GCM_RESULT_H
+#define PUSH_GCM_RESULT_H
+
+#include <glib-object.h>
+
+#include "push-gcm-client.h"
+#include "push-gcm-identity.h"
+
+G_BEGIN_DECLS
+
+#define PUSH_TYPE_GCM_RESULT (push_gcm_result_get_type())
+
+typedef struct _PushGcmResult PushGcmResult;
+
+PushGcmClientError  push_gcm_result_get_error           (PushGcmResult *result);
+PushGcmIdentity    *push_gcm_result_get_identity        (PushGcmResult *result);
+const gchar        *push_gcm_result_get_message_id      (PushGcmResult *result);
+const gchar        *push_gcm_result_get_registration_id (PushGcmResult *result);
+GType               push_gcm_result_get_type            (void) G_GNUC_CONST;
+PushGcmResult      *push_gcm_result_ref                 (PushGcmResult *result);
+void                push_gcm_result_unref               (PushGcmResult *result);
+
+G_END_DECLS
+
+#endif /* PUSH_GCM_RESULT_H */
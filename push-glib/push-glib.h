@@ -27,13 +27,20 @@ G_BEGIN_DECLS
 
 #include "push-aps-client.h"
 #include "push-aps-identity.h"
+#include "push-aps-ingest.h"
 #include "push-aps-message.h"
+#include "push-aps-message-template.h"
+#include "push-aps-router.h"
 #include "push-c2dm-client.h"
 #include "push-c2dm-identity.h"
 #include "push-c2dm-message.h"
+#include "push-gcm-batcher.h"
+#include "push-gcm-ccs-client.h"
 #include "push-gcm-client.h"
 #include "push-gcm-identity.h"
 #include "push-gcm-message.h"
+#include "push-gcm-result.h"
+#include "push-notification.h"
 
 #undef PUSH_INSIDE
 
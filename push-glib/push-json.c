@@ -0,0 +1,334 @@
+/* push-json.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "push-json.h"
+
+/*
+ * Minimal JSON writer used to build notification payloads directly into a
+ * GString without creating a JsonGenerator. The output matches what
+ * JsonGenerator produces with pretty printing disabled, including the
+ * \u escape it uses for DEL (0x7F).
+ */
+
+static const gchar gHexDigits[] = "0123456789abcdef";
+
+/**
+ * push_json_escaped_size:
+ * @value: A UTF-8 encoded string.
+ * @len: The length of @value in bytes, or -1 if it is nul-terminated.
+ *
+ * Computes the number of bytes @value occupies once escaped by
+ * push_json_append_string(), not including the surrounding quotes.
+ *
+ * Returns: The escaped size in bytes.
+ */
+gsize
+push_json_escaped_size (const gchar *value,
+                        gssize       len)
+{
+   const gchar *end;
+   gsize ret = 0;
+   guchar c;
+
+   if (!value) {
+      return 0;
+   }
+
+   if (len < 0) {
+      len = strlen(value);
+   }
+
+   for (end = value + len; value < end; value++) {
+      c = *value;
+      if ((c >= 0x20) && (c != 0x7F) && (c != '"') && (c != '\\')) {
+         ret++;
+      } else if ((c == '"') || (c == '\\') || (c == '\b') || (c == '\f') ||
+                 (c == '\n') || (c == '\r') || (c == '\t')) {
+         ret += 2;
+      } else {
+         ret += 6;
+      }
+   }
+
+   return ret;
+}
+
+/**
+ * push_json_append_escaped:
+ * @str: A #GString.
+ * @value: A UTF-8 encoded string.
+ *
+ * Appends @value to @str with JSON string escaping applied but without the
+ * surrounding quotes. Runs of characters that need no escaping are copied
+ * in a single append.
+ */
+void
+push_json_append_escaped (GString     *str,
+                          const gchar *value)
+{
+   const gchar *run;
+   const gchar *iter;
+   gchar esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+   guchar c;
+
+   g_return_if_fail(str);
+
+   if (!value) {
+      return;
+   }
+
+   for (run = iter = value; (c = *iter); iter++) {
+      if ((c >= 0x20) && (c != 0x7F) && (c != '"') && (c != '\\')) {
+         continue;
+      }
+      if (iter > run) {
+         g_string_append_len(str, run, iter - run);
+      }
+      run = iter + 1;
+      switch (c) {
+      case '"':
+         g_string_append_len(str, "\\\"", 2);
+         break;
+      case '\\':
+         g_string_append_len(str, "\\\\", 2);
+         break;
+      case '\b':
+         g_string_append_len(str, "\\b", 2);
+         break;
+      case '\f':
+         g_string_append_len(str, "\\f", 2);
+         break;
+      case '\n':
+         g_string_append_len(str, "\\n", 2);
+         break;
+      case '\r':
+         g_string_append_len(str, "\\r", 2);
+         break;
+      case '\t':
+         g_string_append_len(str, "\\t", 2);
+         break;
+      default:
+         esc[4] = gHexDigits[c >> 4];
+         esc[5] = gHexDigits[c & 0xF];
+         g_string_append_len(str, esc, sizeof esc);
+         break;
+      }
+   }
+
+   if (iter > run) {
+      g_string_append_len(str, run, iter - run);
+   }
+}
+
+/**
+ * push_json_append_string:
+ * @str: A #GString.
+ * @value: A UTF-8 encoded string.
+ *
+ * Appends @value to @str as a quoted and escaped JSON string.
+ */
+void
+push_json_append_string (GString     *str,
+                         const gchar *value)
+{
+   g_return_if_fail(str);
+
+   g_string_append_c(str, '"');
+   push_json_append_escaped(str, value);
+   g_string_append_c(str, '"');
+}
+
+/**
+ * push_json_append_member:
+ * @str: A #GString.
+ * @name: The member name.
+ *
+ * Appends the quoted @name of an object member followed by a colon.
+ */
+void
+push_json_append_member (GString     *str,
+                         const gchar *name)
+{
+   push_json_append_string(str, name);
+   g_string_append_c(str, ':');
+}
+
+static void
+push_json_append_value (GString  *str,
+                        JsonNode *node)
+{
+   gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+   switch (json_node_get_value_type(node)) {
+   case G_TYPE_INT64:
+      g_string_append_printf(str, "%" G_GINT64_FORMAT,
+                             json_node_get_int(node));
+      break;
+   case G_TYPE_DOUBLE:
+      g_string_append(str,
+                      g_ascii_dtostr(buf, sizeof buf,
+                                     json_node_get_double(node)));
+      break;
+   case G_TYPE_BOOLEAN:
+      if (json_node_get_boolean(node)) {
+         g_string_append_len(str, "true", 4);
+      } else {
+         g_string_append_len(str, "false", 5);
+      }
+      break;
+   case G_TYPE_STRING:
+      push_json_append_string(str, json_node_get_string(node));
+      break;
+   default:
+      g_string_append_len(str, "null", 4);
+      break;
+   }
+}
+
+/**
+ * push_json_append_node:
+ * @str: A #GString.
+ * @node: A #JsonNode.
+ *
+ * Appends the compact JSON encoding of @node to @str. Object members are
+ * written in the order returned by json_object_get_members().
+ */
+void
+push_json_append_node (GString  *str,
+                       JsonNode *node)
+{
+   JsonObject *object;
+   JsonArray *array;
+   GList *list;
+   GList *iter;
+   guint len;
+   guint i;
+
+   g_return_if_fail(str);
+   g_return_if_fail(node);
+
+   switch (JSON_NODE_TYPE(node)) {
+   case JSON_NODE_OBJECT:
+      object = json_node_get_object(node);
+      list = json_object_get_members(object);
+      g_string_append_c(str, '{');
+      for (iter = list; iter; iter = iter->next) {
+         if (iter != list) {
+            g_string_append_c(str, ',');
+         }
+         push_json_append_member(str, iter->data);
+         push_json_append_node(str, json_object_get_member(object, iter->data));
+      }
+      g_string_append_c(str, '}');
+      g_list_free(list);
+      break;
+   case JSON_NODE_ARRAY:
+      array = json_node_get_array(node);
+      len = json_array_get_length(array);
+      g_string_append_c(str, '[');
+      for (i = 0; i < len; i++) {
+         if (i) {
+            g_string_append_c(str, ',');
+         }
+         push_json_append_node(str, json_array_get_element(array, i));
+      }
+      g_string_append_c(str, ']');
+      break;
+   case JSON_NODE_VALUE:
+      push_json_append_value(str, node);
+      break;
+   case JSON_NODE_NULL:
+   default:
+      g_string_append_len(str, "null", 4);
+      break;
+   }
+}
+
+static gsize
+push_json_value_size (JsonNode *node)
+{
+   gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+   switch (json_node_get_value_type(node)) {
+   case G_TYPE_INT64:
+      return g_snprintf(buf, sizeof buf, "%" G_GINT64_FORMAT,
+                        json_node_get_int(node));
+   case G_TYPE_DOUBLE:
+      return strlen(g_ascii_dtostr(buf, sizeof buf,
+                                   json_node_get_double(node)));
+   case G_TYPE_BOOLEAN:
+      return json_node_get_boolean(node) ? 4 : 5;
+   case G_TYPE_STRING:
+      return push_json_escaped_size(json_node_get_string(node), -1) + 2;
+   default:
+      return 4;
+   }
+}
+
+/**
+ * push_json_node_size:
+ * @node: A #JsonNode.
+ *
+ * Computes the number of bytes push_json_append_node() would append for
+ * @node without building the string.
+ *
+ * Returns: The encoded size in bytes.
+ */
+gsize
+push_json_node_size (JsonNode *node)
+{
+   JsonObject *object;
+   JsonArray *array;
+   GList *list;
+   GList *iter;
+   gsize ret;
+   guint len;
+   guint i;
+
+   g_return_val_if_fail(node, 0);
+
+   switch (JSON_NODE_TYPE(node)) {
+   case JSON_NODE_OBJECT:
+      object = json_node_get_object(node);
+      list = json_object_get_members(object);
+      ret = 2;
+      for (iter = list; iter; iter = iter->next) {
+         ret += (iter != list) ? 1 : 0;
+         ret += push_json_escaped_size(iter->data, -1) + 3;
+         ret += push_json_node_size(json_object_get_member(object, iter->data));
+      }
+      g_list_free(list);
+      return ret;
+   case JSON_NODE_ARRAY:
+      array = json_node_get_array(node);
+      len = json_array_get_length(array);
+      ret = 2;
+      for (i = 0; i < len; i++) {
+         ret += i ? 1 : 0;
+         ret += push_json_node_size(json_array_get_element(array, i));
+      }
+      return ret;
+   case JSON_NODE_VALUE:
+      return push_json_value_size(node);
+   case JSON_NODE_NULL:
+   default:
+      return 4;
+   }
+}
@@ -0,0 +1,41 @@
+/* push-json.h
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PUSH_JSON_H
+#define PUSH_JSON_H
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+void  push_json_append_escaped (GString     *str,
+                                const gchar *value);
+void  push_json_append_member  (GString     *str,
+                                const gchar *name);
+void  push_json_append_node    (GString     *str,
+                                JsonNode    *node);
+void  push_json_append_string  (GString     *str,
+                                const gchar *value);
+gsize push_json_escaped_size   (const gchar *value,
+                                gssize       len);
+gsize push_json_node_size      (JsonNode    *node);
+
+G_END_DECLS
+
+#endif /* PUSH_JSON_H */
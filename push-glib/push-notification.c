@@ -0,0 +1,630 @@
+/* push-notification.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glib/gi18n.h>
+
+#include "push-notification.h"
+
+/*
+ * The longest time_to_live GCM accepts, four weeks.
+ */
+#define PUSH_NOTIFICATION_GCM_MAX_TTL 2419200
+
+/**
+ * SECTION:push-notification
+ * @title: PushNotification
+ * @short_description: A notification independent of the delivery service.
+ *
+ * #PushNotification holds the content of a notification once and renders
+ * it into the message types of each service on demand. Use
+ * push_notification_get_aps_message(), push_notification_get_gcm_message()
+ * and push_notification_get_c2dm_message() to retrieve the rendered
+ * messages.
+ *
+ * Each rendering is cached until a property of the notification changes,
+ * so delivering one notification to a mix of iOS and Android devices
+ * serializes each format only once. The rendered messages are shared and
+ * must not be modified.
+ *
+ * APS receives the alert, badge and sound in its "aps" dictionary and the
+ * data added with push_notification_add_data() as custom keys. GCM and
+ * C2DM have no such fields, so the alert, badge and sound are delivered
+ * alongside the data using the same names.
+ */
+
+G_DEFINE_TYPE(PushNotification, push_notification, G_TYPE_OBJECT)
+
+struct _PushNotificationPrivate
+{
+   gchar           *alert;
+   guint            badge;
+   gboolean         badge_set;
+   gchar           *collapse_key;
+   gboolean         delay_while_idle;
+   GDateTime       *expires_at;
+   gchar           *sound;
+   JsonObject      *data;
+
+   PushApsMessage  *aps;
+   PushC2dmMessage *c2dm;
+   PushGcmMessage  *gcm;
+   PushGcmMessage  *gcm_ttl;
+};
+
+enum
+{
+   PROP_0,
+   PROP_ALERT,
+   PROP_BADGE,
+   PROP_COLLAPSE_KEY,
+   PROP_DELAY_WHILE_IDLE,
+   PROP_EXPIRES_AT,
+   PROP_SOUND,
+   LAST_PROP
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+
+static void
+push_notification_invalidate (PushNotification *notification)
+{
+   PushNotificationPrivate *priv = notification->priv;
+
+   g_clear_object(&priv->aps);
+   g_clear_object(&priv->c2dm);
+   g_clear_object(&priv->gcm);
+   g_clear_object(&priv->gcm_ttl);
+}
+
+/**
+ * push_notification_new:
+ *
+ * Creates a new #PushNotification.
+ *
+ * Returns: (transfer full): A newly allocated #PushNotification.
+ */
+PushNotification *
+push_notification_new (void)
+{
+   return g_object_new(PUSH_TYPE_NOTIFICATION, NULL);
+}
+
+/**
+ * push_notification_add_data:
+ * @notification: (in): A #PushNotification.
+ * @key: (in): The key for the data.
+ * @value: (in): The value for @key.
+ *
+ * Adds a key/value pair to be delivered with the notification. It is
+ * added as a custom key to APS payloads, to the "data" of GCM messages
+ * and as a "data.key" parameter to C2DM messages.
+ */
+void
+push_notification_add_data (PushNotification *notification,
+                            const gchar      *key,
+                            const gchar      *value)
+{
+   PushNotificationPrivate *priv;
+
+   g_return_if_fail(PUSH_IS_NOTIFICATION(notification));
+   g_return_if_fail(key);
+   g_return_if_fail(g_strcmp0(key, "aps"));
+
+   priv = notification->priv;
+
+   if (!priv->data) {
+      priv->data = json_object_new();
+   }
+
+   json_object_set_string_member(priv->data, key, value ? value : "");
+   push_notification_invalidate(notification);
+}
+
+/**
+ * push_notification_get_aps_message:
+ * @notification: (in): A #PushNotification.
+ *
+ * Renders @notification as a #PushApsMessage. The message is sealed and
+ * cached until @notification is modified.
+ *
+ * Returns: (transfer none): A #PushApsMessage.
+ */
+PushApsMessage *
+push_notification_get_aps_message (PushNotification *notification)
+{
+   PushNotificationPrivate *priv;
+   GList *list;
+   GList *iter;
+
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), NULL);
+
+   priv = notification->priv;
+
+   if (!priv->aps) {
+      priv->aps = push_aps_message_new();
+      push_aps_message_set_alert(priv->aps, priv->alert);
+      if (priv->badge_set) {
+         push_aps_message_set_badge(priv->aps, priv->badge);
+      }
+      push_aps_message_set_collapse_key(priv->aps, priv->collapse_key);
+      push_aps_message_set_expires_at(priv->aps, priv->expires_at);
+      push_aps_message_set_sound(priv->aps, priv->sound);
+      if (priv->data) {
+         list = json_object_get_members(priv->data);
+         for (iter = list; iter; iter = iter->next) {
+            push_aps_message_add_extra_string(
+                  priv->aps, iter->data,
+                  json_object_get_string_member(priv->data, iter->data));
+         }
+         g_list_free(list);
+      }
+      push_aps_message_seal(priv->aps);
+   }
+
+   return priv->aps;
+}
+
+/**
+ * push_notification_get_c2dm_message:
+ * @notification: (in): A #PushNotification.
+ *
+ * Renders @notification as a #PushC2dmMessage. The message is cached until
+ * @notification is modified and must not be modified by the caller.
+ *
+ * Returns: (transfer none): A #PushC2dmMessage.
+ */
+PushC2dmMessage *
+push_notification_get_c2dm_message (PushNotification *notification)
+{
+   PushNotificationPrivate *priv;
+   GList *list;
+   GList *iter;
+   gchar badge[12];
+
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), NULL);
+
+   priv = notification->priv;
+
+   if (!priv->c2dm) {
+      priv->c2dm = push_c2dm_message_new();
+      push_c2dm_message_set_collapse_key(priv->c2dm, priv->collapse_key);
+      push_c2dm_message_set_delay_while_idle(priv->c2dm,
+                                             priv->delay_while_idle);
+      if (priv->alert) {
+         push_c2dm_message_add_param(priv->c2dm, "alert", priv->alert);
+      }
+      if (priv->badge_set) {
+         g_snprintf(badge, sizeof badge, "%u", priv->badge);
+         push_c2dm_message_add_param(priv->c2dm, "badge", badge);
+      }
+      if (priv->sound) {
+         push_c2dm_message_add_param(priv->c2dm, "sound", priv->sound);
+      }
+      if (priv->data) {
+         list = json_object_get_members(priv->data);
+         for (iter = list; iter; iter = iter->next) {
+            push_c2dm_message_add_param(
+                  priv->c2dm, iter->data,
+                  json_object_get_string_member(priv->data, iter->data));
+         }
+         g_list_free(list);
+      }
+   }
+
+   return priv->c2dm;
+}
+
+/**
+ * push_notification_get_gcm_message:
+ * @notification: (in): A #PushNotification.
+ *
+ * Renders @notification as a #PushGcmMessage. The message is cached until
+ * @notification is modified and must not be modified by the caller.
+ *
+ * If #PushNotification:expires-at is set, the "time_to_live" of the
+ * message is the remaining time, up to four weeks. Since that changes as
+ * the notification waits, a new message is rendered whenever the remaining
+ * time differs from the previous call; messages that were already returned
+ * are never modified. Once that time has passed, %NULL is returned and the
+ * notification should no longer be delivered to GCM.
+ *
+ * Returns: (transfer none): A #PushGcmMessage or %NULL if expired.
+ */
+PushGcmMessage *
+push_notification_get_gcm_message (PushNotification *notification)
+{
+   PushNotificationPrivate *priv;
+   JsonObject *data;
+   GDateTime *now;
+   GTimeSpan span;
+   GList *list;
+   GList *iter;
+   guint ttl = 0;
+
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), NULL);
+
+   priv = notification->priv;
+
+   /*
+    * The remaining time changes as the notification waits, so it is not
+    * part of the cached rendering. Round up so that the last second is
+    * not mistaken for an unset time_to_live.
+    */
+   if (priv->expires_at) {
+      now = g_date_time_new_now_utc();
+      span = g_date_time_difference(priv->expires_at, now);
+      g_date_time_unref(now);
+      if (span <= 0) {
+         return NULL;
+      }
+      span = (span + G_TIME_SPAN_SECOND - 1) / G_TIME_SPAN_SECOND;
+      ttl = MIN(span, PUSH_NOTIFICATION_GCM_MAX_TTL);
+   }
+
+   if (!priv->gcm) {
+      priv->gcm = push_gcm_message_new();
+      push_gcm_message_set_collapse_key(priv->gcm, priv->collapse_key);
+      push_gcm_message_set_delay_while_idle(priv->gcm,
+                                            priv->delay_while_idle);
+
+      data = json_object_new();
+      if (priv->alert) {
+         json_object_set_string_member(data, "alert", priv->alert);
+      }
+      if (priv->badge_set) {
+         json_object_set_int_member(data, "badge", priv->badge);
+      }
+      if (priv->sound) {
+         json_object_set_string_member(data, "sound", priv->sound);
+      }
+      if (priv->data) {
+         list = json_object_get_members(priv->data);
+         for (iter = list; iter; iter = iter->next) {
+            json_object_set_string_member(
+                  data, iter->data,
+                  json_object_get_string_member(priv->data, iter->data));
+         }
+         g_list_free(list);
+      }
+      push_gcm_message_set_data(priv->gcm, data);
+      json_object_unref(data);
+   }
+
+   if (!ttl) {
+      return priv->gcm;
+   }
+
+   /*
+    * The cached rendering may already be queued for delivery, so the
+    * time_to_live goes into a separate message sharing its data.
+    */
+   if (!priv->gcm_ttl ||
+       push_gcm_message_get_time_to_live(priv->gcm_ttl) != ttl) {
+      g_clear_object(&priv->gcm_ttl);
+      priv->gcm_ttl = push_gcm_message_new();
+      push_gcm_message_set_collapse_key(priv->gcm_ttl, priv->collapse_key);
+      push_gcm_message_set_delay_while_idle(priv->gcm_ttl,
+                                            priv->delay_while_idle);
+      push_gcm_message_set_data(priv->gcm_ttl,
+                                push_gcm_message_get_data(priv->gcm));
+      push_gcm_message_set_time_to_live(priv->gcm_ttl, ttl);
+   }
+
+   return priv->gcm_ttl;
+}
+
+const gchar *
+push_notification_get_alert (PushNotification *notification)
+{
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), NULL);
+   return notification->priv->alert;
+}
+
+void
+push_notification_set_alert (PushNotification *notification,
+                             const gchar      *alert)
+{
+   g_return_if_fail(PUSH_IS_NOTIFICATION(notification));
+   g_free(notification->priv->alert);
+   notification->priv->alert = g_strdup(alert);
+   push_notification_invalidate(notification);
+   g_object_notify_by_pspec(G_OBJECT(notification), gParamSpecs[PROP_ALERT]);
+}
+
+guint
+push_notification_get_badge (PushNotification *notification)
+{
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), 0);
+   return notification->priv->badge;
+}
+
+void
+push_notification_set_badge (PushNotification *notification,
+                             guint             badge)
+{
+   g_return_if_fail(PUSH_IS_NOTIFICATION(notification));
+   notification->priv->badge = badge;
+   notification->priv->badge_set = TRUE;
+   push_notification_invalidate(notification);
+   g_object_notify_by_pspec(G_OBJECT(notification), gParamSpecs[PROP_BADGE]);
+}
+
+const gchar *
+push_notification_get_collapse_key (PushNotification *notification)
+{
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), NULL);
+   return notification->priv->collapse_key;
+}
+
+void
+push_notification_set_collapse_key (PushNotification *notification,
+                                    const gchar      *collapse_key)
+{
+   g_return_if_fail(PUSH_IS_NOTIFICATION(notification));
+   g_free(notification->priv->collapse_key);
+   notification->priv->collapse_key = g_strdup(collapse_key);
+   push_notification_invalidate(notification);
+   g_object_notify_by_pspec(G_OBJECT(notification),
+                            gParamSpecs[PROP_COLLAPSE_KEY]);
+}
+
+gboolean
+push_notification_get_delay_while_idle (PushNotification *notification)
+{
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), FALSE);
+   return notification->priv->delay_while_idle;
+}
+
+void
+push_notification_set_delay_while_idle (PushNotification *notification,
+                                        gboolean          delay_while_idle)
+{
+   g_return_if_fail(PUSH_IS_NOTIFICATION(notification));
+   notification->priv->delay_while_idle = delay_while_idle;
+   push_notification_invalidate(notification);
+   g_object_notify_by_pspec(G_OBJECT(notification),
+                            gParamSpecs[PROP_DELAY_WHILE_IDLE]);
+}
+
+/**
+ * push_notification_get_expires_at:
+ * @notification: (in): A #PushNotification.
+ *
+ * Fetches the "expires-at" property.
+ *
+ * Returns: (transfer none): A #GDateTime or %NULL.
+ */
+GDateTime *
+push_notification_get_expires_at (PushNotification *notification)
+{
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), NULL);
+   return notification->priv->expires_at;
+}
+
+void
+push_notification_set_expires_at (PushNotification *notification,
+                                  GDateTime        *expires_at)
+{
+   PushNotificationPrivate *priv;
+
+   g_return_if_fail(PUSH_IS_NOTIFICATION(notification));
+
+   priv = notification->priv;
+
+   if (priv->expires_at) {
+      g_date_time_unref(priv->expires_at);
+      priv->expires_at = NULL;
+   }
+
+   if (expires_at) {
+      priv->expires_at = g_date_time_ref(expires_at);
+   }
+
+   push_notification_invalidate(notification);
+   g_object_notify_by_pspec(G_OBJECT(notification),
+                            gParamSpecs[PROP_EXPIRES_AT]);
+}
+
+const gchar *
+push_notification_get_sound (PushNotification *notification)
+{
+   g_return_val_if_fail(PUSH_IS_NOTIFICATION(notification), NULL);
+   return notification->priv->sound;
+}
+
+void
+push_notification_set_sound (PushNotification *notification,
+                             const gchar      *sound)
+{
+   g_return_if_fail(PUSH_IS_NOTIFICATION(notification));
+   g_free(notification->priv->sound);
+   notification->priv->sound = g_strdup(sound);
+   push_notification_invalidate(notification);
+   g_object_notify_by_pspec(G_OBJECT(notification), gParamSpecs[PROP_SOUND]);
+}
+
+static void
+push_notification_finalize (GObject *object)
+{
+   PushNotification *notification = PUSH_NOTIFICATION(object);
+   PushNotificationPrivate *priv = notification->priv;
+
+   push_notification_invalidate(notification);
+
+   g_free(priv->alert);
+   g_free(priv->collapse_key);
+   g_free(priv->sound);
+
+   if (priv->expires_at) {
+      g_date_time_unref(priv->expires_at);
+   }
+
+   if (priv->data) {
+      json_object_unref(priv->data);
+   }
+
+   G_OBJECT_CLASS(push_notification_parent_class)->finalize(object);
+}
+
+static void
+push_notification_get_property (GObject    *object,
+                                guint       prop_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+   PushNotification *notification = PUSH_NOTIFICATION(object);
+
+   switch (prop_id) {
+   case PROP_ALERT:
+      g_value_set_string(value, push_notification_get_alert(notification));
+      break;
+   case PROP_BADGE:
+      g_value_set_uint(value, push_notification_get_badge(notification));
+      break;
+   case PROP_COLLAPSE_KEY:
+      g_value_set_string(value,
+                         push_notification_get_collapse_key(notification));
+      break;
+   case PROP_DELAY_WHILE_IDLE:
+      g_value_set_boolean(value,
+                          push_notification_get_delay_while_idle(notification));
+      break;
+   case PROP_EXPIRES_AT:
+      g_value_set_boxed(value, push_notification_get_expires_at(notification));
+      break;
+   case PROP_SOUND:
+      g_value_set_string(value, push_notification_get_sound(notification));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_notification_set_property (GObject      *object,
+                                guint         prop_id,
+                                const GValue *value,
+                                GParamSpec   *pspec)
+{
+   PushNotification *notification = PUSH_NOTIFICATION(object);
+
+   switch (prop_id) {
+   case PROP_ALERT:
+      push_notification_set_alert(notification, g_value_get_string(value));
+      break;
+   case PROP_BADGE:
+      push_notification_set_badge(notification, g_value_get_uint(value));
+      break;
+   case PROP_COLLAPSE_KEY:
+      push_notification_set_collapse_key(notification,
+                                         g_value_get_string(value));
+      break;
+   case PROP_DELAY_WHILE_IDLE:
+      push_notification_set_delay_while_idle(notification,
+                                             g_value_get_boolean(value));
+      break;
+   case PROP_EXPIRES_AT:
+      push_notification_set_expires_at(notification,
+                                       g_value_get_boxed(value));
+      break;
+   case PROP_SOUND:
+      push_notification_set_sound(notification, g_value_get_string(value));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+static void
+push_notification_class_init (PushNotificationClass *klass)
+{
+   GObjectClass *object_class;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->finalize = push_notification_finalize;
+   object_class->get_property = push_notification_get_property;
+   object_class->set_property = push_notification_set_property;
+   g_type_class_add_private(object_class, sizeof(PushNotificationPrivate));
+
+   gParamSpecs[PROP_ALERT] =
+      g_param_spec_string("alert",
+                          _("Alert"),
+                          _("The alert text for the notification."),
+                          NULL,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_ALERT,
+                                   gParamSpecs[PROP_ALERT]);
+
+   gParamSpecs[PROP_BADGE] =
+      g_param_spec_uint("badge",
+                        _("Badge"),
+                        _("The badge number for the notification."),
+                        0,
+                        G_MAXUINT,
+                        0,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_BADGE,
+                                   gParamSpecs[PROP_BADGE]);
+
+   gParamSpecs[PROP_COLLAPSE_KEY] =
+      g_param_spec_string("collapse-key",
+                          _("Collapse Key"),
+                          _("The key used for collapsing notifications."),
+                          NULL,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_COLLAPSE_KEY,
+                                   gParamSpecs[PROP_COLLAPSE_KEY]);
+
+   gParamSpecs[PROP_DELAY_WHILE_IDLE] =
+      g_param_spec_boolean("delay-while-idle",
+                           _("Delay While Idle"),
+                           _("If the notification should be delayed "
+                             "until the device wakes up."),
+                           FALSE,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_DELAY_WHILE_IDLE,
+                                   gParamSpecs[PROP_DELAY_WHILE_IDLE]);
+
+   gParamSpecs[PROP_EXPIRES_AT] =
+      g_param_spec_boxed("expires-at",
+                         _("Expires At"),
+                         _("When the notification should expire."),
+                         G_TYPE_DATE_TIME,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_EXPIRES_AT,
+                                   gParamSpecs[PROP_EXPIRES_AT]);
+
+   gParamSpecs[PROP_SOUND] =
+      g_param_spec_string("sound",
+                          _("Sound"),
+                          _("The sound to play upon receipt."),
+                          NULL,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+   g_object_class_install_property(object_class, PROP_SOUND,
+                                   gParamSpecs[PROP_SOUND]);
+}
+
+static void
+push_notification_init (PushNotification *notification)
+{
+   notification->priv =
+      G_TYPE_INSTANCE_GET_PRIVATE(notification,
+                                  PUSH_TYPE_NOTIFICATION,
+                                  PushNotificationPrivate);
+}
@@ -0,0 +1,85 @@
+/* push-notification.h
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PUSH_NOTIFICATION_H
+#define PUSH_NOTIFICATION_H
+
+#include <glib-object.h>
+
+#include "push-aps-message.h"
+#include "push-c2dm-message.h"
+#include "push-gcm-message.h"
+
+G_BEGIN_DECLS
+
+#define PUSH_TYPE_NOTIFICATION            (push_notification_get_type())
+#define PUSH_NOTIFICATION(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_NOTIFICATION, PushNotification))
+#define PUSH_NOTIFICATION_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), PUSH_TYPE_NOTIFICATION, PushNotification const))
+#define PUSH_NOTIFICATION_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  PUSH_TYPE_NOTIFICATION, PushNotificationClass))
+#define PUSH_IS_NOTIFICATION(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), PUSH_TYPE_NOTIFICATION))
+#define PUSH_IS_NOTIFICATION_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  PUSH_TYPE_NOTIFICATION))
+#define PUSH_NOTIFICATION_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  PUSH_TYPE_NOTIFICATION, PushNotificationClass))
+
+typedef struct _PushNotification        PushNotification;
+typedef struct _PushNotificationClass   PushNotificationClass;
+typedef struct _PushNotificationPrivate PushNotificationPrivate;
+
+struct _PushNotification
+{
+   GObject parent;
+
+   /*< private >*/
+   PushNotificationPrivate *priv;
+};
+
+struct _PushNotificationClass
+{
+   GObjectClass parent_class;
+};
+
+void              push_notification_add_data             (PushNotification *notification,
+                                                          const gchar      *key,
+                                                          const gchar      *value);
+const gchar      *push_notification_get_alert            (PushNotification *notification);
+PushApsMessage   *push_notification_get_aps_message      (PushNotification *notification);
+guint             push_notification_get_badge            (PushNotification *notification);
+PushC2dmMessage  *push_notification_get_c2dm_message     (PushNotification *notification);
+const gchar      *push_notification_get_collapse_key     (PushNotification *notification);
+gboolean          push_notification_get_delay_while_idle (PushNotification *notification);
+GDateTime        *push_notification_get_expires_at       (PushNotification *notification);
+PushGcmMessage   *push_notification_get_gcm_message      (PushNotification *notification);
+const gchar      *push_notification_get_sound            (PushNotification *notification);
+GType             push_notification_get_type             (void) G_GNUC_CONST;
+PushNotification *push_notification_new                  (void);
+void              push_notification_set_alert            (PushNotification *notification,
+                                                          const gchar      *alert);
+void              push_notification_set_badge            (PushNotification *notification,
+                                                          guint             badge);
+void              push_notification_set_collapse_key     (PushNotification *notification,
+                                                          const gchar      *collapse_key);
+void              push_notification_set_delay_while_idle (PushNotification *notification,
+                                                          gboolean          delay_while_idle);
+void              push_notification_set_expires_at       (PushNotification *notification,
+                                                          GDateTime        *expires_at);
+void              push_notification_set_sound            (PushNotification *notification,
+                                                          const gchar      *sound);
+
+G_END_DECLS
+
+#endif /* PUSH_NOTIFICATION_H */
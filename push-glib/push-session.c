@@ -0,0 +1,248 @@
+/* push-session.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glib/gi18n.h>
+
+#include "push-debug.h"
+#include "push-session.h"
+
+typedef struct
+{
+   SoupSession        *session;
+   GSimpleAsyncResult *simple;
+   GCancellable       *cancellable;
+   gulong              cancelled_handler;
+   GPtrArray          *messages;
+   guint               n_connected;
+   guint               status_code;
+} PushSessionWarmUp;
+
+/**
+ * push_session_configure:
+ * @session: A #SoupSession.
+ *
+ * Applies the connection pool defaults shared by the HTTP based clients.
+ * libsoup only allows two connections per host by default, which would
+ * serialize requests to the single host each client talks to. Callers may
+ * still override the "max-conns", "max-conns-per-host" and "idle-timeout"
+ * properties afterwards.
+ */
+void
+push_session_configure (SoupSession *session)
+{
+   g_return_if_fail(SOUP_IS_SESSION(session));
+
+   g_object_set(session,
+                SOUP_SESSION_MAX_CONNS, PUSH_SESSION_MAX_CONNS,
+                SOUP_SESSION_MAX_CONNS_PER_HOST, PUSH_SESSION_MAX_CONNS,
+                SOUP_SESSION_IDLE_TIMEOUT, PUSH_SESSION_IDLE_TIMEOUT,
+                NULL);
+}
+
+static void
+push_session_warm_up_cb (SoupSession *session,
+                         SoupMessage *message,
+                         gpointer     user_data)
+{
+   PushSessionWarmUp *warm_up = user_data;
+
+   ENTRY;
+
+   /*
+    * Any HTTP response, even an error, means a connection was opened.
+    */
+   if (SOUP_STATUS_IS_TRANSPORT_ERROR(message->status_code)) {
+      warm_up->status_code = message->status_code;
+   } else {
+      warm_up->n_connected++;
+   }
+
+   g_ptr_array_remove(warm_up->messages, message);
+   if (warm_up->messages->len) {
+      EXIT;
+   }
+
+   if (warm_up->n_connected) {
+      g_simple_async_result_set_op_res_gboolean(warm_up->simple, TRUE);
+   } else {
+      g_simple_async_result_set_error(warm_up->simple,
+                                      SOUP_HTTP_ERROR,
+                                      warm_up->status_code,
+                                      _("Failed to connect: %s"),
+                                      soup_status_get_phrase(
+                                         warm_up->status_code));
+   }
+
+   g_simple_async_result_complete_in_idle(warm_up->simple);
+
+   if (warm_up->cancellable) {
+      g_signal_handler_disconnect(warm_up->cancellable,
+                                  warm_up->cancelled_handler);
+      g_object_unref(warm_up->cancellable);
+   }
+   g_ptr_array_unref(warm_up->messages);
+   g_object_unref(warm_up->simple);
+   g_slice_free(PushSessionWarmUp, warm_up);
+
+   EXIT;
+}
+
+/*
+ * Cancels the outstanding HEAD requests. Their callbacks may run, and
+ * free @warm_up, while we iterate, so a copy of the list is used. This is
+ * connected with g_signal_connect() rather than g_cancellable_connect()
+ * because that callback may disconnect it from within the emission.
+ */
+static void
+push_session_warm_up_cancelled_cb (GCancellable *cancellable,
+                                   gpointer      user_data)
+{
+   PushSessionWarmUp *warm_up = user_data;
+   SoupSession *session;
+   GPtrArray *messages;
+   guint i;
+
+   ENTRY;
+
+   session = g_object_ref(warm_up->session);
+   messages = g_ptr_array_new_with_free_func(g_object_unref);
+   for (i = 0; i < warm_up->messages->len; i++) {
+      g_ptr_array_add(messages,
+                      g_object_ref(g_ptr_array_index(warm_up->messages, i)));
+   }
+
+   for (i = 0; i < messages->len; i++) {
+      soup_session_cancel_message(session,
+                                  g_ptr_array_index(messages, i),
+                                  SOUP_STATUS_CANCELLED);
+   }
+
+   g_ptr_array_unref(messages);
+   g_object_unref(session);
+
+   EXIT;
+}
+
+/**
+ * push_session_warm_up_async:
+ * @session: A #SoupSession.
+ * @uri: The URI of the service.
+ * @n_connections: The number of connections to open.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback.
+ * @user_data: User data for @callback.
+ * @source_tag: The source tag of the public function.
+ *
+ * Opens up to @n_connections keep-alive connections to the host of @uri by
+ * sending concurrent HEAD requests, so the TCP and TLS handshakes are not
+ * paid by the first deliveries. The number of connections is still
+ * limited by the "max-conns-per-host" property of @session. Cancelling
+ * @cancellable cancels the requests that are still outstanding.
+ */
+void
+push_session_warm_up_async (SoupSession         *session,
+                            const gchar         *uri,
+                            guint                n_connections,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data,
+                            gpointer             source_tag)
+{
+   PushSessionWarmUp *warm_up;
+   SoupMessage *message;
+   guint n_messages;
+   guint i;
+
+   ENTRY;
+
+   g_return_if_fail(SOUP_IS_SESSION(session));
+   g_return_if_fail(uri);
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+
+   warm_up = g_slice_new0(PushSessionWarmUp);
+   warm_up->session = session;
+   warm_up->simple = g_simple_async_result_new(G_OBJECT(session), callback,
+                                               user_data, source_tag);
+   g_simple_async_result_set_check_cancellable(warm_up->simple, cancellable);
+   warm_up->messages = g_ptr_array_new_with_free_func(g_object_unref);
+
+   /*
+    * The messages are all tracked before the first is queued, since a
+    * callback could otherwise see an empty list and complete early.
+    */
+   n_messages = MAX(1, n_connections);
+   for (i = 0; i < n_messages; i++) {
+      message = soup_message_new(SOUP_METHOD_HEAD, uri);
+      g_ptr_array_add(warm_up->messages, message);
+   }
+
+   if (cancellable) {
+      warm_up->cancellable = g_object_ref(cancellable);
+      warm_up->cancelled_handler =
+         g_signal_connect(cancellable, "cancelled",
+                          G_CALLBACK(push_session_warm_up_cancelled_cb),
+                          warm_up);
+   }
+
+   for (i = 0; i < n_messages; i++) {
+      message = g_ptr_array_index(warm_up->messages, i);
+      soup_session_queue_message(session,
+                                 g_object_ref(message),
+                                 push_session_warm_up_cb,
+                                 warm_up);
+   }
+
+   if (cancellable && g_cancellable_is_cancelled(cancellable)) {
+      push_session_warm_up_cancelled_cb(cancellable, warm_up);
+   }
+
+   EXIT;
+}
+
+/**
+ * push_session_warm_up_finish:
+ * @session: A #SoupSession.
+ * @result: A #GAsyncResult.
+ * @error: (out) (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes a request to push_session_warm_up_async().
+ *
+ * Returns: %TRUE if at least one connection was opened.
+ */
+gboolean
+push_session_warm_up_finish (SoupSession   *session,
+                             GAsyncResult  *result,
+                             GError       **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+   gboolean ret;
+
+   ENTRY;
+
+   g_return_val_if_fail(SOUP_IS_SESSION(session), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
+
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      RETURN(FALSE);
+   }
+
+   ret = g_simple_async_result_get_op_res_gboolean(simple);
+
+   RETURN(ret);
+}
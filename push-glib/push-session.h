@@ -0,0 +1,49 @@
+/* push-session.h
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PUSH_SESSION_H
+#define PUSH_SESSION_H
+
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Connection pool defaults for the SoupSession based clients. Each client
+ * talks to a single host, so every connection may go to that host. Idle
+ * connections are closed before the services drop them on their side.
+ */
+#define PUSH_SESSION_MAX_CONNS    32
+#define PUSH_SESSION_IDLE_TIMEOUT 60
+
+void     push_session_configure      (SoupSession          *session);
+void     push_session_warm_up_async  (SoupSession          *session,
+                                      const gchar          *uri,
+                                      guint                 n_connections,
+                                      GCancellable         *cancellable,
+                                      GAsyncReadyCallback   callback,
+                                      gpointer              user_data,
+                                      gpointer              source_tag);
+gboolean push_session_warm_up_finish (SoupSession          *session,
+                                      GAsyncResult         *result,
+                                      GError              **error);
+
+G_END_DECLS
+
+#endif /* PUSH_SESSION_H */
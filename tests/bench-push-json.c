@@ -0,0 +1,184 @@
+/* bench-push-json.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <push-glib/push-glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compares serializing APS payloads with push-json against building the
+ * equivalent JsonNode tree and running it through JsonGenerator, which is
+ * what PushApsMessage used to do.
+ */
+
+static gint         gIterations = 100000;
+static GOptionEntry gEntries[] = {
+   { "iterations", 'n', 0, G_OPTION_ARG_INT, &gIterations,
+     "The number of payloads to serialize." },
+   { NULL }
+};
+
+static gsize
+bench_generator (gint i)
+{
+   JsonGenerator *generator;
+   JsonObject *aps;
+   JsonObject *object;
+   JsonNode *node;
+   gchar *json;
+   gsize length;
+
+   aps = json_object_new();
+   json_object_set_string_member(aps, "alert", "You have a new message.");
+   json_object_set_int_member(aps, "badge", i);
+   json_object_set_string_member(aps, "sound", "default");
+
+   object = json_object_new();
+   json_object_set_string_member(object, "thread", "c\xc3\xa9\"12\"");
+   json_object_set_object_member(object, "aps", aps);
+
+   node = json_node_new(JSON_NODE_OBJECT);
+   json_node_take_object(node, object);
+
+   generator = json_generator_new();
+   json_generator_set_root(generator, node);
+   json = json_generator_to_data(generator, &length);
+
+   g_free(json);
+   g_object_unref(generator);
+   json_node_free(node);
+
+   return length;
+}
+
+static gsize
+bench_message (gint i)
+{
+   PushApsMessage *message;
+   gsize length;
+
+   message = push_aps_message_new();
+   push_aps_message_set_alert(message, "You have a new message.");
+   push_aps_message_set_badge(message, i);
+   push_aps_message_set_sound(message, "default");
+   push_aps_message_add_extra_string(message, "thread", "c\xc3\xa9\"12\"");
+   length = strlen(push_aps_message_get_json(message));
+   g_object_unref(message);
+
+   return length;
+}
+
+static gsize
+bench_builder (gint i)
+{
+   PushApsMessageBuilder builder;
+   PushApsMessage *message;
+   gsize length;
+
+   push_aps_message_builder_init(&builder);
+   push_aps_message_builder_set_alert(&builder, "You have a new message.");
+   push_aps_message_builder_set_badge(&builder, i);
+   push_aps_message_builder_set_sound(&builder, "default");
+   push_aps_message_builder_add_extra_string(&builder, "thread",
+                                             "c\xc3\xa9\"12\"");
+   message = push_aps_message_builder_end(&builder);
+   length = strlen(push_aps_message_get_json(message));
+   g_object_unref(message);
+
+   return length;
+}
+
+static gsize
+bench_builder_into (gint i)
+{
+   static PushApsMessage *message;
+   PushApsMessageBuilder builder;
+
+   if (!message) {
+      message = push_aps_message_new();
+   }
+
+   push_aps_message_builder_init(&builder);
+   push_aps_message_builder_set_alert(&builder, "You have a new message.");
+   push_aps_message_builder_set_badge(&builder, i);
+   push_aps_message_builder_set_sound(&builder, "default");
+   push_aps_message_builder_add_extra_string(&builder, "thread",
+                                             "c\xc3\xa9\"12\"");
+   push_aps_message_builder_end_into(&builder, message);
+
+   return strlen(push_aps_message_get_json(message));
+}
+
+static void
+bench_run (const gchar *name,
+           gsize      (*func) (gint i))
+{
+   GTimer *timer;
+   gdouble elapsed;
+   gsize bytes = 0;
+   gint i;
+
+   timer = g_timer_new();
+   for (i = 0; i < gIterations; i++) {
+      bytes += func(i);
+   }
+   elapsed = g_timer_elapsed(timer, NULL);
+   g_timer_destroy(timer);
+
+   g_print("%-16s %8.3f s %10.0f payloads/s %8.1f MB/s\n",
+           name,
+           elapsed,
+           gIterations / elapsed,
+           bytes / elapsed / (1024.0 * 1024.0));
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   GOptionContext *context;
+   GError *error = NULL;
+
+   context = g_option_context_new("- Benchmark APS payload serialization.");
+   g_option_context_add_main_entries(context, gEntries, NULL);
+   if (!g_option_context_parse(context, &argc, &argv, &error)) {
+      g_printerr("%s\n", error->message);
+      g_error_free(error);
+      return EXIT_FAILURE;
+   }
+   g_option_context_free(context);
+
+   if (gIterations <= 0) {
+      g_printerr("The number of iterations must be positive.\n");
+      return EXIT_FAILURE;
+   }
+
+   g_type_init();
+
+   /*
+    * Interning would make every message after the first one a lookup.
+    */
+   push_aps_message_set_intern_limit(0);
+
+   bench_run("JsonGenerator", bench_generator);
+   bench_run("PushApsMessage", bench_message);
+   bench_run("Builder", bench_builder);
+   bench_run("Builder (reuse)", bench_builder_into);
+
+   return EXIT_SUCCESS;
+}
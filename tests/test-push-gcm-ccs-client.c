@@ -0,0 +1,448 @@
+/* test-push-gcm-ccs-client.c
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <push-glib/push-glib.h>
+#include <signal.h>
+#include <string.h>
+
+/*
+ * The client is pointed at tools/push-ccs-server, started on a free port
+ * for every test with delivery receipts enabled. It acks every message,
+ * nacks registration ids starting with "gone" and drains the connection
+ * before acking ids starting with "drain".
+ */
+
+#ifndef PUSH_CCS_SERVER
+#define PUSH_CCS_SERVER "./push-ccs-server"
+#endif
+
+typedef struct
+{
+   GPid       pid;
+   guint      port;
+   GPtrArray *receipts;
+   GPtrArray *removed;
+   guint      n_opened;
+   guint      n_connections;
+} MockCcs;
+
+static GMainLoop *gMainLoop;
+
+static guint
+mock_ccs_get_free_port (void)
+{
+   GSocketListener *listener;
+   GError *error = NULL;
+   guint16 port;
+
+   listener = g_socket_listener_new();
+   port = g_socket_listener_add_any_inet_port(listener, NULL, &error);
+   g_assert_no_error(error);
+   g_socket_listener_close(listener);
+   g_object_unref(listener);
+
+   return port;
+}
+
+/*
+ * Waits until the server accepts connections, it takes a moment to start.
+ */
+static void
+mock_ccs_wait (MockCcs *mock)
+{
+   GSocketConnection *connection;
+   GSocketClient *client;
+   GError *error = NULL;
+   guint i;
+
+   client = g_socket_client_new();
+   for (i = 0; ; i++) {
+      connection = g_socket_client_connect_to_host(client, "127.0.0.1",
+                                                   mock->port, NULL,
+                                                   &error);
+      if (connection) {
+         break;
+      }
+      g_assert_cmpuint(i, <, 200);
+      g_clear_error(&error);
+      g_usleep(G_USEC_PER_SEC / 20);
+   }
+   g_object_unref(connection);
+   g_object_unref(client);
+}
+
+static MockCcs *
+mock_ccs_new (void)
+{
+   MockCcs *mock;
+   GError *error = NULL;
+   gchar *argv[5];
+   gchar *port;
+
+   mock = g_slice_new0(MockCcs);
+   mock->port = mock_ccs_get_free_port();
+   mock->receipts = g_ptr_array_new_with_free_func(g_free);
+   mock->removed = g_ptr_array_new_with_free_func(g_free);
+
+   port = g_strdup_printf("%u", mock->port);
+   argv[0] = (gchar *)PUSH_CCS_SERVER;
+   argv[1] = (gchar *)"--port";
+   argv[2] = port;
+   argv[3] = (gchar *)"--receipts";
+   argv[4] = NULL;
+   g_spawn_async(NULL, argv, NULL, G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL,
+                 &mock->pid, &error);
+   g_assert_no_error(error);
+   g_free(port);
+
+   mock_ccs_wait(mock);
+
+   return mock;
+}
+
+static void
+mock_ccs_free (MockCcs *mock)
+{
+   kill(mock->pid, SIGTERM);
+   g_spawn_close_pid(mock->pid);
+   g_ptr_array_unref(mock->receipts);
+   g_ptr_array_unref(mock->removed);
+   g_slice_free(MockCcs, mock);
+}
+
+static void
+delivery_receipt_cb (PushGcmCcsClient *client,
+                     PushGcmIdentity  *identity,
+                     const gchar      *message_id,
+                     MockCcs          *mock)
+{
+   g_ptr_array_add(mock->receipts, g_strdup(message_id));
+   g_main_loop_quit(gMainLoop);
+}
+
+static void
+identity_removed_cb (PushGcmCcsClient *client,
+                     PushGcmIdentity  *identity,
+                     MockCcs          *mock)
+{
+   g_ptr_array_add(mock->removed,
+                   g_strdup(push_gcm_identity_get_registration_id(identity)));
+}
+
+static void
+notify_n_connections_cb (PushGcmCcsClient *client,
+                         GParamSpec       *pspec,
+                         MockCcs          *mock)
+{
+   guint n_connections;
+
+   n_connections = push_gcm_ccs_client_get_n_connections(client);
+   if (n_connections > mock->n_connections) {
+      mock->n_opened++;
+   }
+   mock->n_connections = n_connections;
+}
+
+static PushGcmCcsClient *
+client_new (MockCcs *mock)
+{
+   PushGcmCcsClient *client;
+
+   client = g_object_new(PUSH_TYPE_GCM_CCS_CLIENT,
+                         "api-key", "api-key",
+                         "host", "127.0.0.1",
+                         "port", mock->port,
+                         "sender-id", "1234",
+                         "tls", FALSE,
+                         NULL);
+   g_signal_connect(client, "delivery-receipt",
+                    G_CALLBACK(delivery_receipt_cb), mock);
+   g_signal_connect(client, "identity-removed",
+                    G_CALLBACK(identity_removed_cb), mock);
+   g_signal_connect(client, "notify::n-connections",
+                    G_CALLBACK(notify_n_connections_cb), mock);
+
+   return client;
+}
+
+static gboolean
+timeout_cb (gpointer data)
+{
+   g_error("Timed out waiting for the test to complete.");
+   return FALSE;
+}
+
+static void
+async_cb (GObject      *object,
+          GAsyncResult *result,
+          gpointer      user_data)
+{
+   GAsyncResult **ret = user_data;
+
+   *ret = g_object_ref(result);
+   g_main_loop_quit(gMainLoop);
+}
+
+static GAsyncResult *
+run_until_complete (GAsyncResult **result)
+{
+   guint handler;
+
+   handler = g_timeout_add_seconds(30, timeout_cb, NULL);
+   while (!*result) {
+      g_main_loop_run(gMainLoop);
+   }
+   g_source_remove(handler);
+
+   return *result;
+}
+
+static void
+run_until_receipts (MockCcs *mock,
+                    guint    n_receipts)
+{
+   guint handler;
+
+   handler = g_timeout_add_seconds(30, timeout_cb, NULL);
+   while (mock->receipts->len < n_receipts) {
+      g_main_loop_run(gMainLoop);
+   }
+   g_source_remove(handler);
+}
+
+static gboolean
+deliver (PushGcmCcsClient  *client,
+         const gchar       *registration_id,
+         PushGcmResult    **gcm_result,
+         GError           **error)
+{
+   PushGcmIdentity *identity;
+   PushGcmMessage *message;
+   GAsyncResult *result = NULL;
+   gboolean ret;
+
+   identity = push_gcm_identity_new(registration_id);
+   message = push_gcm_message_new();
+   push_gcm_ccs_client_deliver_async(client, identity, message, NULL,
+                                     async_cb, &result);
+   ret = push_gcm_ccs_client_deliver_finish_with_result(
+         client, run_until_complete(&result), gcm_result, error);
+   g_object_unref(result);
+   g_object_unref(message);
+   g_object_unref(identity);
+
+   return ret;
+}
+
+static void
+assert_result (PushGcmResult      *result,
+               const gchar        *registration_id,
+               PushGcmClientError  code)
+{
+   g_assert(result);
+   g_assert_cmpstr(push_gcm_identity_get_registration_id(
+                      push_gcm_result_get_identity(result)),
+                   ==,
+                   registration_id);
+   g_assert(push_gcm_result_get_message_id(result));
+   g_assert_cmpstr(push_gcm_result_get_registration_id(result), ==, NULL);
+   g_assert_cmpint(push_gcm_result_get_error(result), ==, code);
+}
+
+static gboolean
+has_string (GPtrArray   *array,
+            const gchar *str)
+{
+   guint i;
+
+   for (i = 0; i < array->len; i++) {
+      if (!g_strcmp0(g_ptr_array_index(array, i), str)) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+static void
+test_push_gcm_ccs_client_ack (void)
+{
+   static const gchar *ids[] = { "a", "b", "c" };
+   PushGcmCcsClient *client;
+   PushGcmMessage *message;
+   PushGcmIdentity *identity;
+   PushGcmResult *gcm_result;
+   GAsyncResult *results[G_N_ELEMENTS(ids)] = { NULL };
+   GPtrArray *message_ids;
+   MockCcs *mock;
+   GError *error = NULL;
+   guint i;
+
+   mock = mock_ccs_new();
+   client = client_new(mock);
+   message_ids = g_ptr_array_new_with_free_func(g_free);
+
+   /*
+    * One message at a time, then several sharing the connection.
+    */
+   g_assert(deliver(client, "first", &gcm_result, &error));
+   g_assert_no_error(error);
+   assert_result(gcm_result, "first", 0);
+   g_ptr_array_add(message_ids,
+                   g_strdup(push_gcm_result_get_message_id(gcm_result)));
+   push_gcm_result_unref(gcm_result);
+
+   message = push_gcm_message_new();
+   for (i = 0; i < G_N_ELEMENTS(ids); i++) {
+      identity = push_gcm_identity_new(ids[i]);
+      push_gcm_ccs_client_deliver_async(client, identity, message, NULL,
+                                        async_cb, &results[i]);
+      g_object_unref(identity);
+   }
+   for (i = 0; i < G_N_ELEMENTS(ids); i++) {
+      g_assert(push_gcm_ccs_client_deliver_finish_with_result(
+                  client, run_until_complete(&results[i]), &gcm_result,
+                  &error));
+      g_assert_no_error(error);
+      assert_result(gcm_result, ids[i], 0);
+      g_assert(!has_string(message_ids,
+                           push_gcm_result_get_message_id(gcm_result)));
+      g_ptr_array_add(message_ids,
+                      g_strdup(push_gcm_result_get_message_id(gcm_result)));
+      push_gcm_result_unref(gcm_result);
+      g_object_unref(results[i]);
+   }
+   g_object_unref(message);
+
+   g_assert_cmpuint(mock->n_opened, ==, 1);
+   g_assert_cmpuint(push_gcm_ccs_client_get_n_connections(client), ==, 1);
+   g_assert_cmpuint(push_gcm_ccs_client_get_queue_depth(client), ==, 0);
+
+   /*
+    * Every acked message gets a receipt carrying its message id.
+    */
+   run_until_receipts(mock, message_ids->len);
+   g_assert_cmpuint(mock->receipts->len, ==, message_ids->len);
+   for (i = 0; i < message_ids->len; i++) {
+      g_assert(has_string(mock->receipts,
+                          g_ptr_array_index(message_ids, i)));
+   }
+   g_assert_cmpuint(mock->removed->len, ==, 0);
+
+   g_ptr_array_unref(message_ids);
+   g_object_unref(client);
+   mock_ccs_free(mock);
+}
+
+static void
+test_push_gcm_ccs_client_nack (void)
+{
+   PushGcmCcsClient *client;
+   PushGcmResult *gcm_result;
+   MockCcs *mock;
+   GError *error = NULL;
+
+   mock = mock_ccs_new();
+   client = client_new(mock);
+
+   g_assert(!deliver(client, "gone-1", &gcm_result, &error));
+   g_assert_error(error, PUSH_GCM_CLIENT_ERROR,
+                  PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED);
+   g_clear_error(&error);
+   assert_result(gcm_result, "gone-1", PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED);
+   push_gcm_result_unref(gcm_result);
+
+   g_assert_cmpuint(mock->removed->len, ==, 1);
+   g_assert_cmpstr(g_ptr_array_index(mock->removed, 0), ==, "gone-1");
+
+   /*
+    * A nack does not affect the connection.
+    */
+   g_assert(deliver(client, "a", &gcm_result, &error));
+   g_assert_no_error(error);
+   assert_result(gcm_result, "a", 0);
+   push_gcm_result_unref(gcm_result);
+
+   g_assert_cmpuint(mock->n_opened, ==, 1);
+   g_assert_cmpuint(push_gcm_ccs_client_get_n_connections(client), ==, 1);
+
+   /*
+    * Only the acked message gets a receipt.
+    */
+   run_until_receipts(mock, 1);
+   g_assert_cmpuint(mock->receipts->len, ==, 1);
+
+   g_object_unref(client);
+   mock_ccs_free(mock);
+}
+
+static void
+test_push_gcm_ccs_client_drain (void)
+{
+   PushGcmCcsClient *client;
+   PushGcmResult *gcm_result;
+   MockCcs *mock;
+   GError *error = NULL;
+
+   mock = mock_ccs_new();
+   client = client_new(mock);
+
+   /*
+    * The message is still acked on the draining connection, which is
+    * closed once nothing is left unacknowledged.
+    */
+   g_assert(deliver(client, "drain-1", &gcm_result, &error));
+   g_assert_no_error(error);
+   assert_result(gcm_result, "drain-1", 0);
+   push_gcm_result_unref(gcm_result);
+
+   g_assert_cmpuint(mock->n_opened, ==, 1);
+   g_assert_cmpuint(push_gcm_ccs_client_get_n_connections(client), ==, 0);
+
+   /*
+    * The next message opens a new connection.
+    */
+   g_assert(deliver(client, "a", &gcm_result, &error));
+   g_assert_no_error(error);
+   assert_result(gcm_result, "a", 0);
+   push_gcm_result_unref(gcm_result);
+
+   g_assert_cmpuint(mock->n_opened, ==, 2);
+   g_assert_cmpuint(push_gcm_ccs_client_get_n_connections(client), ==, 1);
+   g_assert_cmpuint(push_gcm_ccs_client_get_queue_depth(client), ==, 0);
+
+   g_object_unref(client);
+   mock_ccs_free(mock);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+
+   gMainLoop = g_main_loop_new(NULL, FALSE);
+
+   g_test_add_func("/PushGcmCcsClient/ack", test_push_gcm_ccs_client_ack);
+   g_test_add_func("/PushGcmCcsClient/nack", test_push_gcm_ccs_client_nack);
+   g_test_add_func("/PushGcmCcsClient/drain",
+                   test_push_gcm_ccs_client_drain);
+
+   return g_test_run();
+}
@@ -0,0 +1,1033 @@
+/* test-push-gcm-client.c
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <push-glib/push-glib.h>
+#include <string.h>
+
+/*
+ * The client is pointed at a SoupServer standing in for GCM. Each request
+ * is answered with the next canned response, or with a 200 once they run
+ * out. A 200 reports success for every registration id, except that ids
+ * starting with "gone" are not registered and @fail_id is unavailable.
+ */
+
+typedef struct
+{
+   guint        status;
+   const gchar *retry_after;
+   const gchar *fail_id;
+} MockResponse;
+
+typedef struct
+{
+   gint64   received_at;
+   gchar  **ids;
+} MockRequest;
+
+typedef struct
+{
+   SoupServer *server;
+   GQueue      responses;
+   GPtrArray  *requests;
+   guint       n_warm_ups;
+   guint       delay;
+   gchar      *url;
+} MockGcm;
+
+typedef struct
+{
+   SoupServer  *server;
+   SoupMessage *message;
+} MockPause;
+
+static GMainLoop *gMainLoop;
+
+static void
+mock_request_free (gpointer data)
+{
+   MockRequest *request = data;
+
+   g_strfreev(request->ids);
+   g_slice_free(MockRequest, request);
+}
+
+static gboolean
+mock_gcm_unpause_cb (gpointer data)
+{
+   MockPause *pause = data;
+
+   soup_server_unpause_message(pause->server, pause->message);
+   g_object_unref(pause->server);
+   g_object_unref(pause->message);
+   g_slice_free(MockPause, pause);
+
+   return FALSE;
+}
+
+static gchar **
+mock_gcm_read_ids (SoupMessage *message)
+{
+   JsonParser *parser;
+   JsonObject *object;
+   JsonArray *array;
+   GError *error = NULL;
+   gchar **ids;
+   guint i;
+
+   parser = json_parser_new();
+   json_parser_load_from_data(parser,
+                              message->request_body->data,
+                              message->request_body->length,
+                              &error);
+   g_assert_no_error(error);
+
+   object = json_node_get_object(json_parser_get_root(parser));
+   array = json_object_get_array_member(object, "registration_ids");
+   ids = g_new0(gchar *, json_array_get_length(array) + 1);
+   for (i = 0; i < json_array_get_length(array); i++) {
+      ids[i] = g_strdup(json_array_get_string_element(array, i));
+   }
+
+   g_object_unref(parser);
+
+   return ids;
+}
+
+static void
+mock_gcm_handler (SoupServer        *server,
+                  SoupMessage       *message,
+                  const gchar       *path,
+                  GHashTable        *query,
+                  SoupClientContext *context,
+                  gpointer           user_data)
+{
+   MockResponse *response;
+   MockRequest *request;
+   MockPause *pause;
+   MockGcm *mock = user_data;
+   GString *body;
+   gsize length;
+   guint status;
+   guint i;
+
+   /*
+    * Warm up requests only need an answer.
+    */
+   if (message->method != SOUP_METHOD_POST) {
+      mock->n_warm_ups++;
+      soup_message_set_status(message, SOUP_STATUS_OK);
+      return;
+   }
+
+   request = g_slice_new0(MockRequest);
+   request->received_at = g_get_monotonic_time();
+   request->ids = mock_gcm_read_ids(message);
+   g_ptr_array_add(mock->requests, request);
+
+   response = g_queue_pop_head(&mock->responses);
+   status = response ? response->status : SOUP_STATUS_OK;
+
+   if (response && response->retry_after) {
+      soup_message_headers_append(message->response_headers,
+                                  "Retry-After",
+                                  response->retry_after);
+   }
+
+   if (status == SOUP_STATUS_OK) {
+      body = g_string_new("{\"multicast_id\":1,\"results\":[");
+      for (i = 0; request->ids[i]; i++) {
+         if (i) {
+            g_string_append_c(body, ',');
+         }
+         if (response && !g_strcmp0(request->ids[i], response->fail_id)) {
+            g_string_append(body, "{\"error\":\"Unavailable\"}");
+         } else if (g_str_has_prefix(request->ids[i], "gone")) {
+            g_string_append(body, "{\"error\":\"NotRegistered\"}");
+         } else {
+            g_string_append_printf(body, "{\"message_id\":\"m:%s\"}",
+                                   request->ids[i]);
+         }
+      }
+      g_string_append(body, "]}");
+      length = body->len;
+      soup_message_set_response(message,
+                                "application/json",
+                                SOUP_MEMORY_TAKE,
+                                g_string_free(body, FALSE),
+                                length);
+   }
+
+   soup_message_set_status(message, status);
+
+   if (mock->delay) {
+      pause = g_slice_new0(MockPause);
+      pause->server = g_object_ref(server);
+      pause->message = g_object_ref(message);
+      soup_server_pause_message(server, message);
+      g_timeout_add(mock->delay, mock_gcm_unpause_cb, pause);
+   }
+}
+
+static MockGcm *
+mock_gcm_new (void)
+{
+   MockGcm *mock;
+
+   mock = g_slice_new0(MockGcm);
+   mock->server = soup_server_new(SOUP_SERVER_PORT, 0, NULL);
+   g_assert(mock->server);
+   mock->requests = g_ptr_array_new_with_free_func(mock_request_free);
+   mock->url = g_strdup_printf("http://127.0.0.1:%u/gcm/send",
+                               soup_server_get_port(mock->server));
+   g_queue_init(&mock->responses);
+   soup_server_add_handler(mock->server, "/gcm/send",
+                           mock_gcm_handler, mock, NULL);
+   soup_server_run_async(mock->server);
+
+   return mock;
+}
+
+static void
+mock_gcm_free (MockGcm *mock)
+{
+   soup_server_quit(mock->server);
+   g_object_unref(mock->server);
+   g_ptr_array_unref(mock->requests);
+   g_queue_clear(&mock->responses);
+   g_free(mock->url);
+   g_slice_free(MockGcm, mock);
+}
+
+static void
+mock_gcm_push (MockGcm            *mock,
+               const MockResponse *response)
+{
+   g_queue_push_tail(&mock->responses, (gpointer)response);
+}
+
+static MockRequest *
+mock_gcm_get_request (MockGcm *mock,
+                      guint    index)
+{
+   g_assert_cmpuint(index, <, mock->requests->len);
+   return g_ptr_array_index(mock->requests, index);
+}
+
+static gdouble
+mock_gcm_get_interval (MockGcm *mock,
+                       guint    index)
+{
+   return (mock_gcm_get_request(mock, index)->received_at -
+           mock_gcm_get_request(mock, index - 1)->received_at) /
+          (gdouble)G_USEC_PER_SEC;
+}
+
+static PushGcmClient *
+client_new (MockGcm *mock)
+{
+   PushGcmClient *client;
+
+   client = push_gcm_client_new("test-token");
+   push_gcm_client_set_url(client, mock->url);
+
+   return client;
+}
+
+static GList *
+identities_new (const gchar *first,
+                ...)
+{
+   const gchar *registration_id;
+   va_list args;
+   GList *list = NULL;
+
+   va_start(args, first);
+   for (registration_id = first;
+        registration_id;
+        registration_id = va_arg(args, const gchar *)) {
+      list = g_list_prepend(list, push_gcm_identity_new(registration_id));
+   }
+   va_end(args);
+
+   return g_list_reverse(list);
+}
+
+/*
+ * Creates enough identities for @n_requests requests of at most 1000
+ * registration ids each.
+ */
+static GList *
+identities_new_n (guint n_requests)
+{
+   GList *list = NULL;
+   gchar id[16];
+   guint i;
+
+   for (i = 0; i < ((n_requests - 1) * 1000) + 1; i++) {
+      g_snprintf(id, sizeof id, "id-%u", i);
+      list = g_list_prepend(list, push_gcm_identity_new(id));
+   }
+
+   return g_list_reverse(list);
+}
+
+static void
+identities_free (GList *list)
+{
+   g_list_foreach(list, (GFunc)g_object_unref, NULL);
+   g_list_free(list);
+}
+
+static gboolean
+timeout_cb (gpointer data)
+{
+   g_error("Timed out waiting for the test to complete.");
+   return FALSE;
+}
+
+static void
+async_cb (GObject      *object,
+          GAsyncResult *result,
+          gpointer      user_data)
+{
+   GAsyncResult **ret = user_data;
+
+   *ret = g_object_ref(result);
+   g_main_loop_quit(gMainLoop);
+}
+
+static GAsyncResult *
+run_until_complete (GAsyncResult **result)
+{
+   guint handler;
+
+   handler = g_timeout_add_seconds(30, timeout_cb, NULL);
+   while (!*result) {
+      g_main_loop_run(gMainLoop);
+   }
+   g_source_remove(handler);
+
+   return *result;
+}
+
+static gboolean
+deliver (PushGcmClient  *client,
+         GList          *identities,
+         GPtrArray     **results,
+         GError        **error)
+{
+   PushGcmMessage *message;
+   GAsyncResult *result = NULL;
+   gboolean ret;
+
+   message = push_gcm_message_new();
+   push_gcm_client_deliver_async(client, identities, message, NULL,
+                                 async_cb, &result);
+   ret = push_gcm_client_deliver_finish_with_results(
+         client, run_until_complete(&result), results, error);
+   g_object_unref(result);
+   g_object_unref(message);
+
+   return ret;
+}
+
+static void
+assert_result (GPtrArray          *results,
+               guint               index,
+               const gchar        *registration_id,
+               const gchar        *message_id,
+               PushGcmClientError  code)
+{
+   PushGcmResult *result;
+
+   g_assert_cmpuint(index, <, results->len);
+   result = g_ptr_array_index(results, index);
+   g_assert(result);
+   g_assert_cmpstr(push_gcm_identity_get_registration_id(
+                      push_gcm_result_get_identity(result)),
+                   ==,
+                   registration_id);
+   g_assert_cmpstr(push_gcm_result_get_message_id(result), ==, message_id);
+   g_assert_cmpint(push_gcm_result_get_error(result), ==, code);
+}
+
+static void
+test_push_gcm_client_results (void)
+{
+   PushGcmClient *client;
+   GPtrArray *results;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+
+   mock = mock_gcm_new();
+   client = client_new(mock);
+
+   identities = identities_new("a", "gone-b", "c", NULL);
+   g_assert(deliver(client, identities, &results, &error));
+   g_assert_no_error(error);
+
+   g_assert_cmpuint(mock->requests->len, ==, 1);
+   g_assert_cmpuint(results->len, ==, 3);
+   assert_result(results, 0, "a", "m:a", 0);
+   assert_result(results, 1, "gone-b", NULL,
+                 PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED);
+   assert_result(results, 2, "c", "m:c", 0);
+
+   g_ptr_array_unref(results);
+   identities_free(identities);
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_client_retry_after (void)
+{
+   static const MockResponse unavailable = { 503, "2", NULL };
+   PushGcmClient *client;
+   GPtrArray *results;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+
+   mock = mock_gcm_new();
+   mock_gcm_push(mock, &unavailable);
+   client = client_new(mock);
+
+   /*
+    * Without Retry-After the first retry happens within a second.
+    */
+   identities = identities_new("a", NULL);
+   g_assert(deliver(client, identities, &results, &error));
+   g_assert_no_error(error);
+
+   g_assert_cmpuint(mock->requests->len, ==, 2);
+   g_assert_cmpfloat(mock_gcm_get_interval(mock, 1), >=, 1.9);
+   assert_result(results, 0, "a", "m:a", 0);
+
+   g_ptr_array_unref(results);
+   identities_free(identities);
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_client_retry_after_result (void)
+{
+   static const MockResponse partial = { 200, "2", "b" };
+   PushGcmClient *client;
+   MockRequest *request;
+   GPtrArray *results;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+
+   mock = mock_gcm_new();
+   mock_gcm_push(mock, &partial);
+   client = client_new(mock);
+
+   /*
+    * Only the unavailable registration id is sent again, and Retry-After
+    * applies to it even though the request itself succeeded.
+    */
+   identities = identities_new("a", "b", "c", NULL);
+   g_assert(deliver(client, identities, &results, &error));
+   g_assert_no_error(error);
+
+   g_assert_cmpuint(mock->requests->len, ==, 2);
+   request = mock_gcm_get_request(mock, 1);
+   g_assert_cmpuint(g_strv_length(request->ids), ==, 1);
+   g_assert_cmpstr(request->ids[0], ==, "b");
+   g_assert_cmpfloat(mock_gcm_get_interval(mock, 1), >=, 1.9);
+
+   assert_result(results, 0, "a", "m:a", 0);
+   assert_result(results, 1, "b", "m:b", 0);
+   assert_result(results, 2, "c", "m:c", 0);
+
+   g_ptr_array_unref(results);
+   identities_free(identities);
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_client_retry_after_invalid (void)
+{
+   static const MockResponse unavailable = { 503, "soon", NULL };
+   PushGcmClient *client;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+
+   mock = mock_gcm_new();
+   mock_gcm_push(mock, &unavailable);
+   client = client_new(mock);
+
+   /*
+    * An unparsable Retry-After falls back to the backoff, which waits at
+    * most a second before the first retry.
+    */
+   identities = identities_new("a", NULL);
+   g_assert(deliver(client, identities, NULL, &error));
+   g_assert_no_error(error);
+
+   g_assert_cmpuint(mock->requests->len, ==, 2);
+   g_assert_cmpfloat(mock_gcm_get_interval(mock, 1), <, 1.9);
+
+   identities_free(identities);
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_client_max_retries (void)
+{
+   static const MockResponse unavailable = { 503, NULL, NULL };
+   PushGcmClient *client;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+
+   mock = mock_gcm_new();
+   mock_gcm_push(mock, &unavailable);
+   mock_gcm_push(mock, &unavailable);
+   client = client_new(mock);
+   push_gcm_client_set_max_retries(client, 1);
+
+   identities = identities_new("a", NULL);
+   g_assert(!deliver(client, identities, NULL, &error));
+   g_assert_error(error, SOUP_HTTP_ERROR, SOUP_STATUS_SERVICE_UNAVAILABLE);
+   g_clear_error(&error);
+
+   g_assert_cmpuint(mock->requests->len, ==, 2);
+
+   identities_free(identities);
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_client_limit_decrease (void)
+{
+   static const MockResponse unavailable = { 503, NULL, NULL };
+   static const MockResponse too_many = { 429, NULL, NULL };
+   PushGcmClient *client;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+
+   mock = mock_gcm_new();
+   mock->delay = 100;
+   mock_gcm_push(mock, &unavailable);
+   mock_gcm_push(mock, &unavailable);
+   mock_gcm_push(mock, &unavailable);
+   mock_gcm_push(mock, &too_many);
+   client = client_new(mock);
+   push_gcm_client_set_max_retries(client, 0);
+   g_assert_cmpuint(push_gcm_client_get_in_flight_limit(client), ==, 4);
+
+   /*
+    * Three requests fail together, which only halves the limit once.
+    */
+   identities = identities_new_n(3);
+   g_assert(!deliver(client, identities, NULL, &error));
+   g_assert_error(error, SOUP_HTTP_ERROR, SOUP_STATUS_SERVICE_UNAVAILABLE);
+   g_clear_error(&error);
+   identities_free(identities);
+
+   g_assert_cmpuint(mock->requests->len, ==, 3);
+   g_assert_cmpuint(push_gcm_client_get_in_flight_limit(client), ==, 2);
+
+   /*
+    * A 429 sent after that decrease halves it again.
+    */
+   identities = identities_new("a", NULL);
+   g_assert(!deliver(client, identities, NULL, &error));
+   g_assert_error(error, SOUP_HTTP_ERROR, SOUP_STATUS_SERVICE_UNAVAILABLE);
+   g_clear_error(&error);
+   identities_free(identities);
+
+   g_assert_cmpuint(push_gcm_client_get_in_flight_limit(client), ==, 1);
+
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_client_limit_increase (void)
+{
+   PushGcmClient *client;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+   guint i;
+
+   mock = mock_gcm_new();
+   mock->delay = 20;
+   client = client_new(mock);
+   push_gcm_client_set_max_in_flight(client, 5);
+
+   /*
+    * The limit grows by 1/limit per response: 4.25, 4.49, 4.71, 4.92 and
+    * then 5.12, which is capped by max-in-flight.
+    */
+   identities = identities_new("a", NULL);
+   for (i = 0; i < 4; i++) {
+      g_assert(deliver(client, identities, NULL, &error));
+      g_assert_no_error(error);
+      g_assert_cmpuint(push_gcm_client_get_in_flight_limit(client), ==, 4);
+   }
+   for (i = 0; i < 4; i++) {
+      g_assert(deliver(client, identities, NULL, &error));
+      g_assert_no_error(error);
+      g_assert_cmpuint(push_gcm_client_get_in_flight_limit(client), ==, 5);
+   }
+   identities_free(identities);
+
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+notify_queue_depth_cb (PushGcmClient *client,
+                       GParamSpec    *pspec,
+                       guint         *max_depth)
+{
+   *max_depth = MAX(*max_depth, push_gcm_client_get_queue_depth(client));
+}
+
+static void
+test_push_gcm_client_limit_queue (void)
+{
+   PushGcmClient *client;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+   guint max_depth = 0;
+   guint i;
+
+   mock = mock_gcm_new();
+   mock->delay = 50;
+   client = client_new(mock);
+   push_gcm_client_set_max_in_flight(client, 1);
+   g_assert_cmpuint(push_gcm_client_get_in_flight_limit(client), ==, 1);
+   g_signal_connect(client, "notify::queue-depth",
+                    G_CALLBACK(notify_queue_depth_cb), &max_depth);
+
+   /*
+    * With a limit of one, each request is only sent once the previous
+    * response arrived. The others wait in the queue.
+    */
+   identities = identities_new_n(3);
+   g_assert(deliver(client, identities, NULL, &error));
+   g_assert_no_error(error);
+   identities_free(identities);
+
+   g_assert_cmpuint(mock->requests->len, ==, 3);
+   for (i = 1; i < mock->requests->len; i++) {
+      g_assert_cmpfloat(mock_gcm_get_interval(mock, i), >=, 0.045);
+   }
+   g_assert_cmpuint(max_depth, ==, 2);
+   g_assert_cmpuint(push_gcm_client_get_queue_depth(client), ==, 0);
+   g_assert_cmpuint(push_gcm_client_get_in_flight_limit(client), ==, 1);
+
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static gboolean
+warm_up (PushGcmClient  *client,
+         guint           n_connections,
+         GCancellable   *cancellable,
+         GError        **error)
+{
+   GAsyncResult *result = NULL;
+   gboolean ret;
+
+   push_gcm_client_warm_up_async(client, n_connections, cancellable,
+                                 async_cb, &result);
+   ret = push_gcm_client_warm_up_finish(client, run_until_complete(&result),
+                                        error);
+   g_object_unref(result);
+
+   return ret;
+}
+
+static void
+test_push_gcm_client_warm_up (void)
+{
+   PushGcmClient *client;
+   GCancellable *cancellable;
+   MockGcm *mock;
+   GError *error = NULL;
+   GList *identities;
+
+   mock = mock_gcm_new();
+   client = client_new(mock);
+
+   g_assert(warm_up(client, 2, NULL, &error));
+   g_assert_no_error(error);
+   g_assert_cmpuint(mock->n_warm_ups, ==, 2);
+   g_assert_cmpuint(mock->requests->len, ==, 0);
+
+   /*
+    * Deliveries still work after a warm up.
+    */
+   identities = identities_new("a", NULL);
+   g_assert(deliver(client, identities, NULL, &error));
+   g_assert_no_error(error);
+   g_assert_cmpuint(mock->requests->len, ==, 1);
+   identities_free(identities);
+
+   /*
+    * A cancelled warm up reports cancellation rather than a connection
+    * failure.
+    */
+   cancellable = g_cancellable_new();
+   g_cancellable_cancel(cancellable);
+   g_assert(!warm_up(client, 2, cancellable, &error));
+   g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+   g_clear_error(&error);
+   g_object_unref(cancellable);
+
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_client_warm_up_failure (void)
+{
+   PushGcmClient *client;
+   GError *error = NULL;
+
+   /*
+    * Nothing listens on the discard port of the loopback interface.
+    */
+   client = push_gcm_client_new("test-token");
+   push_gcm_client_set_url(client, "http://127.0.0.1:9/gcm/send");
+
+   g_assert(!warm_up(client, 1, NULL, &error));
+   g_assert_error(error, SOUP_HTTP_ERROR, SOUP_STATUS_CANT_CONNECT);
+   g_clear_error(&error);
+
+   g_object_unref(client);
+}
+
+typedef struct
+{
+   GAsyncResult *result;
+   guint        *n_pending;
+} BatchCall;
+
+static void
+batch_cb (GObject      *object,
+          GAsyncResult *result,
+          gpointer      user_data)
+{
+   BatchCall *call = user_data;
+
+   g_assert(!call->result);
+   call->result = g_object_ref(result);
+   if (!--(*call->n_pending)) {
+      g_main_loop_quit(gMainLoop);
+   }
+}
+
+/*
+ * Delivers @message to each of @ids through @batcher and waits for every
+ * delivery to complete. @cancel_index names a delivery whose cancellable
+ * is cancelled right after it was requested, or -1.
+ */
+static BatchCall *
+batch_deliver (PushGcmBatcher  *batcher,
+               PushGcmMessage **messages,
+               const gchar    **ids,
+               gint             cancel_index)
+{
+   PushGcmIdentity *identity;
+   GCancellable *cancellable;
+   BatchCall *calls;
+   guint n_pending;
+   guint handler;
+   guint n_ids;
+   guint i;
+
+   n_ids = g_strv_length((gchar **)ids);
+   n_pending = n_ids;
+   calls = g_new0(BatchCall, n_ids);
+
+   for (i = 0; i < n_ids; i++) {
+      calls[i].n_pending = &n_pending;
+      identity = push_gcm_identity_new(ids[i]);
+      cancellable = g_cancellable_new();
+      push_gcm_batcher_deliver_async(batcher, identity, messages[i],
+                                     cancellable, batch_cb, &calls[i]);
+      if ((gint)i == cancel_index) {
+         g_cancellable_cancel(cancellable);
+      }
+      g_object_unref(cancellable);
+      g_object_unref(identity);
+   }
+
+   handler = g_timeout_add_seconds(30, timeout_cb, NULL);
+   while (n_pending) {
+      g_main_loop_run(gMainLoop);
+   }
+   g_source_remove(handler);
+
+   return calls;
+}
+
+static void
+batch_calls_free (BatchCall *calls,
+                  guint      n_calls)
+{
+   guint i;
+
+   for (i = 0; i < n_calls; i++) {
+      g_object_unref(calls[i].result);
+   }
+   g_free(calls);
+}
+
+static void
+assert_batch_result (PushGcmBatcher *batcher,
+                     BatchCall      *call,
+                     const gchar    *registration_id,
+                     const gchar    *message_id,
+                     GQuark          domain,
+                     gint            code)
+{
+   PushGcmResult *result = NULL;
+   GError *error = NULL;
+   gboolean ret;
+
+   ret = push_gcm_batcher_deliver_finish_with_result(batcher,
+                                                     call->result,
+                                                     &result,
+                                                     &error);
+   if (domain) {
+      g_assert(!ret);
+      g_assert_error(error, domain, code);
+      g_clear_error(&error);
+   } else {
+      g_assert(ret);
+      g_assert_no_error(error);
+   }
+
+   if (!registration_id) {
+      g_assert(!result);
+      return;
+   }
+
+   g_assert(result);
+   g_assert_cmpstr(push_gcm_identity_get_registration_id(
+                      push_gcm_result_get_identity(result)),
+                   ==,
+                   registration_id);
+   g_assert_cmpstr(push_gcm_result_get_message_id(result), ==, message_id);
+   push_gcm_result_unref(result);
+}
+
+static PushGcmMessage *
+batch_message_new (const gchar *collapse_key)
+{
+   PushGcmMessage *message;
+
+   message = push_gcm_message_new();
+   push_gcm_message_set_collapse_key(message, collapse_key);
+
+   return message;
+}
+
+static void
+test_push_gcm_batcher_results (void)
+{
+   static const gchar *ids[] = { "a", "x", "gone-b", "c", "y", NULL };
+   PushGcmMessage *messages[5];
+   PushGcmBatcher *batcher;
+   PushGcmClient *client;
+   MockRequest *request;
+   BatchCall *calls;
+   MockGcm *mock;
+   guint i;
+
+   mock = mock_gcm_new();
+   client = client_new(mock);
+   batcher = push_gcm_batcher_new(client);
+
+   /*
+    * Equal messages are batched even if they are separate instances,
+    * and each caller is completed with the result for its identity.
+    */
+   messages[0] = batch_message_new("one");
+   messages[1] = batch_message_new("two");
+   messages[2] = batch_message_new("one");
+   messages[3] = g_object_ref(messages[0]);
+   messages[4] = g_object_ref(messages[1]);
+
+   calls = batch_deliver(batcher, messages, ids, -1);
+
+   g_assert_cmpuint(mock->requests->len, ==, 2);
+   for (i = 0; i < 2; i++) {
+      request = mock_gcm_get_request(mock, i);
+      if (!g_strcmp0(request->ids[0], "a")) {
+         g_assert_cmpuint(g_strv_length(request->ids), ==, 3);
+         g_assert_cmpstr(request->ids[1], ==, "gone-b");
+         g_assert_cmpstr(request->ids[2], ==, "c");
+      } else {
+         g_assert_cmpuint(g_strv_length(request->ids), ==, 2);
+         g_assert_cmpstr(request->ids[0], ==, "x");
+         g_assert_cmpstr(request->ids[1], ==, "y");
+      }
+   }
+
+   assert_batch_result(batcher, &calls[0], "a", "m:a", 0, 0);
+   assert_batch_result(batcher, &calls[1], "x", "m:x", 0, 0);
+   assert_batch_result(batcher, &calls[2], "gone-b", NULL,
+                       PUSH_GCM_CLIENT_ERROR,
+                       PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED);
+   assert_batch_result(batcher, &calls[3], "c", "m:c", 0, 0);
+   assert_batch_result(batcher, &calls[4], "y", "m:y", 0, 0);
+   g_assert_cmpuint(push_gcm_batcher_get_n_pending(batcher), ==, 0);
+
+   batch_calls_free(calls, G_N_ELEMENTS(messages));
+   for (i = 0; i < G_N_ELEMENTS(messages); i++) {
+      g_object_unref(messages[i]);
+   }
+   g_object_unref(batcher);
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_batcher_cancel (void)
+{
+   static const gchar *ids[] = { "a", "b", "c", NULL };
+   PushGcmMessage *messages[3];
+   PushGcmBatcher *batcher;
+   PushGcmClient *client;
+   BatchCall *calls;
+   MockGcm *mock;
+   guint i;
+
+   mock = mock_gcm_new();
+   mock->delay = 50;
+   client = client_new(mock);
+   batcher = push_gcm_batcher_new(client);
+   push_gcm_batcher_set_window(batcher, 100);
+
+   for (i = 0; i < G_N_ELEMENTS(messages); i++) {
+      messages[i] = batch_message_new(NULL);
+   }
+
+   /*
+    * The cancelled delivery completes without a result while the others
+    * keep the results for their own identities.
+    */
+   calls = batch_deliver(batcher, messages, ids, 1);
+
+   g_assert_cmpuint(mock->requests->len, ==, 1);
+   assert_batch_result(batcher, &calls[0], "a", "m:a", 0, 0);
+   assert_batch_result(batcher, &calls[1], NULL, NULL,
+                       G_IO_ERROR, G_IO_ERROR_CANCELLED);
+   assert_batch_result(batcher, &calls[2], "c", "m:c", 0, 0);
+
+   batch_calls_free(calls, G_N_ELEMENTS(messages));
+   for (i = 0; i < G_N_ELEMENTS(messages); i++) {
+      g_object_unref(messages[i]);
+   }
+   g_object_unref(batcher);
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+static void
+test_push_gcm_batcher_failure (void)
+{
+   static const MockResponse unauthorized = { 401, NULL, NULL };
+   static const gchar *ids[] = { "a", "b", NULL };
+   PushGcmMessage *messages[2];
+   PushGcmBatcher *batcher;
+   PushGcmClient *client;
+   BatchCall *calls;
+   MockGcm *mock;
+   guint i;
+
+   mock = mock_gcm_new();
+   mock_gcm_push(mock, &unauthorized);
+   client = client_new(mock);
+   batcher = push_gcm_batcher_new(client);
+
+   for (i = 0; i < G_N_ELEMENTS(messages); i++) {
+      messages[i] = batch_message_new(NULL);
+   }
+
+   /*
+    * A request that fails as a whole fails every caller.
+    */
+   calls = batch_deliver(batcher, messages, ids, -1);
+
+   g_assert_cmpuint(mock->requests->len, ==, 1);
+   assert_batch_result(batcher, &calls[0], NULL, NULL,
+                       SOUP_HTTP_ERROR, SOUP_STATUS_UNAUTHORIZED);
+   assert_batch_result(batcher, &calls[1], NULL, NULL,
+                       SOUP_HTTP_ERROR, SOUP_STATUS_UNAUTHORIZED);
+
+   batch_calls_free(calls, G_N_ELEMENTS(messages));
+   for (i = 0; i < G_N_ELEMENTS(messages); i++) {
+      g_object_unref(messages[i]);
+   }
+   g_object_unref(batcher);
+   g_object_unref(client);
+   mock_gcm_free(mock);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+
+   gMainLoop = g_main_loop_new(NULL, FALSE);
+
+   g_test_add_func("/PushGcmClient/results", test_push_gcm_client_results);
+   g_test_add_func("/PushGcmClient/retry_after",
+                   test_push_gcm_client_retry_after);
+   g_test_add_func("/PushGcmClient/retry_after_result",
+                   test_push_gcm_client_retry_after_result);
+   g_test_add_func("/PushGcmClient/retry_after_invalid",
+                   test_push_gcm_client_retry_after_invalid);
+   g_test_add_func("/PushGcmClient/max_retries",
+                   test_push_gcm_client_max_retries);
+   g_test_add_func("/PushGcmClient/limit_decrease",
+                   test_push_gcm_client_limit_decrease);
+   g_test_add_func("/PushGcmClient/limit_increase",
+                   test_push_gcm_client_limit_increase);
+   g_test_add_func("/PushGcmClient/limit_queue",
+                   test_push_gcm_client_limit_queue);
+   g_test_add_func("/PushGcmClient/warm_up", test_push_gcm_client_warm_up);
+   g_test_add_func("/PushGcmClient/warm_up_failure",
+                   test_push_gcm_client_warm_up_failure);
+   g_test_add_func("/PushGcmBatcher/results", test_push_gcm_batcher_results);
+   g_test_add_func("/PushGcmBatcher/cancel", test_push_gcm_batcher_cancel);
+   g_test_add_func("/PushGcmBatcher/failure", test_push_gcm_batcher_failure);
+
+   return g_test_run();
+}
@@ -0,0 +1,333 @@
+/* test-push-gcm-response.c
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <json-glib/json-glib.h>
+#include <push-glib/push-gcm-response.h>
+#include <string.h>
+
+typedef struct
+{
+   guint               index;
+   gchar              *message_id;
+   gchar              *registration_id;
+   PushGcmClientError  code;
+} Result;
+
+static void
+result_free (gpointer data)
+{
+   Result *result = data;
+
+   g_free(result->message_id);
+   g_free(result->registration_id);
+   g_slice_free(Result, result);
+}
+
+static void
+collect_cb (guint               index,
+            const gchar        *message_id,
+            const gchar        *registration_id,
+            PushGcmClientError  code,
+            gpointer            user_data)
+{
+   GPtrArray *results = user_data;
+   Result *result;
+
+   result = g_slice_new0(Result);
+   result->index = index;
+   result->message_id = g_strdup(message_id);
+   result->registration_id = g_strdup(registration_id);
+   result->code = code;
+   g_ptr_array_add(results, result);
+}
+
+static GPtrArray *
+parse (const gchar  *json,
+       GError      **error)
+{
+   GPtrArray *results;
+
+   results = g_ptr_array_new_with_free_func(result_free);
+   if (!push_gcm_response_parse(json, strlen(json), collect_cb, results,
+                                error)) {
+      g_assert(!error || *error);
+   }
+
+   return results;
+}
+
+static void
+assert_result (GPtrArray          *results,
+               guint               index,
+               const gchar        *message_id,
+               const gchar        *registration_id,
+               PushGcmClientError  code)
+{
+   Result *result;
+
+   g_assert_cmpuint(index, <, results->len);
+   result = g_ptr_array_index(results, index);
+   g_assert_cmpuint(result->index, ==, index);
+   g_assert_cmpstr(result->message_id, ==, message_id);
+   g_assert_cmpstr(result->registration_id, ==, registration_id);
+   g_assert_cmpint(result->code, ==, code);
+}
+
+static void
+test_push_gcm_response_multicast (void)
+{
+   GPtrArray *results;
+   GError *error = NULL;
+
+   results = parse(
+      "{ \"multicast_id\": 216,\n"
+      "  \"success\": 3,\n"
+      "  \"failure\": 3,\n"
+      "  \"canonical_ids\": 1,\n"
+      "  \"results\": [\n"
+      "    { \"message_id\": \"1:0408\" },\n"
+      "    { \"error\": \"Unavailable\" },\n"
+      "    { \"error\": \"InvalidRegistration\" },\n"
+      "    { \"message_id\": \"1:1516\" },\n"
+      "    { \"message_id\": \"1:2342\", \"registration_id\": \"32\" },\n"
+      "    { \"error\": \"NotRegistered\"}\n"
+      "  ]\n"
+      "}\n",
+      &error);
+   g_assert_no_error(error);
+   g_assert_cmpuint(results->len, ==, 6);
+
+   assert_result(results, 0, "1:0408", NULL, 0);
+   assert_result(results, 1, NULL, NULL, PUSH_GCM_CLIENT_ERROR_UNAVAILABLE);
+   assert_result(results, 2, NULL, NULL,
+                 PUSH_GCM_CLIENT_ERROR_INVALID_REGISTRATION);
+   assert_result(results, 3, "1:1516", NULL, 0);
+   assert_result(results, 4, "1:2342", "32", 0);
+   assert_result(results, 5, NULL, NULL,
+                 PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED);
+
+   g_ptr_array_unref(results);
+}
+
+static void
+test_push_gcm_response_skip (void)
+{
+   GPtrArray *results;
+   GError *error = NULL;
+
+   /*
+    * Unknown members, nested values and members of the wrong type are
+    * skipped. "results" does not have to come last.
+    */
+   results = parse(
+      "{\"results\":[{\"message_id\":1,\"extra\":{\"a\":[1,2,{}]},"
+      "\"error\":null},{},{\"registration_id\":\"r\","
+      "\"message_id\":\"m\",\"flag\":true,\"n\":-1.5e+3}],"
+      "\"nested\":{\"results\":[{\"message_id\":\"nope\"}]},"
+      "\"list\":[\"x\",[],false]}",
+      &error);
+   g_assert_no_error(error);
+   g_assert_cmpuint(results->len, ==, 3);
+
+   assert_result(results, 0, NULL, NULL, 0);
+   assert_result(results, 1, NULL, NULL, 0);
+   assert_result(results, 2, "m", "r", 0);
+
+   g_ptr_array_unref(results);
+
+   results = parse("{\"results\":null,\"success\":0}", &error);
+   g_assert_no_error(error);
+   g_assert_cmpuint(results->len, ==, 0);
+   g_ptr_array_unref(results);
+
+   results = parse(" {\"results\":[]} ", &error);
+   g_assert_no_error(error);
+   g_assert_cmpuint(results->len, ==, 0);
+   g_ptr_array_unref(results);
+
+   results = parse("{}", &error);
+   g_assert_no_error(error);
+   g_assert_cmpuint(results->len, ==, 0);
+   g_ptr_array_unref(results);
+}
+
+static void
+test_push_gcm_response_escapes (void)
+{
+   GPtrArray *results;
+   GError *error = NULL;
+
+   results = parse(
+      "{\"results\":[{\"message_id\":\"0:1\\/2\\\"3\\\\\","
+      "\"registration_id\":\"caf\\u00e9 \\ud83d\\udcf1\\n\\t\"},"
+      "{\"error\":\"Not\\u0052egistered\"}]}",
+      &error);
+   g_assert_no_error(error);
+   g_assert_cmpuint(results->len, ==, 2);
+
+   assert_result(results, 0, "0:1/2\"3\\",
+                 "caf\xc3\xa9 \xf0\x9f\x93\xb1\n\t", 0);
+   assert_result(results, 1, NULL, NULL,
+                 PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED);
+
+   g_ptr_array_unref(results);
+}
+
+static void
+test_push_gcm_response_errors (void)
+{
+   static const struct {
+      const gchar        *name;
+      PushGcmClientError  code;
+   } errors[] = {
+      { "MissingRegistration", PUSH_GCM_CLIENT_ERROR_MISSING_REGISTRATION },
+      { "InvalidRegistration", PUSH_GCM_CLIENT_ERROR_INVALID_REGISTRATION },
+      { "MismatchSenderId", PUSH_GCM_CLIENT_ERROR_MISMATCH_SENDER_ID },
+      { "NotRegistered", PUSH_GCM_CLIENT_ERROR_NOT_REGISTERED },
+      { "MessageTooBig", PUSH_GCM_CLIENT_ERROR_MESSAGE_TOO_BIG },
+      { "InvalidDataKey", PUSH_GCM_CLIENT_ERROR_INVALID_DATA_KEY },
+      { "InvalidTtl", PUSH_GCM_CLIENT_ERROR_INVALID_TTL },
+      { "Unavailable", PUSH_GCM_CLIENT_ERROR_UNAVAILABLE },
+      { "InternalServerError",
+        PUSH_GCM_CLIENT_ERROR_INTERNAL_SERVER_ERROR },
+      { "", PUSH_GCM_CLIENT_ERROR_UNKNOWN },
+      { "Error", PUSH_GCM_CLIENT_ERROR_UNKNOWN },
+      { "notregistered", PUSH_GCM_CLIENT_ERROR_UNKNOWN },
+      { "NotRegisteredX", PUSH_GCM_CLIENT_ERROR_UNKNOWN },
+      { "NotRegistere", PUSH_GCM_CLIENT_ERROR_UNKNOWN },
+      { "InvalidPackageName", PUSH_GCM_CLIENT_ERROR_UNKNOWN },
+      { "DeviceMessageRateExceeded", PUSH_GCM_CLIENT_ERROR_UNKNOWN },
+   };
+   GPtrArray *results;
+   GError *error = NULL;
+   gchar *json;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(errors); i++) {
+      g_assert_cmpint(push_gcm_response_lookup_error(errors[i].name,
+                                                     strlen(errors[i].name)),
+                      ==,
+                      errors[i].code);
+
+      json = g_strdup_printf("{\"results\":[{\"error\":\"%s\"}]}",
+                             errors[i].name);
+      results = parse(json, &error);
+      g_assert_no_error(error);
+      g_assert_cmpuint(results->len, ==, 1);
+      assert_result(results, 0, NULL, NULL, errors[i].code);
+      g_ptr_array_unref(results);
+      g_free(json);
+   }
+
+   g_assert_cmpint(push_gcm_response_lookup_error(NULL, 0),
+                   ==,
+                   PUSH_GCM_CLIENT_ERROR_UNKNOWN);
+
+   /*
+    * The length is taken from @len, not from a nul terminator.
+    */
+   g_assert_cmpint(push_gcm_response_lookup_error("UnavailableXYZ", 11),
+                   ==,
+                   PUSH_GCM_CLIENT_ERROR_UNAVAILABLE);
+}
+
+static void
+test_push_gcm_response_invalid (void)
+{
+   static const gchar *invalid[] = {
+      "",
+      "   ",
+      "[]",
+      "{",
+      "{\"results\"",
+      "{\"results\":",
+      "{\"results\":[",
+      "{\"results\":[{\"message_id\":\"1\"}",
+      "{\"results\":[{\"message_id\":\"1}]}",
+      "{\"results\":[{\"message_id\" \"1\"}]}",
+      "{\"results\":[{\"message_id\":\"\\x\"}]}",
+      "{\"results\":[{\"message_id\":\"\\u12\"}]}",
+      "{\"results\":[1]}",
+      "{\"results\":[{}],}",
+      "{\"results\":[{},]}",
+      "{\"success\":?}",
+      "{\"results\":[]} x",
+      "{\"results\":[]}{}",
+      "{results:[]}",
+   };
+   GPtrArray *results;
+   GString *deep;
+   GError *error = NULL;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(invalid); i++) {
+      results = parse(invalid[i], &error);
+      g_assert_error(error, JSON_PARSER_ERROR, JSON_PARSER_ERROR_PARSE);
+      g_clear_error(&error);
+      g_ptr_array_unref(results);
+   }
+
+   /*
+    * Results read before the syntax error are still reported.
+    */
+   results = parse("{\"results\":[{\"message_id\":\"1\"},"
+                   "{\"error\":\"Unavailable\"},{\"message_id\":",
+                   &error);
+   g_assert_error(error, JSON_PARSER_ERROR, JSON_PARSER_ERROR_PARSE);
+   g_clear_error(&error);
+   g_assert_cmpuint(results->len, ==, 2);
+   assert_result(results, 0, "1", NULL, 0);
+   assert_result(results, 1, NULL, NULL, PUSH_GCM_CLIENT_ERROR_UNAVAILABLE);
+   g_ptr_array_unref(results);
+
+   /*
+    * Skipped values may not nest without bound.
+    */
+   deep = g_string_new("{\"x\":");
+   for (i = 0; i < 64; i++) {
+      g_string_append_c(deep, '[');
+   }
+   for (i = 0; i < 64; i++) {
+      g_string_append_c(deep, ']');
+   }
+   g_string_append_c(deep, '}');
+   results = parse(deep->str, &error);
+   g_assert_error(error, JSON_PARSER_ERROR, JSON_PARSER_ERROR_PARSE);
+   g_clear_error(&error);
+   g_ptr_array_unref(results);
+   g_string_free(deep, TRUE);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+
+   g_test_add_func("/PushGcmResponse/multicast",
+                   test_push_gcm_response_multicast);
+   g_test_add_func("/PushGcmResponse/skip", test_push_gcm_response_skip);
+   g_test_add_func("/PushGcmResponse/escapes",
+                   test_push_gcm_response_escapes);
+   g_test_add_func("/PushGcmResponse/errors", test_push_gcm_response_errors);
+   g_test_add_func("/PushGcmResponse/invalid",
+                   test_push_gcm_response_invalid);
+
+   return g_test_run();
+}
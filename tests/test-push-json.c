@@ -0,0 +1,285 @@
+/* test-push-json.c
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <push-glib/push-glib.h>
+#include <push-glib/push-gcm-message-private.h>
+#include <push-glib/push-json.h>
+#include <string.h>
+
+/*
+ * Strings which exercise every escaping rule of push-json. 0x1F is left
+ * out on purpose, some JsonGenerator releases fail to escape it.
+ */
+static const gchar *gStrings[] = {
+   "",
+   "plain",
+   "quote \" and backslash \\",
+   "slash / stays",
+   "\b\f\n\r\t",
+   "\x01\x02\x07\x0b\x0e\x10\x1b",
+   "del \x7f here",
+   "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x93\xb1",
+   "mixed \"\xc3\xa9\"\n\x7f\x01",
+};
+
+static gchar *
+generate (JsonNode *node)
+{
+   JsonGenerator *generator;
+   gchar *json;
+
+   generator = json_generator_new();
+   json_generator_set_root(generator, node);
+   json = json_generator_to_data(generator, NULL);
+   g_object_unref(generator);
+
+   return json;
+}
+
+static gchar *
+append_node (JsonNode *node)
+{
+   GString *str;
+
+   str = g_string_new(NULL);
+   push_json_append_node(str, node);
+   g_assert_cmpuint(str->len, ==, push_json_node_size(node));
+
+   return g_string_free(str, FALSE);
+}
+
+/*
+ * Parses @json and checks that JsonGenerator writes it back unchanged,
+ * which is the case when it matches the generator byte for byte.
+ */
+static void
+assert_generated (const gchar *json)
+{
+   JsonParser *parser;
+   GError *error = NULL;
+   gchar *expected;
+
+   parser = json_parser_new();
+   json_parser_load_from_data(parser, json, -1, &error);
+   g_assert_no_error(error);
+   expected = generate(json_parser_get_root(parser));
+   g_assert_cmpstr(json, ==, expected);
+   g_free(expected);
+   g_object_unref(parser);
+}
+
+static void
+test_push_json_escape (void)
+{
+   JsonObject *object;
+   JsonNode *node;
+   GString *str;
+   gchar *expected;
+   gchar *json;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(gStrings); i++) {
+      str = g_string_new(NULL);
+      push_json_append_escaped(str, gStrings[i]);
+      g_assert_cmpuint(str->len, ==, push_json_escaped_size(gStrings[i], -1));
+      g_string_free(str, TRUE);
+
+      object = json_object_new();
+      json_object_set_string_member(object, "s", gStrings[i]);
+      node = json_node_new(JSON_NODE_OBJECT);
+      json_node_take_object(node, object);
+
+      expected = generate(node);
+      json = append_node(node);
+      g_assert_cmpstr(json, ==, expected);
+
+      g_free(expected);
+      g_free(json);
+      json_node_free(node);
+   }
+}
+
+static void
+test_push_json_node (void)
+{
+   JsonObject *object;
+   JsonObject *child;
+   JsonArray *array;
+   JsonNode *node;
+   gchar *expected;
+   gchar *json;
+
+   child = json_object_new();
+   json_object_set_string_member(child, "caf\xc3\xa9", "\x7f");
+   json_object_set_null_member(child, "null");
+
+   array = json_array_new();
+   json_array_add_int_element(array, -1);
+   json_array_add_boolean_element(array, TRUE);
+   json_array_add_boolean_element(array, FALSE);
+   json_array_add_string_element(array, "\n");
+   json_array_add_object_element(array, child);
+
+   object = json_object_new();
+   json_object_set_int_member(object, "int", G_MAXINT64);
+   json_object_set_string_member(object, "key \"1\"", "value");
+   json_object_set_array_member(object, "array", array);
+   json_object_set_object_member(object, "empty", json_object_new());
+
+   node = json_node_new(JSON_NODE_OBJECT);
+   json_node_take_object(node, object);
+
+   expected = generate(node);
+   json = append_node(node);
+   g_assert_cmpstr(json, ==, expected);
+
+   g_free(expected);
+   g_free(json);
+   json_node_free(node);
+}
+
+static void
+test_push_json_aps_message (void)
+{
+   PushApsMessageBuilder builder;
+   PushApsMessage *message;
+   JsonObject *object;
+   JsonNode *node;
+   gchar *json;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(gStrings); i++) {
+      message = push_aps_message_new();
+      push_aps_message_set_alert(message, gStrings[i]);
+      push_aps_message_set_badge(message, i);
+      push_aps_message_set_sound(message, gStrings[i]);
+      push_aps_message_add_extra_string(message, gStrings[i], gStrings[i]);
+      push_aps_message_add_extra_string(message, "id", "1234");
+      assert_generated(push_aps_message_get_json(message));
+      g_object_unref(message);
+   }
+
+   /*
+    * Only the badge, and nothing at all.
+    */
+   message = push_aps_message_new();
+   assert_generated(push_aps_message_get_json(message));
+   g_assert_cmpstr(push_aps_message_get_json(message),
+                   ==,
+                   "{\"aps\":{\"badge\":0}}");
+   push_aps_message_set_badge(message, 3);
+   assert_generated(push_aps_message_get_json(message));
+   g_object_unref(message);
+
+   /*
+    * Extras holding objects and arrays.
+    */
+   object = json_object_new();
+   json_object_set_string_member(object, "\x01", "\xc3\xa9");
+   json_object_set_int_member(object, "n", 42);
+   node = json_node_new(JSON_NODE_OBJECT);
+   json_node_take_object(node, object);
+
+   message = push_aps_message_new();
+   push_aps_message_set_alert(message, "Hello");
+   push_aps_message_add_extra(message, "object", node);
+   assert_generated(push_aps_message_get_json(message));
+   g_object_unref(message);
+
+   push_aps_message_builder_init(&builder);
+   push_aps_message_builder_set_alert(&builder, "del \x7f");
+   push_aps_message_builder_set_sound(&builder, "default");
+   push_aps_message_builder_add_extra(&builder, "object", node);
+   push_aps_message_builder_add_extra_string(&builder, "s", "\t\xc3\xa9");
+   message = push_aps_message_builder_end(&builder);
+   assert_generated(push_aps_message_get_json(message));
+   g_assert(push_aps_message_is_sealed(message));
+   json = g_strdup(push_aps_message_get_json(message));
+   g_object_unref(message);
+
+   /*
+    * Building into a caller-owned message produces the same payload and
+    * leaves the message unsealed, so it can be reset and filled again.
+    */
+   message = push_aps_message_new();
+   push_aps_message_set_sound(message, "old");
+   push_aps_message_add_extra_string(message, "old", "old");
+   for (i = 0; i < 2; i++) {
+      push_aps_message_builder_init(&builder);
+      push_aps_message_builder_set_alert(&builder, "del \x7f");
+      push_aps_message_builder_set_sound(&builder, "default");
+      push_aps_message_builder_add_extra(&builder, "object", node);
+      push_aps_message_builder_add_extra_string(&builder, "s", "\t\xc3\xa9");
+      push_aps_message_builder_end_into(&builder, message);
+      g_assert(!push_aps_message_is_sealed(message));
+      g_assert_cmpstr(push_aps_message_get_json(message), ==, json);
+      g_assert_cmpstr(push_aps_message_get_sound(message), ==, "default");
+      push_aps_message_reset(message);
+   }
+   g_object_unref(message);
+   g_free(json);
+
+   json_node_free(node);
+}
+
+static void
+test_push_json_gcm_message (void)
+{
+   PushGcmMessage *message;
+   JsonObject *data;
+   GBytes *bytes;
+   gchar *json;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(gStrings); i++) {
+      data = json_object_new();
+      json_object_set_string_member(data, "alert", gStrings[i]);
+      json_object_set_int_member(data, "badge", i);
+      json_object_set_string_member(data, gStrings[i], "value");
+
+      message = push_gcm_message_new();
+      push_gcm_message_set_collapse_key(message, gStrings[i]);
+      push_gcm_message_set_time_to_live(message, i * 60);
+      push_gcm_message_set_data(message, data);
+
+      bytes = _push_gcm_message_get_bytes(message);
+      json = g_strdup_printf("{%.*s}",
+                             (gint)g_bytes_get_size(bytes),
+                             (const gchar *)g_bytes_get_data(bytes, NULL));
+      assert_generated(json);
+
+      g_free(json);
+      g_object_unref(message);
+      json_object_unref(data);
+   }
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+
+   g_test_add_func("/PushJson/escape", test_push_json_escape);
+   g_test_add_func("/PushJson/node", test_push_json_node);
+   g_test_add_func("/PushJson/aps_message", test_push_json_aps_message);
+   g_test_add_func("/PushJson/gcm_message", test_push_json_gcm_message);
+
+   return g_test_run();
+}
@@ -0,0 +1,594 @@
+/* push-ccs-server.c
+ *
+ * Copyright (C) 2012 Catch.com
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A minimal stand-in for the GCM Cloud Connection Server, for testing and
+ * benchmarking PushGcmCcsClient without talking to Google. It speaks plain
+ * XMPP without TLS, accepts any SASL PLAIN credentials, binds a resource
+ * and acknowledges every message it receives. Point a client created with
+ * "tls" set to FALSE at it using the "host" and "port" properties.
+ *
+ * Messages to registration ids starting with "gone" are nacked as
+ * DEVICE_UNREGISTERED. For ids starting with "drain" the server announces
+ * that the connection is draining before it acks the message.
+ */
+
+#include <gio/gio.h>
+#include <glib/gi18n.h>
+#include <json-glib/json-glib.h>
+#include <stdlib.h>
+
+#define READ_SIZE 4096
+
+typedef struct
+{
+   gint                 ref_count;
+   GSocketConnection   *connection;
+   GCancellable        *cancellable;
+   GMarkupParseContext *context;
+   GString             *out;
+   GString             *flushing;
+   GString             *text;
+   guint                depth;
+   gchar               *stanza_id;
+   gchar               *stanza_type;
+   gboolean             authenticated;
+   gboolean             in_gcm;
+   gboolean             restart;
+   gboolean             closed;
+   guint8               buffer[READ_SIZE];
+} Client;
+
+static gint          gPort = 5235;
+static gboolean      gReceipts;
+static guint64       gReceived;
+static GOptionEntry  gEntries[] = {
+   { "port", 'p', 0, G_OPTION_ARG_INT, &gPort,
+     N_("The port to listen on.") },
+   { "receipts", 'r', 0, G_OPTION_ARG_NONE, &gReceipts,
+     N_("Send a delivery receipt for every acknowledged message.") },
+   { 0 }
+};
+
+static void client_start_stream (Client *client);
+static void client_read         (Client *client);
+
+static Client *
+client_ref (Client *client)
+{
+   client->ref_count++;
+   return client;
+}
+
+static void
+client_unref (Client *client)
+{
+   if (!--client->ref_count) {
+      g_object_unref(client->connection);
+      g_object_unref(client->cancellable);
+      if (client->context) {
+         g_markup_parse_context_free(client->context);
+      }
+      g_string_free(client->out, TRUE);
+      g_string_free(client->flushing, TRUE);
+      g_string_free(client->text, TRUE);
+      g_free(client->stanza_id);
+      g_free(client->stanza_type);
+      g_slice_free(Client, client);
+   }
+}
+
+static void
+client_close (Client *client)
+{
+   if (!client->closed) {
+      client->closed = TRUE;
+      g_cancellable_cancel(client->cancellable);
+      g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+   }
+}
+
+static void client_write (Client *client);
+
+static void
+client_write_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+   Client *client = user_data;
+   GError *error = NULL;
+   gssize n;
+
+   n = g_output_stream_write_finish(G_OUTPUT_STREAM(object), result, &error);
+
+   if (client->closed) {
+      goto cleanup;
+   }
+
+   if (n < 0) {
+      g_printerr("%s\n", error->message);
+      client_close(client);
+      goto cleanup;
+   }
+
+   g_string_erase(client->flushing, 0, n);
+   if (!client->flushing->len) {
+      g_string_append_len(client->flushing,
+                          client->out->str,
+                          client->out->len);
+      g_string_truncate(client->out, 0);
+   }
+   if (client->flushing->len) {
+      client_write(client);
+   }
+
+cleanup:
+   g_clear_error(&error);
+   client_unref(client);
+}
+
+static void
+client_write (Client *client)
+{
+   GOutputStream *output;
+
+   output = g_io_stream_get_output_stream(G_IO_STREAM(client->connection));
+   g_output_stream_write_async(output,
+                               client->flushing->str,
+                               client->flushing->len,
+                               G_PRIORITY_DEFAULT,
+                               client->cancellable,
+                               client_write_cb,
+                               client_ref(client));
+}
+
+static void
+client_flush (Client *client)
+{
+   if (!client->flushing->len && client->out->len) {
+      g_string_append_len(client->flushing,
+                          client->out->str,
+                          client->out->len);
+      g_string_truncate(client->out, 0);
+      client_write(client);
+   }
+}
+
+static void
+client_send_gcm (Client      *client,
+                 JsonBuilder *builder)
+{
+   JsonGenerator *generator;
+   JsonNode *root;
+   gchar *escaped;
+   gchar *json;
+
+   root = json_builder_get_root(builder);
+   generator = json_generator_new();
+   json_generator_set_root(generator, root);
+   json = json_generator_to_data(generator, NULL);
+   escaped = g_markup_escape_text(json, -1);
+
+   g_string_append_printf(client->out,
+                          "<message id=\"\">"
+                          "<gcm xmlns=\"google:mobile:data\">%s</gcm>"
+                          "</message>",
+                          escaped);
+   client_flush(client);
+
+   g_free(escaped);
+   g_free(json);
+   json_node_free(root);
+   g_object_unref(generator);
+}
+
+/*
+ * Acknowledges a message from the client and, if requested, reports that
+ * it was delivered to the device. Unregistered devices get a nack.
+ */
+static void
+client_handle_gcm (Client *client)
+{
+   const gchar *message_id;
+   const gchar *to;
+   JsonBuilder *builder;
+   JsonObject *object;
+   JsonParser *parser;
+   JsonNode *node;
+   gboolean gone;
+   gchar *receipt_id;
+
+   parser = json_parser_new();
+
+   if (!json_parser_load_from_data(parser, client->text->str,
+                                   client->text->len, NULL) ||
+       !(node = json_parser_get_root(parser)) ||
+       !JSON_NODE_HOLDS_OBJECT(node)) {
+      goto cleanup;
+   }
+
+   object = json_node_get_object(node);
+
+   /*
+    * Acks for our receipts need no reply.
+    */
+   if (json_object_has_member(object, "message_type") ||
+       !(node = json_object_get_member(object, "message_id")) ||
+       !(message_id = json_node_get_string(node)) ||
+       !(node = json_object_get_member(object, "to")) ||
+       !(to = json_node_get_string(node))) {
+      goto cleanup;
+   }
+
+   gReceived++;
+   gone = g_str_has_prefix(to, "gone");
+
+   if (g_str_has_prefix(to, "drain")) {
+      builder = json_builder_new();
+      json_builder_begin_object(builder);
+      json_builder_set_member_name(builder, "message_type");
+      json_builder_add_string_value(builder, "control");
+      json_builder_set_member_name(builder, "control_type");
+      json_builder_add_string_value(builder, "CONNECTION_DRAINING");
+      json_builder_end_object(builder);
+      client_send_gcm(client, builder);
+      g_object_unref(builder);
+   }
+
+   builder = json_builder_new();
+   json_builder_begin_object(builder);
+   json_builder_set_member_name(builder, "from");
+   json_builder_add_string_value(builder, to);
+   json_builder_set_member_name(builder, "message_id");
+   json_builder_add_string_value(builder, message_id);
+   json_builder_set_member_name(builder, "message_type");
+   json_builder_add_string_value(builder, gone ? "nack" : "ack");
+   if (gone) {
+      json_builder_set_member_name(builder, "error");
+      json_builder_add_string_value(builder, "DEVICE_UNREGISTERED");
+      json_builder_set_member_name(builder, "error_description");
+      json_builder_add_string_value(builder, "Device unregistered.");
+   }
+   json_builder_end_object(builder);
+   client_send_gcm(client, builder);
+   g_object_unref(builder);
+
+   if (gReceipts && !gone) {
+      receipt_id = g_strdup_printf("dr2:%s", message_id);
+      builder = json_builder_new();
+      json_builder_begin_object(builder);
+      json_builder_set_member_name(builder, "from");
+      json_builder_add_string_value(builder, "gcm.googleapis.com");
+      json_builder_set_member_name(builder, "message_id");
+      json_builder_add_string_value(builder, receipt_id);
+      json_builder_set_member_name(builder, "message_type");
+      json_builder_add_string_value(builder, "receipt");
+      json_builder_set_member_name(builder, "data");
+      json_builder_begin_object(builder);
+      json_builder_set_member_name(builder, "message_status");
+      json_builder_add_string_value(builder, "MESSAGE_SENT_TO_DEVICE");
+      json_builder_set_member_name(builder, "original_message_id");
+      json_builder_add_string_value(builder, message_id);
+      json_builder_set_member_name(builder, "device_registration_id");
+      json_builder_add_string_value(builder, to);
+      json_builder_end_object(builder);
+      json_builder_end_object(builder);
+      client_send_gcm(client, builder);
+      g_object_unref(builder);
+      g_free(receipt_id);
+   }
+
+cleanup:
+   g_object_unref(parser);
+}
+
+static void
+client_handle_stanza (Client      *client,
+                      const gchar *name)
+{
+   gchar *reply;
+
+   if (!g_strcmp0(name, "auth")) {
+      g_string_append(client->out,
+                      "<success xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\"/>");
+      client_flush(client);
+      client->authenticated = TRUE;
+      client->restart = TRUE;
+   } else if (!g_strcmp0(name, "iq") &&
+              !g_strcmp0(client->stanza_type, "set")) {
+      reply = g_markup_printf_escaped(
+            "<iq type=\"result\" id=\"%s\">"
+            "<bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\">"
+            "<jid>push-ccs-server@gcm.googleapis.com/push</jid>"
+            "</bind></iq>",
+            client->stanza_id ? client->stanza_id : "");
+      g_string_append(client->out, reply);
+      client_flush(client);
+      g_free(reply);
+   } else if (!g_strcmp0(name, "message")) {
+      if (client->text->len) {
+         client_handle_gcm(client);
+      }
+      g_string_truncate(client->text, 0);
+   }
+}
+
+static void
+client_start_element (GMarkupParseContext  *context,
+                      const gchar          *element_name,
+                      const gchar         **attribute_names,
+                      const gchar         **attribute_values,
+                      gpointer              user_data,
+                      GError              **error)
+{
+   Client *client = user_data;
+   guint i;
+
+   if (client->depth == 0) {
+      client_start_stream(client);
+   } else if (client->depth == 1) {
+      g_free(client->stanza_id);
+      g_free(client->stanza_type);
+      client->stanza_id = NULL;
+      client->stanza_type = NULL;
+      for (i = 0; attribute_names[i]; i++) {
+         if (!g_strcmp0(attribute_names[i], "id")) {
+            client->stanza_id = g_strdup(attribute_values[i]);
+         } else if (!g_strcmp0(attribute_names[i], "type")) {
+            client->stanza_type = g_strdup(attribute_values[i]);
+         }
+      }
+   } else if (!g_strcmp0(element_name, "gcm")) {
+      client->in_gcm = TRUE;
+      g_string_truncate(client->text, 0);
+   }
+
+   client->depth++;
+}
+
+static void
+client_end_element (GMarkupParseContext  *context,
+                    const gchar          *element_name,
+                    gpointer              user_data,
+                    GError              **error)
+{
+   Client *client = user_data;
+
+   client->depth--;
+
+   if (!g_strcmp0(element_name, "gcm")) {
+      client->in_gcm = FALSE;
+   }
+
+   if (client->depth == 1) {
+      client_handle_stanza(client, element_name);
+   }
+}
+
+static void
+client_text (GMarkupParseContext  *context,
+             const gchar          *text,
+             gsize                 text_len,
+             gpointer              user_data,
+             GError              **error)
+{
+   Client *client = user_data;
+
+   if (client->in_gcm) {
+      g_string_append_len(client->text, text, text_len);
+   }
+}
+
+static const GMarkupParser gParser = {
+   client_start_element,
+   client_end_element,
+   client_text,
+   NULL,
+   NULL,
+};
+
+/*
+ * Answers the stream header of the client with our own header and the
+ * features for the current stage of the handshake.
+ */
+static void
+client_start_stream (Client *client)
+{
+   g_string_append(client->out,
+                   "<stream:stream from=\"gcm.googleapis.com\" "
+                   "id=\"push-ccs-server\" version=\"1.0\" "
+                   "xmlns=\"jabber:client\" "
+                   "xmlns:stream=\"http://etherx.jabber.org/streams\">");
+
+   if (!client->authenticated) {
+      g_string_append(client->out,
+                      "<stream:features>"
+                      "<mechanisms xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\">"
+                      "<mechanism>PLAIN</mechanism>"
+                      "</mechanisms>"
+                      "</stream:features>");
+   } else {
+      g_string_append(client->out,
+                      "<stream:features>"
+                      "<bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\"/>"
+                      "</stream:features>");
+   }
+
+   client_flush(client);
+}
+
+static void
+client_reset (Client *client)
+{
+   if (client->context) {
+      g_markup_parse_context_free(client->context);
+   }
+
+   client->context = g_markup_parse_context_new(&gParser, 0, client, NULL);
+   client->depth = 0;
+   client->in_gcm = FALSE;
+   client->restart = FALSE;
+}
+
+static void
+client_read_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+   Client *client = user_data;
+   GError *error = NULL;
+   gssize n;
+
+   n = g_input_stream_read_finish(G_INPUT_STREAM(object), result, &error);
+
+   if (client->closed) {
+      goto cleanup;
+   }
+
+   if (n <= 0) {
+      if (error) {
+         g_printerr("%s\n", error->message);
+      }
+      client_close(client);
+      goto cleanup;
+   }
+
+   if (!g_markup_parse_context_parse(client->context,
+                                     (const gchar *)client->buffer,
+                                     n,
+                                     &error)) {
+      g_printerr("%s\n", error->message);
+      client_close(client);
+      goto cleanup;
+   }
+
+   /*
+    * After authentication the client starts a new document.
+    */
+   if (client->restart) {
+      client_reset(client);
+   }
+
+   client_read(client);
+
+cleanup:
+   g_clear_error(&error);
+   client_unref(client);
+}
+
+static void
+client_read (Client *client)
+{
+   GInputStream *input;
+
+   input = g_io_stream_get_input_stream(G_IO_STREAM(client->connection));
+   g_input_stream_read_async(input,
+                             client->buffer,
+                             sizeof(client->buffer),
+                             G_PRIORITY_DEFAULT,
+                             client->cancellable,
+                             client_read_cb,
+                             client_ref(client));
+}
+
+static gboolean
+incoming_cb (GSocketService    *service,
+             GSocketConnection *connection,
+             GObject           *source_object,
+             gpointer           user_data)
+{
+   Client *client;
+
+   client = g_slice_new0(Client);
+   client->ref_count = 1;
+   client->connection = g_object_ref(connection);
+   client->cancellable = g_cancellable_new();
+   client->out = g_string_new(NULL);
+   client->flushing = g_string_new(NULL);
+   client->text = g_string_new(NULL);
+   client_reset(client);
+   client_read(client);
+   client_unref(client);
+
+   return FALSE;
+}
+
+static gboolean
+report_cb (gpointer user_data)
+{
+   static guint64 last;
+
+   if (gReceived != last) {
+      g_print("%" G_GUINT64_FORMAT " messages/sec\n", gReceived - last);
+      last = gReceived;
+   }
+
+   return TRUE;
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   GSocketService *service;
+   GOptionContext *context;
+   GMainLoop *main_loop;
+   GError *error = NULL;
+
+   g_set_prgname("push-ccs-server");
+   g_set_application_name(_("Push CCS Server"));
+
+   context = g_option_context_new(_("- Stand in for the GCM CCS server."));
+   g_option_context_add_main_entries(context, gEntries, NULL);
+   if (!g_option_context_parse(context, &argc, &argv, &error)) {
+      g_printerr("%s\n", error->message);
+      g_error_free(error);
+      return EXIT_FAILURE;
+   }
+
+   if ((gPort <= 0) || (gPort > G_MAXUINT16)) {
+      g_printerr("%s\n", _("Please provide a valid port."));
+      return EXIT_FAILURE;
+   }
+
+   g_type_init();
+
+   main_loop = g_main_loop_new(NULL, FALSE);
+
+   service = g_socket_service_new();
+   if (!g_socket_listener_add_inet_port(G_SOCKET_LISTENER(service),
+                                        gPort,
+                                        NULL,
+                                        &error)) {
+      g_printerr("%s\n", error->message);
+      g_error_free(error);
+      return EXIT_FAILURE;
+   }
+   g_signal_connect(service, "incoming", G_CALLBACK(incoming_cb), NULL);
+   g_socket_service_start(service);
+
+   g_timeout_add_seconds(1, report_cb, NULL);
+
+   g_print(_("Listening on port %d.\n"), gPort);
+   g_main_loop_run(main_loop);
+
+   g_object_unref(service);
+   g_main_loop_unref(main_loop);
+
+   return EXIT_SUCCESS;
+}